@@ -14,6 +14,7 @@
 #include <memory>
 #include <algorithm>
 #include "ps/internal/message.h"
+#include "ps/internal/metrics.h"
 #include "ps/internal/threadsafe_queue.h"
 namespace ps {
 
@@ -59,12 +60,20 @@ class Customer {
    */
   inline int customer_id() { return customer_id_; }
 
+  /**
+   * \brief callback run once all responses of a request are received
+   */
+  using Callback = std::function<void()>;
+
   /**
    * \brief get a timestamp for a new request. threadsafe
    * \param recver the receive node id of this request
+   * \param on_complete optional, run by the receiving thread when the last
+   *        response arrives, before waiters of the request are released
    * \return the timestamp of this request
    */
-  int NewRequest(int recver, const bool is_global = false);
+  int NewRequest(int recver, const bool is_global = false,
+                 const Callback& on_complete = Callback());
 
 
   /**
@@ -114,9 +123,43 @@ class Customer {
   ThreadsafeQueue recv_queue_, recv_pull_queue_;
   std::unique_ptr<std::thread> recv_thread_, recv_pull_thread_;
 
-  std::mutex tracker_mu_;
-  std::condition_variable tracker_cond_;
-  std::vector<std::pair<int, int>> tracker_;
+  /**
+   * \brief tracker entry of a request. A slot is claimed by NewRequest and
+   * recycled once the request completes, the timestamps keep increasing so
+   * that a stale timestamp is never mistaken for the new owner.
+   */
+  struct RequestSlot {
+    std::atomic<bool> pending{false};
+    std::atomic<int> owner{-1};
+    std::atomic<int> done{-1};
+    std::atomic<int> expected{0};
+    std::atomic<int> received{0};
+    /** \brief when the request was made and whether it went to the global domain */
+    std::atomic<int64_t> start_us{0};
+    std::atomic<bool> global{false};
+    Callback on_complete;
+  };
+
+  /** \brief waiters of requests blocked on the slots of a stripe */
+  struct WaitStripe {
+    std::mutex mu;
+    std::condition_variable cond;
+    std::atomic<int> waiters{0};
+  };
+
+  inline RequestSlot& Slot(int timestamp) { return tracker_[timestamp & tracker_mask_]; }
+  inline bool IsDone(const RequestSlot& slot, int timestamp) const {
+    return slot.owner.load() != timestamp || slot.done.load() == timestamp;
+  }
+  void Complete(RequestSlot* slot, int timestamp);
+
+  static const int kNumWaitStripes = 64;
+  std::unique_ptr<RequestSlot[]> tracker_;
+  int tracker_mask_;
+  std::atomic<uint32_t> next_timestamp_{0};
+  WaitStripe wait_stripes_[kNumWaitStripes];
+  /** \brief time from requests to their responses by responder, local and global */
+  std::unique_ptr<MetricTable<Histogram*>> latency_[2];
 
   DISALLOW_COPY_AND_ASSIGN(Customer);
 };
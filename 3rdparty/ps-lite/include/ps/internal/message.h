@@ -177,7 +177,11 @@ namespace ps {
              key(kEmpty), \
              version(kEmpty), \
              iters(kEmpty), \
-             simple_app(false) {}
+             simple_app(false), \
+             resend_seq(0), \
+             resend_ack(0), \
+             trace_id(0), \
+             trace_ts(0) {}
     std::string DebugString() const {
       std::stringstream ss;
       if (sender == Node::kEmpty) {
@@ -216,6 +220,9 @@ namespace ps {
         ss << ", simple_app=" << simple_app
            << ", push=" << push;
       }
+      if (resend_seq) ss << ", resend_seq=" << resend_seq;
+      if (resend_ack) ss << ", resend_ack=" << (resend_ack >> 32) << "/" << (resend_ack & 0xffffffff);
+      if (trace_id) ss << ", trace=" << (trace_id >> 32) << "/" << (trace_id & 0xffffffff);
       if (head != kEmpty) ss << ", head=" << head;
       if (body.size()) ss << ", body=" << body;
       if (data_type.size()) {
@@ -267,6 +274,14 @@ namespace ps {
     int iters;
     /** \brief whether or not it's for SimpleApp */
     bool simple_app;
+    /** \brief sequence number to the receiver, 0 if not tracked by the resender */
+    int resend_seq;
+    /** \brief cumulative and selective ack piggybacked by the resender, 0 if none */
+    uint64_t resend_ack;
+    /** \brief key in the high 32 bits and round in the low ones, 0 if not traced */
+    uint64_t trace_id;
+    /** \brief send time of the sender in microseconds, 0 if not traced */
+    int64_t trace_ts;
     /** \brief an string body */
     std::string body;
     /** \brief data type of message.data[i] */
@@ -0,0 +1,319 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_INTERNAL_METRICS_H_
+#define PS_INTERNAL_METRICS_H_
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+namespace ps {
+
+/** \brief a monotonic count, lock-free */
+class Counter {
+ public:
+  void Add(int64_t n = 1) { v_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() const { return v_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> v_{0};
+};
+
+/** \brief a level that goes up and down, lock-free */
+class Gauge {
+ public:
+  void Add(int64_t n) { v_.fetch_add(n, std::memory_order_relaxed); }
+  void Set(int64_t v) { v_.store(v, std::memory_order_relaxed); }
+  int64_t value() const { return v_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> v_{0};
+};
+
+/**
+ * \brief log-linear histogram of non-negative values, lock-free.
+ *
+ * As in HdrHistogram, every power of two is split into kSub linear buckets,
+ * so quantiles are within 1 / kSub of the truth at any magnitude, from
+ * microseconds to minutes, with a fixed 4KB of buckets and one relaxed
+ * increment per record.
+ */
+class Histogram {
+ public:
+  static const int kSubBits = 3;
+  static const int kSub = 1 << kSubBits;
+  static const int kNumBuckets = (64 - kSubBits + 1) * kSub;
+
+  Histogram() {
+    for (auto& b : buckets_) b.store(0, std::memory_order_relaxed);
+  }
+
+  void Record(int64_t v) {
+    const uint64_t u = v < 0 ? 0 : static_cast<uint64_t>(v);
+    buckets_[Index(u)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(u, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (u > max && !max_.compare_exchange_weak(max, u, std::memory_order_relaxed)) {}
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  /** \brief the largest value of the bucket holding quantile q, 0 if empty */
+  uint64_t Quantile(double q) const {
+    uint64_t counts[kNumBuckets], total = 0;
+    for (int i = 0; i < kNumBuckets; ++i) {
+      counts[i] = buckets_[i].load(std::memory_order_relaxed);
+      total += counts[i];
+    }
+    if (total == 0) return 0;
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * total)));
+    uint64_t seen = 0;
+    for (int i = 0; i < kNumBuckets; ++i) {
+      seen += counts[i];
+      if (seen >= rank) return std::min(UpperBound(i), max());
+    }
+    return max();
+  }
+
+  static int Index(uint64_t v) {
+    if (v < static_cast<uint64_t>(kSub)) return static_cast<int>(v);
+    const int exp = 63 - __builtin_clzll(v);
+    const int sub = static_cast<int>(v >> (exp - kSubBits)) - kSub;
+    return (exp - kSubBits + 1) * kSub + sub;
+  }
+
+  static uint64_t UpperBound(int index) {
+    if (index < kSub) return index;
+    const int exp = index / kSub + kSubBits - 1;
+    const uint64_t width = 1ull << (exp - kSubBits);
+    return (kSub + index % kSub) * width + width - 1;
+  }
+
+ private:
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> count_{0}, sum_{0}, max_{0};
+};
+
+/**
+ * \brief metrics of a set of ids, e.g. peers or keys, found without locks.
+ *
+ * Ids are placed by open addressing in a fixed table, and their metrics are
+ * made by create the first time an id is seen, which is the only time the
+ * registry is locked. Ids past the capacity share the metrics of id -1.
+ */
+template <typename T>
+class MetricTable {
+ public:
+  using Create = std::function<T(int id)>;
+
+  explicit MetricTable(const Create& create, int capacity = 1024) : create_(create) {
+    int n = 1;
+    while (n < capacity) n <<= 1;
+    slots_.reset(new Slot[n]);
+    mask_ = n - 1;
+  }
+
+  const T& Get(int id) {
+    uint32_t i = static_cast<uint32_t>(id) * 2654435761u;
+    for (int probe = 0; probe <= mask_; ++probe, ++i) {
+      Slot& s = slots_[i & mask_];
+      int cur = s.id.load(std::memory_order_acquire);
+      if (cur == kFree && s.id.compare_exchange_strong(cur, id)) {
+        s.value = create_(id);
+        s.ready.store(true, std::memory_order_release);
+        return s.value;
+      }
+      if (cur == id) {
+        // another thread is making the metrics of id
+        while (!s.ready.load(std::memory_order_acquire)) std::this_thread::yield();
+        return s.value;
+      }
+    }
+    std::call_once(overflow_once_, [this] { overflow_ = create_(-1); });
+    return overflow_;
+  }
+
+ private:
+  static const int kFree = std::numeric_limits<int>::min();
+  struct Slot {
+    std::atomic<int> id{kFree};
+    std::atomic<bool> ready{false};
+    T value;
+  };
+  Create create_;
+  std::unique_ptr<Slot[]> slots_;
+  int mask_;
+  std::once_flag overflow_once_;
+  T overflow_;
+};
+
+/**
+ * \brief registry of the metrics of the process, exported in the Prometheus
+ * text format on PS_METRICS_PORT and to PS_METRICS_DIR on exit.
+ *
+ * Metrics are named families of series told apart by their labels. Looking a
+ * series up locks the registry, so callers keep the pointer, or a MetricTable
+ * of them, and only update it afterwards, which never locks. Series are never
+ * freed. Gauges that are cheaper to read than to maintain, such as queue
+ * lengths, are sampled by callbacks when exported instead.
+ */
+class Metrics {
+ public:
+  static Metrics* Get() {
+    // never destroyed, series may be updated by threads still running at exit
+    static Metrics* inst = new Metrics();
+    return inst;
+  }
+
+  static int64_t NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /** \brief formats labels as k1="v1",k2="v2" */
+  static std::string Labels(const std::vector<std::pair<std::string, std::string>>& labels) {
+    std::string s;
+    for (const auto& l : labels) {
+      s += (s.empty() ? "" : ",") + l.first + "=\"" + l.second + "\"";
+    }
+    return s;
+  }
+
+  Counter* GetCounter(const std::string& name, const std::string& help,
+                      const std::string& labels = "") {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto& s = Find(name, help, "counter")->counters[labels];
+    if (!s) s.reset(new Counter());
+    return s.get();
+  }
+
+  Gauge* GetGauge(const std::string& name, const std::string& help,
+                  const std::string& labels = "") {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto& s = Find(name, help, "gauge")->gauges[labels];
+    if (!s) s.reset(new Gauge());
+    return s.get();
+  }
+
+  /** \brief exported as a summary of its quantiles */
+  Histogram* GetHistogram(const std::string& name, const std::string& help,
+                          const std::string& labels = "") {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto& s = Find(name, help, "summary")->histograms[labels];
+    if (!s) s.reset(new Histogram());
+    return s.get();
+  }
+
+  /** \brief a gauge read by sample when exported, until removed */
+  void AddSampler(const std::string& name, const std::string& help, const std::string& labels,
+                  const std::function<double()>& sample) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Find(name, help, "gauge")->samplers[labels] = sample;
+  }
+
+  /** \brief once it returns, the sampler is not running and never runs again */
+  void RemoveSampler(const std::string& name, const std::string& labels) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = families_.find(name);
+    if (it != families_.end()) it->second.samplers.erase(labels);
+  }
+
+  /** \brief all series in the Prometheus text exposition format */
+  std::string Prometheus() {
+    std::ostringstream os;
+    std::lock_guard<std::mutex> lk(mu_);
+    for (const auto& it : families_) {
+      const std::string& name = it.first;
+      const Family& f = it.second;
+      os << "# HELP " << name << " " << f.help << "\n# TYPE " << name << " " << f.type << "\n";
+      for (const auto& s : f.counters) os << Series(name, s.first) << " " << s.second->value() << "\n";
+      for (const auto& s : f.gauges) os << Series(name, s.first) << " " << s.second->value() << "\n";
+      for (const auto& s : f.samplers) os << Series(name, s.first) << " " << s.second() << "\n";
+      for (const auto& s : f.histograms) {
+        const Histogram& h = *s.second;
+        for (double q : {0.5, 0.9, 0.99, 1.0}) {
+          std::ostringstream quantile;
+          quantile << "quantile=\"" << q << "\"";
+          const std::string labels = s.first.empty() ? quantile.str() : s.first + "," + quantile.str();
+          os << Series(name, labels) << " " << (q < 1 ? h.Quantile(q) : h.max()) << "\n";
+        }
+        os << Series(name + "_sum", s.first) << " " << h.sum() << "\n";
+        os << Series(name + "_count", s.first) << " " << h.count() << "\n";
+      }
+    }
+    return os.str();
+  }
+
+ private:
+  struct Family {
+    std::string help;
+    const char* type;
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    std::map<std::string, std::function<double()>> samplers;
+  };
+
+  Metrics() {}
+
+  Family* Find(const std::string& name, const std::string& help, const char* type) {
+    Family& f = families_[name];
+    if (f.help.empty()) {
+      f.help = help;
+      f.type = type;
+    }
+    return &f;
+  }
+
+  static std::string Series(const std::string& name, const std::string& labels) {
+    return labels.empty() ? name : name + "{" + labels + "}";
+  }
+
+  std::mutex mu_;
+  std::map<std::string, Family> families_;
+};
+
+/**
+ * \brief bytes before and after a codec, with their ratio sampled on export
+ */
+struct CompressionMetrics {
+  Counter* raw = nullptr;
+  Counter* wire = nullptr;
+
+  static CompressionMetrics Get(const std::string& codec) {
+    auto* m = Metrics::Get();
+    const std::string labels = Metrics::Labels({{"codec", codec}});
+    CompressionMetrics c;
+    c.raw = m->GetCounter("ps_compression_raw_bytes_total", "bytes given to a codec", labels);
+    c.wire = m->GetCounter("ps_compression_wire_bytes_total", "bytes a codec put on the wire",
+                           labels);
+    Counter* raw = c.raw;
+    Counter* wire = c.wire;
+    m->AddSampler("ps_compression_ratio", "raw over wire bytes of a codec", labels, [raw, wire] {
+      return wire->value() ? static_cast<double>(raw->value()) / wire->value() : 0.0;
+    });
+    return c;
+  }
+
+  void Record(int64_t raw_bytes, int64_t wire_bytes) const {
+    raw->Add(raw_bytes);
+    wire->Add(wire_bytes);
+  }
+};
+
+}  // namespace ps
+#endif  // PS_INTERNAL_METRICS_H_
@@ -4,69 +4,186 @@
  */
 #ifndef PS_INTERNAL_THREADSAFE_QUEUE_H_
 #define PS_INTERNAL_THREADSAFE_QUEUE_H_
-#include <queue>
+#include <algorithm>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <memory>
+#include <thread>
+#include <vector>
 #include "ps/base.h"
 #include "ps/internal/message.h"
 namespace ps {
 
 /**
- * \brief thread-safe queue allowing push and waited pop
+ * \brief thread-safe priority queue allowing push and waited pop
+ *
+ * Messages with a larger meta.priority are popped first, messages of the
+ * same priority in push order. Each priority has its own lock-free bucket,
+ * a push is a single atomic exchange and never waits for other producers
+ * or the consumer. Pushes and empty() are threadsafe from any thread, pops
+ * must come from a single consumer thread, as every queue of ps-lite is
+ * drained by exactly one thread. The consumer only sleeps when the queue
+ * is empty and is only notified when it sleeps.
  */
-//template<typename T>
 class ThreadsafeQueue {
  public:
-  ThreadsafeQueue() { }
-  ~ThreadsafeQueue() { }
+  ThreadsafeQueue() : buckets_(new std::vector<Bucket*>()) {
+    retired_.emplace_back(buckets_.load());
+  }
+  ~ThreadsafeQueue() {
+    for (auto* b : *buckets_.load()) delete b;
+  }
 
   /**
-   * \brief push an value into the end. threadsafe.
+   * \brief push an value into its priority bucket. threadsafe.
    * \param new_value the value
    */
   void Push(Message new_value) {
-    mu_.lock();
-    queue_.push(std::move(new_value));
-    mu_.unlock();
-    cond_.notify_all();
+    Bucket* bucket = GetBucket(new_value.meta.priority);
+    Node* node = new Node();
+    node->msg = std::move(new_value);
+    bucket->Push(node);
+    size_.fetch_add(1);
+    if (waiters_.load() > 0) {
+      { std::lock_guard<std::mutex> lk(mu_); }
+      cond_.notify_one();
+    }
   }
 
   /**
-   * \brief wait until pop an element from the beginning, threadsafe
+   * \brief wait until pop the element with the highest priority. should be
+   * called by the consumer thread only
    * \param value the poped value
    */
   void WaitAndPop(Message* value) {
-    std::unique_lock<std::mutex> lk(mu_);
-    cond_.wait(lk, [this]{return !queue_.empty();});
-    *value = std::move(queue_.top());
-    queue_.pop();
+    while (true) {
+      if (size_.load() > 0) {
+        if (TryPopAny(value)) break;
+        // a producer is between its exchange and linking the node
+        std::this_thread::yield();
+        continue;
+      }
+      waiters_.fetch_add(1);
+      {
+        std::unique_lock<std::mutex> lk(mu_);
+        cond_.wait(lk, [this]{ return size_.load() > 0; });
+      }
+      waiters_.fetch_sub(1);
+    }
+    if (size_.fetch_sub(1) == 1 && empty_waiters_.load() > 0) {
+      { std::lock_guard<std::mutex> lk(mu_); }
+      empty_cond_.notify_all();
+    }
   }
-  bool empty(){
-      return queue_.empty();
+
+  /**
+   * \brief block until the queue is drained. threadsafe
+   */
+  void WaitEmpty() {
+    if (size_.load() == 0) return;
+    empty_waiters_.fetch_add(1);
+    {
+      std::unique_lock<std::mutex> lk(mu_);
+      empty_cond_.wait(lk, [this]{ return size_.load() == 0; });
+    }
+    empty_waiters_.fetch_sub(1);
+  }
+
+  bool empty() {
+    return size_.load() == 0;
+  }
+
+  /** \brief number of queued values. threadsafe */
+  int64_t size() {
+    return size_.load();
   }
 
  private:
-    class Compare {
-    public:
-        bool operator()(Message &l, Message &r) {
-          return l.meta.priority <= r.meta.priority;
-        }
-    };
-  mutable std::mutex mu_;
-  //std::queue<T> queue_;
-  std::priority_queue<Message, std::vector<Message>, Compare> queue_;
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    Message msg;
+  };
+
+  /**
+   * \brief unbounded multi-producer single-consumer FIFO of one priority
+   */
+  class Bucket {
+   public:
+    explicit Bucket(int p) : priority(p), head_(&stub_), tail_(&stub_) {}
+    ~Bucket() {
+      Message msg;
+      while (TryPop(&msg)) {}
+      if (tail_ != &stub_) delete tail_;
+    }
+
+    void Push(Node* node) {
+      Node* prev = head_.exchange(node);
+      prev->next.store(node);
+    }
+
+    bool TryPop(Message* value) {
+      Node* tail = tail_;
+      Node* next = tail->next.load();
+      if (!next) return false;
+      *value = std::move(next->msg);
+      // next becomes the new stub, its message is moved out
+      tail_ = next;
+      if (tail != &stub_) delete tail;
+      return true;
+    }
+
+    const int priority;
+
+   private:
+    Node stub_;
+    std::atomic<Node*> head_;
+    Node* tail_;
+  };
+
+  Bucket* GetBucket(int priority) {
+    const std::vector<Bucket*>* buckets = buckets_.load();
+    auto it = Find(*buckets, priority);
+    if (it != buckets->end() && (*it)->priority == priority) return *it;
+    // a new priority, rare after the first iteration
+    std::lock_guard<std::mutex> lk(bucket_mu_);
+    buckets = buckets_.load();
+    it = Find(*buckets, priority);
+    if (it != buckets->end() && (*it)->priority == priority) return *it;
+    Bucket* bucket = new Bucket(priority);
+    auto* grown = new std::vector<Bucket*>(*buckets);
+    grown->insert(grown->begin() + (it - buckets->begin()), bucket);
+    // the consumer may still scan the previous list
+    retired_.emplace_back(grown);
+    buckets_.store(grown);
+    return bucket;
+  }
+
+  /** \brief buckets are sorted by descending priority */
+  static std::vector<Bucket*>::const_iterator Find(const std::vector<Bucket*>& buckets,
+                                                   int priority) {
+    return std::lower_bound(buckets.begin(), buckets.end(), priority,
+                            [](const Bucket* b, int p) { return b->priority > p; });
+  }
+
+  bool TryPopAny(Message* value) {
+    for (auto* b : *buckets_.load()) {
+      if (b->TryPop(value)) return true;
+    }
+    return false;
+  }
+
+  std::atomic<const std::vector<Bucket*>*> buckets_;
+  std::vector<std::unique_ptr<const std::vector<Bucket*>>> retired_;
+  std::mutex bucket_mu_;
+
+  std::atomic<int64_t> size_{0};
+  std::atomic<int> waiters_{0};
+  std::atomic<int> empty_waiters_{0};
+  std::mutex mu_;
   std::condition_variable cond_;
+  std::condition_variable empty_cond_;
 };
 
 }  // namespace ps
-
-// bool TryPop(T& value) {
-//   std::lock_guard<std::mutex> lk(mut);
-//   if(data_queue.empty())
-//     return false;
-//   value=std::move(data_queue.front());
-//   data_queue.pop();
-//   return true;
-// }
 #endif  // PS_INTERNAL_THREADSAFE_QUEUE_H_
@@ -36,6 +36,26 @@ inline V GetEnv(const char *key, V default_val) {
   }
 }
 
+/*!
+ * \brief Get environment variable as floating point with default.
+ */
+inline double GetEnv(const char *key, double default_val) {
+  const char *val = Environment::Get()->find(key);
+  return val == nullptr ? default_val : atof(val);
+}
+
+inline float GetEnv(const char *key, float default_val) {
+  return static_cast<float>(GetEnv(key, static_cast<double>(default_val)));
+}
+
+/*!
+ * \brief Get environment variable as string with default.
+ */
+inline std::string GetEnv(const char *key, const std::string& default_val) {
+  const char *val = Environment::Get()->find(key);
+  return val == nullptr ? default_val : std::string(val);
+}
+
 #ifndef DISALLOW_COPY_AND_ASSIGN
 #define DISALLOW_COPY_AND_ASSIGN(TypeName) \
   TypeName(const TypeName&);               \
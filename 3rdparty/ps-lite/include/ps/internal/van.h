@@ -17,12 +17,20 @@
 #include <condition_variable>
 #include "ps/base.h"
 #include "ps/internal/message.h"
+#include "ps/internal/metrics.h"
 #include "ps/internal/threadsafe_queue.h"
 #include "customer.h"
 #include <cmath>
 #include <iostream>
 namespace ps {
 class Resender;
+class BlockReassembler;
+class ResidualPool;
+class FecEncoder;
+class FecDecoder;
+class Overlay;
+class ClockProbe;
+class MetricsExporter;
 
 /**
  * \brief Van sends messages to remote nodes
@@ -73,6 +81,13 @@ class Van {
     return my_node;
   }//
 
+  /**
+   * \brief declare that [data, data + size) lies at the end of a shared memory
+   * file, open as descriptor shared_id in process shared_pid, so that vans on
+   * the same host can pass it by handle. it must outlive the van
+   */
+  virtual void RegisterSharedBuffer(char* data, size_t size, int shared_pid, int shared_id) {}
+
   /**
    * \brief stop van
    * stop receiving threads
@@ -89,12 +104,26 @@ class Van {
    */
   inline bool IsReady() { return ready_; }
 
+  /**
+   * \brief bytes handed to the transport for a node so far. thread safe
+   */
+  size_t GetSendBytes(int node_id, bool is_global = false);
+
   void AssignMsg(Message& msg, int channel, int tag);
   void WaitForFinish();
   void WaitForGlobalFinish();
-  int GetReceiver(int throughput, int last_recv_id, int version);
-  int GetGlobalReceiver(int throughput, int last_recv_id, int version);
+  /**
+   * \brief the next peer to forward a TSEngine broadcast of key to, -1 when done.
+   * With ENABLE_TS_OVERLAY it is picked locally, otherwise by the scheduler
+   */
+  int GetReceiver(int throughput, int last_recv_id, int version, int key = Meta::kEmpty);
+  int GetGlobalReceiver(int throughput, int last_recv_id, int version, int key = Meta::kEmpty);
   void AskForReceiverPush(int app, int customer1, int timestamp, bool is_global = false);
+  /**
+   * \brief tells TSEngine that data of key is ready to be pushed on, either
+   * the node's own data or data just merged from a peer
+   */
+  void ReadyToPush(int key, bool own, int app, int customer, int timestamp, bool is_global = false);
   Node my_node_, my_node_global_;
 
  protected:
@@ -133,12 +162,30 @@ class Van {
   void PackMeta(const Meta &meta, char **meta_buf, int *buf_size, bool is_global);
 
   /**
-   * \brief unpack meta from a string
+   * \brief size of meta packed in the fixed-layout header,
+   * 0 if it has to be packed by protobuf
+   */
+  int PackedMetaSize(const Meta &meta) const;
+
+  /**
+   * \brief pack meta into the fixed-layout header of PackedMetaSize(meta)
+   * bytes at buf, without allocation
+   */
+  void PackMeta(const Meta &meta, char *buf, bool is_global);
+
+  /**
+   * \brief the send time both meta formats carry for the clock probe, 0 for
+   * control messages or without PS_TRACE
+   */
+  int64_t TraceTs(const Meta &meta) const;
+
+  /**
+   * \brief unpack meta from a string, either a protobuf or a fixed-layout header
    */
   void UnpackMeta(const char *meta_buf, int buf_size, Meta *meta);
 
   Node scheduler_, global_scheduler_;
-  bool is_scheduler_, is_global_scheduler_;
+  bool is_scheduler_ = false, is_global_scheduler_ = false;
   std::mutex start_mu_;
   std::mutex ask_mu;
   std::mutex ask_global_mu;
@@ -179,6 +226,35 @@ class Van {
 
   std::atomic<size_t> send_bytes_{0};
   size_t recv_bytes_ = 0;
+  /** \brief bytes and messages of a link or a DGT channel */
+  struct LinkMetrics {
+    Counter* bytes = nullptr;
+    Counter* messages = nullptr;
+    void Record(int n) const {
+      bytes->Add(n);
+      messages->Add();
+    }
+  };
+  /** \brief traffic with each node of the local and the global network */
+  std::unique_ptr<MetricTable<LinkMetrics>> sent_[2], received_[2];
+  /** \brief traffic on each DGT channel, 0 is the TCP one */
+  std::unique_ptr<MetricTable<LinkMetrics>> channel_sent_;
+  /** \brief bytes of DGT blocks before and after quantization */
+  CompressionMetrics quant_metrics_;
+  /** \brief serves the metrics over HTTP, with PS_METRICS_PORT */
+  MetricsExporter* metrics_exporter_ = nullptr;
+  /**
+   * \brief metrics of traffic named prefix_bytes_total and prefix_messages_total,
+   * by peer of domain, or by DGT channel if domain is empty
+   */
+  static MetricTable<LinkMetrics>* NewLinkTable(const std::string& prefix, const std::string& what,
+                                                const std::string& domain);
+  /**
+   * \brief name of this node in dumps, local nodes are told apart by the
+   * address of the scheduler of their party
+   * \param ids set to the id of this node in each of its domains
+   */
+  std::string NodeName(std::vector<std::pair<std::string, int>>* ids = nullptr) const;
   int num_servers_ = 0;
   int num_workers_ = 0;
   int num_global_servers_ = 0;
@@ -204,6 +280,8 @@ class Van {
   double max_greed_rate;
 
   int enable_p3 = 0;
+  /** whether data messages use the fixed-layout header, PS_PACKED_META */
+  bool packed_meta_ = true;
   void ProcessAutoPullReply();
   void ProcessAutoPullReplyGlobal();
   void ProcessAskPullCommand(Message* msg);
@@ -212,13 +290,25 @@ class Van {
   void ProcessAskPushGlobalCommand(Message* msg);
   void ProcessReplyCommand(Message* reply);
   void ProcessReplyGlobalCommand(Message* reply);
+  /**
+   * \brief hands the overlay body of msg to the overlay of its domain
+   * \return true if msg is consumed
+   */
+  bool ProcessOverlay(Message* msg, bool is_global);
   void Important_scheduler();
   void Unimportant_scheduler();
   int Important_send(Message& msg);
   int Unimportant_send(Message& msg);
   void Receiving_UDP(int channel);
-  void MergeMsg(Message* msg1, Message* msg2);
-  void MergeMsg_HALF(Message* msg1, Message* msg2);
+  /**
+   * \brief hands tensors held for missing DGT blocks to their customers once
+   * their hold passed, with DGT_FEC
+   */
+  void ReleasingHeld();
+  /**
+   * \brief quantizes the fp32 values of an unimportant DGT block to bits_num
+   * bits, with the error of the block fed back into its next round
+   */
   void encode(Message& msg, int bits_num);
   void decode(Message& msg);
   enum class RequestType {
@@ -245,15 +335,30 @@ class Van {
   std::unique_ptr<std::thread> udp_receiver_thread_[8];
   std::unique_ptr<std::thread> important_scheduler_thread_;
   std::unique_ptr<std::thread> unimportant_scheduler_thread_;
-  std::unordered_map<int, std::unordered_map<int, std::unordered_map<int, Message>>> msg_map;
-  std::mutex merge_mu_;
-  std::mutex encode_mu_;
-  std::mutex decode_mu_;
+  /** \brief DGT blocks of pushes received by global servers */
+  BlockReassembler* reassembler_ = nullptr;
   std::vector<std::unique_ptr<std::thread>> udp_receiver_thread_vec;
   ThreadsafeQueue important_queue_;
   ThreadsafeQueue unimportant_queue_;
   ThreadsafeQueue send_queue_;
-  std::unordered_map<int, std::unordered_map<int, SArray<char>>> residual;
+  /** \brief bits of quantized DGT blocks, DGT_QUANT_BITS */
+  int quant_bits_ = 4;
+  /** \brief DGT_STOCHASTIC_ROUNDING */
+  bool quant_stochastic_ = false;
+  /** \brief errors of quantized DGT blocks, bounded by DGT_RESIDUAL_MB */
+  ResidualPool* residuals_ = nullptr;
+  /** \brief parities of the blocks sent on UDP channels, with DGT_FEC */
+  FecEncoder* fec_encoder_ = nullptr;
+  /** \brief recovery of the blocks received on UDP channels, with DGT_FEC */
+  FecDecoder* fec_decoder_ = nullptr;
+  /** \brief DGT_FEC_HOLD_MS in microseconds */
+  int64_t fec_hold_us_ = 0;
+  std::unique_ptr<std::thread> fec_hold_thread_;
+  std::atomic<bool> fec_hold_stop_{false};
+  /** \brief TSEngine overlays of the local and the global domain, with ENABLE_TS_OVERLAY */
+  Overlay* overlay_[2] = {nullptr, nullptr};
+  /** \brief one-way delays from peers for trace merging, with PS_TRACE */
+  ClockProbe* clock_probe_ = nullptr;
 
   /**
    * \brief processing logic of AddNode message for scheduler and global scheduler
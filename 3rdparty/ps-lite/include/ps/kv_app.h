@@ -4,13 +4,22 @@
  */
 #ifndef PS_KV_APP_H_
 #define PS_KV_APP_H_
+#include <stdint.h>
+#include <string.h>
 #include <algorithm>
+#include <cmath>
 #include <utility>
 #include <vector>
 #include <ctime>
 #include <thread>
+#if defined(__AVX__) || defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "ps/base.h"
 #include "ps/simple_app.h"
+#include "dmlc/parameter.h"
 namespace ps {
 
 /**
@@ -43,13 +52,16 @@ struct KVPairs {
   /** \brief the according value lengths (could be empty) */
   SArray<int> lens;
   int priority;
+  /** \brief key and round of a traced request, 0 if not traced */
+  uint64_t trace_id = 0;
 };
 
 /** \brief meta information about a kv request */
 struct KVMeta {
   //static const int kEmpty;
   KVMeta():cmd(Meta::kEmpty), push(false), sender(Meta::kEmpty), timestamp(Meta::kEmpty),
-    key(Meta::kEmpty), version(0), num_merge(1), app_id(Meta::kEmpty), priority(Meta::kEmpty) {}
+    key(Meta::kEmpty), version(0), num_merge(1), app_id(Meta::kEmpty), priority(Meta::kEmpty),
+    trace_id(0) {}
   /** \brief the int cmd */
   int cmd;
   /** \brief whether or not this is a push request */
@@ -67,6 +79,8 @@ struct KVMeta {
   int num_merge;
   int app_id;
   int priority;
+  /** \brief key and round of a traced request, 0 if not traced */
+  uint64_t trace_id;
 };
 
 /**
@@ -174,13 +188,15 @@ class KVWorker: public SimpleApp {
             int cmd = 0,
             const Callback& cb = nullptr,
             int uniq_key = Meta::kEmpty,
-            int version = 0) {
+            int version = 0,
+            uint64_t trace_id = 0) {
     int ts = obj_->NewRequest(kServerGroup);
     AddCallback(ts, cb);
     KVPairs<Val> kvs;
     kvs.keys = keys;
     kvs.vals = vals;
     kvs.lens = lens;
+    kvs.trace_id = trace_id;
 
     if (enable_intra_ts && kvs.keys.size()) {
       KVMeta meta;
@@ -193,8 +209,9 @@ class KVWorker: public SimpleApp {
       meta.key         = uniq_key;
       meta.version     = version;
       meta.num_merge   = 1;
+      meta.trace_id    = trace_id;
       request_handle_(meta, kvs, this);
-      Postoffice::Get()->van()->AskForReceiverPush(meta.app_id, meta.customer_id, ts);
+      Postoffice::Get()->van()->ReadyToPush(uniq_key, true, meta.app_id, meta.customer_id, ts);
     } else {
       Send(ts, true, cmd, kvs, uniq_key, version);
     }
@@ -304,8 +321,9 @@ class KVWorker: public SimpleApp {
             SArray<Val>* vals,
             SArray<int>* lens = nullptr,
             int cmd = 0,
-            const Callback& cb = nullptr) {
-    return Pull_(keys, vals, lens, cmd, cb);
+            const Callback& cb = nullptr,
+            uint64_t trace_id = 0) {
+    return Pull_(keys, vals, lens, cmd, cb, trace_id);
   }
 
   /** \brief auto pull for tsengine*/
@@ -366,7 +384,7 @@ class KVWorker: public SimpleApp {
    */
   template <typename C, typename D>
   int Pull_(const SArray<Key>& keys, C* vals, D* lens,
-            int cmd, const Callback& cb);
+            int cmd, const Callback& cb, uint64_t trace_id = 0);
 
   void AutoPullReply(const int sender);
   void AutoPullUpdate(const int version,const int iters, const int req, const KVPairs<Val>& kvs);
@@ -495,18 +513,21 @@ class KVServer: public SimpleApp {
       meta.key         = uniq_key;
       meta.version     = 0;
       meta.num_merge   = 1;
+      meta.trace_id    = kvs.trace_id;
       request_handle_global(meta, kvs, this);
-      van->AskForReceiverPush(meta.app_id, meta.customer_id, ts, true);
+      van->ReadyToPush(uniq_key, true, meta.app_id, meta.customer_id, ts, true);
     } else {
       Send(ts, true, cmd, kvs, uniq_key);
     }
     return ts;
   }
 
-  int Pull(const SArray<Key>& keys, int cmd = 0, int uniq_key = Meta::kEmpty) {
+  int Pull(const SArray<Key>& keys, int cmd = 0, int uniq_key = Meta::kEmpty,
+           uint64_t trace_id = 0) {
     int ts = obj_->NewRequest(kServerGroupGlobal);
     KVPairs<Val> kvs;
     kvs.keys = keys;
+    kvs.trace_id = trace_id;
     Send(ts, false, cmd, kvs, uniq_key);
     return ts;
   }
@@ -558,6 +579,21 @@ class KVServer: public SimpleApp {
     CHECK(slicer); slicer_ = slicer;
   }
 
+  /**
+   * \brief mean of |x| over a block of fp32 or fp16 (dtype 2) values
+   */
+  static float BlockMeanAbs(const char* data, int bytes, int dtype);
+
+  /**
+   * \brief assigns the blocks of a DGT push to channels by their score, calls
+   * send(seq, channel) in dispatch order. The top k of the ranks and the last
+   * block go to the reliable channel 0, the other ranks split evenly over the
+   * UDP channels by contribution, and blocks without contribution are not sent
+   */
+  template <typename Fn>
+  static void AssignChannels(const std::vector<float>& score, float k, int num_channels,
+                             const Fn& send);
+
   int enable_intra_ts = 0;
   int enable_inter_ts = 0;
   int enable_p3 = 0;
@@ -584,9 +620,11 @@ class KVServer: public SimpleApp {
 
   void InitDGT();
 
-  float EvalMsgContribution(int key, Message& msg);
-
-  int GetChannel(int index, int max_index, int C, float k);
+  /**
+   * \brief builds the DGT message of block seq of kvs and queues it on channel
+   */
+  void SendBlock(const KVPairs<Val>& kvs, int i, int timestamp, bool push, int cmd,
+                 int seq, int seq_num, int channel, float score);
 
   enum class RequestType {
     kDefaultPushPull, kRowSparsePushPull, kCompressedPushPull, kDGCompressedPushOnly
@@ -619,8 +657,8 @@ class KVServer: public SimpleApp {
   float dmlc_k_min = 0.0;
   int adaptive_k_flag = 0;
   int udp_channel_num = 0;
-  std::vector<Message> msg_vector;
-  std::unordered_map<int, std::unordered_map<int, float>> contribution;
+  /** \brief smoothed contribution of each block, by first key */
+  std::unordered_map<int, std::vector<float>> contribution;
   int iter = -1;
   int global_iter = -1;
   int send_push = 0;
@@ -665,6 +703,7 @@ void KVServer<Val>::Response(const KVMeta& req, const KVPairs<Val>& res, bool is
   msg.meta.recver      = req.sender;
   msg.meta.key         = req.key;
   msg.meta.version     = 0;
+  msg.meta.trace_id    = req.trace_id;
   if (res.keys.size()) {
     msg.AddData(res.keys);
     msg.AddData(res.vals);
@@ -819,6 +858,7 @@ void KVWorker<Val>::Send(int timestamp, bool push, int cmd, const KVPairs<Val>&
     msg.meta.version     = key_version;
     msg.meta.iters       = (num_merge != 1) ? num_merge : 1;
     msg.meta.priority    = (enable_priority) ? kvs.priority : 0;
+    msg.meta.trace_id    = kvs.trace_id;
 
     const auto &kvs = s.second;
     if (kvs.keys.size()) {
@@ -850,47 +890,155 @@ void KVServer<Val>::InitDGT() {
 }
 
 template <typename Val>
-float KVServer<Val>::EvalMsgContribution(int key, Message& msg) {
-  // Extract float data and its length from the message.
-  float* pd = reinterpret_cast<float*>(msg.data[1].data());
-  int nlen = msg.data[1].size() / sizeof(float);
-
-  // Calculate the sum of the absolute values of the float data.
-  float N = std::accumulate(
-    pd, pd + nlen, 0.0f, [](float acc, float val) { return acc + std::fabs(val); });
-
-  // Initialize to 0 if not already set.
-  auto it = contribution.find(key);
-  if (it == contribution.end())
-    contribution[key][msg.meta.seq] = 0.0;
-
-  // Initialize to 0 if not already set.
-  auto itt = contribution[key].find(msg.meta.seq);
-  if (itt == contribution[key].end())
-    contribution[key][msg.meta.seq] = 0.0;
-
-  // Update the contribution value
-  contribution[key][msg.meta.seq] = contribution_alpha * contribution[key][msg.meta.seq]
-    + (1 - contribution_alpha) * (N / nlen);
-  return contribution[key][msg.meta.seq];
+float KVServer<Val>::BlockMeanAbs(const char* data, int bytes, int dtype) {
+  if (dtype == 2) {
+    const uint16_t* p = reinterpret_cast<const uint16_t*>(data);
+    const int n = bytes / sizeof(uint16_t);
+    if (n == 0) return 0;
+    float sum = 0;
+    int i = 0;
+#if defined(__F16C__)
+    const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 acc = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+      __m256 x = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+      acc = _mm256_add_ps(acc, _mm256_and_ps(x, mask));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    for (float v : lanes) sum += v;
+#endif
+    for (; i < n; ++i) {
+      // |x| of a half, rebased to fp32 bits; subnormals are m * 2^-24
+      const uint32_t e = (p[i] >> 10) & 0x1f, m = p[i] & 0x3ff;
+      if (e == 0) {
+        sum += m * 5.9604645e-8f;
+      } else {
+        const uint32_t bits = ((e == 0x1f ? 0xff : e + 112) << 23) | (m << 13);
+        float v;
+        memcpy(&v, &bits, sizeof(v));
+        sum += v;
+      }
+    }
+    return sum / n;
+  }
+
+  // other types are scored as fp32, as the bytes they span
+  const float* p = reinterpret_cast<const float*>(data);
+  const int n = bytes / sizeof(float);
+  if (n == 0) return 0;
+  float sum = 0;
+  int i = 0;
+#if defined(__AVX__)
+  const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm256_add_ps(acc0, _mm256_and_ps(_mm256_loadu_ps(p + i), mask));
+    acc1 = _mm256_add_ps(acc1, _mm256_and_ps(_mm256_loadu_ps(p + i + 8), mask));
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, _mm256_add_ps(acc0, acc1));
+  for (float v : lanes) sum += v;
+#elif defined(__SSE2__)
+  const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm_add_ps(acc0, _mm_and_ps(_mm_loadu_ps(p + i), mask));
+    acc1 = _mm_add_ps(acc1, _mm_and_ps(_mm_loadu_ps(p + i + 4), mask));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+  for (float v : lanes) sum += v;
+#endif
+  for (; i < n; ++i) sum += std::fabs(p[i]);
+  return sum / n;
 }
 
 template <typename Val>
-int KVServer<Val>::GetChannel(int index, int max_index, int C, float k) {
-  int min_index = std::round(k * (max_index + 1));
-  if (index < min_index)  return 0;
-  for (int i = 0; i < C; ++i) {
-    if (max_index - min_index > 0) {
-      if (index >= min_index + (float)i * (max_index - min_index) / C && \
-         index < min_index + (float)(i + 1) * (max_index - min_index) / C) {
-        return i + 1;
-      }
-    } else {
-      return i + 1;
+template <typename Fn>
+void KVServer<Val>::AssignChannels(const std::vector<float>& score, float k, int num_channels,
+                                   const Fn& send) {
+  // Blocks without contribution are not sent, except the last one.
+  const int seq_num = score.size();
+  std::vector<int> order;
+  order.reserve(seq_num);
+  for (int seq = 0; seq < seq_num - 1; ++seq) {
+    if (score[seq] != 0) order.push_back(seq);
+  }
+  auto by_score = [&score](int a, int b) { return score[a] > score[b]; };
+
+  // The top k of the ranks, counting the last block, go to the reliable
+  // channel 0 and are queued before the rest is classified.
+  const int num_ranked = order.size();
+  const int min_index = std::round(k * (num_ranked + 1));
+  const int num_top = std::min(min_index, num_ranked);
+  std::nth_element(order.begin(), order.begin() + num_top, order.end(), by_score);
+  for (int j = 0; j < num_top; ++j) send(order[j], 0);
+  // The last block completes the tensor on the receiver, so it is always reliable.
+  if (seq_num > 0) send(seq_num - 1, 0);
+
+  // The other ranks split evenly over the UDP channels by contribution,
+  // channel c taking ranks [min_index + (c-1)*R/C, min_index + c*R/C).
+  const int C = num_channels;
+  const float R = num_ranked - min_index;
+  int begin = num_top;
+  for (int c = 1; c <= C && begin < num_ranked; ++c) {
+    int end = c == C ? num_ranked : std::ceil(min_index + c * R / C);
+    end = std::max(begin, std::min(end, num_ranked));
+    if (end < num_ranked) {
+      std::nth_element(order.begin() + begin, order.begin() + end, order.end(), by_score);
     }
+    for (int j = begin; j < end; ++j) send(order[j], c);
+    begin = end;
   }
-  srand((unsigned)time(NULL));
-  return rand() % C + 1;
+}
+
+template <typename Val>
+void KVServer<Val>::SendBlock(const KVPairs<Val>& kvs, int i, int timestamp, bool push, int cmd,
+                              int seq, int seq_num, int channel, float score) {
+  const int total_bytes = kvs.vals.size();
+  const int val_bytes = seq * block_size;
+  const int l = std::min(total_bytes - val_bytes, block_size);
+
+  Message msg;
+  msg.meta.app_id      = obj_->app_id();
+  msg.meta.customer_id = obj_->customer_id();
+  msg.meta.request     = true;
+  msg.meta.push        = push;
+  msg.meta.head        = cmd;
+  msg.meta.timestamp   = timestamp;
+  msg.meta.recver      = Postoffice::Get()->ServerRankToID(i, true);
+  msg.meta.msg_type    = 1;
+  msg.meta.total_bytes = total_bytes;
+  msg.meta.trace_id    = kvs.trace_id;
+
+  if (DepairDataHandleType(cmd).dtype == 0) { // kFloat32
+      msg.meta.bits_num = 32;
+  } else if (DepairDataHandleType(cmd).dtype == 2) { // kFloat16
+      msg.meta.bits_num = 16;
+  }
+
+  msg.meta.val_bytes = val_bytes;
+  msg.meta.first_key = kvs.keys[0];
+  msg.meta.seq = seq;
+  msg.meta.seq_begin = 0;
+  msg.meta.seq_end = seq_num - 1;
+
+  // Add one data chunk to the message.
+  if (kvs.keys.size()) {
+    msg.AddData(kvs.keys);
+    msg.meta.keys_len = msg.data.back().size();
+    msg.AddData(kvs.vals.segment(val_bytes, val_bytes + l));
+    msg.meta.vals_len = msg.data.back().size();
+    if (kvs.lens.size()) {
+      msg.AddData(kvs.lens);
+      msg.meta.lens_len = msg.data.back().size();
+    }
+  }
+  msg.contribution = score;
+  msg.meta.channel = channel;
+  msg.meta.tos = (udp_channel_num - channel) * 32;
+  Postoffice::Get()->van()->AssignMsg(msg, channel, 0);
 }
 
 template <typename Val>
@@ -917,82 +1065,24 @@ void KVServer<Val>::Send(int timestamp, bool push, int cmd, const KVPairs<Val>&
     // Handling DGT Push.
     if (DepairDataHandleType(cmd).requestType == RequestType::kDefaultPushPull
         && push && enable_dgt) {
-      int total_bytes = kvs.vals.size();
-      int remain_bytes = total_bytes;
-      int val_bytes = 0;
-      int seq = 0;
+      const int total_bytes = kvs.vals.size();
       // Calculate the total number of sequences (or data chunks) that can be segmented.
-      int seq_num = (total_bytes + block_size - 1) / block_size;
+      const int seq_num = (total_bytes + block_size - 1) / block_size;
+      const int dtype = DepairDataHandleType(cmd).dtype;
       dmlc_k = dmlc_k_init;
 
-      // Segment data chunks, until all the bytes are segmented into a chunk.
-      while (remain_bytes != 0) {
-        Message msg;
-        msg.meta.app_id      = obj_->app_id();
-        msg.meta.customer_id = obj_->customer_id();
-        msg.meta.request     = true;
-        msg.meta.push        = push;
-        msg.meta.head        = cmd;
-        msg.meta.timestamp   = timestamp;
-        msg.meta.recver      = Postoffice::Get()->ServerRankToID(i, true);
-        msg.meta.msg_type    = 1;
-        msg.meta.total_bytes = total_bytes;
-
-        if (DepairDataHandleType(cmd).dtype == 0) { // kFloat32
-            msg.meta.bits_num = 32;
-        } else if (DepairDataHandleType(cmd).dtype == 2) { // kFloat16
-            msg.meta.bits_num = 16;
-        }
-
-        // Determine the chunk length and segment data chunks.
-        int l = std::min(remain_bytes, block_size);
-        SArray<Val> tmp_val = kvs.vals.segment(val_bytes, val_bytes + l);
-        msg.meta.val_bytes = val_bytes;
-        msg.meta.first_key = kvs.keys[0];
-        msg.meta.seq = seq;
-        msg.meta.seq_begin = 0;
-        msg.meta.seq_end = seq_num - 1;
-        val_bytes += l;
-
-        // Add one data chunk to the message.
-        if (kvs.keys.size()) {
-          msg.AddData(kvs.keys);
-          msg.meta.keys_len = msg.data.back().size();
-          msg.AddData(tmp_val);
-          msg.meta.vals_len = msg.data.back().size();
-          if (kvs.lens.size()) {
-            msg.AddData(kvs.lens);
-            msg.meta.lens_len = msg.data.back().size();
-          }
-        }
-
-        // Evaluate and assign a contribution value to the message.
-        msg.contribution = EvalMsgContribution((int)kvs.keys[0], msg);
-
-        // Add the non-zero contribution message to the vector.
-        if (msg.contribution != 0 || msg.meta.seq == msg.meta.seq_end) {
-          msg_vector.push_back(msg);
-        }
-        remain_bytes -= l;
-        seq++;
-        msg.data.clear();
+      // Score all blocks in one pass over the buffer, smoothed over rounds.
+      std::vector<float>& score = contribution[(int)kvs.keys[0]];
+      if ((int)score.size() != seq_num) score.assign(seq_num, 0);
+      for (int seq = 0; seq < seq_num; ++seq) {
+        const int offset = seq * block_size;
+        const float norm = BlockMeanAbs(reinterpret_cast<const char*>(kvs.vals.data()) + offset,
+                                        std::min(total_bytes - offset, block_size), dtype);
+        score[seq] = contribution_alpha * score[seq] + (1 - contribution_alpha) * norm;
       }
-
-      // Sort messages based on their contribution value.
-      std::sort(msg_vector.begin(), msg_vector.end() - 1, [](const Message& msg1, const Message& msg2) {
-        return msg1.contribution > msg2.contribution;
+      AssignChannels(score, dmlc_k, udp_channel_num, [&](int seq, int channel) {
+        SendBlock(kvs, i, timestamp, push, cmd, seq, seq_num, channel, score[seq]);
       });
-
-      // Assign data chunks to channels with different reliability and priority.
-      for (size_t j = 0; j < msg_vector.size(); ++j) {
-        msg_vector[j].meta.channel = GetChannel(j, msg_vector.size() - 1, udp_channel_num, dmlc_k);
-        if (msg_vector[j].meta.seq == msg_vector[j].meta.seq_end) {
-          msg_vector[j].meta.channel = 0;
-        }
-        msg_vector[j].meta.tos = (udp_channel_num - msg_vector[j].meta.channel) * 32;
-        Postoffice::Get()->van()->AssignMsg(msg_vector[j], msg_vector[j].meta.channel, 0);
-      }
-      msg_vector.clear();
     } else {
       // Handling normal push.
       Message msg;
@@ -1007,6 +1097,7 @@ void KVServer<Val>::Send(int timestamp, bool push, int cmd, const KVPairs<Val>&
       msg.meta.key         = uniq_key;
       msg.meta.version     = key_version;
       msg.meta.iters       = (num_merge != 1) ? num_merge : 1;
+      msg.meta.trace_id    = kvs.trace_id;
       const auto& kvs = s.second;
       if (kvs.keys.size()) {
         msg.AddData(kvs.keys);
@@ -1043,7 +1134,7 @@ void KVWorker<Val>::AutoPullUpdate(const int version, const int iters, const int
   auto* van = Postoffice::Get()->van();
 
   while (true) {
-    int recver = van->GetReceiver(throughput, last_recv_id, iters);
+    int recver = van->GetReceiver(throughput, last_recv_id, iters, req);
     if (recver == -1) break; // Check if transmission is over.
 
     if (kvs.keys.size()) {
@@ -1131,6 +1222,7 @@ void KVWorker<Val>::TS_Process(const Message& msg) {
       meta.key         = msg.meta.key;
       meta.version     = msg.meta.version;
       meta.num_merge   = msg.meta.iters;
+      meta.trace_id    = msg.meta.trace_id;
 
       KVPairs<Val> kvs;
       kvs.keys = msg.data[0];
@@ -1138,7 +1230,8 @@ void KVWorker<Val>::TS_Process(const Message& msg) {
       kvs.lens = msg.data[2];
 
       request_handle_(meta, kvs, this);
-      Postoffice::Get()->van()->AskForReceiverPush(msg.meta.app_id, msg.meta.customer_id, msg.meta.timestamp);
+      Postoffice::Get()->van()->ReadyToPush(msg.meta.key, false, msg.meta.app_id,
+                                            msg.meta.customer_id, msg.meta.timestamp);
     } else {
       CHECK_GE(msg.data.size(), (size_t)2);
       KVPairs<Val> kvs;
@@ -1169,6 +1262,7 @@ void KVWorker<Val>::TS_Process(const Message& msg) {
     send_push = msg.meta.iters;
     KVMeta meta;
     meta.num_merge = -1;
+    meta.key = msg.meta.key;
     KVPairs<char> kvs;
     request_handle_(meta, kvs, this);
   }
@@ -1187,10 +1281,11 @@ void KVServer<Val>::AutoPullUpdate(const int version, const KVMeta& req, const K
   auto* van = Postoffice::Get()->van();
   int current_iter = (custom_iter != -1) ? custom_iter :
                      ((is_global) ? ++global_iter : ++iter);
+  const int key = (custom_key != -1) ? custom_key : req.key;
 
   while (true) {
-    int recver = (is_global) ? van->GetGlobalReceiver(throughput, last_recv_id, current_iter)
-                             : van->GetReceiver(throughput, last_recv_id, current_iter);
+    int recver = (is_global) ? van->GetGlobalReceiver(throughput, last_recv_id, current_iter, key)
+                             : van->GetReceiver(throughput, last_recv_id, current_iter, key);
     if (recver == -1) break; // Check if transmission is over.
 
     if (kvs.keys.size()) {
@@ -1202,7 +1297,7 @@ void KVServer<Val>::AutoPullUpdate(const int version, const KVMeta& req, const K
       msg.meta.push        = false;
       msg.meta.sender      = (is_global) ? van->my_node_global_.id : van->my_node_.id;
       msg.meta.recver      = recver;
-      msg.meta.key         = (custom_key != -1) ? custom_key : req.key;
+      msg.meta.key         = key;
       msg.meta.version     = version;
       msg.meta.iters       = current_iter;
       msg.meta.timestamp   = -1;
@@ -1239,6 +1334,7 @@ void KVServer<Val>::Process(const Message& msg) {
   meta.version     = msg.meta.version;
   meta.num_merge   = (msg.meta.iters == Meta::kEmpty) ? 1 : msg.meta.iters;
   meta.app_id      = msg.meta.request;
+  meta.trace_id    = msg.meta.trace_id;
   KVPairs<Val> data;
   int n = msg.data.size();
   if (n) {
@@ -1255,8 +1351,8 @@ void KVServer<Val>::Process(const Message& msg) {
   // notice here to normalize it later !!!warning!!! number of field should less than 50
   if (enable_intra_ts && msg.meta.sender > 100
       && msg.meta.push && msg.meta.request) {
-    Postoffice::Get()->van()->AskForReceiverPush(
-      msg.meta.app_id, msg.meta.customer_id, msg.meta.timestamp);
+    Postoffice::Get()->van()->ReadyToPush(
+      msg.meta.key, false, msg.meta.app_id, msg.meta.customer_id, msg.meta.timestamp);
   }
 
   if (enable_inter_ts && !Postoffice::Get()->is_global_server()
@@ -1268,7 +1364,8 @@ void KVServer<Val>::Process(const Message& msg) {
 
   if (enable_inter_ts && Postoffice::Get()->is_global_server()
       && msg.meta.sender < 100 && msg.meta.push && msg.meta.request) {
-    Postoffice::Get()->van()->AskForReceiverPush(msg.meta.app_id, msg.meta.customer_id, msg.meta.timestamp, true);
+    Postoffice::Get()->van()->ReadyToPush(msg.meta.key, false, msg.meta.app_id, msg.meta.customer_id,
+                                          msg.meta.timestamp, true);
   }
 
   if (enable_inter_ts && !Postoffice::Get()->is_global_server()
@@ -1283,6 +1380,7 @@ void KVServer<Val>::Process(const Message& msg) {
       meta.key         = msg.meta.key;
       meta.version     = msg.meta.version;
       meta.num_merge   = msg.meta.iters;
+      meta.trace_id    = msg.meta.trace_id;
 
       KVPairs<Val> kvs;
       kvs.keys = msg.data[0];
@@ -1290,11 +1388,13 @@ void KVServer<Val>::Process(const Message& msg) {
       kvs.lens = msg.data[2];
 
       request_handle_global(meta, kvs, this);
-      Postoffice::Get()->van()->AskForReceiverPush(msg.meta.app_id, msg.meta.customer_id, msg.meta.timestamp, true);
+      Postoffice::Get()->van()->ReadyToPush(msg.meta.key, false, msg.meta.app_id, msg.meta.customer_id,
+                                            msg.meta.timestamp, true);
     } else {
       send_push = msg.meta.iters;
       KVMeta meta;
       meta.num_merge = -1;
+      meta.key = msg.meta.key;
       KVPairs<char> kvs;
       request_handle_global(meta,kvs,this);
     }
@@ -1344,7 +1444,8 @@ void KVServer<Val>::RunCallback(int timestamp) {
 
 template <typename Val>
 template <typename C, typename D>
-int KVWorker<Val>::Pull_(const SArray<Key>& keys, C* vals, D* lens, int cmd, const Callback& cb) {
+int KVWorker<Val>::Pull_(const SArray<Key>& keys, C* vals, D* lens, int cmd, const Callback& cb,
+                         uint64_t trace_id) {
   int ts = obj_->NewRequest(kServerGroup);
   AddCallback(ts, [this, ts, keys, vals, lens, cb]() mutable {
     mu_.lock();
@@ -1401,6 +1502,7 @@ int KVWorker<Val>::Pull_(const SArray<Key>& keys, C* vals, D* lens, int cmd, con
 
   KVPairs<Val> kvs;
   kvs.keys = keys;
+  kvs.trace_id = trace_id;
   Send(ts, false, cmd, kvs);
   return ts;
 }
@@ -0,0 +1,295 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_BLOCK_REASSEMBLER_H_
+#define PS_BLOCK_REASSEMBLER_H_
+#if defined(__AVX__) || defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ps/internal/message.h"
+#include "./half_float/umHalf.h"
+namespace ps {
+
+/**
+ * \brief dst[i] += src[i] on fp32
+ */
+inline void AddFloat(float* dst, const float* src, size_t n) {
+  size_t i = 0;
+#if defined(__AVX__)
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+  }
+#elif defined(__SSE2__)
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+  }
+#endif
+  for (; i < n; ++i) dst[i] += src[i];
+}
+
+/**
+ * \brief dst[i] += src[i] on fp16, summed in fp32
+ */
+inline void AddHalf(half* dst, const half* src, size_t n) {
+  size_t i = 0;
+#if defined(__F16C__)
+  for (; i + 8 <= n; i += 8) {
+    __m256 a = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i)));
+    __m256 b = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm256_cvtps_ph(_mm256_add_ps(a, b), _MM_FROUND_TO_NEAREST_INT));
+  }
+#endif
+  for (; i < n; ++i) dst[i] += src[i];
+}
+
+/**
+ * \brief reassembles the DGT blocks of pushed tensors on global servers.
+ *
+ * Blocks of a tensor, identified by (sender, first_key), are written in place
+ * into one buffer of total_bytes at their val_bytes offset. A block that is
+ * received twice is added onto the first copy, ranges of lost blocks are
+ * zeroed when the tensor completes. Buffers come from a pool and go back to
+ * it when the last reference to the reassembled message is gone, so the
+ * steady state allocates nothing.
+ *
+ * A tensor completes when its last block arrives. With a hold, as with FEC,
+ * a tensor still missing blocks then waits until each of them arrived, was
+ * rebuilt from a parity, or was given up by the parity of its group, or until
+ * the hold passed, so that blocks behind the last one land in their round.
+ * Blocks of a round that already completed are dropped.
+ */
+class BlockReassembler {
+ public:
+  BlockReassembler() : pool_(std::make_shared<Pool>()) {}
+
+  /** \brief microseconds a tensor missing blocks may wait, 0 does not wait */
+  void set_hold(int64_t hold_us) { hold_us_ = hold_us; }
+
+  /**
+   * \brief accumulates the block in msg->data[1] into its tensor
+   * \param dtype 0 for fp32, 2 for fp16, blocks of other types are not merged
+   * \return true if the tensor completed, msg is then its last block with
+   * msg->data[1] holding the tensor
+   */
+  bool Add(Message* msg, int dtype) {
+    const Meta& meta = msg->meta;
+    const SArray<char>& block = msg->data[1];
+    std::lock_guard<std::mutex> lk(mu_);
+    const uint64_t id = Id(meta);
+    Tensor& t = tensors_[id];
+    if (hold_us_ > 0 && t.held && meta.timestamp != t.timestamp) {
+      // the next round started before the held one was released
+      ready_.emplace_back();
+      Release(id, &t, &ready_.back());
+    }
+    if (t.buf.empty()) {
+      if (hold_us_ > 0 && meta.timestamp == t.done_timestamp) {
+        ++num_late_;
+        return false;
+      }
+      t.buf = Acquire(meta.total_bytes);
+      t.timestamp = meta.timestamp;
+      t.seq_begin = meta.seq_begin;
+      t.seen.assign(meta.seq_end - meta.seq_begin + 1, false);
+      t.settled.assign(t.seen.size(), false);
+      t.missing = static_cast<int>(t.seen.size());
+      t.ranges.clear();
+    }
+    const int idx = meta.seq - t.seq_begin;
+    CHECK(idx >= 0 && idx < static_cast<int>(t.seen.size()))
+      << "block " << meta.seq << " out of range of key " << meta.first_key;
+    CHECK_LE(meta.val_bytes + block.size(), t.buf.size())
+      << "block " << meta.seq << " overflows key " << meta.first_key;
+    char* dst = t.buf.data() + meta.val_bytes;
+    if (!t.seen[idx]) {
+      memcpy(dst, block.data(), block.size());
+      t.seen[idx] = true;
+      if (!t.settled[idx]) --t.missing;
+      t.ranges.emplace_back(meta.val_bytes, block.size());
+    } else if (dtype == 0) {
+      AddFloat(reinterpret_cast<float*>(dst), reinterpret_cast<const float*>(block.data()),
+               block.size() / sizeof(float));
+    } else if (dtype == 2) {
+      AddHalf(reinterpret_cast<half*>(dst), reinterpret_cast<const half*>(block.data()),
+              block.size() / sizeof(half));
+    }
+    if (meta.seq == meta.seq_end) {
+      if (hold_us_ > 0 && t.missing > 0) {
+        t.held = true;
+        t.last = *msg;
+        t.deadline = Clock::now() + std::chrono::microseconds(hold_us_);
+        held_.push_back(id);
+        ++num_held_;
+        return false;
+      }
+      Complete(&t, msg);
+      return true;
+    }
+    if (!t.held || t.missing > 0) return false;
+    Release(id, &t, msg);
+    return true;
+  }
+
+  /**
+   * \brief gives up the blocks of a parity group that are still missing
+   * \param meta the meta of the parity
+   * \param seqs the members of the group
+   * \return true if a held tensor completed, msg then holds it as in Add
+   */
+  bool Settle(const Meta& meta, const std::vector<int>& seqs, Message* msg) {
+    std::lock_guard<std::mutex> lk(mu_);
+    const uint64_t id = Id(meta);
+    auto it = tensors_.find(id);
+    if (it == tensors_.end()) return false;
+    Tensor& t = it->second;
+    if (t.buf.empty() || t.timestamp != meta.timestamp) return false;
+    for (int seq : seqs) {
+      const int idx = seq - t.seq_begin;
+      if (idx < 0 || idx >= static_cast<int>(t.seen.size()) || t.seen[idx] || t.settled[idx]) {
+        continue;
+      }
+      t.settled[idx] = true;
+      --t.missing;
+    }
+    if (!t.held || t.missing > 0) return false;
+    Release(id, &t, msg);
+    return true;
+  }
+
+  /** \brief completes the held tensors whose hold passed */
+  void Expire(std::vector<Message>* done) {
+    std::lock_guard<std::mutex> lk(mu_);
+    for (auto& msg : ready_) done->push_back(std::move(msg));
+    ready_.clear();
+    const auto now = Clock::now();
+    for (size_t i = 0; i < held_.size();) {
+      Tensor& t = tensors_[held_[i]];
+      if (t.deadline > now) {
+        ++i;
+        continue;
+      }
+      ++num_expired_;
+      done->emplace_back();
+      Release(held_[i], &t, &done->back());
+    }
+  }
+
+  std::string Summary() {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::ostringstream os;
+    os << num_held_ << " tensors held for missing blocks, " << num_expired_
+       << " released by timeout, " << num_late_ << " late blocks dropped";
+    return os.str();
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Tensor {
+    SArray<char> buf;
+    int timestamp = -1;
+    int seq_begin = 0;
+    std::vector<bool> seen;
+    /** \brief blocks given up by the parity of their group */
+    std::vector<bool> settled;
+    /** \brief blocks neither seen nor settled */
+    int missing = 0;
+    std::vector<std::pair<size_t, size_t>> ranges;
+    /** \brief whether the last block arrived and is kept in last */
+    bool held = false;
+    Message last;
+    Clock::time_point deadline;
+    /** \brief the timestamp of the last round completed */
+    int done_timestamp = -1;
+  };
+
+  static uint64_t Id(const Meta& meta) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(meta.sender)) << 32) |
+           static_cast<uint32_t>(meta.first_key);
+  }
+
+  void Complete(Tensor* t, Message* msg) {
+    ZeroGaps(t);
+    msg->data[1] = t->buf;
+    t->buf.clear();
+    t->done_timestamp = t->timestamp;
+  }
+
+  /** \brief completes a held tensor into msg */
+  void Release(uint64_t id, Tensor* t, Message* msg) {
+    *msg = std::move(t->last);
+    t->last = Message();
+    t->held = false;
+    held_.erase(std::find(held_.begin(), held_.end(), id));
+    Complete(t, msg);
+  }
+
+  /** \brief free buffers by size, shared with the deleters of lent buffers */
+  struct Pool {
+    ~Pool() {
+      for (auto& it : free) {
+        for (char* p : it.second) delete [] p;
+      }
+    }
+    std::mutex mu;
+    std::unordered_map<size_t, std::vector<char*>> free;
+  };
+
+  SArray<char> Acquire(size_t size) {
+    char* p = nullptr;
+    {
+      std::lock_guard<std::mutex> lk(pool_->mu);
+      auto& free = pool_->free[size];
+      if (!free.empty()) {
+        p = free.back();
+        free.pop_back();
+      }
+    }
+    if (!p) p = new char[size];
+    std::shared_ptr<Pool> pool = pool_;
+    SArray<char> buf;
+    buf.reset(p, size, [pool, size](char* data) {
+      std::lock_guard<std::mutex> lk(pool->mu);
+      pool->free[size].push_back(data);
+    });
+    return buf;
+  }
+
+  static void ZeroGaps(Tensor* t) {
+    std::sort(t->ranges.begin(), t->ranges.end());
+    size_t pos = 0;
+    for (const auto& r : t->ranges) {
+      if (r.first > pos) memset(t->buf.data() + pos, 0, r.first - pos);
+      pos = std::max(pos, r.first + r.second);
+    }
+    if (pos < t->buf.size()) memset(t->buf.data() + pos, 0, t->buf.size() - pos);
+  }
+
+  std::mutex mu_;
+  std::unordered_map<uint64_t, Tensor> tensors_;
+  std::shared_ptr<Pool> pool_;
+  int64_t hold_us_ = 0;
+  /** \brief ids of the held tensors */
+  std::vector<uint64_t> held_;
+  /** \brief held tensors released by the next round, for Expire */
+  std::vector<Message> ready_;
+  uint64_t num_held_ = 0;
+  uint64_t num_expired_ = 0;
+  uint64_t num_late_ = 0;
+};
+}  // namespace ps
+#endif  // PS_BLOCK_REASSEMBLER_H_
@@ -0,0 +1,110 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_CLOCK_PROBE_H_
+#define PS_CLOCK_PROBE_H_
+#include <stdint.h>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ps/internal/message.h"
+namespace ps {
+
+/**
+ * \brief one-way delays of data messages from each peer, with PS_TRACE.
+ *
+ * Data messages carry the time their sender packed them in trace_ts. The
+ * smallest receive time minus trace_ts seen from a peer is the latency of the
+ * link plus the offset of our clock to the peer's. The smallest the other way
+ * is the latency minus that offset, so half their difference estimates the
+ * offset as NTP does with a round trip, as long as latency is about the same
+ * both ways. Each node dumps its minimums on exit, and tools/merge_traces.py
+ * solves the offsets of all nodes from the dumps.
+ *
+ * Times are in microseconds of the clock the MXNet profiler stamps events
+ * with, so that the offsets apply to the profiler dumps as they are.
+ */
+class ClockProbe {
+ public:
+  struct Delay {
+    int64_t min_us = std::numeric_limits<int64_t>::max();
+    uint64_t count = 0;
+  };
+
+  static int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+  }
+
+  /** \brief records a received message, ignored if its sender did not trace */
+  void Observe(const Meta& meta) {
+    if (meta.trace_ts == 0) return;
+    const int64_t delay = Now() - meta.trace_ts;
+    std::lock_guard<std::mutex> lk(mu_);
+    Delay& d = delays_[meta.sender];
+    if (delay < d.min_us) d.min_us = delay;
+    ++d.count;
+  }
+
+  std::map<int, Delay> delays() {
+    std::lock_guard<std::mutex> lk(mu_);
+    return delays_;
+  }
+
+  /** \brief the offset of the clock of a to the clock of b */
+  static int64_t Offset(int64_t a_from_b, int64_t b_from_a) {
+    return (a_from_b - b_from_a) / 2;
+  }
+
+  /**
+   * \brief writes the minimums as
+   *
+   *     {"node": name, "ids": {"domain": id}, "delays": {"peer": [min_us, count]}}
+   *
+   * \param ids node id of this node in each of its domains. Local ids repeat
+   * across parties, so a party is named after the address of its scheduler
+   */
+  void Dump(const std::string& path, const std::string& name,
+            const std::vector<std::pair<std::string, int>>& ids) {
+    std::ofstream os(path);
+    if (!os) {
+      LOG(WARNING) << "failed to write clock probe to " << path;
+      return;
+    }
+    os << "{\"node\": \"" << name << "\", \"ids\": {";
+    for (size_t i = 0; i < ids.size(); ++i) {
+      os << (i ? ", " : "") << "\"" << ids[i].first << "\": " << ids[i].second;
+    }
+    os << "}, \"delays\": {";
+    bool first = true;
+    for (const auto& it : delays()) {
+      os << (first ? "" : ", ") << "\"" << it.first << "\": ["
+         << it.second.min_us << ", " << it.second.count << "]";
+      first = false;
+    }
+    os << "}}\n";
+  }
+
+  std::string Summary() {
+    std::ostringstream os;
+    bool first = true;
+    for (const auto& it : delays()) {
+      os << (first ? "" : ", ") << "node " << it.first << ": min "
+         << it.second.min_us << " us of " << it.second.count;
+      first = false;
+    }
+    return os.str();
+  }
+
+ private:
+  std::mutex mu_;
+  std::map<int, Delay> delays_;
+};
+}  // namespace ps
+#endif  // PS_CLOCK_PROBE_H_
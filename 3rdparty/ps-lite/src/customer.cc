@@ -12,6 +12,19 @@ const int Meta::kEmpty = std::numeric_limits<int>::max();
 
 Customer::Customer(int app_id, int customer_id, const Customer::RecvHandle& recv_handle, bool is_server)
     : app_id_(app_id), customer_id_(customer_id), recv_handle_(recv_handle) {
+  // the tracker only holds in-flight requests, so its memory stays flat
+  int capacity = 1;
+  while (capacity < GetEnv("PS_TRACKER_CAPACITY", 16384)) capacity <<= 1;
+  tracker_ = std::unique_ptr<RequestSlot[]>(new RequestSlot[capacity]);
+  tracker_mask_ = capacity - 1;
+  for (int g = 0; g < 2; ++g) {
+    const std::string domain = g ? "global" : "local";
+    latency_[g].reset(new MetricTable<Histogram*>([domain](int peer) {
+      return Metrics::Get()->GetHistogram(
+          "ps_request_latency_us", "microseconds from a request to the response of a peer",
+          Metrics::Labels({{"domain", domain}, {"peer", std::to_string(peer)}}));
+    }));
+  }
   Postoffice::Get()->AddCustomer(this);
   recv_thread_ = std::unique_ptr<std::thread>(new std::thread(&Customer::Receiving, this));
   if (is_server) {
@@ -31,28 +44,77 @@ Customer::~Customer() {
   }
 }
 
-int Customer::NewRequest(int recver, const bool is_global) {
-  std::lock_guard<std::mutex> lk(tracker_mu_);
+int Customer::NewRequest(int recver, const bool is_global, const Callback& on_complete) {
   int num = Postoffice::Get()->GetNodeIDs(recver, is_global).size();
-  tracker_.push_back(std::make_pair(num, 0));
-  return tracker_.size() - 1;
+  // skip slots still held by requests that never completed
+  int ts, tries = 0;
+  bool warned = false;
+  while (true) {
+    // timestamps stay below Meta::kEmpty and non-negative
+    ts = next_timestamp_.fetch_add(1) & 0x3fffffff;
+    bool free = false;
+    if (Slot(ts).pending.compare_exchange_strong(free, true)) break;
+    if (++tries > tracker_mask_) {
+      LOG_IF(WARNING, !warned) << "all " << tracker_mask_ + 1 << " request slots of customer "
+          << customer_id_ << " are in flight, increase PS_TRACKER_CAPACITY";
+      warned = true;
+      std::this_thread::yield();
+      tries = 0;
+    }
+  }
+  RequestSlot& slot = Slot(ts);
+  // stale responses of the previous owner are dropped from here on
+  slot.owner.store(-1);
+  slot.expected.store(num);
+  slot.received.store(0);
+  slot.start_us.store(Metrics::NowUs());
+  slot.global.store(is_global);
+  slot.on_complete = on_complete;
+  slot.owner.store(ts);
+  if (num == 0) Complete(&slot, ts);
+  return ts;
 }
 
 void Customer::WaitRequest(int timestamp) {
-  std::unique_lock<std::mutex> lk(tracker_mu_);
-  tracker_cond_.wait(lk, [this, timestamp]{
-      return tracker_[timestamp].first == tracker_[timestamp].second;
-    });
+  RequestSlot& slot = Slot(timestamp);
+  if (IsDone(slot, timestamp)) return;
+  WaitStripe& stripe = wait_stripes_[(timestamp & tracker_mask_) % kNumWaitStripes];
+  stripe.waiters.fetch_add(1);
+  {
+    std::unique_lock<std::mutex> lk(stripe.mu);
+    stripe.cond.wait(lk, [this, &slot, timestamp]{ return IsDone(slot, timestamp); });
+  }
+  stripe.waiters.fetch_sub(1);
 }
 
 int Customer::NumResponse(int timestamp) {
-  std::lock_guard<std::mutex> lk(tracker_mu_);
-  return tracker_[timestamp].second;
+  return Slot(timestamp).received.load();
 }
 
 void Customer::AddResponse(int timestamp, int num) {
-  std::lock_guard<std::mutex> lk(tracker_mu_);
-  tracker_[timestamp].second += num;
+  RequestSlot& slot = Slot(timestamp);
+  if (slot.owner.load() != timestamp) {
+    LOG(WARNING) << "drop response to finished request " << timestamp;
+    return;
+  }
+  const int received = slot.received.fetch_add(num) + num;
+  if (received == slot.expected.load() && num > 0) Complete(&slot, timestamp);
+}
+
+void Customer::Complete(RequestSlot* slot, int timestamp) {
+  if (slot->on_complete) {
+    Callback cb;
+    std::swap(cb, slot->on_complete);
+    cb();
+  }
+  slot->done.store(timestamp);
+  slot->pending.store(false);
+  WaitStripe& stripe = wait_stripes_[(timestamp & tracker_mask_) % kNumWaitStripes];
+  if (stripe.waiters.load() > 0) {
+    // pairs with the predicate check of WaitRequest under the same lock
+    { std::lock_guard<std::mutex> lk(stripe.mu); }
+    stripe.cond.notify_all();
+  }
 }
 
 void Customer::Receiving() {
@@ -64,11 +126,16 @@ void Customer::Receiving() {
       break;
     }
      // LOG(INFO) << "Receiving():--->"<< recv.DebugString();
+    if (!recv.meta.request) {
+      RequestSlot& slot = Slot(recv.meta.timestamp);
+      if (slot.owner.load() == recv.meta.timestamp) {
+        latency_[slot.global.load()]->Get(recv.meta.sender)->Record(
+            Metrics::NowUs() - slot.start_us.load());
+      }
+    }
     recv_handle_(recv);
     if (!recv.meta.request) {
-      std::lock_guard<std::mutex> lk(tracker_mu_);
-      tracker_[recv.meta.timestamp].second++;
-      tracker_cond_.notify_all();
+      AddResponse(recv.meta.timestamp);
     }
   }
 }
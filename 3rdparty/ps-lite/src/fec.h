@@ -0,0 +1,337 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_FEC_H_
+#define PS_FEC_H_
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ps/internal/message.h"
+namespace ps {
+
+/** \brief msg_type of the XOR parity of a group of DGT blocks */
+static const int kFecParityMsg = 2;
+
+/**
+ * \brief XOR parity of the DGT blocks sent on unreliable UDP channels.
+ *
+ * The blocks of a key sent on a channel are grouped in send order, and each
+ * group is followed on the same channel by a parity block, whose vals are
+ *
+ *     [num members][seq, val_bytes, bytes of each member][XOR of the members]
+ *
+ * with shorter members zero padded. A receiver that misses exactly one member
+ * of a group rebuilds it from the parity and the others, so one loss per group
+ * costs no gradient.
+ *
+ * Group sizes are chosen per channel from the loss rate receivers measure on
+ * the groups they see, so that the share of blocks still lost, about
+ * p * (1 - (1 - p)^size), stays below a target. Lossless channels use the
+ * largest size, so that their loss keeps being measured.
+ */
+class FecEncoder {
+ public:
+  /**
+   * \param num_channels number of UDP channels
+   * \param max_group largest number of blocks per parity
+   * \param target_loss share of blocks allowed to stay lost after recovery
+   */
+  FecEncoder(int num_channels, int max_group, float target_loss)
+      : max_group_(std::max(max_group, 1)), target_loss_(target_loss),
+        groups_(num_channels), size_(num_channels, std::max(max_group, 1)),
+        loss_(num_channels, 0) {}
+
+  /**
+   * \brief adds a block sent on channel, 1-based as Meta::channel
+   * \param parities parity blocks to send after it on the same channel
+   */
+  void Add(const Message& msg, std::vector<Message>* parities) {
+    std::lock_guard<std::mutex> lk(mu_);
+    const int c = msg.meta.channel - 1;
+    Group& g = groups_.at(c);
+    if (!g.members.empty() && (g.meta.recver != msg.meta.recver ||
+        g.meta.first_key != msg.meta.first_key || g.meta.timestamp != msg.meta.timestamp)) {
+      Flush(&g, parities);
+    }
+    const SArray<char>& vals = msg.data[1];
+    if (g.members.empty()) {
+      g.meta = msg.meta;
+      g.keys = msg.data[0];
+      g.xor_bytes.clear();
+    }
+    if (vals.size() > g.xor_bytes.size()) g.xor_bytes.resize(vals.size(), 0);
+    XorInto(g.xor_bytes.data(), vals.data(), vals.size());
+    g.members.push_back({msg.meta.seq, msg.meta.val_bytes, static_cast<int>(vals.size())});
+    if (static_cast<int>(g.members.size()) >= size_[c]) Flush(&g, parities);
+  }
+
+  /** \brief closes the open groups of all channels, when nothing else is queued */
+  void FlushAll(std::vector<Message>* parities) {
+    std::lock_guard<std::mutex> lk(mu_);
+    for (auto& g : groups_) Flush(&g, parities);
+  }
+
+  /** \brief loss rates of the channels measured by a receiver */
+  void SetLoss(const std::vector<float>& loss) {
+    std::lock_guard<std::mutex> lk(mu_);
+    for (size_t c = 0; c < loss.size() && c < loss_.size(); ++c) {
+      loss_[c] = loss[c];
+      size_[c] = GroupSize(loss[c]);
+    }
+  }
+
+  int group_size(int channel) {
+    std::lock_guard<std::mutex> lk(mu_);
+    return size_.at(channel - 1);
+  }
+
+  uint64_t num_parities() const { return num_parities_.load(); }
+  uint64_t parity_bytes() const { return parity_bytes_.load(); }
+
+  std::string Summary() {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::ostringstream os;
+    os << num_parities_.load() << " parities of " << parity_bytes_.load() << " bytes";
+    for (size_t c = 0; c < size_.size(); ++c) {
+      os << ", channel " << c + 1 << ": loss " << loss_[c] << " group " << size_[c];
+    }
+    return os.str();
+  }
+
+  /** \brief dst[i] ^= src[i] */
+  static void XorInto(char* dst, const char* src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      uint64_t a, b;
+      memcpy(&a, dst + i, 8);
+      memcpy(&b, src + i, 8);
+      a ^= b;
+      memcpy(dst + i, &a, 8);
+    }
+    for (; i < n; ++i) dst[i] ^= src[i];
+  }
+
+ private:
+  struct Member {
+    int seq;
+    int val_bytes;
+    int bytes;
+  };
+
+  struct Group {
+    Meta meta;
+    SArray<char> keys;
+    std::vector<Member> members;
+    std::vector<char> xor_bytes;
+  };
+
+  int GroupSize(float p) const {
+    int size = max_group_;
+    while (size > 1 && p * (1 - std::pow(1 - p, size)) > target_loss_) --size;
+    return size;
+  }
+
+  void Flush(Group* g, std::vector<Message>* parities) {
+    if (g->members.empty()) return;
+    const size_t head = sizeof(int) * (1 + 3 * g->members.size());
+    SArray<char> vals(head + g->xor_bytes.size());
+    int* p = reinterpret_cast<int*>(vals.data());
+    *p++ = static_cast<int>(g->members.size());
+    for (const auto& m : g->members) {
+      *p++ = m.seq;
+      *p++ = m.val_bytes;
+      *p++ = m.bytes;
+    }
+    memcpy(vals.data() + head, g->xor_bytes.data(), g->xor_bytes.size());
+
+    Message parity;
+    parity.meta = g->meta;
+    parity.meta.msg_type = kFecParityMsg;
+    parity.meta.compr.clear();
+    parity.meta.data_type.clear();
+    parity.AddData(g->keys);
+    parity.meta.keys_len = parity.data.back().size();
+    parity.AddData(vals);
+    parity.meta.vals_len = parity.data.back().size();
+    parity.meta.lens_len = 0;
+    parities->push_back(parity);
+    ++num_parities_;
+    parity_bytes_ += vals.size();
+    g->members.clear();
+  }
+
+  std::mutex mu_;
+  int max_group_;
+  float target_loss_;
+  std::vector<Group> groups_;
+  std::vector<int> size_;
+  std::vector<float> loss_;
+  std::atomic<uint64_t> num_parities_{0};
+  std::atomic<uint64_t> parity_bytes_{0};
+};
+
+/**
+ * \brief rebuilds single lost DGT blocks of a group from its parity on global
+ * servers, and measures the loss of each channel of each sender.
+ *
+ * Received blocks are kept by reference until the parity of their group
+ * arrives, or until the next round of their key starts.
+ */
+class FecDecoder {
+ public:
+  explicit FecDecoder(int num_channels) : num_channels_(num_channels) {}
+
+  /** \brief records a DGT block received on a UDP channel */
+  void AddBlock(const Message& msg) {
+    std::lock_guard<std::mutex> lk(mu_);
+    ++num_blocks_;
+    Round& r = rounds_[Id(msg.meta.sender, msg.meta.first_key)];
+    if (r.timestamp != msg.meta.timestamp) {
+      r.timestamp = msg.meta.timestamp;
+      r.blocks.clear();
+    }
+    r.blocks[msg.meta.seq] = msg.data[1];
+  }
+
+  /**
+   * \brief handles a parity block
+   * \param recovered the rebuilt block, if exactly one member was lost
+   * \return whether a block was rebuilt
+   */
+  bool AddParity(const Message& parity, Message* recovered) {
+    const int n = NumMembers(parity);
+    const SArray<char>& vals = parity.data[1];
+    const int* p = reinterpret_cast<const int*>(vals.data()) + 1;
+    const size_t head = sizeof(int) * (1 + 3 * n);
+
+    std::lock_guard<std::mutex> lk(mu_);
+    Round& r = rounds_[Id(parity.meta.sender, parity.meta.first_key)];
+    if (r.timestamp != parity.meta.timestamp) {
+      r.timestamp = parity.meta.timestamp;
+      r.blocks.clear();
+    }
+    int lost = -1, num_lost = 0;
+    for (int i = 0; i < n; ++i) {
+      if (!r.blocks.count(p[3 * i])) {
+        lost = i;
+        ++num_lost;
+      }
+    }
+    UpdateLoss(parity.meta.sender, parity.meta.channel, n, num_lost);
+    num_lost_ += num_lost;
+    if (num_lost != 1) {
+      for (int i = 0; i < n; ++i) r.blocks.erase(p[3 * i]);
+      return false;
+    }
+
+    const int bytes = p[3 * lost + 2];
+    CHECK(bytes >= 0 && static_cast<size_t>(bytes) <= vals.size() - head)
+        << "malformed parity of key " << parity.meta.first_key << ": " << bytes << " bytes";
+    SArray<char> block(vals.size() - head);
+    memcpy(block.data(), vals.data() + head, block.size());
+    for (int i = 0; i < n; ++i) {
+      if (i == lost) continue;
+      auto it = r.blocks.find(p[3 * i]);
+      FecEncoder::XorInto(block.data(), it->second.data(),
+                          std::min(it->second.size(), block.size()));
+      r.blocks.erase(it);
+    }
+    block.resize(bytes);
+
+    recovered->meta = parity.meta;
+    recovered->meta.msg_type = 1;
+    recovered->meta.seq = p[3 * lost];
+    recovered->meta.val_bytes = p[3 * lost + 1];
+    recovered->data.clear();
+    recovered->meta.data_type.clear();
+    recovered->AddData(parity.data[0]);
+    recovered->AddData(block);
+    recovered->meta.vals_len = bytes;
+    ++num_recovered_;
+    return true;
+  }
+
+  /** \brief the seq of each member of the group of a parity */
+  static std::vector<int> Members(const Message& parity) {
+    const int n = NumMembers(parity);
+    const int* p = reinterpret_cast<const int*>(parity.data[1].data());
+    std::vector<int> seqs(n);
+    for (int i = 0; i < n; ++i) seqs[i] = p[1 + 3 * i];
+    return seqs;
+  }
+
+  /** \brief the loss rate of each channel from sender, empty before any parity */
+  std::vector<float> Loss(int sender) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = loss_.find(sender);
+    return it == loss_.end() ? std::vector<float>() : it->second;
+  }
+
+  std::string Summary() {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::ostringstream os;
+    os << num_blocks_ << " UDP blocks received, " << num_lost_ << " lost in groups, "
+       << num_recovered_ << " recovered";
+    for (const auto& it : loss_) {
+      os << ", node " << it.first << " loss [";
+      for (size_t c = 0; c < it.second.size(); ++c) os << (c ? " " : "") << it.second[c];
+      os << "]";
+    }
+    return os.str();
+  }
+
+ private:
+  struct Round {
+    int timestamp = -1;
+    std::map<int, SArray<char>> blocks;
+  };
+
+  /**
+   * \brief the member count of a parity, checked against its size before the
+   * seq, val_bytes and bytes of each member are read
+   */
+  static int NumMembers(const Message& parity) {
+    CHECK_GE(parity.data.size(), 2U) << "malformed parity of key " << parity.meta.first_key;
+    const SArray<char>& vals = parity.data[1];
+    CHECK_GE(vals.size(), sizeof(int)) << "malformed parity of key " << parity.meta.first_key;
+    int n;
+    memcpy(&n, vals.data(), sizeof(n));
+    CHECK(n >= 0 && static_cast<size_t>(n) <= (vals.size() - sizeof(int)) / (3 * sizeof(int)))
+        << "malformed parity of key " << parity.meta.first_key << ": " << n << " members in "
+        << vals.size() << " bytes";
+    return n;
+  }
+
+  static uint64_t Id(int sender, int first_key) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(sender)) << 32) |
+           static_cast<uint32_t>(first_key);
+  }
+
+  void UpdateLoss(int sender, int channel, int n, int num_lost) {
+    auto& loss = loss_[sender];
+    if (loss.empty()) loss.assign(num_channels_, 0);
+    if (channel < 1 || channel > num_channels_ || n == 0) return;
+    float& l = loss[channel - 1];
+    l = kAlpha * num_lost / n + (1 - kAlpha) * l;
+  }
+
+  static constexpr float kAlpha = 0.2f;
+  std::mutex mu_;
+  int num_channels_;
+  std::unordered_map<uint64_t, Round> rounds_;
+  std::map<int, std::vector<float>> loss_;
+  uint64_t num_blocks_ = 0;
+  uint64_t num_lost_ = 0;
+  uint64_t num_recovered_ = 0;
+};
+}  // namespace ps
+#endif  // PS_FEC_H_
@@ -752,6 +752,10 @@ const int PBMeta::kPriorityFieldNumber;
 const int PBMeta::kKeyFieldNumber;
 const int PBMeta::kVersionFieldNumber;
 const int PBMeta::kItersFieldNumber;
+const int PBMeta::kResendSeqFieldNumber;
+const int PBMeta::kResendAckFieldNumber;
+const int PBMeta::kTraceIdFieldNumber;
+const int PBMeta::kTraceTsFieldNumber;
 #endif  // !_MSC_VER
 
 PBMeta::PBMeta()
@@ -804,6 +808,10 @@ void PBMeta::SharedCtor() {
   key_ = 0;
   version_ = 0;
   iters_ = 0;
+  resend_seq_ = 0;
+  resend_ack_ = GOOGLE_ULONGLONG(0);
+  trace_id_ = GOOGLE_ULONGLONG(0);
+  trace_ts_ = GOOGLE_LONGLONG(0);
   ::memset(_has_bits_, 0, sizeof(_has_bits_));
 }
 
@@ -886,6 +894,12 @@ void PBMeta::Clear() {
     key_ = 0;
     version_ = 0;
     iters_ = 0;
+    resend_seq_ = 0;
+    resend_ack_ = GOOGLE_ULONGLONG(0);
+  }
+  if (_has_bits_[32 / 32] & (0xffu << (32 % 32))) {
+    trace_id_ = GOOGLE_ULONGLONG(0);
+    trace_ts_ = GOOGLE_LONGLONG(0);
   }
   data_type_.Clear();
   compr_.Clear();
@@ -1380,6 +1394,70 @@ bool PBMeta::MergePartialFromCodedStream(
         } else {
           goto handle_uninterpreted;
         }
+        if (input->ExpectTag(248)) goto parse_resend_seq;
+        break;
+      }
+
+      // optional int32 resend_seq = 31;
+      case 31: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_resend_seq:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::int32, ::google::protobuf::internal::WireFormatLite::TYPE_INT32>(
+                 input, &resend_seq_)));
+          set_has_resend_seq();
+        } else {
+          goto handle_uninterpreted;
+        }
+        if (input->ExpectTag(256)) goto parse_resend_ack;
+        break;
+      }
+
+      // optional uint64 resend_ack = 32;
+      case 32: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_resend_ack:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::uint64, ::google::protobuf::internal::WireFormatLite::TYPE_UINT64>(
+                 input, &resend_ack_)));
+          set_has_resend_ack();
+        } else {
+          goto handle_uninterpreted;
+        }
+        if (input->ExpectTag(264)) goto parse_trace_id;
+        break;
+      }
+
+      // optional uint64 trace_id = 33;
+      case 33: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_trace_id:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::uint64, ::google::protobuf::internal::WireFormatLite::TYPE_UINT64>(
+                 input, &trace_id_)));
+          set_has_trace_id();
+        } else {
+          goto handle_uninterpreted;
+        }
+        if (input->ExpectTag(272)) goto parse_trace_ts;
+        break;
+      }
+
+      // optional int64 trace_ts = 34;
+      case 34: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_trace_ts:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::int64, ::google::protobuf::internal::WireFormatLite::TYPE_INT64>(
+                 input, &trace_ts_)));
+          set_has_trace_ts();
+        } else {
+          goto handle_uninterpreted;
+        }
         if (input->ExpectAtEnd()) return true;
         break;
       }
@@ -1559,6 +1637,26 @@ void PBMeta::SerializeWithCachedSizes(
     ::google::protobuf::internal::WireFormatLite::WriteInt32(30, this->iters(), output);
   }
 
+  // optional int32 resend_seq = 31;
+  if (has_resend_seq()) {
+    ::google::protobuf::internal::WireFormatLite::WriteInt32(31, this->resend_seq(), output);
+  }
+
+  // optional uint64 resend_ack = 32;
+  if (has_resend_ack()) {
+    ::google::protobuf::internal::WireFormatLite::WriteUInt64(32, this->resend_ack(), output);
+  }
+
+  // optional uint64 trace_id = 33;
+  if (has_trace_id()) {
+    ::google::protobuf::internal::WireFormatLite::WriteUInt64(33, this->trace_id(), output);
+  }
+
+  // optional int64 trace_ts = 34;
+  if (has_trace_ts()) {
+    ::google::protobuf::internal::WireFormatLite::WriteInt64(34, this->trace_ts(), output);
+  }
+
 }
 
 int PBMeta::ByteSize() const {
@@ -1761,6 +1859,36 @@ int PBMeta::ByteSize() const {
           this->iters());
     }
 
+    // optional int32 resend_seq = 31;
+    if (has_resend_seq()) {
+      total_size += 2 +
+        ::google::protobuf::internal::WireFormatLite::Int32Size(
+          this->resend_seq());
+    }
+
+    // optional uint64 resend_ack = 32;
+    if (has_resend_ack()) {
+      total_size += 2 +
+        ::google::protobuf::internal::WireFormatLite::UInt64Size(
+          this->resend_ack());
+    }
+
+  }
+  if (_has_bits_[32 / 32] & (0xffu << (32 % 32))) {
+    // optional uint64 trace_id = 33;
+    if (has_trace_id()) {
+      total_size += 2 +
+        ::google::protobuf::internal::WireFormatLite::UInt64Size(
+          this->trace_id());
+    }
+
+    // optional int64 trace_ts = 34;
+    if (has_trace_ts()) {
+      total_size += 2 +
+        ::google::protobuf::internal::WireFormatLite::Int64Size(
+          this->trace_ts());
+    }
+
   }
   // repeated int32 data_type = 9 [packed = true];
   {
@@ -1892,6 +2020,20 @@ void PBMeta::MergeFrom(const PBMeta& from) {
     if (from.has_iters()) {
       set_iters(from.iters());
     }
+    if (from.has_resend_seq()) {
+      set_resend_seq(from.resend_seq());
+    }
+    if (from.has_resend_ack()) {
+      set_resend_ack(from.resend_ack());
+    }
+  }
+  if (from._has_bits_[32 / 32] & (0xffu << (32 % 32))) {
+    if (from.has_trace_id()) {
+      set_trace_id(from.trace_id());
+    }
+    if (from.has_trace_ts()) {
+      set_trace_ts(from.trace_ts());
+    }
   }
 }
 
@@ -1941,7 +2083,12 @@ void PBMeta::Swap(PBMeta* other) {
     std::swap(key_, other->key_);
     std::swap(version_, other->version_);
     std::swap(iters_, other->iters_);
+    std::swap(resend_seq_, other->resend_seq_);
+    std::swap(resend_ack_, other->resend_ack_);
+    std::swap(trace_id_, other->trace_id_);
+    std::swap(trace_ts_, other->trace_ts_);
     std::swap(_has_bits_[0], other->_has_bits_[0]);
+    std::swap(_has_bits_[1], other->_has_bits_[1]);
     std::swap(_cached_size_, other->_cached_size_);
   }
 }
@@ -585,6 +585,34 @@ class PBMeta : public ::google::protobuf::MessageLite {
   inline ::google::protobuf::int32 iters() const;
   inline void set_iters(::google::protobuf::int32 value);
 
+  // optional int32 resend_seq = 31;
+  inline bool has_resend_seq() const;
+  inline void clear_resend_seq();
+  static const int kResendSeqFieldNumber = 31;
+  inline ::google::protobuf::int32 resend_seq() const;
+  inline void set_resend_seq(::google::protobuf::int32 value);
+
+  // optional uint64 resend_ack = 32;
+  inline bool has_resend_ack() const;
+  inline void clear_resend_ack();
+  static const int kResendAckFieldNumber = 32;
+  inline ::google::protobuf::uint64 resend_ack() const;
+  inline void set_resend_ack(::google::protobuf::uint64 value);
+
+  // optional uint64 trace_id = 33;
+  inline bool has_trace_id() const;
+  inline void clear_trace_id();
+  static const int kTraceIdFieldNumber = 33;
+  inline ::google::protobuf::uint64 trace_id() const;
+  inline void set_trace_id(::google::protobuf::uint64 value);
+
+  // optional int64 trace_ts = 34;
+  inline bool has_trace_ts() const;
+  inline void clear_trace_ts();
+  static const int kTraceTsFieldNumber = 34;
+  inline ::google::protobuf::int64 trace_ts() const;
+  inline void set_trace_ts(::google::protobuf::int64 value);
+
   // @@protoc_insertion_point(class_scope:ps.PBMeta)
  private:
   inline void set_has_head();
@@ -643,6 +671,14 @@ class PBMeta : public ::google::protobuf::MessageLite {
   inline void clear_has_version();
   inline void set_has_iters();
   inline void clear_has_iters();
+  inline void set_has_resend_seq();
+  inline void clear_has_resend_seq();
+  inline void set_has_resend_ack();
+  inline void clear_has_resend_ack();
+  inline void set_has_trace_id();
+  inline void clear_has_trace_id();
+  inline void set_has_trace_ts();
+  inline void clear_has_trace_ts();
 
   ::std::string* body_;
   ::ps::PBControl* control_;
@@ -675,9 +711,13 @@ class PBMeta : public ::google::protobuf::MessageLite {
   ::google::protobuf::int32 key_;
   ::google::protobuf::int32 version_;
   ::google::protobuf::int32 iters_;
+  ::google::protobuf::uint64 resend_ack_;
+  ::google::protobuf::int32 resend_seq_;
+  ::google::protobuf::uint64 trace_id_;
+  ::google::protobuf::int64 trace_ts_;
 
   mutable int _cached_size_;
-  ::google::protobuf::uint32 _has_bits_[(30 + 31) / 32];
+  ::google::protobuf::uint32 _has_bits_[(34 + 31) / 32];
 
   #ifdef GOOGLE_PROTOBUF_NO_STATIC_INITIALIZER
   friend void  protobuf_AddDesc_meta_2eproto_impl();
@@ -1735,6 +1775,94 @@ inline void PBMeta::set_iters(::google::protobuf::int32 value) {
   iters_ = value;
 }
 
+// optional int32 resend_seq = 31;
+inline bool PBMeta::has_resend_seq() const {
+  return (_has_bits_[0] & 0x40000000u) != 0;
+}
+inline void PBMeta::set_has_resend_seq() {
+  _has_bits_[0] |= 0x40000000u;
+}
+inline void PBMeta::clear_has_resend_seq() {
+  _has_bits_[0] &= ~0x40000000u;
+}
+inline void PBMeta::clear_resend_seq() {
+  resend_seq_ = 0;
+  clear_has_resend_seq();
+}
+inline ::google::protobuf::int32 PBMeta::resend_seq() const {
+  return resend_seq_;
+}
+inline void PBMeta::set_resend_seq(::google::protobuf::int32 value) {
+  set_has_resend_seq();
+  resend_seq_ = value;
+}
+
+// optional uint64 resend_ack = 32;
+inline bool PBMeta::has_resend_ack() const {
+  return (_has_bits_[0] & 0x80000000u) != 0;
+}
+inline void PBMeta::set_has_resend_ack() {
+  _has_bits_[0] |= 0x80000000u;
+}
+inline void PBMeta::clear_has_resend_ack() {
+  _has_bits_[0] &= ~0x80000000u;
+}
+inline void PBMeta::clear_resend_ack() {
+  resend_ack_ = GOOGLE_ULONGLONG(0);
+  clear_has_resend_ack();
+}
+inline ::google::protobuf::uint64 PBMeta::resend_ack() const {
+  return resend_ack_;
+}
+inline void PBMeta::set_resend_ack(::google::protobuf::uint64 value) {
+  set_has_resend_ack();
+  resend_ack_ = value;
+}
+
+// optional uint64 trace_id = 33;
+inline bool PBMeta::has_trace_id() const {
+  return (_has_bits_[1] & 0x00000001u) != 0;
+}
+inline void PBMeta::set_has_trace_id() {
+  _has_bits_[1] |= 0x00000001u;
+}
+inline void PBMeta::clear_has_trace_id() {
+  _has_bits_[1] &= ~0x00000001u;
+}
+inline void PBMeta::clear_trace_id() {
+  trace_id_ = GOOGLE_ULONGLONG(0);
+  clear_has_trace_id();
+}
+inline ::google::protobuf::uint64 PBMeta::trace_id() const {
+  return trace_id_;
+}
+inline void PBMeta::set_trace_id(::google::protobuf::uint64 value) {
+  set_has_trace_id();
+  trace_id_ = value;
+}
+
+// optional int64 trace_ts = 34;
+inline bool PBMeta::has_trace_ts() const {
+  return (_has_bits_[1] & 0x00000002u) != 0;
+}
+inline void PBMeta::set_has_trace_ts() {
+  _has_bits_[1] |= 0x00000002u;
+}
+inline void PBMeta::clear_has_trace_ts() {
+  _has_bits_[1] &= ~0x00000002u;
+}
+inline void PBMeta::clear_trace_ts() {
+  trace_ts_ = GOOGLE_LONGLONG(0);
+  clear_has_trace_ts();
+}
+inline ::google::protobuf::int64 PBMeta::trace_ts() const {
+  return trace_ts_;
+}
+inline void PBMeta::set_trace_ts(::google::protobuf::int64 value) {
+  set_has_trace_ts();
+  trace_ts_ = value;
+}
+
 
 // @@protoc_insertion_point(namespace_scope)
 
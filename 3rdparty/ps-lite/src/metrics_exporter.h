@@ -0,0 +1,115 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_METRICS_EXPORTER_H_
+#define PS_METRICS_EXPORTER_H_
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include "ps/internal/metrics.h"
+#include "ps/internal/utils.h"
+namespace ps {
+
+/**
+ * \brief serves Metrics::Prometheus() over HTTP for scrapers.
+ *
+ * One thread answers every GET of /metrics with the current text and closes
+ * the connection, it never touches the data path. Processes sharing a host
+ * take the first free port from the one given, the port taken is logged.
+ */
+class MetricsExporter {
+ public:
+  /**
+   * \param host address to listen on, PS_METRICS_HOST
+   * \param port first port to try, PS_METRICS_PORT
+   */
+  MetricsExporter(const std::string& host, int port) {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(fd_, 0) << "failed to open the metrics socket: " << strerror(errno);
+    int one = 1;
+    setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    CHECK_EQ(inet_pton(AF_INET, host.c_str(), &addr.sin_addr), 1)
+        << "PS_METRICS_HOST " << host << " is not an IPv4 address";
+    const int kMaxTries = 64;
+    for (int i = 0; i < kMaxTries; ++i) {
+      addr.sin_port = htons(port + i);
+      if (bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+        port_ = port + i;
+        break;
+      }
+    }
+    if (port_ < 0 || listen(fd_, 16) != 0) {
+      LOG(WARNING) << "no free port for metrics in [" << port << ", " << port + kMaxTries
+                   << "), they are only dumped on exit";
+      close(fd_);
+      fd_ = -1;
+      return;
+    }
+    LOG(INFO) << "metrics are served on http://" << host << ":" << port_ << "/metrics";
+    thread_.reset(new std::thread(&MetricsExporter::Serving, this));
+  }
+
+  ~MetricsExporter() {
+    stop_ = true;
+    if (thread_) thread_->join();
+    if (fd_ >= 0) close(fd_);
+  }
+
+  int port() const { return port_; }
+
+  /** \brief writes the current text to path */
+  static void Dump(const std::string& path) {
+    std::ofstream os(path);
+    if (!os) {
+      LOG(WARNING) << "failed to write metrics to " << path;
+      return;
+    }
+    os << Metrics::Get()->Prometheus();
+  }
+
+ private:
+  void Serving() {
+    while (!stop_) {
+      // wake up now and then to see if we are stopped
+      pollfd pfd = {fd_, POLLIN, 0};
+      if (poll(&pfd, 1, 200) <= 0) continue;
+      int conn = accept(fd_, nullptr, nullptr);
+      if (conn < 0) continue;
+      timeval timeout = {1, 0};
+      setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      // the request line is all we look at
+      char buf[1024];
+      ssize_t n = recv(conn, buf, sizeof(buf) - 1, 0);
+      buf[n > 0 ? n : 0] = '\0';
+      const bool found = strncmp(buf, "GET /metrics", 12) == 0 || strncmp(buf, "GET / ", 6) == 0;
+      const std::string body = found ? Metrics::Get()->Prometheus() : "not found\n";
+      const std::string response = std::string("HTTP/1.0 ") + (found ? "200 OK" : "404 Not Found")
+          + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+          + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+      for (size_t sent = 0; sent < response.size();) {
+        ssize_t m = send(conn, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (m <= 0) break;
+        sent += m;
+      }
+      close(conn);
+    }
+  }
+
+  int fd_ = -1;
+  int port_ = -1;
+  std::atomic<bool> stop_{false};
+  std::unique_ptr<std::thread> thread_;
+};
+}  // namespace ps
+#endif  // PS_METRICS_EXPORTER_H_
@@ -0,0 +1,370 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_OVERLAY_H_
+#define PS_OVERLAY_H_
+#include <stdint.h>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ps/internal/message.h"
+namespace ps {
+
+/**
+ * \brief TSEngine overlay decided by every node locally, instead of asking
+ * the scheduler for the peer of each message.
+ *
+ * Nodes measure the throughput of the links they send on and gossip the rows
+ * of the throughput matrix they know on the TSEngine messages they send
+ * anyway: broadcasts, their replies, pushes and ready notices. A row is
+ * versioned by its owner, newer rows win.
+ *
+ * Pulls: the holder of a broadcast builds a maximum spanning tree of the
+ * throughput, which maximizes the bottleneck of every path, over itself and
+ * the nodes it still has to reach. It sends to its children in the tree one
+ * by one and hands each the rest of its subtree to reach in turn, so every
+ * node is reached exactly once even while views of the matrix differ.
+ *
+ * Pushes: a key is aggregated up the tree its last broadcast took. A node
+ * with its own data tells its children it is ready, and sends on to its
+ * parent once its own data, the data of all its children and the ready notice
+ * of its parent are in. The root, the server, is always ready. Keys without a
+ * broadcast yet are left to the scheduler.
+ *
+ * Unmeasured links look best, so that they get explored. In rounds whose hash
+ * falls above the greed rate, links weigh at random instead.
+ */
+class Overlay {
+ public:
+  /** \brief NextReceiver of a broadcast this node got no subtree for */
+  static const int kUnassigned = -2;
+
+  /**
+   * \param self id of this node
+   * \param root id of the server, which starts broadcasts
+   * \param members ids of the nodes of the domain
+   * \param greed_rate share of rounds that exploit measured links, MAX_GREED_RATE_TS
+   */
+  Overlay(int self, int root, const std::vector<int>& members, double greed_rate)
+      : self_(self), root_(root), members_(members), greed_rate_(greed_rate) {
+    if (!IsMember(root)) members_.push_back(root);
+    std::sort(members_.begin(), members_.end());
+  }
+
+  bool IsMember(int id) const {
+    return std::find(members_.begin(), members_.end(), id) != members_.end();
+  }
+
+  /**
+   * \brief picks the next peer to send broadcast round of key to
+   * \param throughput measured to last_recv, -1 if none
+   * \return the peer, -1 when the subtree is reached, or kUnassigned
+   */
+  int NextReceiver(int key, int round, int throughput, int last_recv) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (throughput >= 0 && last_recv >= 0) {
+      Row& row = rows_[self_];
+      row.thr[last_recv] = throughput;
+      ++row.version;
+    }
+    auto id = std::make_pair(key, round);
+    auto it = assigned_.find(id);
+    if (it == assigned_.end()) {
+      if (self_ != root_) return kUnassigned;
+      std::vector<int> all;
+      for (int m : members_) {
+        if (m != self_) all.push_back(m);
+      }
+      it = assigned_.emplace(id, all).first;
+      tree_[key].children.clear();
+    }
+    std::vector<int>& pending = it->second;
+    if (pending.empty()) {
+      assigned_.erase(it);
+      return -1;
+    }
+    std::vector<int> subtree;
+    const int child = PickChild(round, pending, &subtree);
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [&](int v) {
+      return v == child || std::find(subtree.begin(), subtree.end(), v) != subtree.end();
+    }), pending.end());
+    outbox_[std::make_pair(child, key)] = subtree;
+    tree_[key].children.push_back(child);
+    ++num_decisions_;
+    return child;
+  }
+
+  /**
+   * \brief records that data of key is ready to push on
+   * \param own whether it is the node's own data, or merged from a child
+   * \param notices ready notices to send to the children
+   * \param triggers requests to the own customer to send to the parent
+   * \return false if key has no tree yet, and the scheduler pairs the push
+   */
+  bool Ready(int key, bool own, int app, int customer, int timestamp,
+             std::vector<Message>* notices, std::vector<Message>* triggers) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = tree_.find(key);
+    if (it == tree_.end()) return false;
+    if (self_ == root_) return true;
+    Tree& t = it->second;
+    if (own) {
+      t.own = true;
+      t.app = app;
+      t.customer = customer;
+      t.timestamp = timestamp;
+      for (int c : t.children) {
+        Message notice = Request(key, self_, c, t);
+        notice.meta.body = Compose('r', c, nullptr);
+        notices->push_back(notice);
+      }
+    } else {
+      ++t.merged;
+    }
+    Release(key, &t, triggers);
+    return true;
+  }
+
+  /** \brief sets the overlay body of a TSEngine message to a member */
+  void Annotate(Message* msg) {
+    if (!msg->meta.body.empty() || !IsMember(msg->meta.recver)) return;
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = outbox_.find(std::make_pair(msg->meta.recver, msg->meta.key));
+    if (msg->meta.request && !msg->meta.push && it != outbox_.end()) {
+      msg->meta.body = Compose('b', msg->meta.recver, &it->second);
+      outbox_.erase(it);
+    } else {
+      msg->meta.body = Compose('g', msg->meta.recver, nullptr);
+    }
+  }
+
+  /**
+   * \brief takes the overlay body off a received message
+   * \param triggers requests to the own customer to send to the parent
+   * \return true if msg was a ready notice, which is consumed
+   */
+  bool Receive(Message* msg, std::vector<Message>* triggers) {
+    if (msg->meta.body.compare(0, 4, "ts1 ") != 0) return false;
+    std::istringstream is(msg->meta.body.substr(4));
+    char kind = 'g';
+    is >> kind;
+    std::vector<int> subtree;
+    if (kind == 'b') {
+      size_t n = 0;
+      is >> n;
+      subtree.resize(n);
+      for (auto& v : subtree) is >> v;
+    }
+    msg->meta.body.clear();
+
+    std::lock_guard<std::mutex> lk(mu_);
+    Merge(&is);
+    const int key = msg->meta.key;
+    if (kind == 'b') {
+      assigned_[std::make_pair(key, msg->meta.iters)] = subtree;
+      Tree& t = tree_[key];
+      t.parent = msg->meta.sender;
+      t.children.clear();
+    } else if (kind == 'r') {
+      auto it = tree_.find(key);
+      if (it != tree_.end()) {
+        it->second.parent_ready = true;
+        Release(key, &it->second, triggers);
+      }
+      return true;
+    }
+    return false;
+  }
+
+  std::string Summary() {
+    std::lock_guard<std::mutex> lk(mu_);
+    size_t links = 0;
+    for (const auto& r : rows_) links += r.second.thr.size();
+    std::ostringstream os;
+    os << num_decisions_ << " receivers picked locally, " << num_triggers_
+       << " pushes released, " << links << " of " << members_.size() * (members_.size() - 1)
+       << " links measured";
+    return os.str();
+  }
+
+ private:
+  struct Row {
+    uint32_t version = 0;
+    std::map<int, int> thr;
+  };
+
+  /** \brief the tree the last broadcast of a key took, and its push state */
+  struct Tree {
+    int parent = -1;
+    std::vector<int> children;
+    bool own = false;
+    int merged = 0;
+    bool parent_ready = false;
+    int app = 0;
+    int customer = 0;
+    int timestamp = 0;
+  };
+
+  static uint64_t Mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  int64_t Weight(int round, bool explore, int a, int b) const {
+    if (explore) {
+      return static_cast<int64_t>(Mix(Mix(round) ^ (static_cast<uint64_t>(a) << 32) ^ b) >> 2);
+    }
+    int t = Measured(a, b);
+    if (t < 0) t = Measured(b, a);
+    return t < 0 ? std::numeric_limits<int64_t>::max() : t;
+  }
+
+  int Measured(int a, int b) const {
+    auto row = rows_.find(a);
+    if (row == rows_.end()) return -1;
+    auto it = row->second.thr.find(b);
+    return it == row->second.thr.end() ? -1 : it->second;
+  }
+
+  /**
+   * \brief the child of self in the maximum spanning tree over self and
+   * pending that has the largest subtree, which is sent first
+   */
+  int PickChild(int round, const std::vector<int>& pending, std::vector<int>* subtree) const {
+    const bool explore = Mix(round) % 1000 >= greed_rate_ * 1000;
+    const size_t n = pending.size();
+    std::vector<int64_t> best(n);
+    std::vector<int> from(n, -1);  // -1 is self
+    std::vector<bool> in(n, false);
+    for (size_t i = 0; i < n; ++i) best[i] = Weight(round, explore, self_, pending[i]);
+    for (size_t step = 0; step < n; ++step) {
+      size_t v = n;
+      for (size_t i = 0; i < n; ++i) {
+        if (!in[i] && (v == n || best[i] > best[v])) v = i;
+      }
+      in[v] = true;
+      for (size_t u = 0; u < n; ++u) {
+        if (in[u]) continue;
+        const int64_t w = Weight(round, explore, pending[v], pending[u]);
+        if (w > best[u]) {
+          best[u] = w;
+          from[u] = v;
+        }
+      }
+    }
+    std::vector<int> top(n), size(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+      int v = i;
+      while (from[v] != -1) v = from[v];
+      top[i] = v;
+      ++size[v];
+    }
+    int child = -1;
+    for (size_t i = 0; i < n; ++i) {
+      if (from[i] != -1) continue;
+      if (child == -1 || size[i] > size[child] ||
+          (size[i] == size[child] && best[i] > best[child])) {
+        child = i;
+      }
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (top[i] == child && static_cast<int>(i) != child) subtree->push_back(pending[i]);
+    }
+    return pending[child];
+  }
+
+  Message Request(int key, int sender, int recver, const Tree& t) const {
+    Message msg;
+    msg.meta.app_id      = t.app;
+    msg.meta.customer_id = t.customer;
+    msg.meta.timestamp   = t.timestamp;
+    msg.meta.request     = true;
+    msg.meta.push        = true;
+    msg.meta.sender      = sender;
+    msg.meta.recver      = recver;
+    msg.meta.key         = key;
+    msg.meta.iters       = sender;
+    return msg;
+  }
+
+  /** \brief asks the own customer to send key on, once all its parts are in */
+  void Release(int key, Tree* t, std::vector<Message>* triggers) {
+    if (!t->own || t->merged < static_cast<int>(t->children.size()) ||
+        !(t->parent_ready || t->parent == root_)) {
+      return;
+    }
+    triggers->push_back(Request(key, t->parent, self_, *t));
+    t->own = false;
+    t->merged = 0;
+    t->parent_ready = false;
+    ++num_triggers_;
+  }
+
+  /** \brief the body of a message to peer, with the rows peer has not got from us */
+  std::string Compose(char kind, int peer, const std::vector<int>* subtree) {
+    auto& sent = sent_[peer];
+    std::vector<const std::pair<const int, Row>*> rows;
+    for (const auto& r : rows_) {
+      if (r.first != peer && r.second.version > sent[r.first]) rows.push_back(&r);
+    }
+    if (kind == 'g' && rows.empty()) return "";
+    std::ostringstream os;
+    os << "ts1 " << kind;
+    if (subtree) {
+      os << ' ' << subtree->size();
+      for (int v : *subtree) os << ' ' << v;
+    }
+    os << ' ' << rows.size();
+    for (const auto* r : rows) {
+      os << ' ' << r->first << ' ' << r->second.version << ' ' << r->second.thr.size();
+      for (const auto& e : r->second.thr) os << ' ' << e.first << ' ' << e.second;
+      sent[r->first] = r->second.version;
+    }
+    return os.str();
+  }
+
+  void Merge(std::istream* is) {
+    size_t num_rows = 0;
+    *is >> num_rows;
+    for (size_t i = 0; i < num_rows && *is; ++i) {
+      int owner = 0;
+      uint32_t version = 0;
+      size_t n = 0;
+      *is >> owner >> version >> n;
+      Row row;
+      row.version = version;
+      for (size_t j = 0; j < n; ++j) {
+        int peer = 0, thr = 0;
+        *is >> peer >> thr;
+        row.thr[peer] = thr;
+      }
+      if (owner != self_ && version > rows_[owner].version) rows_[owner] = row;
+    }
+  }
+
+  std::mutex mu_;
+  int self_;
+  int root_;
+  std::vector<int> members_;
+  double greed_rate_;
+  /** \brief the throughput matrix, by row owner */
+  std::map<int, Row> rows_;
+  /** \brief row versions sent to each peer */
+  std::map<int, std::map<int, uint32_t>> sent_;
+  /** \brief nodes left to reach, by (key, round) of broadcasts */
+  std::map<std::pair<int, int>, std::vector<int>> assigned_;
+  /** \brief subtrees handed to the next broadcast to (peer, key) */
+  std::map<std::pair<int, int>, std::vector<int>> outbox_;
+  std::map<int, Tree> tree_;
+  uint64_t num_decisions_ = 0;
+  uint64_t num_triggers_ = 0;
+};
+}  // namespace ps
+#endif  // PS_OVERLAY_H_
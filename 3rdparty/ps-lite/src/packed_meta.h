@@ -0,0 +1,186 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_PACKED_META_H_
+#define PS_PACKED_META_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "ps/internal/message.h"
+namespace ps {
+
+/**
+ * \brief fixed-layout binary header of data messages.
+ *
+ * Control messages, messages with a body and metas that do not fit keep
+ * using protobuf. The first byte is kPackedMetaMagic, whose wire type 7 is
+ * invalid as the first byte of any protobuf message, so receivers tell the
+ * two formats apart without extra framing. Only the first num_compr floats
+ * of compr are sent. The layout is host order, all nodes are expected to
+ * share endianness.
+ */
+struct PackedMeta {
+  uint8_t magic;
+  uint8_t version;
+  uint8_t flags;
+  uint8_t num_compr;
+  uint8_t num_data_type;
+  uint8_t data_type[3];
+  int32_t head;
+  int32_t app_id;
+  int32_t customer_id;
+  int32_t timestamp;
+  int32_t first_key;
+  int32_t seq;
+  int32_t seq_begin;
+  int32_t seq_end;
+  int32_t msg_type;
+  int32_t push_op_num;
+  int32_t val_bytes;
+  int32_t total_bytes;
+  int32_t channel;
+  int32_t keys_len;
+  int32_t vals_len;
+  int32_t lens_len;
+  int32_t bits_num;
+  int32_t priority;
+  int32_t sender;
+  int32_t recver;
+  int32_t key;
+  int32_t version_;
+  int32_t iters;
+  int32_t resend_seq;
+  uint64_t resend_ack;
+  uint64_t trace_id;
+  int64_t trace_ts;
+  float compr[16];
+};
+
+static const uint8_t kPackedMetaMagic = 0xB7;
+static const uint8_t kPackedMetaVersion = 3;
+static const int kPackedMetaMaxCompr = 16;
+static const int kPackedMetaMaxDataType = 3;
+static const int kPackedMetaFixedSize = offsetof(PackedMeta, compr);
+
+enum PackedMetaFlag {
+  kPackedRequest = 1, kPackedPush = 2, kPackedSimpleApp = 4
+};
+
+/**
+ * \brief returns the encoded size of meta, 0 if it needs protobuf
+ */
+inline int PackedMetaSize(const Meta& meta) {
+  if (!meta.control.empty() || !meta.body.empty() ||
+      meta.compr.size() > static_cast<size_t>(kPackedMetaMaxCompr) ||
+      meta.data_type.size() > static_cast<size_t>(kPackedMetaMaxDataType)) {
+    return 0;
+  }
+  return kPackedMetaFixedSize + meta.compr.size() * sizeof(float);
+}
+
+/**
+ * \brief whether buf holds a packed meta rather than a protobuf
+ */
+inline bool IsPackedMeta(const char* buf, int size) {
+  return size >= kPackedMetaFixedSize &&
+         static_cast<uint8_t>(buf[0]) == kPackedMetaMagic;
+}
+
+/**
+ * \brief encodes meta into buf of PackedMetaSize(meta) bytes, no allocation
+ */
+inline void EncodePackedMeta(const Meta& meta, int sender, char* buf) {
+  PackedMeta* p = reinterpret_cast<PackedMeta*>(buf);
+  p->magic = kPackedMetaMagic;
+  p->version = kPackedMetaVersion;
+  p->flags = (meta.request ? kPackedRequest : 0) |
+             (meta.push ? kPackedPush : 0) |
+             (meta.simple_app ? kPackedSimpleApp : 0);
+  p->num_compr = meta.compr.size();
+  p->num_data_type = meta.data_type.size();
+  for (size_t i = 0; i < meta.data_type.size(); ++i) {
+    p->data_type[i] = static_cast<uint8_t>(meta.data_type[i]);
+  }
+  p->head = meta.head;
+  p->app_id = meta.app_id;
+  p->customer_id = meta.customer_id;
+  p->timestamp = meta.timestamp;
+  p->first_key = meta.first_key;
+  p->seq = meta.seq;
+  p->seq_begin = meta.seq_begin;
+  p->seq_end = meta.seq_end;
+  p->msg_type = meta.msg_type;
+  p->push_op_num = meta.push_op_num;
+  p->val_bytes = meta.val_bytes;
+  p->total_bytes = meta.total_bytes;
+  p->channel = meta.channel;
+  p->keys_len = meta.keys_len;
+  p->vals_len = meta.vals_len;
+  p->lens_len = meta.lens_len;
+  p->bits_num = meta.bits_num;
+  p->priority = meta.priority;
+  p->sender = sender;
+  p->recver = meta.recver;
+  p->key = meta.key;
+  p->version_ = meta.version;
+  p->iters = meta.iters;
+  p->resend_seq = meta.resend_seq;
+  p->resend_ack = meta.resend_ack;
+  p->trace_id = meta.trace_id;
+  p->trace_ts = meta.trace_ts;
+  if (meta.compr.size()) {
+    memcpy(p->compr, meta.compr.data(), meta.compr.size() * sizeof(float));
+  }
+}
+
+/**
+ * \brief decodes a packed meta, the same fields as protobuf are restored
+ */
+inline void DecodePackedMeta(const char* buf, int size, Meta* meta) {
+  const PackedMeta* p = reinterpret_cast<const PackedMeta*>(buf);
+  CHECK(IsPackedMeta(buf, size)) << "not a packed meta";
+  CHECK_EQ(p->version, kPackedMetaVersion) << "unsupported packed meta version";
+  CHECK_LE(p->num_compr, kPackedMetaMaxCompr);
+  CHECK_LE(p->num_data_type, kPackedMetaMaxDataType);
+  CHECK_EQ(size, kPackedMetaFixedSize + p->num_compr * static_cast<int>(sizeof(float)))
+    << "corrupted packed meta";
+  meta->head = p->head;
+  meta->app_id = p->app_id;
+  meta->customer_id = p->customer_id;
+  meta->timestamp = p->timestamp;
+  meta->first_key = p->first_key;
+  meta->seq = p->seq;
+  meta->seq_begin = p->seq_begin;
+  meta->seq_end = p->seq_end;
+  meta->msg_type = p->msg_type;
+  meta->push_op_num = p->push_op_num;
+  meta->val_bytes = p->val_bytes;
+  meta->total_bytes = p->total_bytes;
+  meta->channel = p->channel;
+  meta->keys_len = p->keys_len;
+  meta->vals_len = p->vals_len;
+  meta->lens_len = p->lens_len;
+  meta->bits_num = p->bits_num;
+  meta->priority = p->priority;
+  meta->sender = p->sender;
+  meta->recver = p->recver;
+  meta->key = p->key;
+  meta->version = p->version_;
+  meta->iters = p->iters;
+  meta->resend_seq = p->resend_seq;
+  meta->resend_ack = p->resend_ack;
+  meta->trace_id = p->trace_id;
+  meta->trace_ts = p->trace_ts;
+  meta->request = p->flags & kPackedRequest;
+  meta->push = p->flags & kPackedPush;
+  meta->simple_app = p->flags & kPackedSimpleApp;
+  meta->body.clear();
+  meta->compr.assign(p->compr, p->compr + p->num_compr);
+  meta->data_type.resize(p->num_data_type);
+  for (int i = 0; i < p->num_data_type; ++i) {
+    meta->data_type[i] = static_cast<DataType>(p->data_type[i]);
+  }
+  meta->control.cmd = Control::EMPTY;
+}
+}  // namespace ps
+#endif  // PS_PACKED_META_H_
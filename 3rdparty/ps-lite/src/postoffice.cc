@@ -11,7 +11,9 @@
 
 namespace ps {
 Postoffice::Postoffice() {
-  van_ = Van::Create("zmq");
+  // zmq, or shm to pass messages between nodes on the same host in shared memory
+  const char* type = getenv("PS_VAN_TYPE");
+  van_ = Van::Create(type ? type : "zmq");
   env_ref_ = Environment::_GetSharedRef();
 }
 
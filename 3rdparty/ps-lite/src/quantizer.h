@@ -0,0 +1,351 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_QUANTIZER_H_
+#define PS_QUANTIZER_H_
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "dmlc/logging.h"
+namespace ps {
+
+/**
+ * \brief quantizes fp32 blocks of the unimportant DGT channel to 1, 2, 4 or 8
+ * bits per value.
+ *
+ * Values are mapped uniformly on [min, max] to the codes 0 .. 2^bits - 1,
+ * value v decodes to min + code * step. Codes are packed LSB first, value i
+ * of a block is at bit i * bits. Rounding is to the nearest code, or
+ * stochastic so that the decoded value is unbiased.
+ *
+ * The codec itself is stateless, the random state of stochastic rounding is
+ * per thread, so that blocks of different channels encode in parallel.
+ */
+class Quantizer {
+ public:
+  /** \brief the range of a block, sent in Meta::compr */
+  struct Range {
+    float min;
+    float step;
+  };
+
+  static bool ValidBits(int bits) {
+    return bits == 1 || bits == 2 || bits == 4 || bits == 8;
+  }
+
+  /** \brief bytes of n values packed at bits each */
+  static size_t PackedBytes(size_t n, int bits) {
+    return (n * bits + 7) / 8;
+  }
+
+  /** \brief the min and max of x */
+  static void MinMax(const float* x, size_t n, float* min_v, float* max_v) {
+    size_t i = 0;
+    float lo = n ? x[0] : 0, hi = lo;
+#if defined(__AVX__)
+    if (n >= 8) {
+      __m256 vlo = _mm256_loadu_ps(x), vhi = vlo;
+      for (i = 8; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(x + i);
+        vlo = _mm256_min_ps(vlo, v);
+        vhi = _mm256_max_ps(vhi, v);
+      }
+      float l[8], h[8];
+      _mm256_storeu_ps(l, vlo);
+      _mm256_storeu_ps(h, vhi);
+      lo = *std::min_element(l, l + 8);
+      hi = *std::max_element(h, h + 8);
+    }
+#elif defined(__SSE2__)
+    if (n >= 4) {
+      __m128 vlo = _mm_loadu_ps(x), vhi = vlo;
+      for (i = 4; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(x + i);
+        vlo = _mm_min_ps(vlo, v);
+        vhi = _mm_max_ps(vhi, v);
+      }
+      float l[4], h[4];
+      _mm_storeu_ps(l, vlo);
+      _mm_storeu_ps(h, vhi);
+      lo = *std::min_element(l, l + 4);
+      hi = *std::max_element(h, h + 4);
+    }
+#endif
+    for (; i < n; ++i) {
+      lo = std::min(lo, x[i]);
+      hi = std::max(hi, x[i]);
+    }
+    *min_v = lo;
+    *max_v = hi;
+  }
+
+  /**
+   * \brief quantizes x into out, which holds PackedBytes(n, bits)
+   * \param residual if not null, x is what is quantized and the part the codes
+   * miss is left in residual, x and residual may alias
+   * \return the range to decode with
+   */
+  static Range Encode(const float* x, size_t n, int bits, bool stochastic, char* out,
+                      float* residual = nullptr) {
+    switch (bits) {
+      case 1: return Encode<1>(x, n, stochastic, out, residual);
+      case 2: return Encode<2>(x, n, stochastic, out, residual);
+      case 4: return Encode<4>(x, n, stochastic, out, residual);
+      case 8: return Encode<8>(x, n, stochastic, out, residual);
+      default: LOG(FATAL) << "quantization supports 1, 2, 4 or 8 bits, got " << bits;
+    }
+    return Range();
+  }
+
+  /** \brief decodes n values of in into out */
+  static void Decode(const char* in, size_t n, int bits, const Range& range, float* out) {
+    switch (bits) {
+      case 1: return Decode<1>(in, n, range, out);
+      case 2: return Decode<2>(in, n, range, out);
+      case 4: return Decode<4>(in, n, range, out);
+      case 8: return Decode<8>(in, n, range, out);
+      default: LOG(FATAL) << "quantization supports 1, 2, 4 or 8 bits, got " << bits;
+    }
+  }
+
+ private:
+  template <int bits>
+  static Range Encode(const float* x, size_t n, bool stochastic, char* out, float* residual) {
+    Range range;
+    float max_v;
+    MinMax(x, n, &range.min, &max_v);
+    const int levels = (1 << bits) - 1;
+    range.step = max_v > range.min ? (max_v - range.min) / levels : 0;
+    const float inv = range.step > 0 ? 1 / range.step : 0;
+    uint8_t* codes = reinterpret_cast<uint8_t*>(out);
+    memset(codes, 0, PackedBytes(n, bits));
+
+    uint64_t& rng = RandomState();
+    uint8_t group[8];
+    float noise[8], decoded[8];
+    std::fill(noise, noise + 8, 0.5f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      if (stochastic) {
+        for (int j = 0; j < 8; j += 2) Uniform2(&rng, noise + j);
+      }
+      QuantizeGroup(x + i, range.min, inv, levels, noise, group);
+      // 8 codes fill bits bytes
+      uint64_t packed = Pack<bits>(group);
+      memcpy(codes + i * bits / 8, &packed, bits);
+      if (residual) {
+        DequantizeGroup(group, range, decoded);
+        for (int j = 0; j < 8; ++j) residual[i + j] = x[i + j] - decoded[j];
+      }
+    }
+    for (; i < n; ++i) {
+      if (stochastic && (i & 1) == 0) Uniform2(&rng, noise);
+      const float u = stochastic ? noise[i & 1] : 0.5f;
+      int q = static_cast<int>((x[i] - range.min) * inv + u);
+      q = std::min(std::max(q, 0), levels);
+      codes[i * bits / 8] |= q << (i * bits % 8);
+      if (residual) residual[i] = x[i] - (range.min + q * range.step);
+    }
+    return range;
+  }
+
+  template <int bits>
+  static void Decode(const char* in, size_t n, const Range& range, float* out) {
+    const uint8_t* codes = reinterpret_cast<const uint8_t*>(in);
+    size_t i = 0;
+    uint8_t group[8];
+    for (; i + 8 <= n; i += 8) {
+      uint64_t packed = 0;
+      memcpy(&packed, codes + i * bits / 8, bits);
+      Unpack<bits>(packed, group);
+      DequantizeGroup(group, range, out + i);
+    }
+    const int mask = (1 << bits) - 1;
+    for (; i < n; ++i) {
+      const int q = (codes[i * bits / 8] >> (i * bits % 8)) & mask;
+      out[i] = range.min + q * range.step;
+    }
+  }
+
+  /** \brief the xorshift state of the calling thread */
+  static uint64_t& RandomState() {
+    static thread_local uint64_t state = 0;
+    if (state == 0) {
+      state = std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+              static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+      if (state == 0) state = 0x9E3779B97F4A7C15ull;
+    }
+    return state;
+  }
+
+  /** \brief two uniform values in [0, 1) from 24 bits each */
+  static void Uniform2(uint64_t* s, float* u) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *s = x;
+    u[0] = (x & 0xFFFFFF) * (1.0f / (1 << 24));
+    u[1] = ((x >> 32) & 0xFFFFFF) * (1.0f / (1 << 24));
+  }
+
+  /** \brief codes of 8 values, clamped to [0, levels] */
+  static void QuantizeGroup(const float* x, float min_v, float inv, int levels,
+                            const float* noise, uint8_t* codes) {
+#if defined(__SSE2__)
+    const __m128 vmin = _mm_set1_ps(min_v), vinv = _mm_set1_ps(inv);
+    const __m128 vmax = _mm_set1_ps(static_cast<float>(levels)), zero = _mm_setzero_ps();
+    __m128 a = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x), vmin), vinv),
+                          _mm_loadu_ps(noise));
+    __m128 b = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x + 4), vmin), vinv),
+                          _mm_loadu_ps(noise + 4));
+    a = _mm_min_ps(_mm_max_ps(a, zero), vmax);
+    b = _mm_min_ps(_mm_max_ps(b, zero), vmax);
+    // truncation of non-negative values is floor
+    __m128i q = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(codes), _mm_packus_epi16(q, q));
+#else
+    for (int j = 0; j < 8; ++j) {
+      int q = static_cast<int>((x[j] - min_v) * inv + noise[j]);
+      codes[j] = static_cast<uint8_t>(std::min(std::max(q, 0), levels));
+    }
+#endif
+  }
+
+  static void DequantizeGroup(const uint8_t* codes, const Range& range, float* out) {
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i q = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(codes)), zero);
+    const __m128 vmin = _mm_set1_ps(range.min), vstep = _mm_set1_ps(range.step);
+    __m128 a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(q, zero));
+    __m128 b = _mm_cvtepi32_ps(_mm_unpackhi_epi16(q, zero));
+    _mm_storeu_ps(out, _mm_add_ps(vmin, _mm_mul_ps(a, vstep)));
+    _mm_storeu_ps(out + 4, _mm_add_ps(vmin, _mm_mul_ps(b, vstep)));
+#else
+    for (int j = 0; j < 8; ++j) out[j] = range.min + codes[j] * range.step;
+#endif
+  }
+
+  /**
+   * \brief packs 8 codes, one per byte, into the low 8 * bits bits by merging
+   * neighbouring fields in a word, which avoids a loop over the codes
+   */
+  template <int bits>
+  static uint64_t Pack(const uint8_t* codes) {
+    uint64_t x;
+    memcpy(&x, codes, 8);
+    if (bits == 8) return x;
+    x = (x | x >> (8 - bits)) & Mask(16, 2 * bits);
+    x = (x | x >> (16 - 2 * bits)) & Mask(32, 4 * bits);
+    x = (x | x >> (32 - 4 * bits)) & Mask(64, 8 * bits);
+    return x;
+  }
+
+  /** \brief the inverse of Pack */
+  template <int bits>
+  static void Unpack(uint64_t x, uint8_t* codes) {
+    if (bits != 8) {
+      x = (x | x << (32 - 4 * bits)) & Mask(32, 4 * bits);
+      x = (x | x << (16 - 2 * bits)) & Mask(16, 2 * bits);
+      x = (x | x << (8 - bits)) & Mask(8, bits);
+    }
+    memcpy(codes, &x, 8);
+  }
+
+  /** \brief the low width bits of every field of field bits */
+  static constexpr uint64_t Mask(int field, int width) {
+    return field >= 64 ? (width >= 64 ? ~0ull : (1ull << width) - 1)
+                       : Mask(field * 2, width) << field | Mask(field * 2, width);
+  }
+};
+
+/**
+ * \brief residuals of quantized DGT blocks, bounded in bytes.
+ *
+ * A block, identified by (first_key, seq), takes its residual out of the pool
+ * while it is encoded and puts it back after, so that blocks of different
+ * channels encode in parallel. Beyond the capacity, the residual of the least
+ * recently encoded block is dropped and its buffer recycled.
+ */
+class ResidualPool {
+ public:
+  explicit ResidualPool(size_t capacity_bytes) : capacity_(capacity_bytes) {}
+
+  /** \brief the residual of a block of n floats, zeros for a new block */
+  std::vector<float> Take(int first_key, int seq, size_t n) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = index_.find(Id(first_key, seq));
+    std::vector<float> buf;
+    if (it != index_.end()) {
+      buf = std::move(it->second->second);
+      bytes_ -= buf.size() * sizeof(float);
+      lru_.erase(it->second);
+      index_.erase(it);
+      if (buf.size() == n) return buf;
+    }
+    if (!free_.empty()) {
+      buf = std::move(free_.back());
+      free_.pop_back();
+    }
+    buf.assign(n, 0);
+    return buf;
+  }
+
+  void Put(int first_key, int seq, std::vector<float>&& buf) {
+    std::lock_guard<std::mutex> lk(mu_);
+    const uint64_t id = Id(first_key, seq);
+    if (index_.count(id)) {
+      // taken twice concurrently, keep the first one back
+      free_.push_back(std::move(buf));
+      return;
+    }
+    bytes_ += buf.size() * sizeof(float);
+    lru_.emplace_front(id, std::move(buf));
+    index_[id] = lru_.begin();
+    while (bytes_ > capacity_ && !lru_.empty()) {
+      auto& victim = lru_.back();
+      bytes_ -= victim.second.size() * sizeof(float);
+      index_.erase(victim.first);
+      if (free_.size() < kMaxFree) free_.push_back(std::move(victim.second));
+      lru_.pop_back();
+      ++num_dropped_;
+    }
+  }
+
+  size_t bytes() const { return bytes_; }
+  /** \brief residuals dropped to stay within the capacity */
+  size_t num_dropped() const { return num_dropped_; }
+
+ private:
+  static uint64_t Id(int first_key, int seq) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(first_key)) << 32 |
+           static_cast<uint32_t>(seq);
+  }
+
+  static const size_t kMaxFree = 64;
+  typedef std::list<std::pair<uint64_t, std::vector<float>>> LRU;
+  size_t capacity_;
+  size_t bytes_ = 0;
+  size_t num_dropped_ = 0;
+  LRU lru_;
+  std::unordered_map<uint64_t, LRU::iterator> index_;
+  std::vector<std::vector<float>> free_;
+  std::mutex mu_;
+};
+
+}  // namespace ps
+#endif  // PS_QUANTIZER_H_
@@ -1,16 +1,125 @@
 /**
  *  Copyright (c) 2015 by Contributors
+ *  Modifications Copyright (c) 2021 by Contributors at INET-RC
  */
 #ifndef PS_RESENDER_H_
 #define PS_RESENDER_H_
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
-#include <unordered_set>
 #include <unordered_map>
+#include "ps/internal/env.h"
+#include "ps/internal/message.h"
+#include "ps/internal/van.h"
 namespace ps {
 
+/**
+ * \brief bounded duplicate detection of the messages received from one peer.
+ *
+ * Every sequence number below cum() has been received, the window remembers
+ * the next `size` ones. The acknowledgement is cum() in the high 32 bits and a
+ * bitmap of the following 32 sequence numbers in the low bits.
+ */
+class ReceiveWindow {
+ public:
+  enum Result { kNew, kDuplicated, kOutOfWindow };
+
+  /** \param size window size, a power of 2 and at least 64 */
+  explicit ReceiveWindow(uint32_t size = 4096) : bits_(size / 64, 0), size_(size) {
+    CHECK_GE(size, 64);
+    CHECK_EQ(size & (size - 1), 0) << "window size must be a power of 2";
+  }
+
+  Result Add(uint32_t seq) {
+    if (seq < cum_) return kDuplicated;
+    if (seq - cum_ >= size_) return kOutOfWindow;
+    if (Test(seq)) return kDuplicated;
+    Set(seq, true);
+    while (Test(cum_)) Set(cum_++, false);
+    return kNew;
+  }
+
+  uint32_t cum() const { return cum_; }
+
+  uint64_t Ack() const {
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < 32; ++i) {
+      if (Test(cum_ + 1 + i)) mask |= 1u << i;
+    }
+    return (static_cast<uint64_t>(cum_) << 32) | mask;
+  }
+
+ private:
+  bool Test(uint32_t seq) const {
+    return (bits_[(seq & (size_ - 1)) / 64] >> (seq % 64)) & 1;
+  }
+  void Set(uint32_t seq, bool v) {
+    uint64_t& w = bits_[(seq & (size_ - 1)) / 64];
+    if (v) {
+      w |= 1ull << (seq % 64);
+    } else {
+      w &= ~(1ull << (seq % 64));
+    }
+  }
+
+  std::vector<uint64_t> bits_;
+  uint32_t size_;
+  uint32_t cum_ = 1;
+};
+
+/**
+ * \brief hashed timer wheel of retransmission deadlines, in ticks. Entries
+ * with a deadline beyond one turn stay in their slot until it is reached
+ */
+template <typename T>
+class TimerWheel {
+ public:
+  explicit TimerWheel(int num_slots = 512) : slots_(num_slots) {}
+
+  void Add(int64_t deadline, const T& value) {
+    deadline = std::max(deadline, now_ + 1);
+    slots_[deadline % slots_.size()].emplace_back(deadline, value);
+  }
+
+  /** \brief advances to tick now and pops the entries that expired */
+  void Advance(int64_t now, std::vector<T>* expired) {
+    for (; now_ < now; ++now_) {
+      auto& slot = slots_[(now_ + 1) % slots_.size()];
+      size_t keep = 0;
+      for (auto& e : slot) {
+        if (e.first <= now_ + 1) {
+          expired->push_back(e.second);
+        } else {
+          slot[keep++] = e;
+        }
+      }
+      slot.resize(keep);
+    }
+  }
+
+  int64_t now() const { return now_; }
+
+ private:
+  std::vector<std::vector<std::pair<int64_t, T>>> slots_;
+  int64_t now_ = 0;
+};
+
 /**
  * \brief resend a messsage if no ack is received within a given time
+ *
+ * Messages to each peer, separately for the local and the global network,
+ * carry consecutive resend_seq numbers. Receivers acknowledge them
+ * cumulatively with a selective bitmap in resend_ack, piggybacked on any
+ * message going back to the peer. A standalone ACK is only sent when nothing
+ * went back within one tick. Duplicates are detected in a bounded window per
+ * peer, and retransmissions are driven by a timer wheel, so that neither the
+ * memory nor the work per tick grows with the length of the run.
  */
 class Resender {
  public:
@@ -21,6 +130,10 @@ class Resender {
     timeout_ = timeout;
     max_num_retry_ = max_num_retry;
     van_ = van;
+    tick_ = std::max(1, timeout_ / 8);
+    const char* val = Environment::Get()->find("PS_RESEND_WINDOW");
+    window_ = val ? atoi(val) : 4096;
+    start_ = Now();
     monitor_ = new std::thread(&Resender::Monitoring, this);
   }
   ~Resender() {
@@ -30,56 +143,63 @@ class Resender {
   }
 
   /**
-   * \brief add an outgoining message
-   *
+   * \brief add an outgoining message, assigns its sequence number and
+   * piggybacks the acknowledgement of the messages received from its receiver
    */
-  void AddOutgoing(const Message& msg) {
-    if (msg.meta.control.cmd == Control::ACK) return;
-    CHECK_NE(msg.meta.timestamp, Meta::kEmpty) << msg.DebugString();
-    auto key = GetKey(msg);
+  void AddOutgoing(Message* msg, bool is_global) {
+    // retransmitted by the monitor thread, which already refreshed the ack
+    if (msg->meta.resend_seq != 0) return;
+    auto cmd = msg->meta.control.cmd;
+    if (cmd == Control::TERMINATE || msg->meta.recver == Node::kEmpty) return;
     std::lock_guard<std::mutex> lk(mu_);
-    // already buffered, which often due to call Send by the monitor thread
-    if (send_buff_.find(key) != send_buff_.end()) return;
-
-    auto& ent = send_buff_[key];
-    ent.msg = msg;
-    ent.send = Now();
-    ent.num_retry = 0;
+    Peer& peer = GetPeer(PeerKey(msg->meta.recver, is_global));
+    if (peer.recv) {
+      msg->meta.resend_ack = peer.recv->Ack();
+      peer.ack_pending = false;
+    }
+    if (cmd == Control::ACK) return;
+    const uint32_t seq = peer.next_seq++;
+    msg->meta.resend_seq = seq;
+    auto& ent = peer.unacked[seq];
+    ent.msg = *msg;
+    ent.is_global = is_global;
+    wheel_.Add(wheel_.now() + Ticks(1), std::make_pair(PeerKey(msg->meta.recver, is_global), seq));
   }
 
   /**
-   * \brief add an incomming message
+   * \brief add an incomming message, its resend fields are consumed
    * \brief return true if msg has been added before or a ACK message
    */
-  bool AddIncomming(const Message& msg) {
+  bool AddIncomming(Message* msg, bool is_global) {
+    Meta& meta = msg->meta;
     // a message can be received by multiple times
-    if (msg.meta.control.cmd == Control::TERMINATE) {
-      return false;
-    } else if (msg.meta.control.cmd == Control::ACK) {
-      mu_.lock();
-      auto key = msg.meta.control.msg_sig;
-      auto it = send_buff_.find(key);
-      if (it != send_buff_.end()) send_buff_.erase(it);
-      mu_.unlock();
+    if (meta.control.cmd == Control::TERMINATE) return false;
+    const uint64_t ack = meta.resend_ack;
+    const uint32_t seq = meta.resend_seq;
+    meta.resend_ack = 0;
+    meta.resend_seq = 0;
+    if (ack == 0 && seq == 0) return meta.control.cmd == Control::ACK;
+
+    std::unique_lock<std::mutex> lk(mu_);
+    Peer& peer = GetPeer(PeerKey(meta.sender, is_global));
+    if (ack != 0) Acknowledge(&peer, ack);
+    if (meta.control.cmd == Control::ACK || seq == 0) return meta.control.cmd == Control::ACK;
+
+    if (!peer.recv) peer.recv.reset(new ReceiveWindow(window_));
+    auto result = peer.recv->Add(seq);
+    if (result == ReceiveWindow::kOutOfWindow) {
+      // not acknowledged, the sender resends it once the window has moved
+      lk.unlock();
+      LOG(WARNING) << "Drop message beyond the resend window: " << meta.DebugString();
       return true;
-    } else {
-      mu_.lock();
-      auto key = GetKey(msg);
-      auto it = acked_.find(key);
-      bool duplicated = it != acked_.end();
-      if (!duplicated) acked_.insert(key);
-      mu_.unlock();
-      // send back ack message (even if it is duplicated)
-      Message ack;
-      ack.meta.recver = msg.meta.sender;
-      ack.meta.sender = msg.meta.recver;
-      ack.meta.control.cmd = Control::ACK;
-      ack.meta.control.msg_sig = key;
-      van_->Send(ack);
-      // warning
-      if (duplicated) LOG(WARNING) << "Duplicated message: " << msg.DebugString();
-      return duplicated;
     }
+    // acknowledge duplicates too, the previous ack may have been lost
+    peer.ack_pending = true;
+    lk.unlock();
+    if (result == ReceiveWindow::kDuplicated) {
+      LOG(WARNING) << "Duplicated message: " << meta.DebugString();
+    }
+    return result == ReceiveWindow::kDuplicated;
   }
 
  private:
@@ -87,53 +207,94 @@ class Resender {
   // the buffer entry
   struct Entry {
     Message msg;
-    Time send;
+    bool is_global = false;
     int num_retry = 0;
   };
-  std::unordered_map<uint64_t, Entry> send_buff_;
-
-  uint64_t GetKey(const Message& msg) {
-    CHECK_NE(msg.meta.timestamp, Meta::kEmpty) << msg.DebugString();
-    uint16_t id = msg.meta.app_id;
-    uint8_t sender = msg.meta.sender == Node::kEmpty ?
-                     van_->my_node().id : msg.meta.sender;
-    uint8_t recver = msg.meta.recver;
-    return (static_cast<uint64_t>(id) << 48) |
-        (static_cast<uint64_t>(sender) << 40) |
-        (static_cast<uint64_t>(recver) << 32) |
-        (msg.meta.timestamp << 1) | msg.meta.request;
+  struct Peer {
+    uint32_t next_seq = 1;
+    std::map<uint32_t, Entry> unacked;
+    std::unique_ptr<ReceiveWindow> recv;
+    bool ack_pending = false;
+  };
+
+  static int PeerKey(int id, bool is_global) {
+    return is_global ? -1 - id : id;
+  }
+
+  Peer& GetPeer(int key) {
+    auto it = peers_.find(key);
+    if (it != peers_.end()) return *it->second;
+    auto& p = peers_[key];
+    p.reset(new Peer());
+    return *p;
+  }
+
+  static void Acknowledge(Peer* peer, uint64_t ack) {
+    const uint32_t cum = ack >> 32;
+    auto& unacked = peer->unacked;
+    unacked.erase(unacked.begin(), unacked.lower_bound(cum));
+    for (uint32_t i = 0; i < 32; ++i) {
+      if ((ack >> i) & 1) unacked.erase(cum + 1 + i);
+    }
+  }
+
+  /** \brief ticks of the timeout after num_retry retries */
+  int64_t Ticks(int num_retry) const {
+    return (static_cast<int64_t>(timeout_) * num_retry + tick_ - 1) / tick_;
   }
+
   Time Now() {
     return std::chrono::duration_cast<Time>(
         std::chrono::high_resolution_clock::now().time_since_epoch());
   }
 
   void Monitoring() {
+    std::vector<std::pair<int, uint32_t>> expired;
     while (!exit_) {
-      std::this_thread::sleep_for(Time(timeout_));
-      std::vector<Message> resend;
-      Time now = Now();
+      std::this_thread::sleep_for(Time(tick_));
+      std::vector<std::pair<Message, bool>> resend;
+      expired.clear();
       mu_.lock();
-      for (auto& it : send_buff_) {
-        if (it.second.send + Time(timeout_) * (1+it.second.num_retry) < now) {
-          resend.push_back(it.second.msg);
-          ++it.second.num_retry;
-          LOG(WARNING) << van_->my_node().ShortDebugString()
-                       << ": Timeout to get the ACK message. Resend (retry="
-                       << it.second.num_retry << ") " << it.second.msg.DebugString();
-          CHECK_LT(it.second.num_retry, max_num_retry_);
-        }
+      wheel_.Advance((Now() - start_).count() / tick_, &expired);
+      for (const auto& e : expired) {
+        auto& peer = *peers_[e.first];
+        auto it = peer.unacked.find(e.second);
+        if (it == peer.unacked.end()) continue;
+        auto& ent = it->second;
+        ++ent.num_retry;
+        LOG(WARNING) << van_->my_node(ent.is_global).ShortDebugString()
+                     << ": Timeout to get the ACK message. Resend (retry="
+                     << ent.num_retry << ") " << ent.msg.DebugString();
+        CHECK_LT(ent.num_retry, max_num_retry_);
+        if (peer.recv) ent.msg.meta.resend_ack = peer.recv->Ack();
+        resend.emplace_back(ent.msg, ent.is_global);
+        wheel_.Add(wheel_.now() + Ticks(1 + ent.num_retry), e);
+      }
+      // peers which got nothing back since the last tick
+      for (auto& it : peers_) {
+        Peer& peer = *it.second;
+        if (!peer.ack_pending) continue;
+        peer.ack_pending = false;
+        Message ack;
+        ack.meta.recver = it.first >= 0 ? it.first : -1 - it.first;
+        ack.meta.control.cmd = Control::ACK;
+        ack.meta.resend_ack = peer.recv->Ack();
+        resend.emplace_back(ack, it.first < 0);
       }
       mu_.unlock();
 
-      for (const auto& msg : resend) van_->Send(msg);
+      for (const auto& msg : resend) van_->Send(msg.first, msg.second);
     }
   }
   std::thread* monitor_;
-  std::unordered_set<uint64_t> acked_;
+  std::unordered_map<int, std::unique_ptr<Peer>> peers_;
+  TimerWheel<std::pair<int, uint32_t>> wheel_;
   std::atomic<bool> exit_{false};
   std::mutex mu_;
+  Time start_;
   int timeout_;
+  int tick_;
+  int window_;
   int max_num_retry_;
   Van* van_;
 };
@@ -0,0 +1,186 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_SHM_RING_H_
+#define PS_SHM_RING_H_
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "ps/internal/utils.h"
+namespace ps {
+
+/**
+ * \brief single-producer single-consumer byte ring in shared memory.
+ *
+ * Records are an 8 byte header, the uint32 length and the uint32 number of
+ * bytes of the same message in the records that follow, then the payload
+ * padded to 8 bytes. A record never wraps, the producer writes kShmWrap and
+ * restarts at offset 0 when the rest of the ring is too short. Messages longer
+ * than half of the ring are split over several records, so that they keep
+ * their order with the others.
+ */
+struct ShmRing {
+  /** \brief bytes written so far, only advanced by the producer */
+  std::atomic<uint64_t> head;
+  char pad0[56];
+  /** \brief bytes consumed so far, only advanced by the consumer */
+  std::atomic<uint64_t> tail;
+  char pad1[56];
+
+  char* data() { return reinterpret_cast<char*>(this + 1); }
+
+  static size_t Pad(size_t n) { return (n + 7) / 8 * 8; }
+  /** \brief the longest record of a ring of cap bytes */
+  static size_t MaxRecord(uint64_t cap) { return cap / 2 / 8 * 8; }
+};
+
+static const uint32_t kShmWrap = 0xffffffff;
+
+/**
+ * \brief writes one message of len bytes into a ring of cap bytes, waiting
+ * for the consumer whenever the ring is full. Only one writer per ring may
+ * exist at a time, and Close must be called once all bytes are written.
+ */
+class ShmRingWriter {
+ public:
+  ShmRingWriter(ShmRing* ring, uint64_t cap, size_t len)
+      : ring_(ring), cap_(cap), remaining_(len) {
+    CHECK_LT(len, kShmWrap) << "message too long for a ring";
+  }
+
+  void Close() {
+    CHECK_EQ(remaining_, 0U) << "message not fully written";
+    if (record_) Commit();
+  }
+
+  void Write(const void* src, size_t n) {
+    const char* s = static_cast<const char*>(src);
+    while (n > 0) {
+      if (room_ == 0) Next();
+      const size_t k = std::min(n, room_);
+      memcpy(p_, s, k);
+      p_ += k;
+      s += k;
+      n -= k;
+      room_ -= k;
+    }
+  }
+
+  /** \brief skips n bytes of padding */
+  void Skip(size_t n) {
+    while (n > 0) {
+      if (room_ == 0) Next();
+      const size_t k = std::min(n, room_);
+      p_ += k;
+      n -= k;
+      room_ -= k;
+    }
+  }
+
+ private:
+  /** \brief commits the current record and reserves the next one */
+  void Next() {
+    if (record_) Commit();
+    CHECK_GT(remaining_, 0U) << "message longer than announced";
+    record_ = std::min(remaining_, ShmRing::MaxRecord(cap_));
+    remaining_ -= record_;
+    uint64_t head = ring_->head.load(std::memory_order_relaxed);
+    const uint64_t need = 8 + ShmRing::Pad(record_);
+    if (head % cap_ + need > cap_) {
+      // skip the rest of the ring
+      const uint64_t skip = cap_ - head % cap_;
+      WaitSpace(head + skip - cap_);
+      uint32_t wrap = kShmWrap;
+      memcpy(ring_->data() + head % cap_, &wrap, sizeof(wrap));
+      head += skip;
+      ring_->head.store(head, std::memory_order_release);
+    }
+    WaitSpace(head + need - cap_);
+    const uint32_t header[2] = {static_cast<uint32_t>(record_),
+                                static_cast<uint32_t>(remaining_)};
+    memcpy(ring_->data() + head % cap_, header, sizeof(header));
+    p_ = ring_->data() + head % cap_ + 8;
+    room_ = record_;
+  }
+
+  void Commit() {
+    CHECK_EQ(room_, 0U) << "record not fully written";
+    ring_->head.fetch_add(8 + ShmRing::Pad(record_), std::memory_order_release);
+    record_ = 0;
+  }
+
+  /** \brief waits until the consumer passed tail */
+  void WaitSpace(uint64_t tail) {
+    if (static_cast<int64_t>(tail) <= 0) return;
+    while (ring_->tail.load(std::memory_order_acquire) < tail) std::this_thread::yield();
+  }
+
+  ShmRing* ring_;
+  const uint64_t cap_;
+  size_t remaining_;
+  size_t record_ = 0;
+  size_t room_ = 0;
+  char* p_ = nullptr;
+};
+
+/**
+ * \brief reads the messages of a ring of cap bytes, joining those split over
+ * several records. Only one reader per ring may exist.
+ */
+class ShmRingReader {
+ public:
+  /** \brief buffer of a message that was split over several records */
+  typedef std::shared_ptr<std::vector<char>> Buffer;
+
+  ShmRingReader(ShmRing* ring, uint64_t cap) : ring_(ring), cap_(cap) { }
+
+  /**
+   * \brief calls fn(data, len, buffer) for each complete message and returns
+   * whether any record was read. data lies in the ring, and is only valid
+   * during the call, unless buffer, which then holds it, is not null.
+   */
+  template <typename Fn>
+  bool Poll(Fn fn) {
+    uint64_t tail = ring_->tail.load(std::memory_order_relaxed);
+    const uint64_t head = ring_->head.load(std::memory_order_acquire);
+    if (tail == head) return false;
+    while (tail != head) {
+      uint32_t header[2];
+      memcpy(header, ring_->data() + tail % cap_, sizeof(header));
+      if (header[0] == kShmWrap) {
+        tail += cap_ - tail % cap_;
+        continue;
+      }
+      const char* rec = ring_->data() + tail % cap_ + 8;
+      if (header[1] || partial_) {
+        if (!partial_) {
+          partial_.reset(new std::vector<char>());
+          partial_->reserve(header[0] + header[1]);
+        }
+        partial_->insert(partial_->end(), rec, rec + header[0]);
+        if (!header[1]) {
+          Buffer buf = std::move(partial_);
+          partial_.reset();
+          fn(buf->data(), buf->size(), buf);
+        }
+      } else {
+        fn(rec, header[0], Buffer());
+      }
+      tail += 8 + ShmRing::Pad(header[0]);
+      ring_->tail.store(tail, std::memory_order_release);
+    }
+    return true;
+  }
+
+ private:
+  ShmRing* ring_;
+  const uint64_t cap_;
+  Buffer partial_;
+};
+
+}  // namespace ps
+#endif  // PS_SHM_RING_H_
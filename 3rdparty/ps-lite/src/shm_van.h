@@ -0,0 +1,436 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_SHM_VAN_H_
+#define PS_SHM_VAN_H_
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "./shm_ring.h"
+#include "./zmq_van.h"
+namespace ps {
+
+/**
+ * \brief the inbox of a node, one ring per sending node on the same host.
+ * Senders claim a slot by writing their node id into owner
+ */
+struct ShmInbox {
+  static const uint32_t kMagic = 0x5053484e;
+  static const int kSlots = 64;
+  uint32_t magic;
+  uint32_t num_slots;
+  uint64_t ring_bytes;
+  std::atomic<int32_t> owner[kSlots];
+  char pad[64];
+
+  static size_t Size(uint64_t ring_bytes) {
+    return sizeof(ShmInbox) + kSlots * (sizeof(ShmRing) + ring_bytes);
+  }
+  ShmRing* ring(int i) {
+    char* base = reinterpret_cast<char*>(this + 1);
+    return reinterpret_cast<ShmRing*>(base + i * (sizeof(ShmRing) + ring_bytes));
+  }
+};
+
+/**
+ * \brief shared-memory van for nodes on the same host.
+ *
+ * Each node creates an inbox in POSIX shared memory when it binds, named after
+ * its port. When a worker or server connects to a peer on the same host, it
+ * claims a ring in the peer's inbox and sends every later message of the
+ * local network through it. The scheduler, other hosts and the global network
+ * keep using ZMQ, whose receiver is drained into the same queue as the rings.
+ *
+ * Data that lies in a buffer registered by RegisterSharedBuffer, such as
+ * MXNet's CPUSharedStorageManager arrays, is passed by handle and mapped by
+ * the receiver through /proc/<pid>/fd/<fd>, so it is not copied at all. The
+ * sender must leave such data unchanged until the request is answered, which
+ * is how kvstore already treats its send buffers. Other data is copied into
+ * the ring by the sender and out of it by the receiver, without a round trip
+ * through the kernel. Messages longer than half of a ring are split over
+ * several records, so every message of a link goes through the same ring and
+ * keeps its order.
+ */
+class SHMVan : public ZMQVan {
+ public:
+  SHMVan() {
+    ring_bytes_ = GetEnv("PS_SHM_RING_BYTES", 16 << 20);
+    ring_bytes_ = (ring_bytes_ + 7) / 8 * 8;
+    CHECK_GE(ring_bytes_, 1 << 16) << "PS_SHM_RING_BYTES is too small";
+  }
+  virtual ~SHMVan() {
+    // global servers may exit without stopping the local network, the
+    // forwarder then blocks in zmq until the context is shut down
+    exit_ = true;
+    if (poller_ && poller_->joinable()) poller_->join();
+    if (forwarder_ && forwarder_->joinable()) {
+      ShutdownContext();
+      forwarder_->join();
+    }
+  }
+
+  void RegisterSharedBuffer(char* data, size_t size, int shared_pid, int shared_id) override {
+    CHECK_EQ(shared_pid, getpid()) << "only buffers of this process can be registered";
+    struct stat st;
+    CHECK_EQ(fstat(shared_id, &st), 0) << "invalid shared memory fd " << shared_id;
+    CHECK_GE(static_cast<size_t>(st.st_size), size);
+    Region r;
+    r.size = size;
+    r.fd = shared_id;
+    r.ino = st.st_ino;
+    // the data is at the end of the file, after the header of the storage manager
+    r.file_offset = st.st_size - size;
+    std::lock_guard<std::mutex> lk(region_mu_);
+    regions_[data] = r;
+  }
+
+ protected:
+  void Stop(const bool is_global = false) override {
+    ZMQVan::Stop(is_global);
+    if (is_global) return;
+    exit_ = true;
+    if (poller_) poller_->join();
+    if (forwarder_) forwarder_->join();
+    poller_.reset();
+    forwarder_.reset();
+    for (auto& it : outboxes_) munmap(it.second->inbox, ShmInbox::Size(ring_bytes_));
+    outboxes_.clear();
+    for (auto& it : mapped_) munmap(it.second.first, it.second.second);
+    mapped_.clear();
+    readers_.clear();
+    if (inbox_) {
+      munmap(inbox_, ShmInbox::Size(ring_bytes_));
+      shm_unlink(inbox_name_.c_str());
+      inbox_ = nullptr;
+    }
+  }
+
+  int Bind(const Node& node, int max_retry, bool is_global = false) override {
+    int port = ZMQVan::Bind(node, max_retry, is_global);
+    if (is_global || port == -1 || node.role == Node::SCHEDULER) return port;
+    inbox_name_ = "/ps_van_" + std::to_string(port);
+    int fd = shm_open(inbox_name_.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+    CHECK_NE(fd, -1) << "failed to create " << inbox_name_ << ": " << strerror(errno);
+    const size_t size = ShmInbox::Size(ring_bytes_);
+    CHECK_EQ(ftruncate(fd, size), 0) << "failed to size " << inbox_name_;
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK_NE(ptr, MAP_FAILED) << "failed to map " << inbox_name_ << ": " << strerror(errno);
+    inbox_ = static_cast<ShmInbox*>(ptr);
+    inbox_->num_slots = ShmInbox::kSlots;
+    inbox_->ring_bytes = ring_bytes_;
+    readers_.clear();
+    for (int i = 0; i < ShmInbox::kSlots; ++i) {
+      inbox_->owner[i].store(0);
+      inbox_->ring(i)->head.store(0);
+      inbox_->ring(i)->tail.store(0);
+      readers_.emplace_back(new ShmRingReader(inbox_->ring(i), ring_bytes_));
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    reinterpret_cast<std::atomic<uint32_t>*>(&inbox_->magic)->store(ShmInbox::kMagic);
+    return port;
+  }
+
+  void Connect(const Node& node, bool is_global = false) override {
+    ZMQVan::Connect(node, is_global);
+    if (is_global || node.role == Node::SCHEDULER || my_node_.role == Node::SCHEDULER ||
+        my_node_.id == Node::kEmpty || node.id == my_node_.id ||
+        node.hostname != my_node_.hostname) {
+      return;
+    }
+    std::string name = "/ps_van_" + std::to_string(node.port);
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd == -1) {
+      LOG(WARNING) << "no shared memory inbox of node " << node.id << ", use zmq";
+      return;
+    }
+    const size_t size = ShmInbox::Size(ring_bytes_);
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK_NE(ptr, MAP_FAILED) << "failed to map " << name << ": " << strerror(errno);
+    auto* inbox = static_cast<ShmInbox*>(ptr);
+    if (reinterpret_cast<std::atomic<uint32_t>*>(&inbox->magic)->load() != ShmInbox::kMagic ||
+        inbox->ring_bytes != ring_bytes_) {
+      LOG(WARNING) << "incompatible shared memory inbox of node " << node.id << ", use zmq";
+      munmap(ptr, size);
+      return;
+    }
+    int slot = -1;
+    for (int i = 0; i < ShmInbox::kSlots && slot == -1; ++i) {
+      int32_t expected = 0;
+      if (inbox->owner[i].load() == my_node_.id ||
+          inbox->owner[i].compare_exchange_strong(expected, my_node_.id)) {
+        slot = i;
+      }
+    }
+    if (slot == -1) {
+      LOG(WARNING) << "no free ring in the inbox of node " << node.id << ", use zmq";
+      munmap(ptr, size);
+      return;
+    }
+    std::lock_guard<std::mutex> lk(outbox_mu_);
+    auto& out = outboxes_[node.id];
+    if (out) munmap(out->inbox, size);
+    out.reset(new Outbox());
+    out->inbox = inbox;
+    out->ring = inbox->ring(slot);
+    PS_VLOG(1) << my_node_.ShortDebugString() << " uses shared memory to node " << node.id;
+  }
+
+  int SendMsg(const Message& msg, bool is_global = false) override {
+    Outbox* out = nullptr;
+    if (!is_global) {
+      std::lock_guard<std::mutex> lk(outbox_mu_);
+      auto it = outboxes_.find(msg.meta.recver);
+      if (it != outboxes_.end()) out = it->second.get();
+    }
+    if (!out) return ZMQVan::SendMsg(msg, is_global);
+
+    // meta
+    int meta_size = PackedMetaSize(msg.meta);
+    char* meta_buf = nullptr;
+    std::unique_ptr<char[]> packed;
+    if (meta_size > 0) {
+      packed.reset(new char[meta_size]);
+      PackMeta(msg.meta, packed.get(), is_global);
+      meta_buf = packed.get();
+    } else {
+      PackMeta(msg.meta, &meta_buf, &meta_size, is_global);
+      packed.reset(meta_buf);
+    }
+    // data, by handle when it lies in a registered buffer
+    std::vector<Handle> handles(msg.data.size());
+    // sender, meta size, meta, number of arrays
+    size_t len = 16 + Pad(meta_size) + 8;
+    for (size_t i = 0; i < msg.data.size(); ++i) {
+      handles[i].size = msg.data[i].size();
+      handles[i].kind = FindRegion(msg.data[i].data(), msg.data[i].size(), &handles[i]);
+      len += sizeof(Handle) + (handles[i].kind == kInline ? Pad(handles[i].size) : 0);
+    }
+
+    // records of longer messages follow each other, the poller joins them
+    std::lock_guard<std::mutex> lk(out->mu);
+    ShmRingWriter w(out->ring, ring_bytes_, len);
+    Put<int32_t>(&w, my_node_.id);
+    Put<int32_t>(&w, meta_size);
+    w.Write(meta_buf, meta_size);
+    w.Skip(Pad(meta_size) - meta_size);
+    Put<int64_t>(&w, msg.data.size());
+    int send_bytes = meta_size;
+    for (size_t i = 0; i < msg.data.size(); ++i) {
+      w.Write(&handles[i], sizeof(Handle));
+      if (handles[i].kind == kInline) {
+        w.Write(msg.data[i].data(), handles[i].size);
+        w.Skip(Pad(handles[i].size) - handles[i].size);
+      }
+      send_bytes += handles[i].size;
+    }
+    w.Close();
+    return send_bytes;
+  }
+
+  int RecvMsg(Message* msg, bool is_global = false) override {
+    if (is_global || !inbox_) return ZMQVan::RecvMsg(msg, is_global);
+    std::call_once(start_flag_, [this]() {
+      forwarder_.reset(new std::thread(&SHMVan::Forwarding, this));
+      poller_.reset(new std::thread(&SHMVan::Polling, this));
+    });
+    std::unique_lock<std::mutex> lk(recv_mu_);
+    recv_cond_.wait(lk, [this]() { return !recv_queue_.empty(); });
+    *msg = std::move(recv_queue_.front().first);
+    int recv_bytes = recv_queue_.front().second;
+    recv_queue_.pop_front();
+    return recv_bytes;
+  }
+
+ private:
+  enum HandleKind { kInline = 0, kShared = 1 };
+  /** \brief the header of a data array in a record */
+  struct Handle {
+    int32_t kind;
+    int32_t pid;
+    int32_t fd;
+    int32_t pad;
+    uint64_t ino;
+    uint64_t offset;
+    uint64_t size;
+  };
+  struct Region {
+    size_t size;
+    int fd;
+    uint64_t ino;
+    size_t file_offset;
+  };
+  struct Outbox {
+    ShmInbox* inbox;
+    ShmRing* ring;
+    std::mutex mu;
+  };
+
+  static size_t Pad(size_t n) { return ShmRing::Pad(n); }
+
+  template <typename T>
+  static void Put(ShmRingWriter* w, T v) {
+    w->Write(&v, sizeof(T));
+    w->Skip(8 - sizeof(T));
+  }
+
+  template <typename T>
+  static T Get(const char** p) {
+    T v;
+    memcpy(&v, *p, sizeof(T));
+    *p += 8;
+    return v;
+  }
+
+  HandleKind FindRegion(const char* data, size_t size, Handle* h) {
+    if (size < 4096) return kInline;
+    std::lock_guard<std::mutex> lk(region_mu_);
+    auto it = regions_.upper_bound(data);
+    if (it == regions_.begin()) return kInline;
+    --it;
+    const size_t offset = data - it->first;
+    if (offset + size > it->second.size) return kInline;
+    h->pid = getpid();
+    h->fd = it->second.fd;
+    h->ino = it->second.ino;
+    h->offset = it->second.file_offset + offset;
+    return kShared;
+  }
+
+  void Forwarding() {
+    while (true) {
+      Message msg;
+      int recv_bytes = ZMQVan::RecvMsg(&msg);
+      if (recv_bytes == -1) break;
+      bool terminate = msg.meta.control.cmd == Control::TERMINATE;
+      Enqueue(std::move(msg), recv_bytes);
+      if (terminate) break;
+    }
+  }
+
+  void Polling() {
+    int idle = 0;
+    while (!exit_) {
+      bool got = false;
+      for (int i = 0; i < ShmInbox::kSlots; ++i) {
+        if (inbox_->owner[i].load(std::memory_order_relaxed) == 0) continue;
+        got = readers_[i]->Poll([this](const char* data, size_t,
+                                       const ShmRingReader::Buffer& buf) {
+          Message msg;
+          int recv_bytes = Decode(data, &msg, buf);
+          Enqueue(std::move(msg), recv_bytes);
+        }) || got;
+      }
+      if (got) {
+        idle = 0;
+      } else if (++idle < 1000) {
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+    }
+  }
+
+  /**
+   * \brief decodes a message at p, whose inline data is copied unless buf,
+   * which holds p, is given
+   */
+  int Decode(const char* p, Message* msg, const ShmRingReader::Buffer& buf) {
+    msg->meta.sender = Get<int32_t>(&p);
+    const int meta_size = Get<int32_t>(&p);
+    UnpackMeta(p, meta_size, &msg->meta);
+    msg->meta.recver = my_node_.id;
+    p += Pad(meta_size);
+    const int64_t n = Get<int64_t>(&p);
+    int recv_bytes = meta_size;
+    for (int64_t i = 0; i < n; ++i) {
+      Handle h;
+      memcpy(&h, p, sizeof(Handle));
+      p += sizeof(Handle);
+      SArray<char> data;
+      if (h.kind == kInline && buf) {
+        // a message joined from several records, its buffer is ours
+        data.reset(const_cast<char*>(p), h.size, [buf](char*) {});
+        p += Pad(h.size);
+      } else if (h.kind == kInline) {
+        char* copy = new char[h.size];
+        memcpy(copy, p, h.size);
+        data.reset(copy, h.size, [](char* copy) { delete [] copy; });
+        p += Pad(h.size);
+      } else {
+        // zero-copy, the mapping lives until the van stops
+        data.reset(Map(h) + h.offset, h.size, [](char* buf) {});
+      }
+      msg->data.push_back(data);
+      recv_bytes += h.size;
+    }
+    return recv_bytes;
+  }
+
+  /** \brief maps the shared buffer of a handle, cached by pid, fd and inode */
+  char* Map(const Handle& h) {
+    auto key = std::make_tuple(h.pid, h.fd, h.ino);
+    auto it = mapped_.find(key);
+    if (it != mapped_.end()) return static_cast<char*>(it->second.first);
+    std::string path = "/proc/" + std::to_string(h.pid) + "/fd/" + std::to_string(h.fd);
+    int fd = open(path.c_str(), O_RDWR);
+    CHECK_NE(fd, -1) << "failed to open " << path << ": " << strerror(errno);
+    struct stat st;
+    CHECK_EQ(fstat(fd, &st), 0);
+    CHECK_EQ(static_cast<uint64_t>(st.st_ino), h.ino) << path << " was reused";
+    void* ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK_NE(ptr, MAP_FAILED) << "failed to map " << path << ": " << strerror(errno);
+    mapped_[key] = std::make_pair(ptr, static_cast<size_t>(st.st_size));
+    return static_cast<char*>(ptr);
+  }
+
+  void Enqueue(Message&& msg, int recv_bytes) {
+    {
+      std::lock_guard<std::mutex> lk(recv_mu_);
+      recv_queue_.emplace_back(std::move(msg), recv_bytes);
+    }
+    recv_cond_.notify_one();
+  }
+
+  size_t ring_bytes_;
+  std::string inbox_name_;
+  ShmInbox* inbox_ = nullptr;
+  /** \brief readers of the rings of inbox_, only used by the poller */
+  std::vector<std::unique_ptr<ShmRingReader>> readers_;
+
+  std::mutex outbox_mu_;
+  std::unordered_map<int, std::unique_ptr<Outbox>> outboxes_;
+
+  std::mutex region_mu_;
+  std::map<const char*, Region> regions_;
+  /** \brief mappings of received handles, only used by the poller */
+  std::map<std::tuple<int, int, uint64_t>, std::pair<void*, size_t>> mapped_;
+
+  std::once_flag start_flag_;
+  std::unique_ptr<std::thread> forwarder_;
+  std::unique_ptr<std::thread> poller_;
+  std::atomic<bool> exit_{false};
+
+  std::mutex recv_mu_;
+  std::condition_variable recv_cond_;
+  std::deque<std::pair<Message, int>> recv_queue_;
+};
+}  // namespace ps
+#endif  // PS_SHM_VAN_H_
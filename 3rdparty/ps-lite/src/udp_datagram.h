@@ -0,0 +1,93 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_UDP_DATAGRAM_H_
+#define PS_UDP_DATAGRAM_H_
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include "ps/internal/message.h"
+namespace ps {
+
+/**
+ * \brief layout of a message sent over a udp channel, one datagram per
+ * message: [meta_size][meta][num_data][size of each data][data...]
+ *
+ * A message split over several datagrams is rebuilt wrongly by the receiver
+ * as soon as one of them is lost, so the data is copied behind the meta.
+ * The sizes are sent on their own because quantized values are shorter than
+ * the vals_len recorded in the meta.
+ */
+static const int kUdpMaxData = 3;
+
+inline size_t UdpDatagramSize(int meta_size, const Message& msg) {
+  size_t bytes = sizeof(int32_t) * (2 + msg.data.size()) + meta_size;
+  for (const auto& d : msg.data) bytes += d.size();
+  return bytes;
+}
+
+/**
+ * \brief writes the datagram of msg into buf of UdpDatagramSize(meta_size,
+ * msg) bytes, except for the meta at buf + sizeof(int32_t) left to the caller
+ */
+inline void FillUdpDatagram(int meta_size, const Message& msg, char* buf) {
+  CHECK_LE(msg.data.size(), static_cast<size_t>(kUdpMaxData))
+      << "udp messages carry keys, vals and lens only";
+  int32_t head[2 + kUdpMaxData] = {meta_size, static_cast<int32_t>(msg.data.size())};
+  for (size_t i = 0; i < msg.data.size(); ++i) {
+    head[2 + i] = static_cast<int32_t>(msg.data[i].size());
+  }
+  memcpy(buf, head, sizeof(int32_t));
+  char* p = buf + sizeof(int32_t) + meta_size;
+  memcpy(p, head + 1, sizeof(int32_t) * (1 + msg.data.size()));
+  p += sizeof(int32_t) * (1 + msg.data.size());
+  for (const auto& d : msg.data) {
+    memcpy(p, d.data(), d.size());
+    p += d.size();
+  }
+}
+
+/**
+ * \brief returns the meta size of a datagram of size bytes, -1 if it is
+ * too short to hold it
+ */
+inline int UdpDatagramMetaSize(const char* buf, size_t size) {
+  int32_t meta_size;
+  if (size < 2 * sizeof(int32_t)) return -1;
+  memcpy(&meta_size, buf, sizeof(meta_size));
+  if (meta_size < 0 || static_cast<size_t>(meta_size) > size - 2 * sizeof(int32_t)) return -1;
+  return meta_size;
+}
+
+/**
+ * \brief splits the data of a datagram into msg->data, the arrays keep owner
+ * alive. Returns false, leaving msg->data empty, if the sizes do not add up.
+ */
+inline bool SplitUdpDatagram(char* buf, size_t size, int meta_size,
+                             const std::shared_ptr<void>& owner, Message* msg) {
+  msg->data.clear();
+  size_t offset = sizeof(int32_t) + meta_size;
+  int32_t n;
+  memcpy(&n, buf + offset, sizeof(n));
+  offset += sizeof(n);
+  if (n < 0 || n > kUdpMaxData || size - offset < sizeof(int32_t) * n) return false;
+  int32_t lens[kUdpMaxData];
+  memcpy(lens, buf + offset, sizeof(int32_t) * n);
+  offset += sizeof(int32_t) * n;
+  size_t total = offset;
+  for (int i = 0; i < n; ++i) {
+    if (lens[i] < 0) return false;
+    total += lens[i];
+  }
+  if (total != size) return false;
+  for (int i = 0; i < n; ++i) {
+    SArray<char> data;
+    data.reset(buf + offset, lens[i], [owner](char*) {});
+    msg->data.push_back(data);
+    offset += lens[i];
+  }
+  return true;
+}
+
+}  // namespace ps
+#endif  // PS_UDP_DATAGRAM_H_
@@ -11,7 +11,16 @@
 #include "ps/internal/customer.h"
 #include "./network_utils.h"
 #include "./meta.pb.h"
+#include "./packed_meta.h"
+#include "./block_reassembler.h"
+#include "./quantizer.h"
+#include "./fec.h"
+#include "./overlay.h"
+#include "./clock_probe.h"
+#include "./metrics_exporter.h"
 #include "./zmq_van.h"
+#include "./shm_van.h"
+#include "./wan_van.h"
 #include "./resender.h"
 #include "ps/simple_app.h"
 #include "./half_float/umHalf.h"
@@ -24,12 +33,80 @@ namespace ps {
 static const int kDefaultHeartbeatInterval = 0;
 
 Van* Van::Create(const std::string& type) {
+  Van* van = nullptr;
   if (type == "zmq") {
-    return new ZMQVan();
+    van = new ZMQVan();
+  } else if (type == "shm") {
+    van = new SHMVan();
+  } else if (type == "wan") {
+    van = new WANVan();
   } else {
     LOG(FATAL) << "unsupported van type: " << type;
     return nullptr;
   }
+  // set PS_PACKED_META=0 when talking to nodes that only parse protobuf metas
+  van->packed_meta_ = GetEnv("PS_PACKED_META", 1) != 0;
+  if (GetEnv("PS_TRACE", 0)) van->clock_probe_ = new ClockProbe();
+  // traffic is counted even when nobody exports it, GetSendBytes reads it
+  for (int g = 0; g < 2; ++g) {
+    const std::string domain = g ? "global" : "local";
+    van->sent_[g].reset(NewLinkTable("ps_sent", "sent to a peer", domain));
+    van->received_[g].reset(NewLinkTable("ps_received", "received from a peer", domain));
+  }
+  van->channel_sent_.reset(NewLinkTable("ps_dgt_channel_sent", "sent on a DGT channel", ""));
+  for (auto q : {std::make_pair("send", &van->send_queue_),
+                 std::make_pair("important", &van->important_queue_),
+                 std::make_pair("unimportant", &van->unimportant_queue_)}) {
+    auto* queue = q.second;
+    Metrics::Get()->AddSampler("ps_queue_length", "messages waiting in a queue of the van",
+                               Metrics::Labels({{"queue", q.first}}),
+                               [queue] { return static_cast<double>(queue->size()); });
+  }
+  const int metrics_port = GetEnv("PS_METRICS_PORT", 0);
+  if (metrics_port > 0) {
+    van->metrics_exporter_ =
+        new MetricsExporter(GetEnv("PS_METRICS_HOST", std::string("127.0.0.1")), metrics_port);
+  }
+  return van;
+}
+
+MetricTable<Van::LinkMetrics>* Van::NewLinkTable(const std::string& prefix,
+                                                 const std::string& what,
+                                                 const std::string& domain) {
+  return new MetricTable<LinkMetrics>([=](int id) {
+    const std::string labels = domain.empty()
+        ? Metrics::Labels({{"channel", std::to_string(id)}})
+        : Metrics::Labels({{"domain", domain}, {"peer", std::to_string(id)}});
+    LinkMetrics m;
+    m.bytes = Metrics::Get()->GetCounter(prefix + "_bytes_total", "bytes " + what, labels);
+    m.messages = Metrics::Get()->GetCounter(prefix + "_messages_total", "messages " + what, labels);
+    return m;
+  });
+}
+
+std::string Van::NodeName(std::vector<std::pair<std::string, int>>* ids) const {
+  auto* po = Postoffice::Get();
+  std::vector<std::pair<std::string, int>> unused;
+  if (!ids) ids = &unused;
+  if (is_global_scheduler_) {
+    *ids = {{"global", my_node_global_.id}};
+    return "global_scheduler";
+  }
+  if (po->is_global_server()) {
+    *ids = {{"global", my_node_global_.id}};
+    return "global_server" + std::to_string(po->my_rank(true));
+  }
+  const std::string party = scheduler_.hostname + ":" + std::to_string(scheduler_.port);
+  if (is_scheduler_) {
+    *ids = {{party, my_node_.id}};
+    return "scheduler@" + party;
+  }
+  if (po->is_server()) {
+    *ids = {{party, my_node_.id}, {"global", my_node_global_.id}};
+    return "server" + std::to_string(po->my_rank()) + "@" + party;
+  }
+  *ids = {{party, my_node_.id}};
+  return "worker" + std::to_string(po->my_rank()) + "@" + party;
 }
 
 void Van::ProcessTerminateCommand(bool is_global) {
@@ -287,47 +364,10 @@ void Van::ProcessBarrierCommand(Message* msg, bool is_global) {
   }
 }
 
-void Van::MergeMsg(Message* msg1, Message* msg2) {
-  std::lock_guard<std::mutex> lk(merge_mu_);
-  float *p1 = (float*)msg1->data[1].data();
-  float *p2 = (float*)msg2->data[1].data();
-  int nlen1 = msg1->data[1].size() / sizeof(float);
-  int nlen2 = msg2->data[1].size() / sizeof(float);
-  assert(nlen1 == nlen2);
-  float* merged = (float*)malloc(nlen1 * sizeof(float));
-  float* n = (float*)malloc(nlen1 * sizeof(float));
-  memcpy(merged, p1, nlen1 * sizeof(float));
-  memcpy(n, p2, nlen1 * sizeof(float));
-  for (int i = 0; i < nlen1; i++) {
-    merged[i] += n[i];
-  }
-  msg1->data[1].reset((char*)merged, nlen1 * sizeof(float), [merged](char* buf) {
-    free(merged);
-  });
-  free(n);
-}
-
-void Van::MergeMsg_HALF(Message* msg1, Message* msg2) {
-  std::lock_guard<std::mutex> lk(merge_mu_);
-  half *p1 = (half*)msg1->data[1].data();
-  half *p2 = (half*)msg2->data[1].data();
-  int nlen1 = msg1->data[1].size() / 16;
-  int nlen2 = msg2->data[1].size() / 16;
-  assert(nlen1 == nlen2);
-  half* merged = (half*)malloc(nlen1 * 16);
-  half* n = (half*)malloc(nlen1 * sizeof(half));
-  memcpy(merged, p1, nlen1 * sizeof(half));
-  memcpy(n, p2, nlen1 * sizeof(half));
-  for (int i = 0; i < nlen1; i++) {
-    merged[i] += n[i];
-  }
-  msg1->data[1].reset((char *)merged, nlen1 * sizeof(half), [merged](char* buf) {
-    free(merged);
-  });
-  free(n);
-}
-
 void Van::ProcessDataMsg(Message* msg) {
+  // ready notices of the TSEngine overlay are not for the customer
+  if (ProcessOverlay(msg, msg->meta.recver < kOffset)) return;
+
   // data msg
   CHECK_NE(msg->meta.sender, Meta::kEmpty);
   CHECK_NE(msg->meta.recver, Meta::kEmpty);
@@ -338,30 +378,30 @@ void Van::ProcessDataMsg(Message* msg) {
   CHECK(obj) << "timeout (5 sec) to wait App " << app_id << " customer " << customer_id \
     << " ready at " << my_node_.role;
 
+  if (fec_decoder_ && msg->meta.msg_type == kFecParityMsg) {
+    // a parity block rebuilds at most one lost block of its group
+    Message recovered;
+    if (fec_decoder_->AddParity(*msg, &recovered) &&
+        reassembler_->Add(&recovered, DepairDataHandleType(recovered.meta.head).dtype)) {
+      obj->Accept(recovered);
+    }
+    // the other lost members of the group will not come, stop waiting for them
+    Message done;
+    if (reassembler_->Settle(msg->meta, FecDecoder::Members(*msg), &done)) obj->Accept(done);
+    return;
+  }
+  if (fec_encoder_ && !msg->meta.request && msg->meta.push && !msg->meta.compr.empty()) {
+    // push responses of global servers carry the loss of our UDP channels
+    fec_encoder_->SetLoss(msg->meta.compr);
+    msg->meta.compr.clear();
+  }
+
   if (enable_dgt && DepairDataHandleType(msg->meta.head).requestType == RequestType::kDefaultPushPull && \
     my_node_global_.role == 3 && msg->meta.msg_type == 1) { // If I am global_server, and recv push msg
     if (enable_dgt == 3) decode(*msg);
-    if (msg_map[msg->meta.sender][msg->meta.first_key].find(msg->meta.seq) \
-      == msg_map[msg->meta.sender][msg->meta.first_key].end()) {
-      msg_map[msg->meta.sender][msg->meta.first_key][msg->meta.seq] = *msg;
-    } else {
-      if (DepairDataHandleType(msg->meta.head).dtype == 0) { // kFloat32
-        MergeMsg(&msg_map[msg->meta.sender][msg->meta.first_key][msg->meta.seq], msg);
-      } else if (DepairDataHandleType(msg->meta.head).dtype == 2) { // kFloat16
-        MergeMsg_HALF(&msg_map[msg->meta.sender][msg->meta.first_key][msg->meta.seq], msg);
-      }
-    }
-
-    if (msg->meta.seq == msg->meta.seq_end) {
-      char* buf = (char *)malloc(msg->meta.total_bytes);
-      memset(buf, 0, msg->meta.total_bytes);
-      for (auto &m : msg_map[msg->meta.sender][msg->meta.first_key]) {
-        memcpy(buf + m.second.meta.val_bytes, m.second.data[1].data(), m.second.data[1].size());
-      }
-      msg_map[msg->meta.sender][msg->meta.first_key].clear();
-      msg->data[1].reset(buf, msg->meta.total_bytes, [buf](char* p) {
-        free(buf);
-      });
+    if (fec_decoder_ && msg->meta.channel > 0) fec_decoder_->AddBlock(*msg);
+    // blocks are merged in place, the tensor goes to the customer without copies
+    if (reassembler_->Add(msg, DepairDataHandleType(msg->meta.head).dtype)) {
       obj->Accept(*msg);
     }
   } else {
@@ -547,6 +587,14 @@ void Van::Start(int customer_id) {
         if (enable_p3) {
           sender_thread_ = std::unique_ptr<std::thread>(new std::thread(&Van::Sending, this));
         }
+        if (GetEnv("ENABLE_TS_OVERLAY", 0)) {
+          std::vector<int> members;
+          for (int r = 0; r < Postoffice::Get()->num_workers(); ++r) {
+            members.push_back(Postoffice::WorkerRankToID(r));
+          }
+          overlay_[0] = new Overlay(my_node_.id, Postoffice::ServerRankToID(0), members,
+                                    GetEnv("MAX_GREED_RATE_TS", 0.9));
+        }
       }
       init_stage++;
     }
@@ -619,6 +667,13 @@ void Van::StartGlobal(int customer_id) {
       }
       enable_dgt = atoi(Environment::Get()->find("ENABLE_DGT"));
       if (enable_dgt) {
+        reassembler_ = new BlockReassembler();
+        quant_bits_ = GetEnv("DGT_QUANT_BITS", 4);
+        CHECK(Quantizer::ValidBits(quant_bits_))
+          << "DGT_QUANT_BITS must be 1, 2, 4 or 8, got " << quant_bits_;
+        quant_stochastic_ = GetEnv("DGT_STOCHASTIC_ROUNDING", 0) != 0;
+        residuals_ = new ResidualPool(static_cast<size_t>(GetEnv("DGT_RESIDUAL_MB", 256)) << 20);
+        if (enable_dgt == 3) quant_metrics_ = CompressionMetrics::Get("dgt_quant");
         if (getenv("DMLC_UDP_CHANNEL_NUM") == nullptr) {
           #ifdef _MSC_VER
             _putenv_s("DMLC_UDP_CHANNEL_NUM", "3");
@@ -627,6 +682,20 @@ void Van::StartGlobal(int customer_id) {
           #endif
         }
         int udp_ch_num = atoi(Environment::Get()->find("DMLC_UDP_CHANNEL_NUM"));
+        if (enable_dgt == 1 && GetEnv("DGT_FEC", 0)) {
+          fec_encoder_ = new FecEncoder(udp_ch_num, GetEnv("DGT_FEC_MAX_GROUP", 16),
+                                        GetEnv("DGT_FEC_TARGET_LOSS", 0.001f));
+          fec_decoder_ = new FecDecoder(udp_ch_num);
+          if (my_node_global_.role == 3) {
+            // the last block is reliable and usually comes before the UDP blocks
+            fec_hold_us_ = static_cast<int64_t>(GetEnv("DGT_FEC_HOLD_MS", 5.0) * 1000);
+            reassembler_->set_hold(fec_hold_us_);
+            if (fec_hold_us_ > 0) {
+              fec_hold_thread_ = std::unique_ptr<std::thread>(
+                new std::thread(&Van::ReleasingHeld, this));
+            }
+          }
+        }
         for (int i = 0; i < udp_ch_num; ++i) {
           int p = GetAvailablePort();
           my_node_global_.udp_port.push_back(p);
@@ -667,6 +736,15 @@ void Van::StartGlobal(int customer_id) {
     while (!ready_global_.load()) {
       std::this_thread::sleep_for (std::chrono::milliseconds(100));
     }
+
+    if (!is_global_scheduler_ && GetEnv("ENABLE_TS_OVERLAY", 0)) {
+      std::vector<int> members;
+      for (int r = 0; r < Postoffice::Get()->num_global_workers(); ++r) {
+        members.push_back(Postoffice::WorkerRankToID(r, true));
+      }
+      overlay_[1] = new Overlay(my_node_global_.id, Postoffice::ServerRankToID(0, true), members,
+                                GetEnv("MAX_GREED_RATE_TS", 0.9));
+    }
   }
 }
 
@@ -700,6 +778,61 @@ void Van::Stop(bool is_global) {
     if (!is_scheduler_ && enable_p3) sender_thread_->join();
   }
   if (resender_) delete resender_;
+  if (fec_hold_thread_) {
+    fec_hold_stop_ = true;
+    fec_hold_thread_->join();
+    fec_hold_thread_.reset();
+  }
+  if (reassembler_) {
+    if (fec_hold_us_ > 0) {
+      LOG(INFO) << "DGT blocks of node " << my_node_global_.id << ": " << reassembler_->Summary();
+    }
+    delete reassembler_;
+    reassembler_ = nullptr;
+  }
+  if (residuals_) {
+    delete residuals_;
+    residuals_ = nullptr;
+  }
+  if (fec_encoder_) {
+    LOG(INFO) << "FEC of node " << my_node_global_.id << ": sent " << fec_encoder_->Summary()
+              << "; " << fec_decoder_->Summary();
+    delete fec_encoder_;
+    delete fec_decoder_;
+    fec_encoder_ = nullptr;
+    fec_decoder_ = nullptr;
+  }
+  for (int g = 0; g <= static_cast<int>(is_global); ++g) {
+    // servers stop both domains with the global one
+    if (!overlay_[g] || (g == 0 && is_global && !Postoffice::Get()->is_server())) continue;
+    LOG(INFO) << "TSEngine overlay of node " << (g ? my_node_global_.id : my_node_.id)
+              << ": " << overlay_[g]->Summary();
+    delete overlay_[g];
+    overlay_[g] = nullptr;
+  }
+  if (clock_probe_ && !is_scheduler_ && !is_global_scheduler_) {
+    // each node stops once, servers with the global domain
+    std::vector<std::pair<std::string, int>> ids;
+    const std::string name = NodeName(&ids);
+    const std::string path = GetEnv("PS_TRACE_DIR", std::string(".")) + "/clock_" + name + ".json";
+    PS_VLOG(1) << "clock probe of " << name << ": " << clock_probe_->Summary();
+    clock_probe_->Dump(path, name, ids);
+  }
+  if (clock_probe_) {
+    delete clock_probe_;
+    clock_probe_ = nullptr;
+  }
+  const std::string metrics_dir = GetEnv("PS_METRICS_DIR", std::string());
+  if (!metrics_dir.empty()) {
+    MetricsExporter::Dump(metrics_dir + "/metrics_" + NodeName() + ".prom");
+  }
+  if (metrics_exporter_) {
+    delete metrics_exporter_;
+    metrics_exporter_ = nullptr;
+  }
+  for (const char* queue : {"send", "important", "unimportant"}) {
+    Metrics::Get()->RemoveSampler("ps_queue_length", Metrics::Labels({{"queue", queue}}));
+  }
   ready_ = false;
   if (is_global) ready_global_ = false;
 }
@@ -719,17 +852,19 @@ void Van::Important_scheduler() {
 
 void Van::Unimportant_scheduler() {
   while (true) {
-    if (important_queue_.empty()) {
-      Message msg;
-      unimportant_queue_.WaitAndPop(&msg);
-      Unimportant_send(msg);
-    }
+    Message msg;
+    unimportant_queue_.WaitAndPop(&msg);
+    // important blocks go first, sleep instead of spinning until they are out
+    important_queue_.WaitEmpty();
+    Unimportant_send(msg);
   }
 }
 
 int Van::Important_send(Message& msg) {
   int send_bytes = SendMsg(msg, true);
   CHECK_NE(send_bytes, -1);
+  sent_[1]->Get(msg.meta.recver).Record(send_bytes);
+  channel_sent_->Get(0).Record(send_bytes);
   return send_bytes;
 }
 
@@ -737,56 +872,42 @@ int Van::Unimportant_send(Message& msg) {
   int send_bytes = 0;
   if (enable_dgt == 1) {
     send_bytes = SendMsg_UDP(msg.meta.channel - 1, msg, 0);
+    if (fec_encoder_ && send_bytes != -1) {
+      std::vector<Message> parities;
+      fec_encoder_->Add(msg, &parities);
+      // the blocks of a key are queued together, close their groups after the last
+      if (unimportant_queue_.empty()) fec_encoder_->FlushAll(&parities);
+      for (const auto& parity : parities) {
+        int bytes = SendMsg_UDP(parity.meta.channel - 1, parity, 0);
+        if (bytes != -1) send_bytes += bytes;
+      }
+    }
   } else if (enable_dgt == 2) {
     send_bytes = SendMsg(msg, true); // for tcp-dgt
   } else if (enable_dgt == 3) {
-    encode(msg, 4);
+    encode(msg, quant_bits_);
     send_bytes = SendMsg(msg, true); // for tcp-dgt and encode
   }
   CHECK_NE(send_bytes, -1);
+  sent_[1]->Get(msg.meta.recver).Record(send_bytes);
+  channel_sent_->Get(msg.meta.channel).Record(send_bytes);
   return send_bytes;
 }
 
 void Van::encode(Message& msg, int bits_num) {
-  std::lock_guard<std::mutex> lk(encode_mu_);
+  // only fp32 blocks are quantized, fp16 ones go as they are
+  if (msg.meta.bits_num != 32) return;
   SArray<char>& s_val = msg.data[1];
-  float *ps = (float*)s_val.data();
-  int d_val_size = 0;
-
-  if (s_val.size() % (msg.meta.bits_num / bits_num) == 0) {
-      d_val_size = s_val.size() / (msg.meta.bits_num / bits_num);
-  } else {
-      d_val_size = s_val.size() / (msg.meta.bits_num / bits_num) + 1;
-  }
-  SArray<char> d_val(d_val_size);
-  char *pd = d_val.data();
-  auto it = residual[msg.meta.first_key].find(msg.meta.seq);
-  if (it == residual[msg.meta.first_key].end()) {
-    residual[msg.meta.first_key][msg.meta.seq] = SArray<char>(s_val.size());
-  }
-  float *pr = (float*)residual[msg.meta.first_key][msg.meta.seq].data();
-
-  int param_n = s_val.size() / sizeof(float);
-  float max_v = 0.0, min_v = 0.0;
-  for (int i = 0; i < param_n; ++i) {
-    *(pr+i) += *(ps+i);
-  }
-  for (int i = 0; i < param_n; ++i) {
-    max_v = std::max(max_v, *(pr + i));
-    min_v = std::min(min_v, *(pr + i));
-  }
-  for (int i = 0; i < pow(2, bits_num); ++i) {
-    float zv = ((min_v + i * (max_v - min_v) / pow(2, bits_num)) \
-      + (min_v + (i + 1) * (max_v - min_v) / pow(2, bits_num))) / 2;
-    msg.meta.compr.push_back(zv);
-  }
-  char qj = 0;
-  for (int i = 0; i < param_n; ++i) {
-    qj = (*(pr + i) - min_v) / ((max_v - min_v) / pow(2, bits_num));
-    *pd |= (qj << (((8 / bits_num) - 1 - i % (8 / bits_num)) * bits_num));
-    if (i % (8 / bits_num) == 0) pd += 1;
-    *(pr+i) -= msg.meta.compr[qj];
-  }
+  const size_t n = s_val.size() / sizeof(float);
+  // Take moves the residual out of the pool under its lock, it is ours until Put
+  std::vector<float> residual = residuals_->Take(msg.meta.first_key, msg.meta.seq, n);
+  AddFloat(residual.data(), reinterpret_cast<const float*>(s_val.data()), n);
+  SArray<char> d_val(Quantizer::PackedBytes(n, bits_num));
+  Quantizer::Range range = Quantizer::Encode(residual.data(), n, bits_num, quant_stochastic_,
+                                             d_val.data(), residual.data());
+  residuals_->Put(msg.meta.first_key, msg.meta.seq, std::move(residual));
+  quant_metrics_.Record(s_val.size(), d_val.size());
+  msg.meta.compr = {range.min, range.step};
   msg.meta.bits_num = bits_num;
   msg.data[1] = d_val;
 }
@@ -799,27 +920,11 @@ void Van::decode(Message& msg) {
     && msg.meta.bits_num == 16) { // kFloat16
     return;
   }
-
-  SArray<char>& s_val = msg.data[1];
-  char *ps = (char*)s_val.data();
-  int d_val_size = msg.meta.vals_len;
-  SArray<char> d_val(d_val_size);
-  float *pd = (float*)d_val.data();
-  int nlen = s_val.size();
-  char qj = 0;
-  int param_n = d_val_size / sizeof(float);
-  int bits_num  = msg.meta.bits_num;
-  assert(pow(2, bits_num) == msg.meta.compr.size());
-  char mask = pow(2, bits_num) - 1;
-  for (int i = 0; i < nlen; ++i) {
-    for (int j = 0; j < 8 / bits_num; ++j) {
-      qj = (*(ps + i) >> (8 - bits_num - bits_num * j)) & mask;
-      *pd = msg.meta.compr[qj];
-      pd += 1;
-      param_n -= 1;
-      if (param_n == 0) break;
-    }
-  }
+  CHECK_EQ(msg.meta.compr.size(), 2U) << "a quantized block carries its min and step";
+  SArray<char> d_val(msg.meta.vals_len);
+  Quantizer::Range range = {msg.meta.compr[0], msg.meta.compr[1]};
+  Quantizer::Decode(msg.data[1].data(), d_val.size() / sizeof(float), msg.meta.bits_num, range,
+                    reinterpret_cast<float*>(d_val.data()));
   msg.data[1] = d_val;
 }
 
@@ -828,22 +933,54 @@ int Van::DGT_Send(const Message& msg, int channel, int tag) {
   send_bytes = SendMsg_UDP(channel - 1, msg, tag);
   CHECK_NE(send_bytes, -1);
   send_bytes_ += send_bytes;
-  if (resender_) resender_->AddOutgoing(msg);
+  sent_[1]->Get(msg.meta.recver).Record(send_bytes);
+  channel_sent_->Get(channel).Record(send_bytes);
   return send_bytes;
 }
                 
-int Van::Send(const Message& msg, bool is_global) {
+int Van::Send(const Message& original, bool is_global) {
+  const Message* out = &original;
+  Message with_loss;
+  if (fec_decoder_ && is_global && original.meta.push && !original.meta.request &&
+      original.meta.control.empty()) {
+    // feed the loss measured on the UDP channels of the pusher back to it
+    std::vector<float> loss = fec_decoder_->Loss(original.meta.recver);
+    if (!loss.empty()) {
+      with_loss = original;
+      with_loss.meta.compr = loss;
+      out = &with_loss;
+    }
+  }
+  Message annotated;
+  if (overlay_[is_global] && !out->meta.simple_app &&
+      (out->meta.control.empty() || out->meta.control.cmd == Control::AUTOPULLREPLY)) {
+    // gossip the throughput matrix, and subtrees of broadcasts
+    annotated = *out;
+    overlay_[is_global]->Annotate(&annotated);
+    out = &annotated;
+  }
+  const Message& msg = *out;
   int send_bytes;
-  send_bytes = SendMsg(msg, is_global);
+  if (resender_) {
+    Message tracked = msg;
+    resender_->AddOutgoing(&tracked, is_global);
+    send_bytes = SendMsg(tracked, is_global);
+  } else {
+    send_bytes = SendMsg(msg, is_global);
+  }
   CHECK_NE(send_bytes, -1);
   send_bytes_ += send_bytes;
-  if (resender_) resender_->AddOutgoing(msg);
+  sent_[is_global]->Get(msg.meta.recver).Record(send_bytes);
   if (Postoffice::Get()->verbose() >= 2) {
     PS_VLOG(2) << "[SEND] " << msg.DebugString();
   }
   return send_bytes;
 }
 
+size_t Van::GetSendBytes(int node_id, bool is_global) {
+  return sent_[is_global]->Get(node_id).bytes->value();
+}
+
 void Van::PushToSenderQueue(const Message& msg) {
   send_queue_.Push(msg);
 }
@@ -877,12 +1014,13 @@ void Van::Receiving() {
     }
     CHECK_NE(recv_bytes, -1);
     recv_bytes_ += recv_bytes;
+    received_[0]->Get(msg.meta.sender).Record(recv_bytes);
     if (Postoffice::Get()->verbose() >= 2) {
       PS_VLOG(2) << "[RECV][LOCAL] " << msg.DebugString();
     }
 
     // duplicated message
-    if (resender_ && resender_->AddIncomming(msg)) continue;
+    if (resender_ && resender_->AddIncomming(&msg, false)) continue;
 
     if (!msg.meta.control.empty()) {
       // control msg
@@ -897,6 +1035,7 @@ void Van::Receiving() {
       } else if (ctrl.cmd == Control::HEARTBEAT) {
         ProcessHeartbeat(&msg);
       } else if (ctrl.cmd == Control::AUTOPULLREPLY) {
+        ProcessOverlay(&msg, false);
         ProcessAutoPullReply();
       } else if (ctrl.cmd == Control::ASKPULL) {
         ProcessAskPullCommand(&msg);
@@ -921,12 +1060,13 @@ void Van::ReceivingGlobal() {
     int recv_bytes = RecvMsg(&msg, true);
     CHECK_NE(recv_bytes, -1);
     recv_bytes_ += recv_bytes;
+    received_[1]->Get(msg.meta.sender).Record(recv_bytes);
     if (Postoffice::Get()->verbose() >= 2) {
       PS_VLOG(2) << "[RECV][GLOBAL] " << msg.DebugString();
     }
 
     // duplicated message
-    if (resender_ && resender_->AddIncomming(msg)) continue;
+    if (resender_ && resender_->AddIncomming(&msg, true)) continue;
     if (!msg.meta.control.empty()) {
       // control msg
       auto& ctrl = msg.meta.control;
@@ -940,6 +1080,7 @@ void Van::ReceivingGlobal() {
       } else if (ctrl.cmd == Control::HEARTBEAT) {
         // TODO: perform heartbeat
       } else if (ctrl.cmd == Control::AUTOPULLREPLY) {
+        ProcessOverlay(&msg, true);
         ProcessAutoPullReplyGlobal();
       } else if (ctrl.cmd == Control::ASKPULL) {
         ProcessAskPullGlobalCommand(&msg);
@@ -956,6 +1097,20 @@ void Van::ReceivingGlobal() {
   }
 }
 
+void Van::ReleasingHeld() {
+  const auto period = std::chrono::microseconds(std::max<int64_t>(fec_hold_us_ / 4, 100));
+  while (!fec_hold_stop_) {
+    std::this_thread::sleep_for(period);
+    std::vector<Message> done;
+    reassembler_->Expire(&done);
+    for (auto& msg : done) {
+      auto* obj = Postoffice::Get()->GetCustomer(msg.meta.app_id, msg.meta.app_id, 5);
+      CHECK(obj) << "timeout (5 sec) to wait App " << msg.meta.app_id << " ready";
+      obj->Accept(msg);
+    }
+  }
+}
+
 void Van::Receiving_UDP(int channel) {
   Meta nodes;
   Meta recovery_nodes;  // store recovery nodes
@@ -975,6 +1130,7 @@ void Van::Receiving_UDP(int channel) {
     }
     CHECK_NE(recv_bytes, -1);
     recv_bytes_ += recv_bytes;
+    received_[1]->Get(msg.meta.sender).Record(recv_bytes);
     if (Postoffice::Get()->verbose() >= 2) {
       PS_VLOG(2) << msg.DebugString();
     }
@@ -1008,6 +1164,12 @@ void Van::PackMeta(const Meta& meta, char** meta_buf, int* buf_size, bool is_glo
   if (meta.version != Meta::kEmpty) pb.set_version(meta.version);
   if (meta.key != Meta::kEmpty) pb.set_key(meta.key);
   if (meta.iters != Meta::kEmpty) pb.set_iters(meta.iters);
+  if (meta.resend_seq) pb.set_resend_seq(meta.resend_seq);
+  if (meta.resend_ack) pb.set_resend_ack(meta.resend_ack);
+  if (meta.trace_id) pb.set_trace_id(meta.trace_id);
+  // stamped as late as possible, the probe keeps the smallest delays
+  const int64_t trace_ts = TraceTs(meta);
+  if (trace_ts) pb.set_trace_ts(trace_ts);
   if (meta.body.size()) pb.set_body(meta.body);
   if (is_global) pb.set_sender(my_node_global_.id);
   else pb.set_sender(my_node_.id);
@@ -1060,7 +1222,25 @@ void Van::PackMeta(const Meta& meta, char** meta_buf, int* buf_size, bool is_glo
     << "failed to serialize protbuf";
 }
 
+int Van::PackedMetaSize(const Meta& meta) const {
+  return packed_meta_ ? ps::PackedMetaSize(meta) : 0;
+}
+
+void Van::PackMeta(const Meta& meta, char* buf, bool is_global) {
+  EncodePackedMeta(meta, is_global ? my_node_global_.id : my_node_.id, buf);
+  reinterpret_cast<PackedMeta*>(buf)->trace_ts = TraceTs(meta);
+}
+
+int64_t Van::TraceTs(const Meta& meta) const {
+  return clock_probe_ && meta.control.empty() ? ClockProbe::Now() : 0;
+}
+
 void Van::UnpackMeta(const char* meta_buf, int buf_size, Meta* meta) {
+  if (IsPackedMeta(meta_buf, buf_size)) {
+    DecodePackedMeta(meta_buf, buf_size, meta);
+    if (clock_probe_) clock_probe_->Observe(*meta);
+    return;
+  }
   // to protobuf
   PBMeta pb;
   CHECK(pb.ParseFromArray(meta_buf, buf_size))
@@ -1069,6 +1249,10 @@ void Van::UnpackMeta(const char* meta_buf, int buf_size, Meta* meta) {
   meta->key = pb.has_key() ? pb.key() : Meta::kEmpty;
   meta->version = pb.has_version() ? pb.version() : Meta::kEmpty;
   meta->iters = pb.has_iters() ? pb.iters() : Meta::kEmpty;
+  meta->resend_seq = pb.resend_seq();
+  meta->resend_ack = pb.resend_ack();
+  meta->trace_id = pb.trace_id();
+  meta->trace_ts = pb.trace_ts();
   // to meta
   meta->head = pb.head();
   meta->app_id = pb.has_app_id() ? pb.app_id() : Meta::kEmpty;
@@ -1123,6 +1307,7 @@ void Van::UnpackMeta(const char* meta_buf, int buf_size, Meta* meta) {
   } else {
     meta->control.cmd = Control::EMPTY;
   }
+  if (clock_probe_) clock_probe_->Observe(*meta);
 }
 
 void Van::Heartbeat() {
@@ -1194,6 +1379,33 @@ void Van::AskForReceiverPush(int app, int customer, int timestamp, bool is_globa
   Send(msg, is_global);
 }
 
+void Van::ReadyToPush(int key, bool own, int app, int customer, int timestamp, bool is_global) {
+  Overlay* overlay = overlay_[is_global];
+  std::vector<Message> notices, triggers;
+  if (!overlay || key == Meta::kEmpty ||
+      !overlay->Ready(key, own, app, customer, timestamp, &notices, &triggers)) {
+    AskForReceiverPush(app, customer, timestamp, is_global);
+    return;
+  }
+  for (auto& notice : notices) Send(notice, is_global);
+  for (auto& trigger : triggers) {
+    int customer_id = Postoffice::Get()->is_worker() ? trigger.meta.customer_id : trigger.meta.app_id;
+    Postoffice::Get()->GetCustomer(trigger.meta.app_id, customer_id, 5)->Accept(trigger);
+  }
+}
+
+bool Van::ProcessOverlay(Message* msg, bool is_global) {
+  Overlay* overlay = overlay_[is_global];
+  if (!overlay || msg->meta.body.empty()) return false;
+  std::vector<Message> triggers;
+  bool consumed = overlay->Receive(msg, &triggers);
+  for (auto& trigger : triggers) {
+    int customer_id = Postoffice::Get()->is_worker() ? trigger.meta.customer_id : trigger.meta.app_id;
+    Postoffice::Get()->GetCustomer(trigger.meta.app_id, customer_id, 5)->Accept(trigger);
+  }
+  return consumed;
+}
+
 void Van::ProcessAskPushCommand(Message* msg) {
   if (ask_q.size() == 1 && ask_q.front() == (msg->meta.sender - 100)) return;
 
@@ -1471,7 +1683,12 @@ void Van::ProcessReplyGlobalCommand(Message* reply) {
   ask_global_cond.notify_one();
 }
 
-int Van::GetReceiver(int throughput, int last_recv_id, int version) {
+int Van::GetReceiver(int throughput, int last_recv_id, int version, int key) {
+  if (overlay_[0] && key != Meta::kEmpty) {
+    int recver = overlay_[0]->NextReceiver(key, version, throughput, last_recv_id);
+    if (recver != Overlay::kUnassigned) return recver;
+  }
+
   // Request a receiver.
   AskForReceiverPull(throughput, last_recv_id, version, false);
 
@@ -1487,7 +1704,12 @@ int Van::GetReceiver(int throughput, int last_recv_id, int version) {
   return temp;
 }
 
-int Van::GetGlobalReceiver(int throughput, int last_recv_id, int version) {
+int Van::GetGlobalReceiver(int throughput, int last_recv_id, int version, int key) {
+  if (overlay_[1] && key != Meta::kEmpty) {
+    int recver = overlay_[1]->NextReceiver(key, version, throughput, last_recv_id);
+    if (recver != Overlay::kUnassigned) return recver;
+  }
+
   // Request a receiver.
   AskForReceiverPull(throughput, last_recv_id, version, true);
 
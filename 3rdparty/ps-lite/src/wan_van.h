@@ -0,0 +1,376 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ */
+#ifndef PS_WAN_VAN_H_
+#define PS_WAN_VAN_H_
+#include <ctype.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "./zmq_van.h"
+namespace ps {
+
+/**
+ * \brief one line of a WAN topology file, the links it matches and their
+ * emulated properties
+ */
+struct WANLink {
+  bool is_global = false;
+  std::string sender, recver;
+  /** \brief bytes per microsecond, 0 for unlimited */
+  double bandwidth = 0;
+  /** \brief one-way delay in microseconds, half of the round trip */
+  int64_t delay = 0;
+  /** \brief loss rate of each UDP channel, the last one applies to the rest */
+  std::vector<double> loss;
+
+  double Loss(int channel) const {
+    if (loss.empty()) return 0;
+    return loss[std::min<size_t>(channel, loss.size() - 1)];
+  }
+};
+
+/**
+ * \brief messages waiting for the transmitter of a link, one FIFO per
+ * connection, i.e. the TCP connection and each DGT UDP channel.
+ *
+ * Messages of one connection leave in the order they were queued, as the
+ * kernel queue of a socket keeps them. With strict priority the connection
+ * whose oldest message has the highest class goes next, ties and fifo go to
+ * the oldest message of all.
+ */
+template <typename T>
+class LinkQueues {
+ public:
+  explicit LinkQueues(bool strict_priority) : strict_priority_(strict_priority) { }
+
+  void Push(int connection, int cls, T item) {
+    queues_[connection].push_back(Item{cls, seq_++, std::move(item)});
+  }
+
+  bool empty() const {
+    for (const auto& q : queues_) {
+      if (!q.second.empty()) return false;
+    }
+    return true;
+  }
+
+  /** \brief removes and returns the message transmitted next, queues must not be empty */
+  T Pop() {
+    std::deque<Item>* next = nullptr;
+    for (auto& q : queues_) {
+      if (q.second.empty()) continue;
+      if (!next || Before(q.second.front(), next->front())) next = &q.second;
+    }
+    CHECK(next) << "no message waiting";
+    T item = std::move(next->front().item);
+    next->pop_front();
+    return item;
+  }
+
+ private:
+  struct Item {
+    int cls;
+    uint64_t seq;
+    T item;
+  };
+
+  bool Before(const Item& a, const Item& b) const {
+    if (strict_priority_ && a.cls != b.cls) return a.cls > b.cls;
+    return a.seq < b.seq;
+  }
+
+  bool strict_priority_;
+  uint64_t seq_ = 0;
+  std::map<int, std::deque<Item>> queues_;
+};
+
+/**
+ * \brief emulates a wide-area network between nodes running on one host.
+ *
+ * Messages are delayed and throttled per (sender, receiver) link on the sender
+ * before going out through ZMQ. The links are read from the file named by
+ * PS_WAN_TOPOLOGY, one per line and the first matching line applies:
+ *
+ *     # network sender   receiver bandwidth(Mbps) rtt(ms) [loss=ch0,ch1,...]
+ *     global    server:1 *        20              150     loss=0,0.01,0.05
+ *     global    *        *        100             40      loss=0,0.01
+ *     local     *        *        10000           0.1
+ *     priority  strict
+ *
+ * Senders and receivers are `*`, a role, a role and rank such as `server:0`, or
+ * a node id. The roles are scheduler, server and worker on the local network,
+ * global_scheduler, global_server and server (the local servers) on the global
+ * network. Pairs matched by no line, and messages to the node itself, are
+ * sent directly. The loss rates apply to messages of the DGT UDP channels only,
+ * which are dropped on the sender; TCP is lossless as the kernel would resend.
+ *
+ * The DSCP priority model follows the TOS the messages are marked with: the
+ * class of a message is its IP precedence, tos >> 5, so that DGT channels
+ * of more important blocks are higher. Priority only applies across
+ * connections, see LinkQueues: with `priority strict` (default) a link
+ * transmits next from the connection whose oldest message has the highest
+ * class, with `priority fifo` it ignores the marking. Transmissions are not
+ * preempted.
+ */
+class WANVan : public ZMQVan {
+ public:
+  WANVan() {
+    const char* path = Environment::Get()->find("PS_WAN_TOPOLOGY");
+    CHECK(path) << "PS_WAN_TOPOLOGY is required by the wan van";
+    LoadTopology(path);
+    rng_.seed(GetEnv("PS_WAN_SEED", 0));
+    start_ = Now();
+    shaper_ = std::thread(&WANVan::Shaping, this);
+  }
+  virtual ~WANVan() {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      exit_ = true;
+    }
+    cv_.notify_all();
+    shaper_.join();
+  }
+
+ protected:
+  void Stop(const bool is_global = false) override {
+    {
+      // the barrier replies of the scheduler may still be on their way
+      std::unique_lock<std::mutex> lk(mu_);
+      drained_cv_.wait(lk, [this, is_global]{ return num_pending_[is_global] == 0; });
+    }
+    PS_VLOG(1) << my_node(is_global).ShortDebugString() << " emulated "
+               << num_delayed_ << " messages, dropped " << num_dropped_ << " udp messages";
+    ZMQVan::Stop(is_global);
+  }
+
+  int SendMsg(const Message& msg, bool is_global = false) override {
+    return Enqueue(msg, is_global, -1, 0);
+  }
+
+  int SendMsg_UDP(int channel, const Message& msg, int tag) override {
+    return Enqueue(msg, true, channel, tag);
+  }
+
+ private:
+  struct Pending {
+    Message msg;
+    bool is_global;
+    int channel;
+    int tag;
+    int64_t arrival;
+  };
+  struct Link {
+    explicit Link(const WANLink* conf, bool strict_priority)
+        : conf(conf), queues(strict_priority) { }
+    const WANLink* conf;
+    /** \brief the time the transmitter is free again */
+    int64_t busy_until = 0;
+    /** \brief waiting messages by connection, channel -1 is TCP */
+    LinkQueues<Pending> queues;
+  };
+  struct Delivery {
+    int64_t due;
+    uint64_t order;
+    Message msg;
+    bool is_global;
+    int channel;
+    int tag;
+    bool operator<(const Delivery& other) const {
+      return due != other.due ? due > other.due : order > other.order;
+    }
+  };
+
+  int64_t Now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void LoadTopology(const std::string& path) {
+    std::ifstream in(path);
+    CHECK(in.good()) << "failed to open WAN topology " << path;
+    std::string line;
+    for (int lineno = 1; std::getline(in, line); ++lineno) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream is(line);
+      std::string network;
+      if (!(is >> network)) continue;
+      if (network == "priority") {
+        std::string model;
+        is >> model;
+        CHECK(model == "strict" || model == "fifo")
+            << path << ":" << lineno << ": unknown priority model " << model;
+        strict_priority_ = model == "strict";
+        continue;
+      }
+      CHECK(network == "global" || network == "local")
+          << path << ":" << lineno << ": unknown network " << network;
+      WANLink link;
+      double mbps, rtt_ms;
+      link.is_global = network == "global";
+      is >> link.sender >> link.recver >> mbps >> rtt_ms;
+      CHECK(!is.fail() && mbps >= 0 && rtt_ms >= 0) << path << ":" << lineno << ": " << line;
+      link.bandwidth = mbps / 8;
+      link.delay = static_cast<int64_t>(rtt_ms * 1000 / 2);
+      std::string opt;
+      while (is >> opt) {
+        CHECK_EQ(opt.compare(0, 5, "loss="), 0) << path << ":" << lineno << ": " << opt;
+        std::istringstream ls(opt.substr(5));
+        std::string p;
+        while (std::getline(ls, p, ',')) {
+          link.loss.push_back(std::stod(p));
+          CHECK(link.loss.back() >= 0 && link.loss.back() <= 1) << path << ":" << lineno;
+        }
+      }
+      conf_.push_back(link);
+    }
+    PS_VLOG(1) << "loaded " << conf_.size() << " WAN links from " << path;
+  }
+
+  /** \brief the role of a node on a network, as named in the topology file */
+  static std::string RoleOf(int id, bool is_global) {
+    if (id == kScheduler) return is_global ? "global_scheduler" : "scheduler";
+    const bool even = (id < kOffset ? id - 8 : id - kOffset) % 2 == 0;
+    if (is_global) return even ? "global_server" : "server";
+    return even ? "server" : "worker";
+  }
+
+  static bool Match(const std::string& sel, int id, bool is_global) {
+    if (sel == "*") return true;
+    if (id == Node::kEmpty) return false;
+    const size_t colon = sel.find(':');
+    if (sel.substr(0, colon) == RoleOf(id, is_global)) {
+      return colon == std::string::npos || atoi(sel.c_str() + colon + 1) == Postoffice::IDtoRank(id);
+    }
+    return isdigit(sel[0]) && atoi(sel.c_str()) == id;
+  }
+
+  /** \brief the link to recver, nullptr if it is not emulated. mu_ is held */
+  Link* FindLink(int recver, bool is_global) {
+    // not my_node(), messages are sent before this node is ready
+    const int me = is_global ? my_node_global_.id : my_node_.id;
+    if (recver == me) return nullptr;
+    // the route depends on the id of this node, which is assigned at registration
+    auto& routes = routes_[is_global];
+    if (routes_owner_[is_global] != me) {
+      routes.clear();
+      routes_owner_[is_global] = me;
+    }
+    auto it = routes.find(recver);
+    if (it != routes.end()) return it->second;
+    Link* found = nullptr;
+    for (const auto& conf : conf_) {
+      if (conf.is_global == is_global &&
+          Match(conf.sender, me, is_global) && Match(conf.recver, recver, is_global)) {
+        links_.emplace_back(new Link(&conf, strict_priority_));
+        found = links_.back().get();
+        break;
+      }
+    }
+    routes[recver] = found;
+    return found;
+  }
+
+  int Enqueue(const Message& msg, bool is_global, int channel, int tag) {
+    size_t bytes = sizeof(Meta);
+    for (const auto& d : msg.data) bytes += d.size();
+    std::unique_lock<std::mutex> lk(mu_);
+    Link* link = FindLink(msg.meta.recver, is_global);
+    if (!link) {
+      lk.unlock();
+      return channel < 0 ? ZMQVan::SendMsg(msg, is_global)
+                         : ZMQVan::SendMsg_UDP(channel, msg, tag);
+    }
+    if (channel >= 0 && std::uniform_real_distribution<double>(0, 1)(rng_) <
+                        link->conf->Loss(channel)) {
+      ++num_dropped_;
+      return bytes;
+    }
+    link->queues.Push(channel, msg.meta.tos >> 5,
+                      Pending{msg, is_global, channel, tag, Now() - start_});
+    ++num_pending_[is_global];
+    ++num_delayed_;
+    lk.unlock();
+    cv_.notify_all();
+    return bytes;
+  }
+
+  /**
+   * \brief starts the transmissions due and sends the messages that arrived,
+   * a discrete-event loop over the links in real time
+   */
+  void Shaping() {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (!exit_) {
+      const int64_t now = Now() - start_;
+      int64_t wake = now + 1000000;
+      for (auto& link : links_) {
+        while (link->busy_until <= now && !link->queues.empty()) {
+          Pending p = link->queues.Pop();
+          size_t bytes = sizeof(Meta);
+          for (const auto& d : p.msg.data) bytes += d.size();
+          const double bw = link->conf->bandwidth;
+          const int64_t start = std::max(link->busy_until, p.arrival);
+          link->busy_until = start + (bw > 0 ? static_cast<int64_t>(bytes / bw) : 0);
+          deliveries_.push(Delivery{link->busy_until + link->conf->delay, order_++,
+                                    std::move(p.msg), p.is_global, p.channel, p.tag});
+        }
+        if (!link->queues.empty()) wake = std::min(wake, link->busy_until);
+      }
+      std::vector<Delivery> due;
+      for (; !deliveries_.empty() && deliveries_.top().due <= now; deliveries_.pop()) {
+        due.push_back(deliveries_.top());
+      }
+      if (!deliveries_.empty()) wake = std::min(wake, deliveries_.top().due);
+      if (!due.empty()) {
+        lk.unlock();
+        for (const auto& d : due) {
+          int ret = d.channel < 0 ? ZMQVan::SendMsg(d.msg, d.is_global)
+                                  : ZMQVan::SendMsg_UDP(d.channel, d.msg, d.tag);
+          if (ret == -1) LOG(WARNING) << "failed to send an emulated message " << d.msg.DebugString();
+        }
+        lk.lock();
+        for (const auto& d : due) --num_pending_[d.is_global];
+        drained_cv_.notify_all();
+        continue;
+      }
+      cv_.wait_for(lk, std::chrono::microseconds(std::max<int64_t>(wake - now, 1)));
+    }
+  }
+
+  std::vector<WANLink> conf_;
+  bool strict_priority_ = true;
+  std::vector<std::unique_ptr<Link>> links_;
+  std::unordered_map<int, Link*> routes_[2];
+  int routes_owner_[2] = {Node::kEmpty, Node::kEmpty};
+  std::priority_queue<Delivery> deliveries_;
+  uint64_t order_ = 0;
+  std::mt19937 rng_;
+  int64_t start_;
+  /** \brief queued or in-flight messages of the local and the global network */
+  size_t num_pending_[2] = {0, 0};
+  size_t num_delayed_ = 0;
+  size_t num_dropped_ = 0;
+  bool exit_ = false;
+  /** \brief guards the links, the routes and the deliveries */
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::condition_variable drained_cv_;
+  std::thread shaper_;
+};
+}  // namespace ps
+#endif  // PS_WAN_VAN_H_
@@ -8,7 +8,10 @@
 #include <stdlib.h>
 #include <thread>
 #include <string>
+#include <memory>
+#include <mutex>
 #include "ps/internal/van.h"
+#include "./udp_datagram.h"
 #include <assert.h>
 #include <stdlib.h>                   
 #if _MSC_VER
@@ -88,10 +91,22 @@ class ZMQVan : public Van {
       CHECK_EQ(zmq_close(it.second), 0);
     }
     senders.clear();
+    if (is_global) {
+      std::lock_guard<std::mutex> lk(udp_mu_);
+      udp_senders_.clear();
+    }
     zmq_ctx_destroy(context_);
     context_ = nullptr;
   }
 
+  /**
+   * \brief makes blocking calls on the sockets of this van return, so that
+   * threads still receiving can be joined
+   */
+  void ShutdownContext() {
+    if (context_) zmq_ctx_shutdown(context_);
+  }
+
   std::vector<int> Bind_UDP(const Node& node, int max_retry) override {
     std::vector<int> tmp_udp_port;
     for (size_t i = 0; i < node.udp_port.size(); ++i) {
@@ -135,15 +150,16 @@ class ZMQVan : public Van {
     CHECK_NE(node.id, node.kEmpty);
     CHECK(node.hostname.size());
     int id = node.id;
-    auto it = udp_senders_.find(id);
-    if (it != udp_senders_.end()) {
-      for (size_t i = 0; i < it->second.size(); ++i)
-        zmq_close(it->second[i]);
+    {
+      // senders still holding the old channels close them when done
+      std::lock_guard<std::mutex> lk(udp_mu_);
+      udp_senders_.erase(id);
     }
     // worker doesn't need to connect to the other workers. same for server
     if ((node.role == my_node_global_.role) &&
         (node.id != my_node_global_.id)) return;
 
+    std::vector<std::shared_ptr<UdpChannel>> channels;
     for (size_t i = 0; i < node.udp_port.size(); ++i) {
       PS_VLOG(1) << node.udp_port[i];
       void *udp_sender = zmq_socket(context_, ZMQ_DEALER);
@@ -191,65 +207,60 @@ class ZMQVan : public Van {
         PS_VLOG(1) << "UDP[channel " << i + 1 << "]:connect to "
           + addr + " success.";
       }
-      udp_senders_[id].push_back(udp_sender);
+      channels.emplace_back(new UdpChannel(udp_sender));
     }
+    std::lock_guard<std::mutex> lk(udp_mu_);
+    udp_senders_[id] = std::move(channels);
   }
 
   int SendMsg_UDP(int channel, const Message& msg, int tag) override {
-    std::lock_guard<std::mutex> lk(mu_);
     // find the socket
     int id = msg.meta.recver;
     CHECK_NE(id, Meta::kEmpty);
-    auto it = udp_senders_.find(id);
-    if (it == udp_senders_.end()) {
-      LOG(WARNING) << "Udp:there is no socket to node " << id;
-      return -1;
+    std::shared_ptr<UdpChannel> udp_channel;
+    {
+      std::lock_guard<std::mutex> lk(udp_mu_);
+      auto it = udp_senders_.find(id);
+      if (it == udp_senders_.end()) {
+        LOG(WARNING) << "Udp:there is no socket to node " << id;
+        return -1;
+      }
+      udp_channel = it->second.at(channel);
     }
-    void *socket = it->second[channel];
-    int meta_size;
-    char* meta_buf;
-    int n = msg.data.size();
+    int meta_size = PackedMetaSize(msg.meta);
+    char* meta_buf = nullptr;
+    if (meta_size == 0) PackMeta(msg.meta, &meta_buf, &meta_size, true);
 
-    PackMeta(msg.meta, &meta_buf, &meta_size,true);
-
-    size_t tot_bytes = 0;
-    size_t addr_offset = 0;
-    int send_bytes = 0;
-    tot_bytes += sizeof(meta_size);
-    tot_bytes += meta_size;
-    for (int i = 0; i < n; ++i) {
-      tot_bytes += msg.data[i].size();
-    }
+    // one datagram per message, see udp_datagram.h
+    size_t tot_bytes = UdpDatagramSize(meta_size, msg);
     char *send_buf = (char*) malloc(tot_bytes);
-
-    memcpy(send_buf, (char*)&meta_size, sizeof(meta_size));
-    addr_offset += sizeof(meta_size);
-    memcpy(send_buf + addr_offset, meta_buf, meta_size);
-    addr_offset += meta_size;
-    for (int i = 0; i < n; ++i) {
-      memcpy(send_buf + addr_offset, msg.data[i].data(), msg.data[i].size());
-      addr_offset += msg.data[i].size();
+    FillUdpDatagram(meta_size, msg, send_buf);
+    if (meta_buf) {
+      memcpy(send_buf + sizeof(meta_size), meta_buf, meta_size);
+      delete [] meta_buf;
+    } else {
+      PackMeta(msg.meta, send_buf + sizeof(meta_size), true);
     }
-    assert(tot_bytes == addr_offset);
 
+    // zmq sockets are not threadsafe, lock this channel only
+    std::lock_guard<std::mutex> lk(udp_channel->mu);
     zmq_msg_t data_msg;
     zmq_msg_init_data(&data_msg, send_buf, tot_bytes, FreeData_malloc, NULL);
-
     while (true) {
-      if (zmq_msg_send(&data_msg, socket, tag) == static_cast<ssize_t>(tot_bytes)) break;
+      if (zmq_msg_send(&data_msg, udp_channel->socket, tag) == static_cast<ssize_t>(tot_bytes)) {
+        break;
+      }
       if (errno == EINTR) continue;
       LOG(WARNING) << "Udp:failed to send message to node [" << id
                    << "] errno: " << errno << " " << zmq_strerror(errno);
       return -1;
     }
-    send_bytes = tot_bytes;
-    return send_bytes;
+    return tot_bytes;
   }
 
   int RecvMsg_UDP(int channel, Message* msg) override {
     msg->data.clear();
-    size_t recv_bytes = 0;
-    for (int i = 0; ; ++i) {
+    while (true) {
       zmq_msg_t* zmsg = new zmq_msg_t;
       CHECK(zmq_msg_init(zmsg) == 0) << zmq_strerror(errno);
       while (true) {
@@ -260,48 +271,26 @@ class ZMQVan : public Van {
         }
         LOG(WARNING) << "failed to receive message. errno: "
                      << errno << " " << zmq_strerror(errno);
+        zmq_msg_close(zmsg);
+        delete zmsg;
         return -1;
       }
+      std::shared_ptr<void> owner(zmsg, [](void* p) {
+        zmq_msg_close(static_cast<zmq_msg_t*>(p));
+        delete static_cast<zmq_msg_t*>(p);
+      });
       char* buf = CHECK_NOTNULL((char *)zmq_msg_data(zmsg));
       size_t size = zmq_msg_size(zmsg);
-      recv_bytes += size;
 
-      int meta_size;
-      int addr_offset = 0;
-      memcpy((void*)&meta_size, buf+addr_offset, sizeof(meta_size));
-      addr_offset += sizeof(meta_size);
-
-      // task
-      UnpackMeta(buf + addr_offset, meta_size, &(msg->meta));
-      addr_offset += meta_size;
-
-      if (msg->meta.keys_len > 0) {
-        SArray<char> data;
-        data.reset(buf + addr_offset, msg->meta.keys_len, [zmsg, size](char* buf) {});
-        msg->data.push_back(data);
-        addr_offset += msg->meta.keys_len;
-        if (msg->meta.lens_len > 0) {
-          data.reset(buf + addr_offset, msg->meta.vals_len, [zmsg, size](char* buf) {});
-          msg->data.push_back(data);
-          addr_offset += msg->meta.vals_len;
-          data.reset(buf + addr_offset, msg->meta.lens_len, [zmsg, size](char* buf) {
-            zmq_msg_close(zmsg);
-            delete zmsg;
-          });
-          msg->data.push_back(data);
-          addr_offset += msg->meta.lens_len;
-        } else {
-          data.reset(buf + addr_offset, msg->meta.vals_len, [zmsg, size](char* buf) {
-            zmq_msg_close(zmsg);
-            delete zmsg;
-          });
-          msg->data.push_back(data);
-          addr_offset += msg->meta.vals_len;
-        }
+      // drop datagrams whose sizes do not add up
+      int meta_size = UdpDatagramMetaSize(buf, size);
+      if (meta_size < 0 || !SplitUdpDatagram(buf, size, meta_size, owner, msg)) {
+        LOG(WARNING) << "Udp:dropped a datagram of " << size << " bytes";
+        continue;
       }
-      break;
+      UnpackMeta(buf + sizeof(meta_size), meta_size, &(msg->meta));
+      return size;
     }
-    return recv_bytes;
   }
 
   int Bind(const Node& node, int max_retry, bool is_global = false) override {
@@ -392,15 +381,20 @@ class ZMQVan : public Van {
     // for tcp-dgt
     int tos = msg.meta.tos;
     zmq_setsockopt(socket, ZMQ_TOS, &tos, sizeof(tos));
-    // send meta
-    int meta_size;
-    char* meta_buf;
-    PackMeta(msg.meta, &meta_buf, &meta_size, is_global);
+    // send meta, data messages are packed in place into the zmq frame
+    int meta_size = PackedMetaSize(msg.meta);
     int tag = ZMQ_SNDMORE;
     int n = msg.data.size();
     if (n == 0) tag = 0;
     zmq_msg_t meta_msg;
-    zmq_msg_init_data(&meta_msg, meta_buf, meta_size, FreeData, NULL);
+    if (meta_size > 0) {
+      zmq_msg_init_size(&meta_msg, meta_size);
+      PackMeta(msg.meta, static_cast<char*>(zmq_msg_data(&meta_msg)), is_global);
+    } else {
+      char* meta_buf;
+      PackMeta(msg.meta, &meta_buf, &meta_size, is_global);
+      zmq_msg_init_data(&meta_msg, meta_buf, meta_size, FreeData, NULL);
+    }
     while (true) {
       if (zmq_msg_send(&meta_msg, socket, tag) == meta_size) break;
       if (errno == EINTR) continue;
@@ -507,7 +501,26 @@ class ZMQVan : public Van {
   std::mutex mu_;
   void *receiver_ = nullptr;
   void *receiver_global_ = nullptr;
-  std::unordered_map<int, std::vector<void*>> udp_senders_;
+  /**
+   * \brief a udp channel socket with its own lock, so that channels do not
+   * serialize with each other or with the tcp path guarded by mu_. The
+   * socket is closed when the last sender using it is done.
+   */
+  struct UdpChannel {
+    explicit UdpChannel(void* socket) : socket(socket) { }
+    ~UdpChannel() {
+      int linger = 0;
+      zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+      zmq_close(socket);
+    }
+    void* socket;
+    std::mutex mu;
+  };
+  /**
+   * \brief node_id to its udp channels, replaced as a whole by Connect_UDP
+   */
+  std::unordered_map<int, std::vector<std::shared_ptr<UdpChannel>>> udp_senders_;
+  std::mutex udp_mu_;
   std::vector<void *> udp_receiver_vec;
   void *udp_receiver_ = nullptr;
 };
@@ -0,0 +1,61 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks that the smallest one-way delays of two nodes recover the
+ * offset of their clocks under queuing jitter.
+ *
+ * Usage: test_clock_probe [offset_us=250000] [num_msgs=1000]
+ */
+#include <cstdio>
+#include <random>
+#include "../src/clock_probe.h"
+using namespace ps;
+
+const int kA = 101;
+const int kB = 100;
+
+/**
+ * \brief a message sent by sender, whose clock is ahead of the receiver's by
+ * ahead_us, arriving latency_us after it was stamped
+ */
+Meta Stamped(int sender, int64_t ahead_us, int64_t latency_us) {
+  Meta meta;
+  meta.sender = sender;
+  meta.trace_ts = ClockProbe::Now() + ahead_us - latency_us;
+  return meta;
+}
+
+int main(int argc, char *argv[]) {
+  const int64_t offset = argc > 1 ? atoll(argv[1]) : 250000;
+  const int n = argc > 2 ? atoi(argv[2]) : 1000;
+  const int64_t latency = 800;
+
+  // the clock of b is offset ahead of the clock of a
+  ClockProbe a, b;
+  std::mt19937 gen(0);
+  std::exponential_distribution<double> queuing(1.0 / 2000);
+  for (int i = 0; i < n; ++i) {
+    a.Observe(Stamped(kB, offset, latency + queuing(gen)));
+    b.Observe(Stamped(kA, -offset, latency + queuing(gen)));
+  }
+  // untraced messages are ignored
+  a.Observe(Meta());
+
+  auto from_b = a.delays();
+  auto from_a = b.delays();
+  CHECK_EQ(from_b.size(), 1U);
+  CHECK_EQ(from_b[kB].count, static_cast<uint64_t>(n));
+  const int64_t est = ClockProbe::Offset(from_b[kB].min_us, from_a[kA].min_us);
+  // the minimum is within a few microseconds of the base latency
+  CHECK_LE(std::abs(est + offset), 100) << "offset of a to b is " << -offset << ", got " << est;
+  LOG(INFO) << "a: " << a.Summary() << "; b: " << b.Summary() << "; offset " << est;
+
+  const std::string path = "/tmp/test_clock_probe.json";
+  a.Dump(path, "worker0@10.0.0.1:9092", {{"10.0.0.1:9092", kA}});
+  std::ifstream is(path);
+  std::string dump((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+  CHECK_NE(dump.find("\"ids\": {\"10.0.0.1:9092\": 101}"), std::string::npos) << dump;
+  CHECK_NE(dump.find("\"100\": ["), std::string::npos) << dump;
+  std::remove(path.c_str());
+  return 0;
+}
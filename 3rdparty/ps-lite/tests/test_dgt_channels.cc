@@ -0,0 +1,139 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks the DGT scoring and channel assignment of KVServer on random
+ * blocks: BlockMeanAbs matches a scalar mean of fp32 and fp16 blocks of any
+ * length, and AssignChannels sends each scored block once, the last block and
+ * the top k of the ranks reliably first, and the other ranks over the UDP
+ * channels in order of contribution.
+ *
+ * Usage: test_dgt_channels [trials=2000]
+ */
+#include <cmath>
+#include <random>
+#include "ps/ps.h"
+using namespace ps;
+
+/** \brief the value of a half, decoded without bit tricks */
+float HalfToFloat(uint16_t h) {
+  const int e = (h >> 10) & 0x1f, m = h & 0x3ff;
+  const float sign = (h & 0x8000) ? -1 : 1;
+  if (e == 0) return sign * std::ldexp(static_cast<float>(m), -24);
+  if (e == 0x1f) return m ? NAN : sign * INFINITY;
+  return sign * std::ldexp(static_cast<float>(1024 + m), e - 25);
+}
+
+void TestMeanAbs(std::mt19937* gen, int trials) {
+  std::uniform_int_distribution<int> length(0, 1100);
+  std::normal_distribution<float> normal(0, 10);
+  std::uniform_int_distribution<int> half(0, 0x7bff);
+  for (int t = 0; t < trials; ++t) {
+    // fp32 blocks of any length, so that the vector loops leave a tail
+    const int n = length(*gen);
+    std::vector<float> x(n);
+    double sum = 0;
+    for (auto& v : x) {
+      v = normal(*gen);
+      sum += std::fabs(v);
+    }
+    const float expected = n ? sum / n : 0;
+    const float mean = KVServer<char>::BlockMeanAbs(reinterpret_cast<const char*>(x.data()),
+                                                    n * sizeof(float), 0);
+    CHECK_LE(std::fabs(mean - expected), 1e-4f * (1 + expected))
+        << "fp32 block of " << n << ": " << mean << " instead of " << expected;
+
+    // fp16 blocks, subnormals included
+    std::vector<uint16_t> h(n);
+    sum = 0;
+    for (auto& v : h) {
+      v = static_cast<uint16_t>(half(*gen) | (t % 2 ? 0x8000 : 0));
+      if (t % 3 == 0) v &= 0x83ff;
+      sum += std::fabs(HalfToFloat(v));
+    }
+    const float expected16 = n ? sum / n : 0;
+    const float mean16 = KVServer<char>::BlockMeanAbs(reinterpret_cast<const char*>(h.data()),
+                                                      n * sizeof(uint16_t), 2);
+    CHECK_LE(std::fabs(mean16 - expected16), 1e-4f * (1 + expected16))
+        << "fp16 block of " << n << ": " << mean16 << " instead of " << expected16;
+  }
+}
+
+void TestChannels(std::mt19937* gen, int trials) {
+  std::uniform_int_distribution<int> blocks(1, 300), channels(1, 4);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  for (int t = 0; t < trials; ++t) {
+    // scores with zeros and ties
+    const int seq_num = blocks(*gen);
+    const float zeros = uniform(*gen) / 2, k = uniform(*gen);
+    const int C = channels(*gen);
+    std::vector<float> score(seq_num);
+    for (auto& s : score) {
+      s = uniform(*gen) < zeros ? 0 : std::round(uniform(*gen) * 20) / 20 + 0.01f;
+    }
+
+    std::vector<std::pair<int, int>> sent;
+    KVServer<char>::AssignChannels(score, k, C, [&sent](int seq, int channel) {
+      sent.emplace_back(seq, channel);
+    });
+
+    // what is sent, and how many blocks each channel takes
+    int num_ranked = 0;
+    for (int seq = 0; seq < seq_num - 1; ++seq) num_ranked += score[seq] != 0;
+    const int min_index = std::round(k * (num_ranked + 1));
+    std::vector<int> expected(C + 1, 0);
+    expected[0] = std::min(min_index, num_ranked) + 1;
+    int begin = std::min(min_index, num_ranked);
+    for (int c = 1; c <= C; ++c) {
+      int end = c == C ? num_ranked
+          : static_cast<int>(std::ceil(min_index + c * static_cast<float>(num_ranked - min_index) / C));
+      end = std::max(begin, std::min(end, num_ranked));
+      expected[c] = end - begin;
+      begin = end;
+    }
+
+    std::vector<int> count(C + 1, 0), channel_of(seq_num, -1);
+    int last_channel = 0;
+    for (const auto& s : sent) {
+      CHECK(s.first >= 0 && s.first < seq_num);
+      CHECK(s.second >= 0 && s.second <= C);
+      CHECK_EQ(channel_of[s.first], -1) << "block " << s.first << " is sent twice";
+      CHECK_GE(s.second, last_channel) << "channel " << s.second << " is filled after "
+                                       << last_channel;
+      channel_of[s.first] = s.second;
+      last_channel = s.second;
+      ++count[s.second];
+    }
+    CHECK_EQ(channel_of[seq_num - 1], 0) << "the last block is not reliable";
+    for (int seq = 0; seq < seq_num - 1; ++seq) {
+      CHECK_EQ(channel_of[seq] >= 0, score[seq] != 0)
+          << "block " << seq << " of score " << score[seq];
+    }
+    for (int c = 0; c <= C; ++c) {
+      CHECK_EQ(count[c], expected[c]) << "channel " << c << " of " << C << ", k " << k
+                                      << ", " << num_ranked << " ranked blocks";
+    }
+
+    // channels are ordered by contribution
+    std::vector<float> lowest(C + 1, INFINITY), highest(C + 1, -INFINITY);
+    for (int seq = 0; seq < seq_num - 1; ++seq) {
+      const int c = channel_of[seq];
+      if (c < 0) continue;
+      lowest[c] = std::min(lowest[c], score[seq]);
+      highest[c] = std::max(highest[c], score[seq]);
+    }
+    for (int c = 1; c <= C; ++c) {
+      for (int d = 0; d < c; ++d) {
+        CHECK_GE(lowest[d], highest[c]) << "channel " << c << " holds a block above channel " << d;
+      }
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const int trials = argc > 1 ? atoi(argv[1]) : 2000;
+  std::mt19937 gen(0);
+  TestMeanAbs(&gen, trials / 4);
+  TestChannels(&gen, trials);
+  LOG(INFO) << "checked " << trials << " random pushes";
+  return 0;
+}
@@ -0,0 +1,218 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks that XOR parities of DGT blocks rebuild single lost blocks,
+ * that group sizes follow the measured loss, and that tensors missing blocks
+ * at their last block are held until the blocks are rebuilt or given up, and
+ * that malformed parities are rejected before they are read.
+ *
+ * Usage: test_fec [num_blocks=1000] [loss_percent=5]
+ */
+#include <random>
+#include <thread>
+#include "../src/block_reassembler.h"
+#include "../src/fec.h"
+using namespace ps;
+
+Message Block(int seq, int bytes, int channel) {
+  Message msg;
+  msg.meta.sender = 9;
+  msg.meta.recver = 8;
+  msg.meta.first_key = 3;
+  msg.meta.timestamp = 1;
+  msg.meta.msg_type = 1;
+  msg.meta.channel = channel;
+  msg.meta.seq = seq;
+  msg.meta.val_bytes = seq * 4096;
+  SArray<uint64_t> keys(1, 3);
+  msg.AddData(keys);
+  SArray<char> vals(bytes);
+  for (int i = 0; i < bytes; ++i) vals[i] = static_cast<char>(seq * 31 + i);
+  msg.AddData(vals);
+  return msg;
+}
+
+/** \brief block seq of a tensor of num blocks of 4096 bytes, round timestamp */
+Message TensorBlock(int seq, int num, int timestamp) {
+  Message msg = Block(seq, 4096, seq == num - 1 ? 0 : 1);
+  msg.meta.timestamp = timestamp;
+  msg.meta.total_bytes = num * 4096;
+  msg.meta.seq_begin = 0;
+  msg.meta.seq_end = num - 1;
+  return msg;
+}
+
+/** \brief whether block seq of tensor holds the bytes of Block, or zeros */
+bool Holds(const Message& tensor, int seq, bool zeros) {
+  const Message block = Block(seq, 4096, 1);
+  const char* p = tensor.data[1].data() + seq * 4096;
+  for (int i = 0; i < 4096; ++i) {
+    if (p[i] != (zeros ? 0 : block.data[1][i])) return false;
+  }
+  return true;
+}
+
+void TestHold() {
+  FecEncoder encoder(1, 2, 0.001f);
+  FecDecoder decoder(1);
+  BlockReassembler reassembler;
+  reassembler.set_hold(1000 * 1000);
+  std::vector<Message> parities;
+  Message msg;
+
+  // blocks 0 and 1 go in one group, block 1 is lost and the last block comes
+  // first, the parity rebuilds block 1 and releases the tensor
+  Message b0 = TensorBlock(0, 3, 1), b1 = TensorBlock(1, 3, 1);
+  encoder.Add(b0, &parities);
+  encoder.Add(b1, &parities);
+  CHECK_EQ(parities.size(), 1U);
+  decoder.AddBlock(b0);
+  msg = b0;
+  CHECK(!reassembler.Add(&msg, 1));
+  msg = TensorBlock(2, 3, 1);
+  CHECK(!reassembler.Add(&msg, 1)) << "the last block must wait for the parity";
+  Message recovered;
+  CHECK(decoder.AddParity(parities[0], &recovered));
+  CHECK(reassembler.Add(&recovered, 1)) << "the rebuilt block completes the tensor";
+  CHECK_EQ(recovered.meta.seq, 2) << "the tensor comes as its last block";
+  CHECK(Holds(recovered, 0, false) && Holds(recovered, 1, false) && Holds(recovered, 2, false));
+  CHECK(!reassembler.Settle(parities[0].meta, FecDecoder::Members(parities[0]), &msg));
+
+  // both members are lost, the parity gives them up
+  parities.clear();
+  encoder.Add(TensorBlock(0, 3, 2), &parities);
+  encoder.Add(TensorBlock(1, 3, 2), &parities);
+  msg = TensorBlock(2, 3, 2);
+  CHECK(!reassembler.Add(&msg, 1));
+  CHECK(!decoder.AddParity(parities[0], &recovered));
+  CHECK(reassembler.Settle(parities[0].meta, FecDecoder::Members(parities[0]), &msg));
+  CHECK(Holds(msg, 0, true) && Holds(msg, 1, true) && Holds(msg, 2, false));
+
+  // a block of a completed round is dropped, not merged into the next round
+  msg = TensorBlock(0, 3, 2);
+  CHECK(!reassembler.Add(&msg, 1));
+  msg = TensorBlock(0, 3, 3);
+  CHECK(!reassembler.Add(&msg, 1));
+  msg = TensorBlock(1, 3, 3);
+  CHECK(!reassembler.Add(&msg, 1));
+  msg = TensorBlock(2, 3, 3);
+  CHECK(reassembler.Add(&msg, 1)) << "a tensor with all its blocks is not held";
+  CHECK(Holds(msg, 0, false)) << "a late block was merged into the next round";
+
+  // without parity, the hold passes
+  BlockReassembler timed;
+  timed.set_hold(1000);
+  msg = TensorBlock(1, 2, 4);
+  CHECK(!timed.Add(&msg, 1));
+  std::vector<Message> done;
+  timed.Expire(&done);
+  CHECK(done.empty());
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  timed.Expire(&done);
+  CHECK_EQ(done.size(), 1U);
+  CHECK(Holds(done[0], 0, true) && Holds(done[0], 1, false));
+  LOG(INFO) << reassembler.Summary() << "; " << timed.Summary();
+}
+
+/** \brief whether the decoder rejects a parity without reading past its end */
+bool Rejects(const Message& parity, int num_received = 0) {
+  FecDecoder decoder(1);
+  Message recovered;
+  // members after the first are received
+  for (int seq = 1; seq <= num_received; ++seq) decoder.AddBlock(Block(seq, 100, 1));
+  try {
+    decoder.AddParity(parity, &recovered);
+    FecDecoder::Members(parity);
+  } catch (const dmlc::Error&) {
+    return true;
+  }
+  return false;
+}
+
+void TestMalformed() {
+  FecEncoder encoder(1, 4, 0.001f);
+  std::vector<Message> parities;
+  for (int seq = 0; seq < 4; ++seq) encoder.Add(Block(seq, 100, 1), &parities);
+  CHECK_EQ(parities.size(), 1U);
+  const Message& parity = parities[0];
+  CHECK(!Rejects(parity));
+  CHECK_EQ(FecDecoder::Members(parity).size(), 4U);
+
+  // a count beyond the header, a negative one, and a header cut short
+  for (int n : {5, 1 << 30, -1}) {
+    Message bad = parity;
+    bad.data[1] = SArray<char>();
+    bad.data[1].CopyFrom(parity.data[1].data(), parity.data[1].size());
+    if (n == 5) bad.data[1].resize(sizeof(int) * (1 + 3 * 4) + 4);
+    memcpy(bad.data[1].data(), &n, sizeof(n));
+    CHECK(Rejects(bad)) << "a parity of " << n << " members in " << bad.data[1].size()
+                        << " bytes is accepted";
+  }
+  Message bad = parity;
+  bad.data[1] = SArray<char>(2);
+  CHECK(Rejects(bad)) << "a parity shorter than its count is accepted";
+  bad.data.resize(1);
+  CHECK(Rejects(bad)) << "a parity without values is accepted";
+
+  // a lost member longer than the parity block
+  Message longer = parity;
+  longer.data[1] = SArray<char>();
+  longer.data[1].CopyFrom(parity.data[1].data(), parity.data[1].size());
+  const int bytes = 1 << 20;
+  memcpy(longer.data[1].data() + sizeof(int) * 3, &bytes, sizeof(bytes));
+  CHECK(!Rejects(parity, 3));
+  CHECK(Rejects(longer, 3)) << "a member longer than the parity is rebuilt";
+}
+
+int main(int argc, char *argv[]) {
+  const int n = argc > 1 ? atoi(argv[1]) : 1000;
+  const int loss_percent = argc > 2 ? atoi(argv[2]) : 5;
+
+  FecEncoder encoder(2, 8, 0.001f);
+  FecDecoder decoder(2);
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<int> percent(0, 99);
+  int lost = 0, recovered = 0;
+  for (int seq = 0; seq < n; ++seq) {
+    // the last block of each channel is short, as the tail of a tensor
+    const int bytes = seq >= n - 2 ? 1000 + seq % 7 : 4096;
+    Message block = Block(seq, bytes, seq % 2 + 1);
+    std::vector<Message> parities;
+    encoder.Add(block, &parities);
+    if (seq == n - 1) encoder.FlushAll(&parities);
+    if (percent(gen) < loss_percent) {
+      ++lost;
+    } else {
+      decoder.AddBlock(block);
+    }
+    for (auto& parity : parities) {
+      CHECK_EQ(parity.meta.msg_type, kFecParityMsg);
+      parity.meta.sender = block.meta.sender;
+      Message rebuilt;
+      if (!decoder.AddParity(parity, &rebuilt)) continue;
+      ++recovered;
+      Message expected = Block(rebuilt.meta.seq, rebuilt.data[1].size(), parity.meta.channel);
+      CHECK_EQ(rebuilt.meta.msg_type, 1);
+      CHECK_EQ(rebuilt.meta.val_bytes, expected.meta.val_bytes);
+      CHECK_EQ(rebuilt.data[1].size(), expected.data[1].size());
+      CHECK_EQ(memcmp(rebuilt.data[1].data(), expected.data[1].data(), expected.data[1].size()), 0)
+        << "block " << rebuilt.meta.seq << " is rebuilt wrong";
+    }
+  }
+  CHECK_GT(recovered, 0);
+  LOG(INFO) << "lost " << lost << " of " << n << " blocks, recovered " << recovered;
+
+  // lossy channels get smaller groups, lossless ones the largest
+  std::vector<float> loss = decoder.Loss(9);
+  CHECK_EQ(loss.size(), 2U);
+  encoder.SetLoss({0.2f, 0});
+  CHECK_EQ(encoder.group_size(1), 1);
+  CHECK_EQ(encoder.group_size(2), 8);
+  encoder.SetLoss({0.02f, 0.001f});
+  CHECK_LT(encoder.group_size(1), encoder.group_size(2));
+  LOG(INFO) << encoder.Summary() << "; " << decoder.Summary();
+
+  TestHold();
+  TestMalformed();
+  return 0;
+}
@@ -0,0 +1,193 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks the fixed-layout data header against protobuf metas and
+ * measures the cost of encoding both.
+ *
+ * Usage: test_meta_codec [num_iters=1000000]
+ */
+#include <chrono>
+#include "ps/internal/message.h"
+#include "../src/meta.pb.h"
+#include "../src/packed_meta.h"
+using namespace ps;
+
+// mirrors the data message fields packed by Van::PackMeta
+void ToProtobuf(const Meta& meta, int sender, PBMeta* pb) {
+  pb->set_head(meta.head);
+  if (meta.app_id != Meta::kEmpty) pb->set_app_id(meta.app_id);
+  if (meta.timestamp != Meta::kEmpty) pb->set_timestamp(meta.timestamp);
+  if (meta.version != Meta::kEmpty) pb->set_version(meta.version);
+  if (meta.key != Meta::kEmpty) pb->set_key(meta.key);
+  if (meta.iters != Meta::kEmpty) pb->set_iters(meta.iters);
+  if (meta.resend_seq) pb->set_resend_seq(meta.resend_seq);
+  if (meta.resend_ack) pb->set_resend_ack(meta.resend_ack);
+  if (meta.trace_id) pb->set_trace_id(meta.trace_id);
+  if (meta.trace_ts) pb->set_trace_ts(meta.trace_ts);
+  pb->set_sender(sender);
+  pb->set_recver(meta.recver);
+  pb->set_bits_num(meta.bits_num);
+  pb->set_first_key(meta.first_key);
+  pb->set_seq_begin(meta.seq_begin);
+  pb->set_seq_end(meta.seq_end);
+  pb->set_seq(meta.seq);
+  pb->set_channel(meta.channel);
+  pb->set_msg_type(meta.msg_type);
+  pb->set_push_op(meta.push_op_num);
+  pb->set_val_bytes(meta.val_bytes);
+  pb->set_total_bytes(meta.total_bytes);
+  pb->set_keys_len(meta.keys_len);
+  pb->set_vals_len(meta.vals_len);
+  pb->set_lens_len(meta.lens_len);
+  for (auto v : meta.compr) pb->add_compr(v);
+  pb->set_push(meta.push);
+  pb->set_request(meta.request);
+  pb->set_simple_app(meta.simple_app);
+  pb->set_customer_id(meta.customer_id);
+  pb->set_priority(meta.priority);
+  for (auto d : meta.data_type) pb->add_data_type(d);
+}
+
+void CheckSame(const Meta& a, const Meta& b) {
+  CHECK_EQ(a.head, b.head);
+  CHECK_EQ(a.app_id, b.app_id);
+  CHECK_EQ(a.customer_id, b.customer_id);
+  CHECK_EQ(a.timestamp, b.timestamp);
+  CHECK_EQ(a.first_key, b.first_key);
+  CHECK_EQ(a.seq, b.seq);
+  CHECK_EQ(a.seq_begin, b.seq_begin);
+  CHECK_EQ(a.seq_end, b.seq_end);
+  CHECK_EQ(a.msg_type, b.msg_type);
+  CHECK_EQ(a.push_op_num, b.push_op_num);
+  CHECK_EQ(a.val_bytes, b.val_bytes);
+  CHECK_EQ(a.total_bytes, b.total_bytes);
+  CHECK_EQ(a.channel, b.channel);
+  CHECK_EQ(a.keys_len, b.keys_len);
+  CHECK_EQ(a.vals_len, b.vals_len);
+  CHECK_EQ(a.lens_len, b.lens_len);
+  CHECK_EQ(a.bits_num, b.bits_num);
+  CHECK_EQ(a.priority, b.priority);
+  CHECK_EQ(a.sender, b.sender);
+  CHECK_EQ(a.recver, b.recver);
+  CHECK_EQ(a.key, b.key);
+  CHECK_EQ(a.version, b.version);
+  CHECK_EQ(a.iters, b.iters);
+  CHECK_EQ(a.resend_seq, b.resend_seq);
+  CHECK_EQ(a.resend_ack, b.resend_ack);
+  CHECK_EQ(a.trace_id, b.trace_id);
+  CHECK_EQ(a.trace_ts, b.trace_ts);
+  CHECK_EQ(a.request, b.request);
+  CHECK_EQ(a.push, b.push);
+  CHECK_EQ(a.simple_app, b.simple_app);
+  CHECK(a.compr == b.compr);
+  CHECK(a.data_type == b.data_type);
+}
+
+Meta DGTBlockMeta() {
+  Meta meta;
+  meta.head = 3;
+  meta.app_id = 0;
+  meta.customer_id = 0;
+  meta.timestamp = 1234;
+  meta.first_key = 7;
+  meta.seq = 5;
+  meta.seq_begin = 0;
+  meta.seq_end = 63;
+  meta.msg_type = 1;
+  meta.val_bytes = 4096;
+  meta.total_bytes = 262144;
+  meta.channel = 2;
+  meta.keys_len = 8;
+  meta.vals_len = 4096;
+  meta.lens_len = 4;
+  meta.bits_num = 4;
+  meta.priority = -7;
+  meta.sender = 9;
+  meta.recver = 8;
+  meta.request = true;
+  meta.push = true;
+  meta.key = 7;
+  meta.version = 11;
+  meta.resend_seq = 42;
+  meta.resend_ack = (40ull << 32) | 5;
+  meta.trace_id = (7ull << 32) | 3;
+  meta.trace_ts = 1634425787123456;
+  for (int i = 0; i < 16; ++i) meta.compr.push_back(0.125f * i - 1);
+  meta.data_type = {UINT64, CHAR, INT32};
+  return meta;
+}
+
+int main(int argc, char *argv[]) {
+  const int n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+  // the magic byte has protobuf wire type 7, which no protobuf starts with
+  CHECK_EQ(kPackedMetaMagic & 7, 7);
+
+  Meta meta = DGTBlockMeta();
+  int size = PackedMetaSize(meta);
+  CHECK_EQ(size, kPackedMetaFixedSize + 16 * static_cast<int>(sizeof(float)));
+
+  // round trip of the packed header
+  char buf[sizeof(PackedMeta)];
+  EncodePackedMeta(meta, meta.sender, buf);
+  CHECK(IsPackedMeta(buf, size));
+  Meta packed;
+  DecodePackedMeta(buf, size, &packed);
+  CheckSame(meta, packed);
+
+  // a default meta keeps its kEmpty fields, as with protobuf
+  Meta empty;
+  empty.sender = 1;
+  EncodePackedMeta(empty, 1, buf);
+  Meta empty_packed;
+  DecodePackedMeta(buf, PackedMetaSize(empty), &empty_packed);
+  CheckSame(empty, empty_packed);
+
+  // the same meta through protobuf is never taken as a packed header
+  PBMeta pb;
+  ToProtobuf(meta, meta.sender, &pb);
+  std::string str;
+  CHECK(pb.SerializeToString(&str));
+  CHECK(!IsPackedMeta(str.data(), str.size()));
+  const size_t pb_size = str.size();
+  PBMeta pb_empty;
+  ToProtobuf(empty, 1, &pb_empty);
+  CHECK(pb_empty.SerializeToString(&str));
+  CHECK(!IsPackedMeta(str.data(), str.size()));
+
+  // control messages, bodies and large compr tables stay on protobuf
+  Meta ctrl = meta;
+  ctrl.control.cmd = Control::ACK;
+  CHECK_EQ(PackedMetaSize(ctrl), 0);
+  Meta body = meta;
+  body.body = "optimizer";
+  CHECK_EQ(PackedMetaSize(body), 0);
+  Meta compr = meta;
+  compr.compr.resize(kPackedMetaMaxCompr + 1);
+  CHECK_EQ(PackedMetaSize(compr), 0);
+
+  // encode cost
+  using clock = std::chrono::high_resolution_clock;
+  auto start = clock::now();
+  size_t sink = 0;
+  for (int i = 0; i < n; ++i) {
+    PBMeta p;
+    ToProtobuf(meta, meta.sender, &p);
+    int bytes = p.ByteSize();
+    char* out = new char[bytes + 1];
+    p.SerializeToArray(out, bytes);
+    sink += out[0];
+    delete [] out;
+  }
+  double pb_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / n;
+  start = clock::now();
+  for (int i = 0; i < n; ++i) {
+    meta.seq = i;
+    EncodePackedMeta(meta, meta.sender, buf);
+    sink += buf[8];
+  }
+  double packed_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / n;
+  LOG(INFO) << "encode protobuf " << pb_ns << " ns, packed " << packed_ns
+            << " ns, " << pb_size << " vs " << size << " bytes (" << sink % 2 << ")";
+  return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks the metrics registry: histogram quantiles stay within their
+ * bucket width, concurrent updates through a MetricTable add up, and the
+ * exporter serves the Prometheus text over HTTP.
+ *
+ * Usage: test_metrics [num_threads=8] [num_updates=100000]
+ */
+#include <random>
+#include "../src/metrics_exporter.h"
+using namespace ps;
+
+struct KeyMetrics {
+  Counter* pushes = nullptr;
+  Histogram* latency = nullptr;
+};
+
+std::string Scrape(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  CHECK_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+  const std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+  CHECK_EQ(send(fd, request.data(), request.size(), 0), static_cast<ssize_t>(request.size()));
+  std::string response;
+  char buf[4096];
+  ssize_t n;
+  while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) response.append(buf, n);
+  close(fd);
+  return response;
+}
+
+int main(int argc, char *argv[]) {
+  const int num_threads = argc > 1 ? atoi(argv[1]) : 8;
+  const int n = argc > 2 ? atoi(argv[2]) : 100000;
+
+  // quantiles of a long-tailed distribution are within 1 / kSub
+  Histogram h;
+  std::mt19937 gen(0);
+  std::lognormal_distribution<double> dist(7, 1.5);
+  std::vector<int64_t> values(n);
+  for (auto& v : values) {
+    v = static_cast<int64_t>(dist(gen));
+    h.Record(v);
+  }
+  std::sort(values.begin(), values.end());
+  for (double q : {0.5, 0.9, 0.99}) {
+    const double truth = values[static_cast<size_t>(std::ceil(q * n)) - 1];
+    const double got = h.Quantile(q);
+    CHECK_GE(got, truth) << "quantile " << q;
+    CHECK_LE(got, truth * (1 + 1.0 / Histogram::kSub) + 1) << "quantile " << q;
+  }
+  CHECK_EQ(h.max(), static_cast<uint64_t>(values.back()));
+  CHECK_EQ(h.count(), static_cast<uint64_t>(n));
+  for (uint64_t v : {0ull, 7ull, 8ull, 1000ull, 1ull << 40, ~0ull}) {
+    const int i = Histogram::Index(v);
+    CHECK_GE(Histogram::UpperBound(i), v);
+    CHECK(i == 0 || Histogram::UpperBound(i - 1) < v) << v;
+  }
+
+  // threads racing on the same keys share their series
+  MetricTable<KeyMetrics> keys([](int key) {
+    const std::string labels = Metrics::Labels({{"key", std::to_string(key)}});
+    KeyMetrics m;
+    m.pushes = Metrics::Get()->GetCounter("test_pushes_total", "pushes of a key", labels);
+    m.latency = Metrics::Get()->GetHistogram("test_latency_us", "latency of a key", labels);
+    return m;
+  }, 16);
+  const int num_keys = 12;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < n; ++i) {
+        const KeyMetrics& m = keys.Get((i + t) % num_keys);
+        m.pushes->Add();
+        m.latency->Record(i % 1000);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  int64_t total = 0;
+  for (int k = 0; k < num_keys; ++k) total += keys.Get(k).pushes->value();
+  CHECK_EQ(total, static_cast<int64_t>(num_threads) * n);
+  // keys past the capacity share one series
+  for (int k = num_keys; k < 16; ++k) keys.Get(k);
+  CHECK_EQ(keys.Get(100).pushes, keys.Get(101).pushes);
+  CHECK_NE(keys.Get(100).pushes, keys.Get(0).pushes);
+
+  Gauge* depth = Metrics::Get()->GetGauge("test_depth", "a level");
+  depth->Add(3);
+  depth->Add(-1);
+  Metrics::Get()->AddSampler("test_sampled", "a sampled level", "", [] { return 42.0; });
+
+  MetricsExporter exporter("127.0.0.1", 19100);
+  CHECK_GE(exporter.port(), 19100);
+  const std::string text = Scrape(exporter.port());
+  CHECK_NE(text.find("HTTP/1.0 200 OK"), std::string::npos) << text;
+  CHECK_NE(text.find("# TYPE test_pushes_total counter"), std::string::npos) << text;
+  CHECK_NE(text.find("test_pushes_total{key=\"0\"} "), std::string::npos) << text;
+  CHECK_NE(text.find("test_latency_us{key=\"0\",quantile=\"0.99\"} "), std::string::npos) << text;
+  CHECK_NE(text.find("test_depth 2\n"), std::string::npos) << text;
+  CHECK_NE(text.find("test_sampled 42\n"), std::string::npos) << text;
+
+  Metrics::Get()->RemoveSampler("test_sampled", "");
+  const std::string path = "/tmp/test_metrics.prom";
+  MetricsExporter::Dump(path);
+  std::ifstream is(path);
+  std::string dump((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+  CHECK_EQ(dump.find("test_sampled 42"), std::string::npos) << "removed samplers are not read";
+  CHECK_NE(dump.find("test_latency_us_count{key=\"0\"} "), std::string::npos) << dump;
+  std::remove(path.c_str());
+  LOG(INFO) << "p50 " << h.Quantile(0.5) << " p99 " << h.Quantile(0.99) << " max " << h.max();
+  return 0;
+}
@@ -0,0 +1,158 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks the decentralized TSEngine overlay on a simulated domain:
+ * broadcasts reach every node exactly once, pushes climb the tree of the last
+ * broadcast, and the gossiped throughput leads the root to fast links.
+ *
+ * Usage: test_overlay [num_workers=8] [num_rounds=40]
+ */
+#include <deque>
+#include <memory>
+#include <random>
+#include <set>
+#include "../src/overlay.h"
+using namespace ps;
+
+const int kRoot = 100;
+const int kKey = 7;
+
+struct Domain {
+  std::vector<int> ids;
+  std::map<int, std::unique_ptr<Overlay>> nodes;
+  std::map<std::pair<int, int>, int> thr;
+
+  explicit Domain(int num_workers, double greed_rate) {
+    std::vector<int> workers;
+    for (int r = 0; r < num_workers; ++r) workers.push_back(kRoot + 1 + 2 * r);
+    ids = workers;
+    ids.insert(ids.begin(), kRoot);
+    for (int id : ids) nodes[id].reset(new Overlay(id, kRoot, workers, greed_rate));
+    // the root reaches one worker fast, which reaches all others fast
+    const int hub = workers[num_workers / 2];
+    for (int a : ids) {
+      for (int b : ids) {
+        thr[{a, b}] = (a == kRoot && b == hub) || (a == hub && b != kRoot) ? 1000 : 10;
+      }
+    }
+  }
+
+  Message Deliver(Message msg, std::vector<Message>* triggers = nullptr) {
+    nodes[msg.meta.sender]->Annotate(&msg);
+    std::vector<Message> unused;
+    nodes[msg.meta.recver]->Receive(&msg, triggers ? triggers : &unused);
+    return msg;
+  }
+
+  /** \return parent of each node in the tree the broadcast took */
+  std::map<int, int> Broadcast(int round) {
+    std::map<int, int> parent;
+    std::deque<int> holders = {kRoot};
+    while (!holders.empty()) {
+      const int self = holders.front();
+      holders.pop_front();
+      int throughput = -1, last = -1;
+      while (true) {
+        int recver = nodes[self]->NextReceiver(kKey, round, throughput, last);
+        CHECK_NE(recver, Overlay::kUnassigned) << self << " got no subtree";
+        if (recver == -1) break;
+        CHECK(!parent.count(recver)) << recver << " is reached twice";
+        parent[recver] = self;
+        Message msg;
+        msg.meta.sender = self;
+        msg.meta.recver = recver;
+        msg.meta.request = true;
+        msg.meta.key = kKey;
+        msg.meta.iters = round;
+        msg.AddData(SArray<char>(8));
+        CHECK_EQ(Deliver(msg).meta.body.size(), 0U);
+        // the reply gossips back
+        Message reply;
+        reply.meta.sender = recver;
+        reply.meta.recver = self;
+        reply.meta.control.cmd = Control::AUTOPULLREPLY;
+        Deliver(reply);
+        holders.push_back(recver);
+        throughput = thr[{self, recver}];
+        last = recver;
+      }
+    }
+    CHECK_EQ(parent.size(), ids.size() - 1) << "some nodes are not reached";
+    return parent;
+  }
+
+  /** \brief pushes own data of all workers in random order up the tree */
+  void Push(const std::map<int, int>& parent, std::mt19937* gen) {
+    std::map<int, int> merged, own;
+    std::vector<Message> triggers;
+    auto send_on = [&](const Message& trigger) {
+      const int self = trigger.meta.recver, to = trigger.meta.iters;
+      CHECK_EQ(to, parent.at(self)) << self << " pushes off the tree";
+      int children = 0;
+      for (const auto& p : parent) children += p.second == self;
+      CHECK_EQ(merged[self], children) << self << " pushes before its children";
+      CHECK(to == kRoot || own[to]) << self << " pushes before " << to << " is ready";
+      Message data;
+      data.meta.sender = self;
+      data.meta.recver = to;
+      data.meta.request = true;
+      data.meta.push = true;
+      data.meta.key = kKey;
+      data.AddData(SArray<char>(8));
+      Deliver(data);
+      ++merged[to];
+      std::vector<Message> notices;
+      CHECK(nodes[to]->Ready(kKey, false, 0, 0, 0, &notices, &triggers));
+    };
+
+    std::vector<int> order(ids.begin() + 1, ids.end());
+    std::shuffle(order.begin(), order.end(), *gen);
+    for (int self : order) {
+      own[self] = 1;
+      std::vector<Message> notices;
+      CHECK(nodes[self]->Ready(kKey, true, 0, 0, 0, &notices, &triggers));
+      for (auto& notice : notices) {
+        CHECK(nodes[notice.meta.recver]->Receive(&notice, &triggers));
+      }
+      while (!triggers.empty()) {
+        Message trigger = triggers.back();
+        triggers.pop_back();
+        send_on(trigger);
+      }
+    }
+    int at_root = 0;
+    for (const auto& p : parent) at_root += p.second == kRoot;
+    CHECK_EQ(merged[kRoot], at_root) << "the root misses pushes";
+  }
+};
+
+int main(int argc, char *argv[]) {
+  const int num_workers = argc > 1 ? atoi(argv[1]) : 8;
+  const int rounds = argc > 2 ? atoi(argv[2]) : 40;
+  std::mt19937 gen(0);
+
+  Domain domain(num_workers, 1.0);
+  // no broadcast yet, pushes are left to the scheduler
+  std::vector<Message> notices, triggers;
+  CHECK(!domain.nodes[kRoot + 1]->Ready(kKey, true, 0, 0, 0, &notices, &triggers));
+
+  std::map<int, int> parent;
+  for (int round = 0; round < rounds; ++round) {
+    parent = domain.Broadcast(round);
+    domain.Push(parent, &gen);
+  }
+  // once links are measured, the root sends to the hub, which reaches the rest
+  const int hub = kRoot + 1 + 2 * (num_workers / 2);
+  for (const auto& p : parent) {
+    CHECK_EQ(p.second, p.first == hub ? kRoot : hub) << "slow link to " << p.first;
+  }
+  LOG(INFO) << "root: " << domain.nodes[kRoot]->Summary();
+
+  // exploring rounds still reach everyone once
+  Domain explore(num_workers, 0.5);
+  for (int round = 0; round < rounds; ++round) {
+    explore.Push(explore.Broadcast(round), &gen);
+  }
+  LOG(INFO) << "root with exploration: " << explore.nodes[kRoot]->Summary();
+  return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks the ordering of ThreadsafeQueue and measures messages/sec
+ * with several producers, as engine push threads feed the send queues,
+ * against the previous mutex-guarded std::priority_queue.
+ *
+ * Usage: test_priority_queue [num_producers=8] [num_msgs=200000] [num_priorities=64]
+ */
+#include <chrono>
+#include <queue>
+#include "ps/internal/threadsafe_queue.h"
+using namespace ps;
+
+class LegacyQueue {
+ public:
+  void Push(Message new_value) {
+    mu_.lock();
+    queue_.push(std::move(new_value));
+    mu_.unlock();
+    cond_.notify_all();
+  }
+
+  void WaitAndPop(Message* value) {
+    std::unique_lock<std::mutex> lk(mu_);
+    cond_.wait(lk, [this]{return !queue_.empty();});
+    *value = std::move(queue_.top());
+    queue_.pop();
+  }
+
+ private:
+  class Compare {
+   public:
+    bool operator()(Message &l, Message &r) {
+      return l.meta.priority <= r.meta.priority;
+    }
+  };
+  std::mutex mu_;
+  std::priority_queue<Message, std::vector<Message>, Compare> queue_;
+  std::condition_variable cond_;
+};
+
+template <typename Queue>
+double Run(Queue* queue, int num_producers, int num_msgs, int num_priorities, bool check) {
+  const int total = num_producers * num_msgs;
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<std::thread> producers;
+  for (int p = 0; p < num_producers; ++p) {
+    producers.emplace_back([=]() {
+      for (int i = 0; i < num_msgs; ++i) {
+        Message msg;
+        msg.meta.sender = p;
+        msg.meta.timestamp = i;
+        msg.meta.priority = -(i % num_priorities);
+        queue->Push(msg);
+      }
+    });
+  }
+  // last timestamp popped per producer and priority
+  std::vector<std::vector<int>> last(num_producers, std::vector<int>(num_priorities, -1));
+  for (int i = 0; i < total; ++i) {
+    Message msg;
+    queue->WaitAndPop(&msg);
+    if (check) {
+      int& prev = last[msg.meta.sender][-msg.meta.priority];
+      CHECK_GT(msg.meta.timestamp, prev) << "reordered within a priority";
+      prev = msg.meta.timestamp;
+    }
+  }
+  for (auto& t : producers) t.join();
+  double sec = std::chrono::duration<double>(
+      std::chrono::high_resolution_clock::now() - start).count();
+  return total / sec;
+}
+
+int main(int argc, char *argv[]) {
+  const int num_producers = argc > 1 ? atoi(argv[1]) : 8;
+  const int num_msgs = argc > 2 ? atoi(argv[2]) : 200000;
+  const int num_priorities = argc > 3 ? atoi(argv[3]) : 64;
+
+  // a backlog is popped by descending priority
+  ThreadsafeQueue queue;
+  for (int i = 0; i < 100; ++i) {
+    Message msg;
+    msg.meta.priority = (i * 37) % 11 - 5;
+    queue.Push(msg);
+  }
+  CHECK(!queue.empty());
+  int prev = 1 << 30;
+  for (int i = 0; i < 100; ++i) {
+    Message msg;
+    queue.WaitAndPop(&msg);
+    CHECK_LE(msg.meta.priority, prev);
+    prev = msg.meta.priority;
+  }
+  CHECK(queue.empty());
+  queue.WaitEmpty();
+
+  double rate = Run(&queue, num_producers, num_msgs, num_priorities, true);
+  LegacyQueue legacy;
+  double legacy_rate = Run(&legacy, num_producers, num_msgs, num_priorities, false);
+  LOG(INFO) << num_producers << " producers, " << num_priorities << " priorities: "
+            << rate / 1e6 << " M msgs/sec, legacy " << legacy_rate / 1e6
+            << " M msgs/sec, speedup " << rate / legacy_rate;
+  return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks the quantization codec of DGT blocks and the bounded residual
+ * pool, and measures the encode and decode throughput of each bit width.
+ *
+ * Usage: test_quantizer [num_floats=1048576] [num_iters=100]
+ */
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include "../src/quantizer.h"
+using namespace ps;
+
+std::vector<float> RandomBlock(size_t n, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::normal_distribution<float> dist(0, 1);
+  std::vector<float> x(n);
+  for (auto& v : x) v = dist(gen);
+  return x;
+}
+
+void CheckRoundTrip(size_t n, int bits, bool stochastic) {
+  std::vector<float> x = RandomBlock(n, n + bits);
+  std::vector<char> codes(Quantizer::PackedBytes(n, bits));
+  std::vector<float> residual(n), out(n);
+  auto range = Quantizer::Encode(x.data(), n, bits, stochastic, codes.data(), residual.data());
+  Quantizer::Decode(codes.data(), n, bits, range, out.data());
+  for (size_t i = 0; i < n; ++i) {
+    // decoded plus residual is what was encoded, within a step of it
+    CHECK_LT(std::fabs(out[i] + residual[i] - x[i]), 1e-4f * (1 + std::fabs(x[i])));
+    CHECK_LE(std::fabs(residual[i]), range.step * (stochastic ? 1.0001f : 0.5001f) + 1e-6f)
+      << "bits " << bits << " at " << i;
+  }
+}
+
+void CheckUnbiased(int bits) {
+  // one value between two codes decodes to itself on average
+  const size_t n = 1 << 16;
+  std::vector<float> x(n, 0.3f);
+  x[0] = 0;
+  x[1] = 1;
+  std::vector<char> codes(Quantizer::PackedBytes(n, bits));
+  std::vector<float> out(n);
+  auto range = Quantizer::Encode(x.data(), n, bits, true, codes.data());
+  Quantizer::Decode(codes.data(), n, bits, range, out.data());
+  double sum = 0;
+  for (size_t i = 2; i < n; ++i) sum += out[i];
+  CHECK_LT(std::fabs(sum / (n - 2) - 0.3), 0.01) << "bits " << bits;
+}
+
+void CheckResidualPool() {
+  const size_t n = 1024, block = n * sizeof(float);
+  ResidualPool pool(4 * block);
+  for (int seq = 0; seq < 8; ++seq) {
+    auto r = pool.Take(1, seq, n);
+    CHECK_EQ(r.size(), n);
+    CHECK_EQ(r[0], 0);
+    r[0] = seq + 1;
+    pool.Put(1, seq, std::move(r));
+    CHECK_LE(pool.bytes(), 4 * block);
+  }
+  CHECK_EQ(pool.num_dropped(), 4U);
+  // recent blocks keep their residual, recycled buffers come back zeroed
+  CHECK_EQ(pool.Take(1, 7, n)[0], 8);
+  CHECK_EQ(pool.Take(1, 0, n)[0], 0);
+}
+
+int main(int argc, char *argv[]) {
+  const size_t n = argc > 1 ? atoi(argv[1]) : 1 << 20;
+  const int iters = argc > 2 ? atoi(argv[2]) : 100;
+
+  for (int bits : {1, 2, 4, 8}) {
+    for (size_t size : {1, 7, 8, 13, 4096, 4099}) {
+      CheckRoundTrip(size, bits, false);
+      CheckRoundTrip(size, bits, true);
+    }
+    CheckUnbiased(bits);
+  }
+  // a constant block has no range
+  std::vector<float> constant(100, 2.5f), out(100);
+  std::vector<char> codes(Quantizer::PackedBytes(100, 4));
+  auto range = Quantizer::Encode(constant.data(), 100, 4, false, codes.data());
+  Quantizer::Decode(codes.data(), 100, 4, range, out.data());
+  for (float v : out) CHECK_EQ(v, 2.5f);
+  CheckResidualPool();
+
+  // throughput over fp32 bytes, blocks of each thread encode in parallel
+  using clock = std::chrono::high_resolution_clock;
+  const int nthreads = std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
+  std::vector<float> x = RandomBlock(n, 1);
+  for (int bits : {1, 2, 4, 8}) {
+    for (bool stochastic : {false, true}) {
+      std::vector<char> packed(Quantizer::PackedBytes(n, bits));
+      std::vector<float> residual(n), decoded(n);
+      auto start = clock::now();
+      for (int i = 0; i < iters; ++i) {
+        range = Quantizer::Encode(x.data(), n, bits, stochastic, packed.data(), residual.data());
+      }
+      double encode_s = std::chrono::duration<double>(clock::now() - start).count();
+      start = clock::now();
+      for (int i = 0; i < iters; ++i) {
+        Quantizer::Decode(packed.data(), n, bits, range, decoded.data());
+      }
+      double decode_s = std::chrono::duration<double>(clock::now() - start).count();
+
+      start = clock::now();
+      std::vector<std::thread> threads;
+      for (int t = 0; t < nthreads; ++t) {
+        threads.emplace_back([&]() {
+          std::vector<char> p(Quantizer::PackedBytes(n, bits));
+          std::vector<float> r(n);
+          for (int i = 0; i < iters; ++i) {
+            Quantizer::Encode(x.data(), n, bits, stochastic, p.data(), r.data());
+          }
+        });
+      }
+      for (auto& t : threads) t.join();
+      double parallel_s = std::chrono::duration<double>(clock::now() - start).count();
+
+      const double gb = static_cast<double>(n) * sizeof(float) * iters / 1e9;
+      LOG(INFO) << bits << " bits, " << (stochastic ? "stochastic" : "nearest")
+                << ": encode " << gb / encode_s << " GB/s, decode " << gb / decode_s
+                << " GB/s, encode on " << nthreads << " threads " << gb * nthreads / parallel_s
+                << " GB/s";
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,66 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks the bounded duplicate window and the timer wheel of the
+ * resender.
+ */
+#include "../src/resender.h"
+using namespace ps;
+
+int main(int argc, char *argv[]) {
+  // in order
+  ReceiveWindow window(64);
+  for (uint32_t seq = 1; seq <= 1000; ++seq) {
+    CHECK_EQ(window.Add(seq), ReceiveWindow::kNew);
+  }
+  CHECK_EQ(window.cum(), 1001);
+  CHECK_EQ(window.Ack(), 1001ull << 32);
+  CHECK_EQ(window.Add(1000), ReceiveWindow::kDuplicated);
+  CHECK_EQ(window.Add(1), ReceiveWindow::kDuplicated);
+
+  // a gap is acknowledged selectively until it is filled
+  CHECK_EQ(window.Add(1002), ReceiveWindow::kNew);
+  CHECK_EQ(window.Add(1004), ReceiveWindow::kNew);
+  CHECK_EQ(window.Add(1004), ReceiveWindow::kDuplicated);
+  CHECK_EQ(window.Ack(), (1001ull << 32) | 1 | 4);
+  CHECK_EQ(window.Add(1001 + 64), ReceiveWindow::kOutOfWindow);
+  CHECK_EQ(window.Add(1001), ReceiveWindow::kNew);
+  CHECK_EQ(window.cum(), 1003);
+  CHECK_EQ(window.Add(1003), ReceiveWindow::kNew);
+  CHECK_EQ(window.Ack(), 1005ull << 32);
+
+  // shuffled within the window, each seq is new exactly once
+  ReceiveWindow shuffled(4096);
+  std::vector<uint32_t> seqs;
+  for (uint32_t seq = 1; seq <= 100000; ++seq) seqs.push_back(seq);
+  for (size_t i = 0; i + 64 <= seqs.size(); i += 64) {
+    std::reverse(seqs.begin() + i, seqs.begin() + i + 64);
+  }
+  for (uint32_t seq : seqs) {
+    CHECK_EQ(shuffled.Add(seq), ReceiveWindow::kNew);
+    CHECK_EQ(shuffled.Add(seq), ReceiveWindow::kDuplicated);
+  }
+  CHECK_EQ(shuffled.cum(), 100001);
+
+  // deadlines beyond one turn of the wheel wait for their turn
+  TimerWheel<int> wheel(8);
+  wheel.Add(3, 3);
+  wheel.Add(11, 11);
+  wheel.Add(5, 5);
+  std::vector<int> expired;
+  wheel.Advance(4, &expired);
+  CHECK_EQ(expired.size(), 1);
+  CHECK_EQ(expired[0], 3);
+  wheel.Advance(10, &expired);
+  CHECK_EQ(expired.size(), 2);
+  CHECK_EQ(expired[1], 5);
+  wheel.Advance(20, &expired);
+  CHECK_EQ(expired.size(), 3);
+  CHECK_EQ(expired[2], 11);
+  // a deadline in the past fires on the next tick
+  wheel.Add(1, 1);
+  wheel.Advance(21, &expired);
+  CHECK_EQ(expired.size(), 4);
+  LOG(INFO) << "resender windows OK";
+  return 0;
+}
@@ -0,0 +1,79 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks that messages of any length, shorter and longer than the
+ * ring, go through a shared-memory ring in order and intact while the ring
+ * wraps many times.
+ *
+ * Usage: test_shm_ring [num_msgs=2000] [ring_bytes=4096]
+ */
+#include <random>
+#include <thread>
+#include "../src/shm_ring.h"
+using namespace ps;
+
+/** \brief byte i of message seq */
+char Byte(int seq, size_t i) { return static_cast<char>(seq * 131 + i * 7); }
+
+int main(int argc, char *argv[]) {
+  const int n = argc > 1 ? atoi(argv[1]) : 2000;
+  const uint64_t cap = argc > 2 ? atoll(argv[2]) : 4096;
+  CHECK_EQ(cap % 8, 0U);
+
+  std::vector<uint64_t> storage((sizeof(ShmRing) + cap) / 8 + 1);
+  ShmRing* ring = new (storage.data()) ShmRing();
+  ring->head.store(0);
+  ring->tail.store(0);
+
+  // lengths around 8 byte boundaries, half of the ring and several rings
+  std::mt19937 gen(0);
+  std::vector<size_t> lens(n);
+  for (int i = 0; i < n; ++i) {
+    const size_t max = i % 10 == 0 ? 3 * cap : i % 3 == 0 ? cap / 2 + 16 : 64;
+    lens[i] = std::uniform_int_distribution<size_t>(1, max)(gen);
+  }
+
+  std::thread producer([&]() {
+    std::mt19937 gen(1);
+    for (int seq = 0; seq < n; ++seq) {
+      std::vector<char> msg(lens[seq]);
+      for (size_t i = 0; i < msg.size(); ++i) msg[i] = Byte(seq, i);
+      // written in pieces, as SHMVan writes the header, meta and arrays
+      ShmRingWriter w(ring, cap, msg.size());
+      for (size_t i = 0; i < msg.size(); ) {
+        const size_t k = std::min(msg.size() - i,
+                                  std::uniform_int_distribution<size_t>(1, 100)(gen));
+        w.Write(msg.data() + i, k);
+        i += k;
+      }
+      w.Close();
+    }
+  });
+
+  ShmRingReader reader(ring, cap);
+  int seq = 0, joined = 0;
+  while (seq < n) {
+    // yields when idle as the poller of SHMVan does
+    const bool got = reader.Poll([&](const char* data, size_t len, const ShmRingReader::Buffer& buf) {
+      CHECK_LT(seq, n) << "more messages than sent";
+      CHECK_EQ(len, lens[seq]) << "message " << seq << " out of order or cut";
+      for (size_t i = 0; i < len; ++i) {
+        CHECK_EQ(data[i], Byte(seq, i)) << "byte " << i << " of message " << seq;
+      }
+      if (buf) {
+        CHECK_GT(len, ShmRing::MaxRecord(cap)) << "a short message was split";
+        ++joined;
+      } else {
+        CHECK_LE(len, ShmRing::MaxRecord(cap)) << "a long message was not split";
+      }
+      ++seq;
+    });
+    if (!got) std::this_thread::yield();
+  }
+  producer.join();
+  CHECK_EQ(ring->head.load(), ring->tail.load());
+  CHECK_GT(ring->head.load() / cap, static_cast<uint64_t>(n) / 10) << "the ring barely wrapped";
+  LOG(INFO) << n << " messages in order, " << joined << " joined from several records, "
+            << "the ring wrapped " << ring->head.load() / cap << " times";
+  return 0;
+}
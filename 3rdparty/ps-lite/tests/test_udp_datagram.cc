@@ -0,0 +1,109 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks that DGT messages sent over udp channels come back intact
+ * from their datagram, quantized values included, and that truncated or
+ * corrupted datagrams are dropped instead of rebuilt into wrong messages.
+ *
+ * Usage: test_udp_datagram [num_msgs=10000]
+ */
+#include <random>
+#include "../src/packed_meta.h"
+#include "../src/udp_datagram.h"
+using namespace ps;
+
+std::mt19937 gen(0);
+
+Message RandomBlock(int seq) {
+  Message msg;
+  msg.meta.sender = 9;
+  msg.meta.recver = 8;
+  msg.meta.first_key = seq % 7;
+  msg.meta.timestamp = seq / 7;
+  msg.meta.seq = seq;
+  msg.meta.channel = 1 + seq % 3;
+  const int num_data = std::uniform_int_distribution<int>(0, 3)(gen);
+  if (num_data == 0) return msg;
+  SArray<uint64_t> keys(1, seq % 7);
+  msg.AddData(keys);
+  msg.meta.keys_len = msg.data.back().size();
+  const int vals = std::uniform_int_distribution<int>(0, 4096)(gen);
+  SArray<char> val(vals);
+  for (int i = 0; i < vals; ++i) val[i] = static_cast<char>(seq * 31 + i);
+  msg.AddData(val);
+  // quantized values are shorter than the vals_len kept in the meta
+  msg.meta.vals_len = seq % 2 ? vals * 4 : vals;
+  if (num_data == 3) {
+    SArray<int> lens(1, vals);
+    msg.AddData(lens);
+    msg.meta.lens_len = msg.data.back().size();
+  }
+  return msg;
+}
+
+std::vector<char> Datagram(const Message& msg) {
+  const int meta_size = PackedMetaSize(msg.meta);
+  CHECK_GT(meta_size, 0);
+  std::vector<char> buf(UdpDatagramSize(meta_size, msg));
+  FillUdpDatagram(meta_size, msg, buf.data());
+  EncodePackedMeta(msg.meta, msg.meta.sender, buf.data() + sizeof(int32_t));
+  return buf;
+}
+
+/** \brief the receive path of ZMQVan::RecvMsg_UDP, false if dropped */
+bool Receive(std::vector<char>* buf, std::shared_ptr<void> owner, Message* msg) {
+  const int meta_size = UdpDatagramMetaSize(buf->data(), buf->size());
+  if (meta_size < 0 || !SplitUdpDatagram(buf->data(), buf->size(), meta_size, owner, msg)) {
+    return false;
+  }
+  if (!IsPackedMeta(buf->data() + sizeof(int32_t), meta_size)) return false;
+  DecodePackedMeta(buf->data() + sizeof(int32_t), meta_size, &msg->meta);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  const int n = argc > 1 ? atoi(argv[1]) : 10000;
+
+  int released = 0;
+  for (int seq = 0; seq < n; ++seq) {
+    Message msg = RandomBlock(seq);
+    std::vector<char> buf = Datagram(msg);
+    const int before = released;
+    {
+      Message got;
+      std::shared_ptr<void> owner(&released, [](void* p) { ++*static_cast<int*>(p); });
+      CHECK(Receive(&buf, owner, &got)) << "dropped an intact datagram of " << buf.size();
+      owner.reset();
+      CHECK_EQ(got.meta.seq, seq);
+      CHECK_EQ(got.meta.vals_len, msg.meta.vals_len);
+      CHECK_EQ(got.data.size(), msg.data.size());
+      for (size_t i = 0; i < msg.data.size(); ++i) {
+        CHECK_EQ(got.data[i].size(), msg.data[i].size()) << "data " << i << " of " << seq;
+        CHECK_EQ(memcmp(got.data[i].data(), msg.data[i].data(), msg.data[i].size()), 0);
+      }
+      // the data arrays keep the datagram alive
+      CHECK_EQ(released, before + msg.data.empty()) << "released while the message holds it";
+    }
+    CHECK_EQ(released, before + 1) << "datagram of " << seq << " not released";
+
+    // a truncated datagram never makes a message
+    const size_t cut = std::uniform_int_distribution<size_t>(0, buf.size() - 1)(gen);
+    std::vector<char> truncated(buf.begin(), buf.begin() + cut);
+    Message got;
+    CHECK(!Receive(&truncated, nullptr, &got)) << "took " << cut << " of " << buf.size();
+    CHECK(got.data.empty());
+
+    // nor does one whose size fields are corrupted
+    std::vector<char> corrupted = buf;
+    const size_t sizes = sizeof(int32_t) + PackedMetaSize(msg.meta);
+    const size_t at = sizes + sizeof(int32_t) *
+        std::uniform_int_distribution<size_t>(0, msg.data.size())(gen);
+    int32_t value;
+    memcpy(&value, corrupted.data() + at, sizeof(value));
+    value += std::uniform_int_distribution<int>(1, 100)(gen);
+    memcpy(corrupted.data() + at, &value, sizeof(value));
+    CHECK(!Receive(&corrupted, nullptr, &got)) << "took a corrupted size at " << at;
+  }
+  LOG(INFO) << n << " messages round tripped, truncated and corrupted ones dropped";
+  return 0;
+}
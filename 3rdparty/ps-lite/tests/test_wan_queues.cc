@@ -0,0 +1,73 @@
+/**
+ *  Copyright (c) 2021 by Contributors at INET-RC
+ *
+ * \brief checks the link queues of the wan van: messages of one connection
+ * never overtake each other, whatever their marking, and strict priority
+ * picks among connections by the class of their oldest message.
+ *
+ * Usage: test_wan_queues [num_msgs=100000]
+ */
+#include <random>
+#include "ps/internal/postoffice.h"
+#include "../src/wan_van.h"
+using namespace ps;
+
+struct Msg {
+  int connection;
+  int cls;
+  int seq;
+};
+
+int main(int argc, char *argv[]) {
+  const int n = argc > 1 ? atoi(argv[1]) : 100000;
+
+  // a DGT block of channel 0 marked high on TCP after an unmarked TCP message
+  LinkQueues<Msg> link(true);
+  link.Push(-1, 0, Msg{-1, 0, 0});
+  link.Push(2, 1, Msg{2, 1, 1});
+  link.Push(-1, 3, Msg{-1, 3, 2});
+  CHECK_EQ(link.Pop().seq, 1) << "the udp channel has the highest class in front";
+  CHECK_EQ(link.Pop().seq, 0) << "a marked tcp message overtook an unmarked one";
+  CHECK_EQ(link.Pop().seq, 2);
+  CHECK(link.empty());
+
+  for (bool strict : {true, false}) {
+    std::mt19937 gen(strict);
+    LinkQueues<Msg> queues(strict);
+    // what is still queued per connection, to check the choice against
+    std::map<int, std::deque<Msg>> model;
+    int pushed = 0, popped = 0;
+    while (popped < n) {
+      if (pushed < n && std::uniform_int_distribution<int>(0, 2)(gen)) {
+        // tcp messages carry any class, each udp channel a fixed one
+        const int connection = std::uniform_int_distribution<int>(-1, 3)(gen);
+        const int cls = connection < 0 ? std::uniform_int_distribution<int>(0, 7)(gen)
+                                       : 3 - connection;
+        Msg m{connection, cls, pushed++};
+        queues.Push(connection, cls, m);
+        model[connection].push_back(m);
+        continue;
+      }
+      if (queues.empty()) continue;
+      const Msg m = queues.Pop();
+      ++popped;
+      auto& q = model[m.connection];
+      CHECK_EQ(q.front().seq, m.seq) << "message " << m.seq << " overtook " << q.front().seq
+                                     << " on connection " << m.connection;
+      q.pop_front();
+      for (const auto& other : model) {
+        if (other.first == m.connection || other.second.empty()) continue;
+        const Msg& front = other.second.front();
+        if (strict) {
+          CHECK(front.cls < m.cls || (front.cls == m.cls && front.seq > m.seq))
+              << "connection " << other.first << " had a higher class in front";
+        } else {
+          CHECK_GT(front.seq, m.seq) << "fifo sent " << m.seq << " before " << front.seq;
+        }
+      }
+    }
+    CHECK(queues.empty());
+    LOG(INFO) << n << " messages, " << (strict ? "strict" : "fifo") << ": order kept";
+  }
+  return 0;
+}
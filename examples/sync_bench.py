@@ -0,0 +1,108 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+"""Measures the time of a synchronization round, i.e. pushing the gradients
+of all keys and pulling the updated parameters back, with synthetic tensors.
+Keys are sized geometrically, no smaller than --min-kb and about --model-mb in
+total, so that both tiny and big tensors are synchronized as in a real model."""
+
+import os
+import time
+import mxnet as mx
+import argparse
+import logging
+import numpy as np
+
+
+def key_sizes(num_keys, model_mb, min_kb):
+    """Number of float32 elements of each key, summing to about model_mb."""
+    total = int(model_mb * (1 << 20) / 4)
+    smallest = max(int(min_kb * 1024 / 4), 1)
+    weights = np.geomspace(1, max(total / smallest, 1), num_keys)
+    sizes = np.maximum((weights / weights.sum() * total).astype(int), smallest)
+    return [int(s) for s in sizes]
+
+
+def main():
+    logging.basicConfig(level=logging.INFO)
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-nk", "--num-keys", type=int, default=16)
+    parser.add_argument("-mb", "--model-mb", type=float, default=16)
+    parser.add_argument("-kb", "--min-kb", type=float, default=4)
+    parser.add_argument("-r", "--rounds", type=int, default=50)
+    parser.add_argument("-w", "--warmup", type=int, default=5)
+    parser.add_argument('-ms', '--mixed-sync', action="store_true")
+    parser.add_argument("-gc", "--gc-type", type=str, default="none",
+                        help="gradient compression of local servers, e.g. 2bit, bsc, powersgd")
+    parser.add_argument("-gt", "--gc-threshold", type=float, default=None)
+    parser.add_argument("-gr", "--gc-rank", type=int, default=None)
+    args = parser.parse_args()
+
+    enable_tsengine = int(os.getenv('ENABLE_INTER_TS', 0)) \
+                          or int(os.getenv('ENABLE_INTRA_TS', 0))
+    kvstore_dist = mx.kv.create("dist_async" if args.mixed_sync else "dist_sync")
+    is_master_worker = kvstore_dist.is_master_worker
+    if is_master_worker:
+        kvstore_dist.set_optimizer(mx.optimizer.SGD(learning_rate=0.01))
+        if args.gc_type != "none":
+            compression = {"type": args.gc_type}
+            if args.gc_threshold is not None: compression["threshold"] = args.gc_threshold
+            if args.gc_rank is not None: compression["rank"] = args.gc_rank
+            kvstore_dist.set_gradient_compression(compression)
+    num_all_workers = kvstore_dist.num_all_workers
+    my_rank = kvstore_dist.rank
+    # waiting for configurations to complete
+    time.sleep(1)
+
+    sizes = key_sizes(args.num_keys, args.model_mb, args.min_kb)
+    params = [mx.nd.zeros((size,)) for size in sizes]
+    grads = [mx.nd.random.uniform(-1, 1, shape=(size,)) for size in sizes]
+    # keys of one init call can share a fusion bucket
+    keys = list(range(len(params)))
+    kvstore_dist.init(keys, params)
+    if not is_master_worker:
+        kvstore_dist.pull(keys, out=params)
+    mx.nd.waitall()
+
+    if is_master_worker: return
+
+    print("Start benchmark on %d workers, my rank is %d, %d keys of %.2f MB in total."
+          % (num_all_workers, my_rank, len(sizes), sum(sizes) * 4 / (1 << 20)))
+    sync_times = []
+    for it in range(args.warmup + args.rounds):
+        begin_time = time.time()
+        for idx, (param, grad) in enumerate(zip(params, grads)):
+            kvstore_dist.push(idx, grad, priority=-idx)
+            kvstore_dist.pull(idx, param, priority=-idx)
+            if enable_tsengine: mx.nd.waitall()
+        mx.nd.waitall()
+        sync_time = time.time() - begin_time
+        if it < args.warmup: continue
+        sync_times.append(sync_time)
+        print("[Round %d] Sync Time %.3f ms" % (it - args.warmup + 1, sync_time * 1000))
+
+    sync_times = np.array(sync_times) * 1000
+    print("[Rank %d] Sync Time mean %.3f ms, p50 %.3f ms, p95 %.3f ms, max %.3f ms"
+          % (my_rank, sync_times.mean(), np.percentile(sync_times, 50),
+             np.percentile(sync_times, 95), sync_times.max()))
+
+
+if __name__ == "__main__":
+    main()
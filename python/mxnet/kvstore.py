@@ -92,10 +92,43 @@ def _get_kvstore_server_command_type(command):
                      'kStopServer': 2,
                      'kSyncMode': 3,
                      'kSetGradientCompression': 4,
-                     'kSetProfilerParams': 5}
+                     'kSetProfilerParams': 5,
+                     'kSetServerOptimizer': 7,
+                     'kSetKeySizes': 8}
     assert (command in command_types), "Unknown command type to send to server"
     return command_types[command]
 
+def _native_server_optimizer_str(optimizer):
+    """Encodes the optimizer for the native optimizer of global servers.
+
+    Returns None if the optimizer can only be applied by the python updater,
+    e.g. with a learning rate scheduler or per-parameter multipliers.
+    """
+    names = {opt.SGD: 'sgd', opt.Adam: 'adam', opt.DCASGD: 'dcasgd'}
+    # pylint: disable=unidiomatic-typecheck
+    if type(optimizer) not in names or optimizer.lr_scheduler is not None:
+        return None
+    if any(v != 1.0 for v in optimizer.lr_mult.values()):
+        return None
+    if optimizer.wd != 0 and any(v != 1.0 for v in optimizer.wd_mult.values()):
+        return None
+    params = {'optimizer': names[type(optimizer)],
+              'learning_rate': optimizer.lr,
+              'wd': optimizer.wd,
+              'rescale_grad': optimizer.rescale_grad}
+    if optimizer.clip_gradient is not None:
+        params['clip_gradient'] = optimizer.clip_gradient
+    if isinstance(optimizer, (opt.SGD, opt.DCASGD)):
+        params['momentum'] = optimizer.momentum
+    if isinstance(optimizer, opt.Adam):
+        params['beta1'] = optimizer.beta1
+        params['beta2'] = optimizer.beta2
+        params['epsilon'] = optimizer.epsilon
+    if isinstance(optimizer, opt.DCASGD):
+        params['lamda'] = optimizer.lamda
+    return ','.join('%s:%s' % (k, repr(v) if isinstance(v, float) else v)
+                    for k, v in params.items())
+
 class KVStore(object):
     """A key-value store for synchronization of values, over multiple devices."""
     def __init__(self, handle):
@@ -431,13 +464,17 @@ class KVStore(object):
         a dictionary which includes `threshold` like:
         {'type': '2bit', 'threshold': 0.5}
 
+        PowerSGD compression takes a positive int `rank`, local servers then push
+        rank-`rank` factors of each large gradient to global servers, keeping what the
+        factors miss for the next round, e.g. {'type': 'powersgd', 'rank': 4}
+
         Parameters
         ----------
         compression_params : dict
             A dictionary specifying the type and parameters for gradient compression.
             The key `type` in this dictionary is a
             required string argument and specifies the type of gradient compression.
-            Currently `type` can be only `2bit`
+            Currently `type` can be `2bit`, `bsc` or `powersgd`
             Other keys in this dictionary are optional and specific to the type
             of gradient compression.
         """
@@ -492,6 +529,10 @@ class KVStore(object):
                 raise
             cmd = _get_kvstore_server_command_type('kController')
             self._send_command_to_servers(cmd, optim_str)
+            native_str = _native_server_optimizer_str(optimizer)
+            if native_str is not None:
+                cmd = _get_kvstore_server_command_type('kSetServerOptimizer')
+                self._send_command_to_servers(cmd, native_str)
             if optimizer.multi_precision:
                 cmd = _get_kvstore_server_command_type('kSetMultiPrecision')
                 self._send_command_to_servers(cmd, '')
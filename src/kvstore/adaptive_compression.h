@@ -0,0 +1,373 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file adaptive_compression.h
+ * \brief per-key choice of the compression of pushes to global servers,
+ * driven by the goodput of the links
+ */
+#ifndef MXNET_KVSTORE_ADAPTIVE_COMPRESSION_H_
+#define MXNET_KVSTORE_ADAPTIVE_COMPRESSION_H_
+#include <dmlc/logging.h>
+#include <mshadow/base.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "./bsc_codec.h"
+
+namespace mxnet {
+namespace kvstore {
+namespace adaptive {
+
+enum Mode : uint32_t {
+  kRaw, kFP16, kTwoBit, kBSC
+};
+
+/**
+ * \brief leads each encoded part, so that the receiver decodes it without
+ * knowing the mode the sender picked
+ */
+struct Header {
+  uint32_t mode;
+  /** \brief number of fp32 elements of the part */
+  uint32_t size;
+  /** \brief the 2-bit threshold or the BSC ratio */
+  float param;
+  /** \brief number of (value, index) pairs of BSC */
+  uint32_t num_pairs;
+};
+
+inline int64_t NumPairs(int64_t size, float ratio) {
+  return std::min<int64_t>(size, std::max<int64_t>(1, std::ceil(size * ratio)));
+}
+
+/** \brief bytes of an encoded part, header included */
+inline size_t EncodedBytes(Mode mode, int64_t size, float param) {
+  size_t bytes = 0;
+  switch (mode) {
+    case kRaw: bytes = size * sizeof(float); break;
+    case kFP16: bytes = (size + 1) / 2 * sizeof(float); break;
+    case kTwoBit: bytes = (size + 15) / 16 * sizeof(uint32_t); break;
+    case kBSC: bytes = NumPairs(size, param) * 2 * sizeof(float); break;
+  }
+  return sizeof(Header) + bytes;
+}
+
+/**
+ * \brief encodes x with error feedback: the residual of the previous rounds is
+ * added before encoding and what the encoding loses is kept in it, whichever
+ * modes the rounds use
+ * \param out at least EncodedBytes(mode, size, param) bytes
+ */
+inline void Encode(Mode mode, const float* x, float* residual, int64_t size, float param,
+                   char* out, int nthreads) {
+  Header* header = reinterpret_cast<Header*>(out);
+  header->mode = mode;
+  header->size = static_cast<uint32_t>(size);
+  header->param = param;
+  header->num_pairs = 0;
+  float* r = residual;
+  #pragma omp parallel for num_threads(nthreads) schedule(static)
+  for (int64_t i = 0; i < size; ++i) r[i] += x[i];
+
+  char* body = out + sizeof(Header);
+  switch (mode) {
+    case kRaw: {
+      std::memcpy(body, r, size * sizeof(float));
+      std::memset(r, 0, size * sizeof(float));
+      break;
+    }
+    case kFP16: {
+      auto* h = reinterpret_cast<mshadow::half::half_t*>(body);
+      #pragma omp parallel for num_threads(nthreads) schedule(static)
+      for (int64_t i = 0; i < size; ++i) {
+        h[i] = mshadow::half::half_t(r[i]);
+        r[i] -= static_cast<float>(h[i]);
+      }
+      if (size % 2) h[size] = mshadow::half::half_t(0.0f);
+      break;
+    }
+    case kTwoBit: {
+      // 16 codes per word, 1 for +param, 2 for -param
+      auto* words = reinterpret_cast<uint32_t*>(body);
+      const int64_t num_words = (size + 15) / 16;
+      #pragma omp parallel for num_threads(nthreads) schedule(static)
+      for (int64_t w = 0; w < num_words; ++w) {
+        uint32_t word = 0;
+        const int64_t end = std::min(size, (w + 1) * 16);
+        for (int64_t i = w * 16; i < end; ++i) {
+          uint32_t code = 0;
+          if (r[i] >= param) {
+            code = 1;
+            r[i] -= param;
+          } else if (r[i] <= -param) {
+            code = 2;
+            r[i] += param;
+          }
+          word |= code << ((i - w * 16) * 2);
+        }
+        words[w] = word;
+      }
+      break;
+    }
+    case kBSC: {
+      const int64_t num_pairs = NumPairs(size, param);
+      // the boundary is estimated on a sample, as GradientCompression does
+      const int64_t sample_size = std::min<int64_t>(size, 1 << 16);
+      std::vector<float> sample;
+      bsc::SampleAbs(r, size, sample_size, static_cast<uint32_t>(size), &sample);
+      const float bound = bsc::TopKBoundary(&sample, NumPairs(sample_size, param));
+      float* zip = reinterpret_cast<float*>(body);
+      header->num_pairs = static_cast<uint32_t>(num_pairs);
+      bsc::Gather(r, size, bsc::AbsGreaterEqual(bound), zip, num_pairs, nthreads,
+                  [r](int64_t i) { r[i] = 0; });
+      break;
+    }
+    default:
+      LOG(FATAL) << "unknown compression mode " << mode;
+  }
+}
+
+/**
+ * \brief decodes a part encoded by \ref Encode into size fp32 elements
+ */
+inline void Decode(const char* in, size_t bytes, float* out, int64_t size, int nthreads) {
+  CHECK_GE(bytes, sizeof(Header));
+  const Header* header = reinterpret_cast<const Header*>(in);
+  const Mode mode = static_cast<Mode>(header->mode);
+  CHECK_EQ(header->size, static_cast<uint32_t>(size)) << "encoded part has a different size";
+  CHECK_EQ(bytes, EncodedBytes(mode, size, header->param)) << "truncated part of mode " << mode;
+  const char* body = in + sizeof(Header);
+  switch (mode) {
+    case kRaw:
+      std::memcpy(out, body, size * sizeof(float));
+      break;
+    case kFP16: {
+      const auto* h = reinterpret_cast<const mshadow::half::half_t*>(body);
+      #pragma omp parallel for num_threads(nthreads) schedule(static)
+      for (int64_t i = 0; i < size; ++i) out[i] = static_cast<float>(h[i]);
+      break;
+    }
+    case kTwoBit: {
+      const auto* words = reinterpret_cast<const uint32_t*>(body);
+      const float value[] = {0, header->param, -header->param, 0};
+      #pragma omp parallel for num_threads(nthreads) schedule(static)
+      for (int64_t i = 0; i < size; ++i) {
+        out[i] = value[(words[i / 16] >> ((i % 16) * 2)) & 3];
+      }
+      break;
+    }
+    case kBSC:
+      bsc::Decompress(reinterpret_cast<const float*>(body), header->num_pairs, out, size,
+                      nthreads);
+      break;
+    default:
+      LOG(FATAL) << "unknown compression mode " << mode;
+  }
+}
+
+/**
+ * \brief picks the mode of each key every round, so that the pushes of a round
+ * fit in the target sync time at the goodput of each link.
+ *
+ * The goodput of a link to a global server is measured over its busy periods,
+ * from the first push sent while no push was outstanding to the arrival of the
+ * last one on the global server, as the bytes the van handed to the link in
+ * between over the duration. Global servers hold pushes until all parties
+ * pushed, and tell in their responses for how long, so that the wait for the
+ * other parties is left out of the estimate.
+ *
+ * A round starts when a key is pushed a second time. Keys start raw; while a
+ * link would take longer than the target, the biggest keys on it are moved to
+ * the next cheaper mode, one level at a time, so that small keys stay exact as
+ * long as possible.
+ */
+class CompressionController {
+ public:
+  /**
+   * \param target_ms target time to push all keys of a round
+   * \param two_bit_threshold threshold of the 2-bit mode
+   * \param bsc_ratio share of the elements BSC keeps
+   */
+  void Init(int num_links, double target_ms, float two_bit_threshold, float bsc_ratio) {
+    std::lock_guard<std::mutex> lk(mu_);
+    CHECK_GT(num_links, 0);
+    CHECK_GT(target_ms, 0) << "target sync time must be positive";
+    CHECK_GT(two_bit_threshold, 0);
+    CHECK(bsc_ratio > 0 && bsc_ratio <= 1) << "BSC ratio must be in (0, 1]";
+    links_.assign(num_links, Link());
+    target_ms_ = target_ms;
+    param_[kRaw] = param_[kFP16] = 0;
+    param_[kTwoBit] = two_bit_threshold;
+    param_[kBSC] = bsc_ratio;
+    // levels by decreasing size of the encoding
+    levels_ = {kRaw, kFP16, kTwoBit, kBSC};
+    std::stable_sort(levels_.begin(), levels_.end(), [this](Mode a, Mode b) {
+      return EncodedBytes(a, 1 << 20, param_[a]) > EncodedBytes(b, 1 << 20, param_[b]);
+    });
+  }
+
+  bool enabled() const { return !links_.empty(); }
+
+  float param(Mode mode) const { return param_[mode]; }
+
+  /**
+   * \brief the mode of a push of key, starts a new round if key was pushed in
+   * the current one
+   * \param parts the link and number of elements of each part of the key
+   */
+  Mode Choose(int key, const std::vector<std::pair<int, int64_t>>& parts) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto& k = keys_[key];
+    if (k.parts.empty()) k.parts = parts;
+    if (k.round == round_) {
+      ++round_;
+      Plan();
+    }
+    k.round = round_;
+    return k.mode;
+  }
+
+  /** \brief a push to link is sent, sent_bytes is the counter of the van before */
+  void OnPush(int link, size_t sent_bytes) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Link& l = links_.at(link);
+    if (l.outstanding++ == 0) {
+      l.start = l.end = std::chrono::steady_clock::now();
+      l.start_bytes = sent_bytes;
+    }
+  }
+
+  /**
+   * \brief a push to link is acknowledged
+   * \param held_us how long the global server held the push before responding
+   */
+  void OnAck(int link, size_t sent_bytes, int64_t held_us) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Link& l = links_.at(link);
+    if (l.outstanding == 0) return;
+    const auto arrived = std::chrono::steady_clock::now() - std::chrono::microseconds(held_us);
+    l.end = std::max(l.end, arrived);
+    if (--l.outstanding > 0) return;
+    const double elapsed = std::chrono::duration<double, std::milli>(l.end - l.start).count();
+    if (elapsed <= 0 || sent_bytes <= l.start_bytes) return;
+    const double sample = (sent_bytes - l.start_bytes) / elapsed;
+    l.goodput = l.goodput == 0 ? sample : kAlpha * sample + (1 - kAlpha) * l.goodput;
+  }
+
+  /** \brief bytes per millisecond of a link, 0 before the first measurement */
+  double goodput(int link) {
+    std::lock_guard<std::mutex> lk(mu_);
+    return links_.at(link).goodput;
+  }
+
+ private:
+  struct Link {
+    int outstanding = 0;
+    std::chrono::steady_clock::time_point start;
+    /** \brief the latest arrival of a push of the busy period on the global server */
+    std::chrono::steady_clock::time_point end;
+    size_t start_bytes = 0;
+    double goodput = 0;
+  };
+  struct Key {
+    std::vector<std::pair<int, int64_t>> parts;
+    Mode mode = kRaw;
+    int64_t round = -1;
+  };
+
+  size_t Bytes(const Key& k, int level, int link) const {
+    size_t bytes = 0;
+    const Mode mode = levels_[level];
+    for (const auto& part : k.parts) {
+      if (part.first == link) bytes += EncodedBytes(mode, part.second, param_[mode]);
+    }
+    return bytes;
+  }
+
+  /** \brief assigns the modes of the next round. mu_ is held */
+  void Plan() {
+    const int num_links = links_.size();
+    std::vector<double> budget(num_links), load(num_links, 0);
+    for (int l = 0; l < num_links; ++l) {
+      // stay raw until every link was measured
+      if (links_[l].goodput == 0) return;
+      budget[l] = links_[l].goodput * target_ms_;
+    }
+    std::vector<std::pair<size_t, Key*>> order;
+    std::unordered_map<Key*, int> level;
+    for (auto& it : keys_) {
+      Key* k = &it.second;
+      size_t bytes = 0;
+      for (int l = 0; l < num_links; ++l) {
+        load[l] += Bytes(*k, 0, l);
+        bytes += Bytes(*k, 0, l);
+      }
+      order.emplace_back(bytes, k);
+      level[k] = 0;
+    }
+    std::sort(order.begin(), order.end(),
+              [](const std::pair<size_t, Key*>& a, const std::pair<size_t, Key*>& b) {
+                return a.first > b.first;
+              });
+    auto overloaded = [&](const Key* k) {
+      for (const auto& part : k->parts) {
+        if (load[part.first] > budget[part.first]) return true;
+      }
+      return false;
+    };
+    for (size_t lv = 1; lv < levels_.size(); ++lv) {
+      bool changed = false;
+      for (auto& it : order) {
+        Key* k = it.second;
+        if (!overloaded(k)) continue;
+        for (int l = 0; l < num_links; ++l) {
+          load[l] += static_cast<double>(Bytes(*k, lv, l)) - Bytes(*k, level[k], l);
+        }
+        level[k] = lv;
+        changed = true;
+      }
+      if (!changed) break;
+    }
+    for (auto& it : level) it.first->mode = levels_[it.second];
+  }
+
+  /** \brief weight of a new goodput sample */
+  static constexpr double kAlpha = 0.3;
+
+  std::vector<Link> links_;
+  std::unordered_map<int, Key> keys_;
+  std::vector<Mode> levels_;
+  float param_[4] = {0, 0, 0, 0};
+  double target_ms_ = 0;
+  int64_t round_ = 0;
+  std::mutex mu_;
+};
+
+}  // namespace adaptive
+}  // namespace kvstore
+}  // namespace mxnet
+#endif  // MXNET_KVSTORE_ADAPTIVE_COMPRESSION_H_
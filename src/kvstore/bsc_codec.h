@@ -0,0 +1,334 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file bsc_codec.h
+ * \brief kernels of bi-sparse compression (BSC) on raw cpu buffers
+ *
+ * A compressed buffer of zipped_size elements has two sections of equal
+ * length: zipped_size float values followed by zipped_size uint32 indices,
+ * stored bitwise in the float slots so that indices are exact beyond 2^24.
+ * Unused slots hold kBSCEmptyValue and kBSCEmptyIndex.
+ *
+ * Pull responses of aggregated gradients are sized to their content instead:
+ * a PullHeader followed by a compressed buffer of exactly nnz elements, or by
+ * the dense values once the nonzeros are too many for the sparse encoding to
+ * pay off.
+ */
+#ifndef MXNET_KVSTORE_BSC_CODEC_H_
+#define MXNET_KVSTORE_BSC_CODEC_H_
+#include <dmlc/logging.h>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace mxnet {
+namespace kvstore {
+namespace bsc {
+
+const float kBSCEmptyValue = -65530;
+const uint32_t kBSCEmptyIndex = 0xFFFFFFFF;
+
+/*! \brief index section of a compressed buffer */
+inline uint32_t* IndexSection(float* zip, int64_t zipped_size) {
+  return reinterpret_cast<uint32_t*>(zip + zipped_size);
+}
+
+inline const uint32_t* IndexSection(const float* zip, int64_t zipped_size) {
+  return reinterpret_cast<const uint32_t*>(zip + zipped_size);
+}
+
+/*! \brief selects gradients with |x| >= bound */
+struct AbsGreaterEqual {
+  explicit AbsGreaterEqual(float b) : bound(b) {}
+  inline bool operator()(float x) const { return std::fabs(x) >= bound; }
+#if defined(__AVX512F__)
+  inline uint32_t Mask(const float* p) const {
+    __m512 x = _mm512_abs_ps(_mm512_loadu_ps(p));
+    return _mm512_cmp_ps_mask(x, _mm512_set1_ps(bound), _CMP_GE_OQ);
+  }
+#elif defined(__AVX2__)
+  inline uint32_t Mask(const float* p) const {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 x = _mm256_andnot_ps(sign, _mm256_loadu_ps(p));
+    return _mm256_movemask_ps(_mm256_cmp_ps(x, _mm256_set1_ps(bound), _CMP_GE_OQ));
+  }
+#elif defined(__SSE2__)
+  inline uint32_t Mask(const float* p) const {
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 x = _mm_andnot_ps(sign, _mm_loadu_ps(p));
+    return _mm_movemask_ps(_mm_cmpge_ps(x, _mm_set1_ps(bound)));
+  }
+#endif
+  float bound;
+};
+
+/*! \brief selects non-zero gradients */
+struct NonZero {
+  inline bool operator()(float x) const { return x != 0; }
+#if defined(__AVX512F__)
+  inline uint32_t Mask(const float* p) const {
+    return _mm512_cmp_ps_mask(_mm512_loadu_ps(p), _mm512_setzero_ps(), _CMP_NEQ_UQ);
+  }
+#elif defined(__AVX2__)
+  inline uint32_t Mask(const float* p) const {
+    __m256 x = _mm256_loadu_ps(p);
+    return _mm256_movemask_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_NEQ_UQ));
+  }
+#elif defined(__SSE2__)
+  inline uint32_t Mask(const float* p) const {
+    return _mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(p), _mm_setzero_ps()));
+  }
+#endif
+};
+
+#if defined(__AVX512F__)
+const int64_t kLanes = 16;
+#elif defined(__AVX2__)
+const int64_t kLanes = 8;
+#elif defined(__SSE2__)
+const int64_t kLanes = 4;
+#else
+const int64_t kLanes = 1;
+#endif
+
+/*!
+ * \brief calls visit(i) for each i in [begin, end) with pred(x[i]) in order,
+ * stops early when visit returns false
+ */
+template<typename Pred, typename Visit>
+inline void Scan(const float* x, int64_t begin, int64_t end, const Pred& pred, Visit visit) {
+  int64_t i = begin;
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__)
+  for (; i + kLanes <= end; i += kLanes) {
+    uint32_t mask = pred.Mask(x + i);
+    while (mask) {
+      const int bit = __builtin_ctz(mask);
+      if (!visit(i + bit)) return;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i < end; ++i) {
+    if (pred(x[i]) && !visit(i)) return;
+  }
+}
+
+/*! \brief counts elements in [begin, end) with pred(x[i]) */
+template<typename Pred>
+inline int64_t Count(const float* x, int64_t begin, int64_t end, const Pred& pred) {
+  int64_t count = 0;
+  int64_t i = begin;
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__)
+  for (; i + kLanes <= end; i += kLanes) {
+    count += __builtin_popcount(pred.Mask(x + i));
+  }
+#endif
+  for (; i < end; ++i) {
+    count += pred(x[i]);
+  }
+  return count;
+}
+
+/*!
+ * \brief u = momentum * u + grad, v += u
+ */
+inline void MomentumCorrection(const float* grad, float* u, float* v, int64_t size,
+                               float momentum, int nthreads) {
+  #pragma omp parallel for num_threads(nthreads) schedule(static)
+  for (int64_t i = 0; i < size; ++i) {
+    u[i] = u[i] * momentum + grad[i];
+    v[i] = v[i] + u[i];
+  }
+}
+
+/*!
+ * \brief reservoir sampling (algorithm L) of |x| without materializing
+ * an index vector, fills sample with min(k, size) values
+ */
+inline void SampleAbs(const float* x, int64_t size, int64_t k, uint32_t seed,
+                      std::vector<float>* sample) {
+  k = std::min(k, size);
+  sample->resize(k);
+  if (k <= 0) return;
+  for (int64_t i = 0; i < k; ++i) (*sample)[i] = std::fabs(x[i]);
+  std::mt19937 rng(seed);
+  // uniform in (0, 1), log of it must be finite
+  std::uniform_real_distribution<double> uniform(std::nextafter(0.0, 1.0), 1.0);
+  std::uniform_int_distribution<int64_t> slot(0, k - 1);
+  double w = std::exp(std::log(uniform(rng)) / k);
+  int64_t i = k - 1;
+  while (w < 1.0) {
+    i += static_cast<int64_t>(std::floor(std::log(uniform(rng)) / std::log1p(-w))) + 1;
+    if (i >= size || i < 0) break;
+    (*sample)[slot(rng)] = std::fabs(x[i]);
+    w *= std::exp(std::log(uniform(rng)) / k);
+  }
+}
+
+/*!
+ * \brief returns the top_k-th largest value of sample, reorders sample
+ */
+inline float TopKBoundary(std::vector<float>* sample, int64_t top_k) {
+  top_k = std::max<int64_t>(1, std::min<int64_t>(top_k, sample->size()));
+  std::nth_element(sample->begin(), sample->begin() + (top_k - 1), sample->end(),
+                   std::greater<float>());
+  return (*sample)[top_k - 1];
+}
+
+/*!
+ * \brief writes the first zipped_size elements selected by pred into zip,
+ * in index order, and pads the remaining slots.
+ * The input is split into nthreads partitions counted in parallel, so that
+ * each partition knows its output offset and is gathered independently.
+ * \param on_select called as on_select(i) for each selected index
+ * \return number of selected elements written
+ */
+template<typename Pred, typename OnSelect>
+inline int64_t Gather(const float* x, int64_t size, const Pred& pred, float* zip,
+                      int64_t zipped_size, int nthreads, OnSelect on_select) {
+  nthreads = std::max(1, nthreads);
+  std::vector<int64_t> offset(nthreads + 1, 0);
+  const int64_t chunk = (size + nthreads - 1) / nthreads;
+  #pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+  for (int t = 0; t < nthreads; ++t) {
+    const int64_t begin = std::min(size, t * chunk);
+    const int64_t end = std::min(size, begin + chunk);
+    offset[t + 1] = Count(x, begin, end, pred);
+  }
+  for (int t = 0; t < nthreads; ++t) offset[t + 1] += offset[t];
+
+  uint32_t* index = IndexSection(zip, zipped_size);
+  #pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+  for (int t = 0; t < nthreads; ++t) {
+    int64_t pos = offset[t];
+    if (pos >= zipped_size) continue;
+    const int64_t begin = std::min(size, t * chunk);
+    const int64_t end = std::min(size, begin + chunk);
+    Scan(x, begin, end, pred, [&](int64_t i) {
+      zip[pos] = x[i];
+      index[pos] = static_cast<uint32_t>(i);
+      on_select(i);
+      return ++pos < zipped_size;
+    });
+  }
+
+  const int64_t written = std::min(offset[nthreads], zipped_size);
+  std::fill(zip + written, zip + zipped_size, kBSCEmptyValue);
+  std::fill(index + written, index + zipped_size, kBSCEmptyIndex);
+  return written;
+}
+
+/*!
+ * \brief scatters a compressed buffer into a zeroed dense buffer
+ */
+inline void Decompress(const float* zip, int64_t zipped_size, float* out,
+                       int64_t original_size, int nthreads) {
+  std::memset(out, 0, original_size * sizeof(float));
+  const uint32_t* index = IndexSection(zip, zipped_size);
+  #pragma omp parallel for num_threads(nthreads) schedule(static)
+  for (int64_t i = 0; i < zipped_size; ++i) {
+    const uint32_t idx = index[i];
+    if (idx != kBSCEmptyIndex && idx < original_size) out[idx] = zip[i];
+  }
+}
+
+/*! \brief counts the nonzeros of x on nthreads threads */
+inline int64_t CountNonZero(const float* x, int64_t size, int nthreads) {
+  nthreads = std::max(1, nthreads);
+  const int64_t chunk = (size + nthreads - 1) / nthreads;
+  int64_t nnz = 0;
+  #pragma omp parallel for num_threads(nthreads) schedule(static, 1) reduction(+:nnz)
+  for (int t = 0; t < nthreads; ++t) {
+    const int64_t begin = std::min(size, t * chunk);
+    nnz += Count(x, begin, std::min(size, begin + chunk), NonZero());
+  }
+  return nnz;
+}
+
+/*! \brief leads a pull response */
+struct PullHeader {
+  /*! \brief 1 if the values follow densely */
+  uint32_t dense;
+  uint32_t original_size;
+  uint32_t nnz;
+  uint32_t reserved;
+};
+
+/*! \brief whether nnz nonzeros are sent densely */
+inline bool PullIsDense(int64_t original_size, int64_t nnz, float dense_density) {
+  return nnz >= dense_density * original_size;
+}
+
+/*! \brief bytes of a pull response */
+inline size_t PullBytes(int64_t original_size, int64_t nnz, bool dense) {
+  return sizeof(PullHeader) + (dense ? original_size : 2 * nnz) * sizeof(float);
+}
+
+/*!
+ * \brief encodes the nnz nonzeros of x into a pull response of
+ * PullBytes(size, nnz, dense) bytes
+ */
+inline void PullCompress(const float* x, int64_t size, int64_t nnz, bool dense, char* out,
+                         int nthreads) {
+  PullHeader* header = reinterpret_cast<PullHeader*>(out);
+  header->dense = dense;
+  header->original_size = static_cast<uint32_t>(size);
+  header->nnz = static_cast<uint32_t>(nnz);
+  header->reserved = 0;
+  float* body = reinterpret_cast<float*>(out + sizeof(PullHeader));
+  if (dense) {
+    std::memcpy(body, x, size * sizeof(float));
+  } else {
+    Gather(x, size, NonZero(), body, nnz, nthreads, [](int64_t) {});
+  }
+}
+
+/*!
+ * \brief decodes a pull response of either format into original_size elements
+ */
+inline void PullDecompress(const char* in, size_t bytes, float* out, int64_t original_size,
+                           int nthreads) {
+  CHECK_GE(bytes, sizeof(PullHeader)) << "truncated BSC pull response";
+  const PullHeader* header = reinterpret_cast<const PullHeader*>(in);
+  CHECK_EQ(header->original_size, static_cast<uint32_t>(original_size))
+      << "BSC pull response of a different size";
+  CHECK_GE(bytes, PullBytes(original_size, header->nnz, header->dense))
+      << "truncated BSC pull response";
+  const float* body = reinterpret_cast<const float*>(in + sizeof(PullHeader));
+  if (header->dense) {
+    std::memcpy(out, body, original_size * sizeof(float));
+  } else {
+    Decompress(body, header->nnz, out, original_size, nthreads);
+  }
+}
+
+}  // namespace bsc
+}  // namespace kvstore
+}  // namespace mxnet
+#endif  // MXNET_KVSTORE_BSC_CODEC_H_
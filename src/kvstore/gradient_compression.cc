@@ -33,6 +33,8 @@
 #include "kvstore_local.h"
 #include "gradient_compression.h"
 #include "gradient_compression-inl.h"
+#include "bsc_codec.h"
+#include "../engine/openmp.h"
 
 namespace mxnet {
 namespace kvstore {
@@ -52,6 +54,8 @@ void GradientCompression::SetParams(const std::vector<std::pair<std::string, std
     SetTwoBitCompression(params.threshold);
   } else if (params.type == "bsc") {
     SetBiSparseCompression(params.threshold);
+  } else if (params.type == "powersgd") {
+    SetPowerSGDCompression(params.rank);
   } else {
     LOG(FATAL) << "Unknown type for gradient compression " << params.type;
   }
@@ -65,6 +69,10 @@ float GradientCompression::get_threshold() {
   return threshold_;
 }
 
+int GradientCompression::get_rank() {
+  return rank_;
+}
+
 std::string GradientCompression::get_type_str() {
   return std::to_string(static_cast<int>(type_));
 }
@@ -79,11 +87,19 @@ void GradientCompression::SetBiSparseCompression(const float threshold) {
     threshold_ = threshold;
 }
 
+void GradientCompression::SetPowerSGDCompression(const int rank) {
+  CHECK_GT(rank, 0) << "rank must be greater than 0";
+  type_ = CompressionType::kPowerSGD;
+  rank_ = rank;
+}
+
 std::string GradientCompression::EncodeParams() {
   using namespace std;  // to reduce length of next line
   string rval = get_type_str();
   if (type_ == CompressionType::kTwoBit || type_ == CompressionType::kBiSparseCompression) {
     rval += "," + to_string(threshold_);
+  } else if (type_ == CompressionType::kPowerSGD) {
+    rval += ",," + to_string(rank_);
   }
   return rval;
 }
@@ -97,6 +113,9 @@ void GradientCompression::DecodeParams(const std::string &s) {
       threshold_ = stof(elems[1]);
     }
   }
+  if (elems.size() > 2) {
+    rank_ = stoi(elems[2]);
+  }
 }
 
 int GradientCompression::GetCompressionFactor() {
@@ -193,8 +212,9 @@ void GradientCompression::BSCompress(const mxnet::NDArray &from, mxnet::NDArray
   const float threshold = threshold_;
   if (type_ == CompressionType::kBiSparseCompression) {
     auto bsc_compress = [this, from, to, u_, v_, threshold](mxnet::RunContext ctx) {
-      const int original_size = from.data().Size();
-      const int zipped_size = float(original_size) * threshold;
+      const int64_t original_size = from.data().Size();
+      const int64_t zipped_size = float(original_size) * threshold;
+      const int nthreads = engine::OpenMP::Get()->GetRecommendedOMPThreadCount();
 
       // The momentum coef for momentum correction.
       float momentum = 0.9;
@@ -204,11 +224,11 @@ void GradientCompression::BSCompress(const mxnet::NDArray &from, mxnet::NDArray
       // (limited to 0.5% of the original size, scaled by the threshold).
       // The sample size is 0.5% of the original size, scaled by the
       // threshold, provided that this number is at least 10.
-      const int sample_size = original_size * 0.005 * threshold >= 10
+      const int64_t sample_size = original_size * 0.005 * threshold >= 10
                                 ? original_size * 0.005 : 10 / threshold;
 
       // The number of important gradients to transfer.
-      const unsigned int top_k = sample_size * threshold;
+      const int64_t top_k = sample_size * threshold;
 
       float *grad = from.data().dptr<float>();
       float *u = u_.data().dptr<float>();
@@ -216,48 +236,20 @@ void GradientCompression::BSCompress(const mxnet::NDArray &from, mxnet::NDArray
       float *out = to.data().dptr<float>();
 
       // Apply momentum correction to all gradients.
-      for (int i = 0; i < original_size; i++) {
-        u[i] = u[i] * momentum + grad[i];
-        v[i] = v[i] + u[i];
-      }
-
-      // Shuffle indices for random sampling.
-      std::vector<int> indices(original_size);
-      std::iota(indices.begin(), indices.end(), 0);
-      std::shuffle(indices.begin(), indices.end(), std::default_random_engine(42));
-
-      // Initialize the priority queue for top_k sampling.
-      std::priority_queue<float, std::vector<float>, std::greater<float> > q;
-
-      for (int i = 0; i < sample_size; i++) {
-        // Top_k sampling among the randomly sampled gradients.
-        float abs_val = fabs(v[indices[i]]);
-        if (q.size() < top_k || abs_val > q.top()) {
-          if (q.size() == top_k) q.pop();
-          q.push(abs_val);
-        }
-      }
+      bsc::MomentumCorrection(grad, u, v, original_size, momentum, nthreads);
 
-      // Use the top-k-th sampled gradients as the boundary.
-      float boundary = q.top();
+      // Top_k sampling among the randomly sampled gradients, the top-k-th
+      // sampled gradient is used as the boundary.
+      std::vector<float> sample;
+      bsc::SampleAbs(v, original_size, sample_size, 42, &sample);
+      const float boundary = bsc::TopKBoundary(&sample, top_k);
 
       // Keep only gradients larger than the boundary and reset their residual tensors.
-      int send_grad_index = 0;
-      for (int i = 0; i < original_size; i++) {
-        if (fabs(v[i]) >= boundary && send_grad_index < zipped_size) {
-          out[send_grad_index] = v[i];
-          out[send_grad_index + zipped_size] = i;
-          v[i] = 0;
-          u[i] = 0;
-          send_grad_index += 1;
-        }
-      }
-
-      // Fill the remaining space with placeholders.
-      for (; send_grad_index < zipped_size; send_grad_index++) {
-        out[send_grad_index] = -65530;
-        out[send_grad_index + zipped_size] = -1;
-      }
+      bsc::Gather(v, original_size, bsc::AbsGreaterEqual(boundary), out, zipped_size,
+                  nthreads, [u, v](int64_t i) {
+        v[i] = 0;
+        u[i] = 0;
+      });
     };
 
     // Push the compression function to engine to execute.
@@ -268,41 +260,20 @@ void GradientCompression::BSCompress(const mxnet::NDArray &from, mxnet::NDArray
   }
 }
 
-void GradientCompression::BSCPullCompress(const mxnet::NDArray &from, mxnet::NDArray &to,
-                                 const int multiplier, const int priority) {
-  const float threshold = threshold_;
+void GradientCompression::BSCPullCompress(const mxnet::NDArray &from, const float dense_density,
+                                          std::vector<char> *to) {
   if (type_ == CompressionType::kBiSparseCompression) {
-    auto bsc_compress = [this, from, to, threshold, multiplier](mxnet::RunContext ctx) {
-      const int original_size = from.data().Size();
-      const int zipped_size = float(original_size) * threshold * multiplier;
-
-      float *grad = from.data().dptr<float>();
-      float *out = to.data().dptr<float>();
-
-      // Filtering data: only keep non-zero gradients.
-      int send_grad_index = 0;
-      for (int i = 0; i < original_size; i++) {
-        // Keep the non-zero gradients and their indexes.
-        if (grad[i] != 0 && send_grad_index < zipped_size) {
-          out[send_grad_index] = grad[i];
-          out[send_grad_index + zipped_size] = i;
-          send_grad_index += 1;
-        }
-      }
-
-      // Fill up the remaining space with a placeholder.
-      for (; send_grad_index < zipped_size; send_grad_index++) {
-        out[send_grad_index] = -65530;
-        out[send_grad_index + zipped_size] = -1;
-      }
-    };
-
-    // Push the compression function to engine to execute.
-    mxnet::Engine::Get()->PushSync(bsc_compress, from.ctx(), {from.var()}, {to.var()},
-                                   mxnet::FnProperty::kNormal, priority, "BSCPullCompress");
-  }
-  else
-  {
+    from.WaitToRead();
+    const int64_t original_size = from.data().Size();
+    const int nthreads = engine::OpenMP::Get()->GetRecommendedOMPThreadCount();
+    const float *grad = from.data().dptr<float>();
+
+    // Size the response to the nonzeros, which are only known after counting.
+    const int64_t nnz = bsc::CountNonZero(grad, original_size, nthreads);
+    const bool dense = bsc::PullIsDense(original_size, nnz, dense_density);
+    to->resize(bsc::PullBytes(original_size, nnz, dense));
+    bsc::PullCompress(grad, original_size, nnz, dense, to->data(), nthreads);
+  } else {
     LOG(FATAL) << "Unsupported compression of type " << get_type_str();
   }
 }
@@ -310,21 +281,16 @@ void GradientCompression::BSCPullCompress(const mxnet::NDArray &from, mxnet::NDA
 void GradientCompression::BSCDecompress(const mxnet::NDArray &from, mxnet::NDArray &to, const int priority) {
   if (type_ == CompressionType::kBiSparseCompression) {
     auto bsc_decompress = [this, from, to](mxnet::RunContext ctx) {
-      int zipped_size = from.data().Size() / 2;
-      int original_size = to.data().Size();
+      const int64_t zipped_size = from.data().Size() / 2;
+      const int64_t original_size = to.data().Size();
+      const int nthreads = engine::OpenMP::Get()->GetRecommendedOMPThreadCount();
 
       float *zip = from.data().dptr<float>();
       float *out = to.data().dptr<float>();
 
-      // Initialize the output buffer to zero using memset.
-      std::memset(out, 0, original_size * sizeof(float));
-
       // Decompress the gradients: for each gradient in the compressed array,
-      // place it at the corresponding index in the output buffer.
-      for (int i = 0; i < zipped_size; i++) {
-        int grad_index = zip[i + zipped_size];
-        if (grad_index >= 0) out[grad_index] = zip[i];
-      }
+      // place it at the corresponding index in the zeroed output buffer.
+      bsc::Decompress(zip, zipped_size, out, original_size, nthreads);
     };
 
     // Push the decompression function to engine to execute.
@@ -335,6 +301,23 @@ void GradientCompression::BSCDecompress(const mxnet::NDArray &from, mxnet::NDArr
   }
 }
 
+void GradientCompression::BSCPullDecompress(const mxnet::NDArray &from, mxnet::NDArray &to,
+                                            const int priority) {
+  if (type_ == CompressionType::kBiSparseCompression) {
+    auto bsc_decompress = [from, to](mxnet::RunContext ctx) {
+      const size_t bytes = from.data().Size() * mshadow::mshadow_sizeof(from.dtype());
+      const int64_t original_size = to.data().Size();
+      const int nthreads = engine::OpenMP::Get()->GetRecommendedOMPThreadCount();
+      bsc::PullDecompress(static_cast<const char *>(from.data().dptr_), bytes,
+                          to.data().dptr<float>(), original_size, nthreads);
+    };
+    mxnet::Engine::Get()->PushSync(bsc_decompress, from.ctx(), {from.var()}, {to.var()},
+                                   mxnet::FnProperty::kNormal, priority, "BSCPullDecompressCPU");
+  } else {
+    LOG(FATAL) << "Unsupported compression of type " << get_type_str();
+  }
+}
+
 }  // namespace kvstore
 }  // namespace mxnet
 
@@ -36,17 +36,20 @@ namespace mxnet {
 namespace kvstore {
 
 enum class CompressionType {
-  kNone, kTwoBit, kBiSparseCompression
+  kNone, kTwoBit, kBiSparseCompression, kPowerSGD
 };
 
 struct GradientCompressionParam : public dmlc::Parameter<GradientCompressionParam> {
   std::string type;
   float threshold;
+  int rank;
   DMLC_DECLARE_PARAMETER(GradientCompressionParam) {
     DMLC_DECLARE_FIELD(type)
-      .describe("Type of gradient compression to use, like `2bit` , `bsc`for example");
+      .describe("Type of gradient compression to use, like `2bit` , `bsc`, `powersgd` for example");
     DMLC_DECLARE_FIELD(threshold).set_default(0.5)
       .describe("Threshold to use for 2bit/bsc gradient compression");
+    DMLC_DECLARE_FIELD(rank).set_default(4)
+      .describe("Rank of the factors of powersgd gradient compression");
   }
 };
 
@@ -70,6 +73,8 @@ class GradientCompression {
   
   float get_threshold();
 
+  int get_rank();
+
   /*!
    * \brief returns as string the enum value of compression type
    */
@@ -86,6 +91,12 @@ class GradientCompression {
    * \param threshold float value used for thresholding gradients
    */
   void SetBiSparseCompression(const float threshold);
+
+  /*!
+   * \brief sets PowerSGD low-rank compression
+   * \param rank default rank of the factors
+   */
+  void SetPowerSGDCompression(const int rank);
   /*!
    * \brief encodes parameters of gc into a string
    */
@@ -122,7 +133,15 @@ class GradientCompression {
   void BSCompress(const mxnet::NDArray &from, mxnet::NDArray &to, 
                   mxnet::NDArray &u_, mxnet::NDArray &v_, const int priority);
 
-  void BSCPullCompress(const mxnet::NDArray &from, mxnet::NDArray &to, const int multiplier, const int priority);
+  /*!
+  * \brief Encodes the nonzeros of `from` into a pull response of exactly their
+  * size, densely once their density reaches `dense_density`. Blocks until done
+  * \param from the ndarray containing aggregated gradients
+  * \param dense_density share of nonzeros from which the values are sent densely
+  * \param to the encoded response
+  */
+  void BSCPullCompress(const mxnet::NDArray &from, const float dense_density,
+                       std::vector<char> *to);
   /*!
   * \brief Issues dequantize operation to be scheduled by the engine
   * Decompresses `from` into `to` using current parameters of `type` and `threshold`
@@ -134,6 +153,14 @@ class GradientCompression {
   
   void BSCDecompress(const mxnet::NDArray &from, mxnet::NDArray &to, const int priority);
 
+  /*!
+  * \brief Issues decoding of a pull response of BSCPullCompress, sparse or dense
+  * \param from the ndarray containing the response
+  * \param to the target ndarray of the original size
+  * \param priority Priority of the action.
+  */
+  void BSCPullDecompress(const mxnet::NDArray &from, mxnet::NDArray &to, const int priority);
+
  private:
   /*!
    * \brief denotes the type of gradient compression which has been set
@@ -146,6 +173,11 @@ class GradientCompression {
    * all negative gradients will be thresholded to -1*`threshold_`
    */
   float threshold_ = 0;
+
+  /*!
+   * \brief denotes the default rank of PowerSGD factors
+   */
+  int rank_ = 0;
 };
 }  // namespace kvstore
 }  // namespace mxnet
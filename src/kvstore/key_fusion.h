@@ -0,0 +1,268 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file key_fusion.h
+ * \brief packing of small keys into fused buckets
+ */
+#ifndef MXNET_KVSTORE_KEY_FUSION_H_
+#define MXNET_KVSTORE_KEY_FUSION_H_
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace mxnet {
+namespace kvstore {
+
+/**
+ * \brief assigns small keys to fused buckets and tracks the rounds of each
+ * bucket.
+ *
+ * Keys are appended to the open bucket of their dtype as they are initialized,
+ * so that a bucket holds keys of neighbouring priorities. A bucket is sealed
+ * when the next key would not fit, or at the end of the init call that added
+ * its keys, so that they are never pulled before the bucket is on servers.
+ * Once sealed, servers only see the bucket, which is a key of its own starting
+ * at kBucketKeyBase. Every worker initializes the same keys in the same order,
+ * so all of them agree on the buckets without exchanging them.
+ *
+ * A round of a bucket completes when each of its keys was pushed once, then
+ * the bucket is pushed as one message. Pulls of its keys are served from the
+ * bucket, after the round completed. A key pushed again before the round
+ * completed ends it early: the keys not pushed in it are skipped by the
+ * following rounds until they are pushed again, and send zero gradients with
+ * the bucket, so that frozen keys do not stall the others. A skipped key pushed
+ * after the other keys of a completed round is pushed in a round of its own, so
+ * that rounds never hold the pushes of two iterations, which applications
+ * issue in the order of their keys.
+ */
+class KeyFusion {
+ public:
+  /** \brief bucket keys are above the keys of the application */
+  static const int kBucketKeyBase = 1 << 17;
+
+  struct Bucket {
+    int key;
+    int dtype;
+    /** \brief number of elements */
+    size_t size = 0;
+    std::vector<int> members;
+    /** \brief offset of each member in elements */
+    std::vector<size_t> offsets;
+    bool sealed = false;
+    /** \brief the members pushed in this round */
+    std::vector<bool> pushed;
+    int num_pushed = 0;
+    /** \brief the members not pushed in the last round, which rounds do not wait for */
+    std::vector<bool> skipped;
+    int num_skipped = 0;
+    /** \brief whether the round was pushed before all its members were */
+    bool ended = false;
+    /** \brief highest priority of the pushes in this round */
+    int priority = 0;
+    /** \brief the members whose pull waits for the round to complete */
+    std::vector<bool> deferred;
+    int num_deferred = 0;
+    /**
+     * \brief the members whose value in the last pulled bucket was served, or
+     * was outdated by a push since
+     */
+    std::vector<bool> served;
+
+    bool complete() const {
+      return ended || num_pushed + num_skipped == static_cast<int>(members.size());
+    }
+  };
+
+  enum PullAction {
+    /** \brief the round is incomplete, copy after its push */
+    kDefer,
+    /** \brief the pulled bucket is up to date for the key, copy from it */
+    kCopy,
+    /** \brief pull the bucket, then copy from it */
+    kPullAndCopy
+  };
+
+  /**
+   * \param threshold keys below this many bytes are fused, 0 disables fusion
+   * \param bucket_bytes the size a bucket is sealed at
+   */
+  void Init(size_t threshold, size_t bucket_bytes) {
+    CHECK_LE(threshold, bucket_bytes) << "fused keys must fit in a bucket";
+    threshold_ = threshold;
+    bucket_bytes_ = bucket_bytes;
+  }
+
+  bool enabled() const { return threshold_ > 0; }
+
+  /**
+   * \brief adds a key if it is small enough
+   * \param sealed the bucket closed to make room for the key, if any
+   * \return whether the key is fused
+   */
+  bool Add(int key, size_t size, int dtype, int num_bytes, std::vector<int>* sealed) {
+    const size_t bytes = size * num_bytes;
+    if (!enabled() || bytes >= threshold_ || member_.count(key)) return false;
+    CHECK_LT(key, kBucketKeyBase) << "keys of fused buckets start at " << kBucketKeyBase;
+    auto it = open_.find(dtype);
+    if (it != open_.end() && (buckets_[it->second].size + size) * num_bytes > bucket_bytes_) {
+      Seal(it->second);
+      sealed->push_back(it->second);
+      open_.erase(it);
+      it = open_.end();
+    }
+    if (it == open_.end()) {
+      const int bkey = kBucketKeyBase + static_cast<int>(buckets_.size());
+      buckets_[bkey].key = bkey;
+      buckets_[bkey].dtype = dtype;
+      it = open_.emplace(dtype, bkey).first;
+    }
+    Bucket& b = buckets_[it->second];
+    b.members.push_back(key);
+    b.offsets.push_back(b.size);
+    b.size += size;
+    member_[key] = std::make_pair(b.key, static_cast<int>(b.members.size()) - 1);
+    return true;
+  }
+
+  /** \brief seals the open buckets, returns their keys */
+  std::vector<int> SealAll() {
+    std::vector<int> sealed;
+    for (const auto& it : open_) {
+      Seal(it.second);
+      sealed.push_back(it.second);
+    }
+    open_.clear();
+    return sealed;
+  }
+
+  /** \brief the sealed bucket of a key, nullptr if the key is not fused yet */
+  Bucket* Find(int key, int* index) {
+    auto it = member_.find(key);
+    if (it == member_.end()) return nullptr;
+    Bucket& b = buckets_[it->second.first];
+    if (!b.sealed) return nullptr;
+    *index = it->second.second;
+    return &b;
+  }
+
+  Bucket& bucket(int bkey) { return buckets_.at(bkey); }
+
+  /**
+   * \brief ends the round early if the index-th member was already pushed in
+   * it, the members not pushed are then skipped
+   * \return whether the round ended, its bucket is then pushed before the push
+   * of the member is recorded
+   */
+  static bool Flush(Bucket* b, int index) {
+    if (b->complete() || !b->pushed[index]) return false;
+    for (size_t i = 0; i < b->members.size(); ++i) {
+      if (b->pushed[i] || b->skipped[i]) continue;
+      b->skipped[i] = true;
+      ++b->num_skipped;
+    }
+    b->ended = true;
+    return true;
+  }
+
+  /**
+   * \brief records a push of the index-th member
+   * \return whether the round of the bucket completed
+   */
+  static bool Push(Bucket* b, int index, int priority) {
+    bool late = false;
+    if (b->complete()) {
+      // a skipped key pushed after the keys of the last round belongs to its iteration
+      late = b->skipped[index] &&
+             std::find(b->pushed.begin() + index, b->pushed.end(), true) == b->pushed.end();
+      std::fill(b->pushed.begin(), b->pushed.end(), false);
+      b->num_pushed = 0;
+      b->ended = false;
+    }
+    CHECK(!b->pushed[index]) << "key " << b->members[index] << " is pushed twice in a round, "
+                             << "call Flush first";
+    if (b->skipped[index]) {
+      b->skipped[index] = false;
+      --b->num_skipped;
+    }
+    b->priority = b->num_pushed == 0 ? priority : std::max(b->priority, priority);
+    b->pushed[index] = true;
+    ++b->num_pushed;
+    b->ended = late;
+    return b->complete();
+  }
+
+  /**
+   * \brief records the push of a completed round
+   * \return whether pulls wait for the round, the bucket is then pulled with it
+   */
+  static bool Pushed(Bucket* b) {
+    if (b->num_deferred == 0) {
+      std::fill(b->served.begin(), b->served.end(), true);
+      return false;
+    }
+    b->served = b->deferred;
+    std::fill(b->deferred.begin(), b->deferred.end(), false);
+    b->num_deferred = 0;
+    return true;
+  }
+
+  static PullAction Pull(Bucket* b, int index) {
+    if (b->num_pushed != 0 && !b->complete()) {
+      if (!b->deferred[index]) {
+        b->deferred[index] = true;
+        ++b->num_deferred;
+      }
+      return kDefer;
+    }
+    if (!b->served[index]) {
+      b->served[index] = true;
+      return kCopy;
+    }
+    // the key was served from this bucket already, or no pull followed the last push
+    std::fill(b->served.begin(), b->served.end(), false);
+    b->served[index] = true;
+    return kPullAndCopy;
+  }
+
+ private:
+  void Seal(int bkey) {
+    Bucket& b = buckets_[bkey];
+    b.sealed = true;
+    b.pushed.assign(b.members.size(), false);
+    b.skipped.assign(b.members.size(), false);
+    b.deferred.assign(b.members.size(), false);
+    b.served.assign(b.members.size(), true);
+  }
+
+  size_t threshold_ = 0;
+  size_t bucket_bytes_ = 0;
+  std::map<int, Bucket> buckets_;
+  /** \brief the open bucket of each dtype */
+  std::map<int, int> open_;
+  /** \brief the bucket and index of each fused key */
+  std::unordered_map<int, std::pair<int, int>> member_;
+};
+
+}  // namespace kvstore
+}  // namespace mxnet
+#endif  // MXNET_KVSTORE_KEY_FUSION_H_
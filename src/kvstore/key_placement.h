@@ -0,0 +1,227 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file key_placement.h
+ * \brief size-aware placement of small keys on servers
+ */
+#ifndef MXNET_KVSTORE_KEY_PLACEMENT_H_
+#define MXNET_KVSTORE_KEY_PLACEMENT_H_
+#include <dmlc/logging.h>
+#include <dmlc/parameter.h>
+#include <stdint.h>
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mxnet {
+namespace kvstore {
+
+/**
+ * \brief parses server weights, e.g. "1,1,0.5", servers not listed weigh 1
+ */
+inline std::vector<double> ParsePlacementWeights(const std::string& weights) {
+  std::vector<double> weight;
+  std::stringstream ss(weights);
+  std::string w;
+  while (std::getline(ss, w, ',')) {
+    weight.push_back(std::stod(w));
+    CHECK_GT(weight.back(), 0) << "server weights must be positive: " << weights;
+  }
+  return weight;
+}
+
+inline std::string PlacementWeightsFromEnv() {
+  return dmlc::GetEnv("MXNET_KVSTORE_PLACEMENT_WEIGHTS", std::string());
+}
+
+/**
+ * \brief fingerprint of server weights, the same for weights that place keys
+ * the same way, e.g. "" and "1,1"
+ */
+inline std::string PlacementWeightsFingerprint(const std::string& weights) {
+  std::vector<double> weight = ParsePlacementWeights(weights);
+  while (!weight.empty() && weight.back() == 1) weight.pop_back();
+  std::ostringstream canonical;
+  canonical << std::setprecision(17);
+  for (double w : weight) canonical << w << ",";
+  // FNV-1a, std::hash may differ between nodes
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : canonical.str()) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+  }
+  std::ostringstream os;
+  os << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return os.str();
+}
+
+/**
+ * \brief deterministic bin-packing of keys onto servers.
+ *
+ * Keys are registered in batches with their sizes in bytes. Within a batch,
+ * keys are placed largest first, each small key on the server with the least
+ * weighted load, ties broken by the lowest rank. Big keys, which are split
+ * evenly over all servers, only add to the load of every server. Every node
+ * that registers the same batches in the same order gets the same plan, so
+ * workers register at InitImpl and local servers replay the batches the
+ * master worker forwards to them.
+ *
+ * Server weights come from MXNET_KVSTORE_PLACEMENT_WEIGHTS, e.g. "1,1,0.5"
+ * gives the third server half the share of the others. They must be the same
+ * on every node of every party, which servers check against the fingerprint
+ * workers send before their first batch. Push latencies are
+ * measured per server and logged with the byte share, so that weights can be
+ * derived from a previous run; the plan itself never depends on timing, as
+ * nodes would not agree on it.
+ */
+class KeyPlacement {
+ public:
+  /**
+   * \param num_servers number of servers keys are placed on
+   * \param bigarray_bound keys with at least this many elements are split
+   */
+  void Init(int num_servers, size_t bigarray_bound) {
+    std::lock_guard<std::mutex> lk(mu_);
+    CHECK_GT(num_servers, 0);
+    bigarray_bound_ = bigarray_bound;
+    load_.assign(num_servers, 0);
+    latency_.assign(num_servers, 0);
+    weight_.assign(num_servers, 1);
+    const std::vector<double> weight = ParsePlacementWeights(PlacementWeightsFromEnv());
+    for (int i = 0; i < num_servers && i < static_cast<int>(weight.size()); ++i) {
+      weight_[i] = weight[i];
+    }
+  }
+
+  bool initialized() const { return !load_.empty(); }
+
+  /**
+   * \brief places a batch of keys, keys placed before keep their server
+   * \param keys pairs of key, number of elements and bytes per element
+   */
+  void Register(std::vector<std::pair<int, std::pair<size_t, int>>> keys) {
+    std::lock_guard<std::mutex> lk(mu_);
+    CHECK(initialized());
+    std::stable_sort(keys.begin(), keys.end(), [](
+        const std::pair<int, std::pair<size_t, int>>& a,
+        const std::pair<int, std::pair<size_t, int>>& b) {
+      const size_t sa = a.second.first * a.second.second;
+      const size_t sb = b.second.first * b.second.second;
+      return sa != sb ? sa > sb : a.first < b.first;
+    });
+    const int num_servers = load_.size();
+    for (const auto& k : keys) {
+      if (server_.count(k.first)) continue;
+      const double bytes = static_cast<double>(k.second.first) * k.second.second;
+      if (k.second.first >= bigarray_bound_) {
+        for (auto& l : load_) l += bytes / num_servers;
+        server_[k.first] = -1;
+        continue;
+      }
+      int best = 0;
+      for (int i = 1; i < num_servers; ++i) {
+        if ((load_[i] + bytes) / weight_[i] < (load_[best] + bytes) / weight_[best]) best = i;
+      }
+      load_[best] += bytes;
+      server_[k.first] = best;
+    }
+  }
+
+  /**
+   * \brief the server of a small key, -1 if the key was not registered
+   */
+  int Server(int key) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = server_.find(key);
+    return it == server_.end() ? -1 : it->second;
+  }
+
+  /**
+   * \brief records the round trip of a push to server, as a moving average
+   */
+  void Observe(int server, double usec) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (server < 0 || server >= static_cast<int>(latency_.size())) return;
+    latency_[server] = latency_[server] == 0 ? usec : 0.9 * latency_[server] + 0.1 * usec;
+  }
+
+  /**
+   * \brief byte share and push latency of each server
+   */
+  std::string Summary() {
+    std::lock_guard<std::mutex> lk(mu_);
+    double total = 0;
+    for (double l : load_) total += l;
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < load_.size(); ++i) {
+      os << (i ? ", " : "") << "server " << i << ": "
+         << (total > 0 ? 100 * load_[i] / total : 0) << "% of " << total / (1 << 20) << " MB";
+      if (latency_[i] > 0) os << ", " << latency_[i] / 1000 << " ms";
+    }
+    return os.str();
+  }
+
+ private:
+  std::mutex mu_;
+  size_t bigarray_bound_ = 0;
+  std::vector<double> load_;
+  std::vector<double> weight_;
+  std::vector<double> latency_;
+  std::unordered_map<int, int> server_;
+};
+
+/**
+ * \brief encodes a batch of key sizes for the master worker to forward
+ * the plan inputs to servers, "key:elems:bytes,..."
+ */
+inline std::string EncodeKeySizes(const std::vector<std::pair<int, std::pair<size_t, int>>>& keys) {
+  std::ostringstream os;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    os << (i ? "," : "") << keys[i].first << ":" << keys[i].second.first
+       << ":" << keys[i].second.second;
+  }
+  return os.str();
+}
+
+inline std::vector<std::pair<int, std::pair<size_t, int>>> DecodeKeySizes(const std::string& s) {
+  std::vector<std::pair<int, std::pair<size_t, int>>> keys;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    int key, bytes;
+    size_t elems;
+    char c1, c2;
+    std::stringstream is(item);
+    is >> key >> c1 >> elems >> c2 >> bytes;
+    CHECK(!is.fail() && c1 == ':' && c2 == ':') << "invalid key sizes " << item;
+    keys.emplace_back(key, std::make_pair(elems, bytes));
+  }
+  return keys;
+}
+
+}  // namespace kvstore
+}  // namespace mxnet
+#endif  // MXNET_KVSTORE_KEY_PLACEMENT_H_
@@ -30,14 +30,19 @@
 #include <algorithm>
 #include <utility>
 #include <ctime>
+#include <chrono>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <deque>
 #include <queue>
+#include "./key_fusion.h"
+#include "./key_placement.h"
 #include "./kvstore_local.h"
 #include "mxnet/engine.h"
 #include "ps/ps.h"
 #include "./kvstore_dist_server.h"
+#include "./trace.h"
 namespace mxnet {
 namespace kvstore {
 
@@ -67,6 +72,11 @@ class KVStoreDist : public KVStoreLocal {
       }
     }
     bigarray_bound_ = dmlc::GetEnv("MXNET_KVSTORE_BIGARRAY_BOUND", 1000 * 1000);
+    size_aware_placement_ = dmlc::GetEnv("MXNET_KVSTORE_SIZE_AWARE_PLACEMENT", false);
+    cut_through_ = dmlc::GetEnv("MXNET_KVSTORE_CUT_THROUGH", false);
+    shm_van_ = dmlc::GetEnv("PS_VAN_TYPE", std::string("zmq")) == "shm";
+    fusion_.Init(dmlc::GetEnv("MXNET_KVSTORE_FUSION_THRESHOLD", static_cast<size_t>(0)),
+                 dmlc::GetEnv("MXNET_KVSTORE_FUSION_BUCKET_BYTES", static_cast<size_t>(1 << 20)));
     log_verbose_ = dmlc::GetEnv("MXNET_KVSTORE_DIST_ROW_SPARSE_VERBOSE", false);
   }
 
@@ -74,6 +84,9 @@ class KVStoreDist : public KVStoreLocal {
     Engine::Get()->WaitForAll();
     customer_id_ = 0;
     if (IsWorkerNode() && !IsGlobalSchedulerNode()) {
+      if (size_aware_placement_ && placement_.initialized()) {
+        LOG(INFO) << "Worker " << get_rank() << " key placement: " << placement_.Summary();
+      }
       if (barrier_before_exit_) {
         Barrier();
         if (!ps::IsMasterWorker() && get_rank() == 0 &&
@@ -93,7 +106,17 @@ class KVStoreDist : public KVStoreLocal {
                     ps::KVWorker<char>* worker) {
     // Send my data to other workers.
     if (req_meta.num_merge == -1) {
-      int key = send_q.front();
+      // the TSEngine overlay names the key it releases, the scheduler the oldest
+      std::unique_lock<std::mutex> send_lk(send_mu);
+      auto it = send_q.begin();
+      if (req_meta.key != ps::Meta::kEmpty) {
+        it = std::find_if(send_q.begin(), send_q.end(),
+                          [&](int k) { return req_meta_buf[k].key == req_meta.key; });
+      }
+      CHECK(it != send_q.end()) << "no buffered data to send for key " << req_meta.key;
+      int key = *it;
+      send_q.erase(it);
+      send_lk.unlock();
 
       // Copy my data to the sender buffer.
       req_data_buf[key].vals.CopyFrom(
@@ -113,10 +136,6 @@ class KVStoreDist : public KVStoreLocal {
         req_meta_buf[key].app_id,
         req_meta_buf[key].customer_id,
         req_meta_buf[key].num_merge);
-
-      std::unique_lock<std::mutex> send_lk(send_mu);
-      send_q.pop();
-      send_lk.unlock();
     } else {
       // Receive data from other workers and merge them.
       CHECK_EQ(req_data.keys.size(), (size_t)1);
@@ -131,7 +150,7 @@ class KVStoreDist : public KVStoreLocal {
 
       std::unique_lock<std::mutex> send_lk(send_mu);
       if (req_meta.sender == server_id) {
-        send_q.push(key);
+        send_q.push_back(key);
         req_meta_buf[key].cmd         = req_meta.cmd;
         req_meta_buf[key].push        = req_meta.push;
         req_meta_buf[key].sender      = req_meta.sender;
@@ -296,7 +315,8 @@ class KVStoreDist : public KVStoreLocal {
   std::unordered_map<int, ComprPSKV> compr_ps_kv_;
   std::unordered_map<int, ps::KVPairs<char>> req_data_buf;
   std::unordered_map<int, ps::KVMeta> req_meta_buf;
-  std::queue<int> send_q;
+  /** \brief keys whose own data is buffered, in the order it came */
+  std::deque<int> send_q;
   std::unordered_map<int, UpdateBuf> update_buf_;
 
   /**
@@ -310,21 +330,264 @@ class KVStoreDist : public KVStoreLocal {
     for (size_t i = 0; i < keys.size(); ++i) {
       comm_->Init(keys[i], values[i].storage_type(), values[i].shape(), values[i].dtype());
     }
-    if (get_rank() == 0) {
-      Push_(keys, values, 0, false);
+    if (size_aware_placement_) RegisterKeySizes(keys, values);
+    if (get_rank() == 0 && gradient_compression_->get_type() == CompressionType::kPowerSGD) {
+      RegisterKeyShapes(keys, values);
+    }
+    // fused keys are only initialized on servers through their buckets
+    std::vector<int> rest_keys(keys), sealed;
+    std::vector<NDArray> rest_vals(values);
+    if (fusion_.enabled()) {
+      AddFusedKeys(&rest_keys, &rest_vals, &sealed);
+      // every worker makes the same calls, so they seal at the same keys
+      for (const int bkey : fusion_.SealAll()) sealed.push_back(bkey);
+    }
+    if (get_rank() == 0 && !rest_keys.empty()) {
+      Push_(rest_keys, rest_vals, 0, false);
       // wait until the push is finished
-      for (const int key : keys) {
+      for (const int key : rest_keys) {
         comm_buf_[key].WaitToWrite();
         compr_buf_[key].WaitToWrite();
       }
     }
+    InitBuckets(sealed);
     if (!ps::Postoffice::Get()->is_recovery()) Barrier();
   }
 
   void PushImpl(const std::vector<int>& keys,
                 const std::vector<NDArray>& values,
                 int priority) override {
-    Push_(keys, values, priority, true);
+    if (!fusion_.enabled()) {
+      Push_(keys, values, priority, true);
+      return;
+    }
+    std::vector<int> rest_keys(keys), fused_keys;
+    std::vector<NDArray> rest_vals(values), fused_vals;
+    TakeFusedKeys(&rest_keys, &rest_vals, &fused_keys, &fused_vals);
+    if (!rest_keys.empty()) Push_(rest_keys, rest_vals, priority, true);
+    if (!fused_keys.empty()) PushFused(fused_keys, fused_vals, priority);
+  }
+
+  /**
+   * \brief moves the small dense keys of a batch out of keys and values, into
+   * the open buckets. Key 0 is never fused, as servers count iterations by its
+   * pushes
+   */
+  void AddFusedKeys(std::vector<int>* keys, std::vector<NDArray>* values,
+                    std::vector<int>* sealed) {
+    size_t n = 0;
+    for (size_t i = 0; i < keys->size(); ++i) {
+      const int key = (*keys)[i];
+      const NDArray& value = (*values)[i];
+      const int dtype = value.dtype();
+      if (key == 0 || value.storage_type() != kDefaultStorage ||
+          !fusion_.Add(key, value.shape().Size(), dtype, mshadow::mshadow_sizeof(dtype), sealed)) {
+        (*keys)[n] = key;
+        (*values)[n++] = value;
+        continue;
+      }
+      fusion_shape_[key] = value.shape();
+      if (get_rank() == 0) {
+        // the value the bucket is initialized with once it is sealed
+        auto& stage = fusion_init_[key];
+        stage = NDArray(value.shape(), pinned_ctx_, false, dtype);
+        CopyFromTo(value, &stage);
+      }
+    }
+    keys->resize(n);
+    values->resize(n);
+  }
+
+  /**
+   * \brief allocates the buffers of sealed buckets, rank 0 initializes them
+   * on servers with the staged values of their keys
+   */
+  void InitBuckets(const std::vector<int>& bkeys) {
+    for (const int bkey : bkeys) {
+      const auto& b = fusion_.bucket(bkey);
+      const TShape shape{static_cast<int64_t>(b.size)};
+      auto& buf = fusion_buf_[bkey];
+      buf.grad = NDArray(shape, pinned_ctx_, false, b.dtype);
+      buf.weight = NDArray(shape, pinned_ctx_, false, b.dtype);
+      buf.pulled = NDArray(shape, pinned_ctx_, false, b.dtype);
+      for (size_t i = 0; i < b.members.size(); ++i) {
+        const TShape& mshape = fusion_shape_[b.members[i]];
+        const int64_t begin = b.offsets[i];
+        buf.grads.push_back(buf.grad.Slice(begin, begin + mshape.Size()).Reshape(mshape));
+        buf.weights.push_back(buf.weight.Slice(begin, begin + mshape.Size()).Reshape(mshape));
+      }
+      comm_->Init(bkey, kDefaultStorage, shape, b.dtype);
+      if (get_rank() != 0) continue;
+      for (size_t i = 0; i < b.members.size(); ++i) {
+        CopyFromTo(fusion_init_[b.members[i]], &buf.grads[i]);
+        fusion_init_.erase(b.members[i]);
+      }
+      Push_({bkey}, {buf.grad}, 0, false);
+      comm_buf_[bkey].WaitToWrite();
+      compr_buf_[bkey].WaitToWrite();
+    }
+  }
+
+  /**
+   * \brief moves the keys of sealed buckets and their values out of keys and values
+   */
+  template <typename V>
+  void TakeFusedKeys(std::vector<int>* keys, std::vector<V>* values,
+                     std::vector<int>* fused_keys, std::vector<V>* fused_values) {
+    size_t n = 0;
+    int index;
+    for (size_t i = 0; i < keys->size(); ++i) {
+      if (fusion_.Find((*keys)[i], &index)) {
+        fused_keys->push_back((*keys)[i]);
+        fused_values->push_back((*values)[i]);
+      } else {
+        (*keys)[n] = (*keys)[i];
+        (*values)[n++] = (*values)[i];
+      }
+    }
+    keys->resize(n);
+    values->resize(n);
+  }
+
+  /**
+   * \brief copies the merged values into their buckets, and pushes each
+   * bucket whose keys were all pushed in this round as one message
+   */
+  void PushFused(const std::vector<int>& keys, const std::vector<NDArray>& values, int priority) {
+    std::vector<int> uniq_keys;
+    std::vector<std::vector<NDArray> > grouped_vals;
+    GroupKVPairsPush(keys, values, &uniq_keys, &grouped_vals, false);
+    for (size_t i = 0; i < uniq_keys.size(); ++i) {
+      int index;
+      auto* b = fusion_.Find(uniq_keys[i], &index);
+      auto& buf = fusion_buf_[b->key];
+      // the key starts the next round, the keys not pushed in this one are skipped
+      if (KeyFusion::Flush(b, index)) PushBucket(b);
+      const NDArray& merged = comm_->Reduce(uniq_keys[i], grouped_vals[i], priority);
+      CopyFromTo(merged, &buf.grads[index], priority);
+      if (KeyFusion::Push(b, index, priority)) PushBucket(b);
+    }
+  }
+
+  /**
+   * \brief pushes the bucket of a completed round, with zero gradients for the
+   * keys not pushed in it, then completes the deferred pulls of the round
+   */
+  void PushBucket(KeyFusion::Bucket* b) {
+    auto* buf = &fusion_buf_[b->key];
+    for (size_t i = 0; i < b->members.size(); ++i) {
+      if (!b->pushed[i]) buf->grads[i] = 0;
+    }
+    Push_({b->key}, {buf->grad}, b->priority, true);
+    if (!KeyFusion::Pushed(b)) return;
+    // the bucket is pulled aside, and copied into the weights held by the gate
+    // of the deferred pulls once their reads of the previous round are done
+    PullImpl({b->key}, {&buf->pulled}, b->priority, true);
+    NDArray weight = buf->weight, pulled = buf->pulled;
+    std::shared_ptr<FusionBuf::Gate> gate = std::move(buf->gate);
+    Engine::Get()->PushAsync(
+      [gate, weight, pulled](RunContext rctx, Engine::CallbackOnComplete on_complete) {
+        gate->Arrive(weight, pulled, on_complete);
+      },
+      pinned_ctx_, {pulled.var()}, {}, FnProperty::kNormal, b->priority,
+      "KVStoreDistFusedPullRelease");
+  }
+
+  /**
+   * \brief serves pulls of fused keys from their buckets. The pull of a bucket
+   * waits for the push of all its keys in this round
+   */
+  void PullFused(const std::vector<int>& keys, const std::vector<NDArray*>& values,
+                 int priority) {
+    std::vector<int> uniq_keys;
+    std::vector<std::vector<NDArray*> > grouped_vals;
+    GroupKVPairsPull(keys, values, &uniq_keys, &grouped_vals, true);
+    for (size_t i = 0; i < uniq_keys.size(); ++i) {
+      int index;
+      auto* b = fusion_.Find(uniq_keys[i], &index);
+      auto& buf = fusion_buf_[b->key];
+      switch (KeyFusion::Pull(b, index)) {
+        case KeyFusion::kDefer: {
+          if (buf.gate) break;
+          // holds the weights of the bucket until it is pulled with the round,
+          // so that the outputs are written by the copies below
+          buf.gate = std::make_shared<FusionBuf::Gate>();
+          NDArray weight = buf.weight, pulled = buf.pulled;
+          std::shared_ptr<FusionBuf::Gate> gate = buf.gate;
+          Engine::Get()->PushAsync(
+            [gate, weight, pulled](RunContext rctx, Engine::CallbackOnComplete on_complete) {
+              gate->Arrive(weight, pulled, on_complete);
+            },
+            pinned_ctx_, {}, {weight.var()}, FnProperty::kNormal, priority,
+            "KVStoreDistFusedPullGate");
+          break;
+        }
+        case KeyFusion::kPullAndCopy:
+          PullImpl({b->key}, {&buf.weight}, priority, true);
+          break;
+        case KeyFusion::kCopy:
+          break;
+      }
+      comm_->Broadcast(uniq_keys[i], buf.weights[index], grouped_vals[i], priority);
+    }
+  }
+
+  /**
+   * \brief places the default storage keys of a batch on local servers by
+   * size, the master worker forwards the batch so that local servers place
+   * them on global servers the same way
+   */
+  void RegisterKeySizes(const std::vector<int>& keys, const std::vector<NDArray>& values) {
+    std::vector<std::pair<int, std::pair<size_t, int>>> sizes;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (values[i].storage_type() != kDefaultStorage) continue;
+      sizes.emplace_back(keys[i], std::make_pair(
+          values[i].shape().Size(), mshadow::mshadow_sizeof(values[i].dtype())));
+    }
+    if (!placement_.initialized()) {
+      // servers check the weights before they place any key
+      SendCommandToServers(static_cast<int>(CommandType::kCheckPlacement),
+                           PlacementWeightsFingerprint(PlacementWeightsFromEnv()));
+      placement_.Init(ps::Postoffice::Get()->GetServerKeyRanges().size(), bigarray_bound_);
+    }
+    placement_.Register(sizes);
+    if (get_rank() == 0) {
+      SendCommandToServers(static_cast<int>(CommandType::kSetKeySizes), EncodeKeySizes(sizes));
+    }
+  }
+
+  /**
+   * \brief tells local servers the shapes of the default storage keys of a
+   * batch, so that PowerSGD views them as matrices of their rows
+   */
+  void RegisterKeyShapes(const std::vector<int>& keys, const std::vector<NDArray>& values) {
+    std::vector<std::pair<int, std::pair<int64_t, int64_t>>> shapes;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      const mxnet::TShape& shape = values[i].shape();
+      if (values[i].storage_type() != kDefaultStorage || shape.ndim() == 0 || shape[0] == 0) continue;
+      shapes.emplace_back(keys[i], std::make_pair(shape[0], shape.Size() / shape[0]));
+    }
+    SendCommandToServers(static_cast<int>(CommandType::kSetKeyShapes),
+                         powersgd::EncodeKeyShapes(shapes));
+  }
+
+  /**
+   * \brief the server of a key below bigarray_bound_
+   */
+  inline int PickServer(const int key, const int num_servers) {
+    if (size_aware_placement_) {
+      const int server = placement_.Server(key);
+      if (server >= 0) return server;
+    }
+    return static_cast<uint64_t>(key) * 9973 % num_servers;
+  }
+
+  /**
+   * \brief whether big keys are pushed and pulled in chunks of bigarray_bound_
+   * elements. P3 already slices keys, and TSEngine merges whole keys on workers
+   */
+  inline bool CutThrough() const {
+    return cut_through_ && !ps_worker_->enable_p3 && !ps_worker_->enable_intra_ts;
   }
 
   void PullImpl(const std::vector<int>& keys,
@@ -335,7 +598,15 @@ class KVStoreDist : public KVStoreLocal {
 
     std::vector<int> uniq_keys;
     std::vector<std::vector<NDArray*> > grouped_vals;
-    GroupKVPairsPull(keys, values, &uniq_keys, &grouped_vals, true);
+    if (fusion_.enabled()) {
+      std::vector<int> rest_keys(keys), fused_keys;
+      std::vector<NDArray*> rest_vals(values), fused_vals;
+      TakeFusedKeys(&rest_keys, &rest_vals, &fused_keys, &fused_vals);
+      if (!fused_keys.empty()) PullFused(fused_keys, fused_vals, priority);
+      GroupKVPairsPull(rest_keys, rest_vals, &uniq_keys, &grouped_vals, true);
+    } else {
+      GroupKVPairsPull(keys, values, &uniq_keys, &grouped_vals, true);
+    }
 
     for (size_t i = 0; i < uniq_keys.size(); ++i) {
       int key = uniq_keys[i];
@@ -363,7 +634,14 @@ class KVStoreDist : public KVStoreLocal {
           "KVStoreDistDefaultStoragePull");
       } else {
         auto pull_from_servers = [this, key, recv_buf](
-          RunContext rctx, Engine::CallbackOnComplete cb) {
+          RunContext rctx, Engine::CallbackOnComplete on_complete) {
+          // the pull of a traced round belongs to its last push
+          const uint64_t trace = KVStoreTrace::Get()->Current(key);
+          KVStoreTrace::Get()->Begin("pull", trace);
+          auto cb = [on_complete, trace]() {
+            KVStoreTrace::Get()->End("pull", trace);
+            on_complete();
+          };
           // convert to ps keys
           size_t size = recv_buf.shape().Size();
           const int dtype = recv_buf.dtype();
@@ -383,6 +661,8 @@ class KVStoreDist : public KVStoreLocal {
               mode = RequestType::kCompressedPushPull;
               break;
             case CompressionType::kBiSparseCompression:
+            case CompressionType::kPowerSGD:
+              // only local servers compress, for global servers
               mode = RequestType::kDefaultPushPull;
               break;
             default:
@@ -396,12 +676,32 @@ class KVStoreDist : public KVStoreLocal {
                 delete vals;
                 cb();
               });
+          } else if (CutThrough() && pskv.keys.size() > 1) {
+            // one request per chunk, which local servers answer as soon as
+            // the chunk came back from global servers
+            auto *counter = new std::atomic<int>(pskv.keys.size());
+            size_t offset = 0;
+            for (size_t i = 0; i < pskv.keys.size(); ++i) {
+              auto part = new ps::SArray<char>(data + offset, pskv.lens[i], false);
+              auto lens = new ps::SArray<int>(pskv.lens.segment(i, i + 1));
+              CHECK_NOTNULL(ps_worker_)->ZPull(
+                pskv.keys.segment(i, i + 1), part, lens, cmd, [vals, part, lens, counter, cb]() {
+                  delete part;
+                  delete lens;
+                  if (--(*counter) == 0) {
+                    delete counter;
+                    delete vals;
+                    cb();
+                  }
+                }, trace);
+              offset += pskv.lens[i];
+            }
           } else {
             CHECK_NOTNULL(ps_worker_)->ZPull(
               pskv.keys, vals, &pskv.lens, cmd, [vals, cb]() {
                 delete vals;
                 cb();
-              });
+              }, trace);
           }
         };
         CHECK_NOTNULL(Engine::Get())->PushAsync(
@@ -482,7 +782,13 @@ class KVStoreDist : public KVStoreLocal {
         comm_buf = merged;  // avoid memory copy
       } else {
         if (comm_buf.is_none()) {
-          if (storage_type == kDefaultStorage) {
+          if (storage_type == kDefaultStorage && shm_van_) {
+            // servers on this host read it by handle instead of a copy
+            comm_buf = NDArray(merged.shape(), Context::CPUShared(0), false, merged.dtype());
+            Storage::Handle handle = comm_buf.storage_handle();
+            ps::Postoffice::Get()->van()->RegisterSharedBuffer(
+                static_cast<char*>(handle.dptr), handle.size, handle.shared_pid, handle.shared_id);
+          } else if (storage_type == kDefaultStorage) {
             comm_buf = NDArray(merged.shape(), pinned_ctx_, true, merged.dtype());
           } else {
             comm_buf = NDArray(storage_type, merged.shape(), pinned_ctx_, true, merged.dtype());
@@ -496,7 +802,8 @@ class KVStoreDist : public KVStoreLocal {
       // push to servers
       if (storage_type == kDefaultStorage) {
           if (gradient_compression_->get_type() == CompressionType::kNone
-            || gradient_compression_->get_type() == CompressionType::kBiSparseCompression) {
+            || gradient_compression_->get_type() == CompressionType::kBiSparseCompression
+            || gradient_compression_->get_type() == CompressionType::kPowerSGD) {
           PSKV& pskv = ps_worker_->enable_p3 ? EncodeP3Key(key, comm_buf.shape().Size(), num_bytes)
             : EncodeDefaultKey(key, comm_buf.shape().Size(), num_bytes);
           PushDefault(key, comm_buf, pskv, priority);
@@ -601,7 +908,7 @@ class KVStoreDist : public KVStoreLocal {
         "KVStoreDistDefaultPush");
     } else {
       auto push_to_servers =
-        [this, key, pskv, send_buf](RunContext rctx, Engine::CallbackOnComplete cb) {
+        [this, key, pskv, send_buf](RunContext rctx, Engine::CallbackOnComplete on_complete) {
           const int dtype = send_buf.dtype();
           // convert to ps keys
           const size_t size = send_buf.shape().Size() * mshadow::mshadow_sizeof(dtype);
@@ -609,9 +916,47 @@ class KVStoreDist : public KVStoreLocal {
           // do push. false means no delete
           ps::SArray<char> vals(data, size, false);
           int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
+          // the push span of a traced round lasts until all servers acked
+          const uint64_t trace = KVStoreTrace::Get()->NextRound(key);
+          KVStoreTrace::Get()->Begin("push", trace);
+          auto cb = [on_complete, trace]() {
+            KVStoreTrace::Get()->End("push", trace);
+            on_complete();
+          };
+          if (CutThrough() && pskv.keys.size() > 1) {
+            // one message per chunk, so that local servers forward each chunk
+            // once all workers pushed it instead of waiting for the whole key
+            auto *counter = new std::atomic<int>(pskv.keys.size());
+            int len = 0;
+            for (size_t i = 0; i < pskv.keys.size(); ++i) {
+              CHECK_NOTNULL(ps_worker_)->ZPush(
+                  pskv.keys.segment(i, i + 1), vals.segment(len, len + pskv.lens[i]),
+                  pskv.lens.segment(i, i + 1), cmd, [cb, counter]() {
+                    if (--(*counter) == 0) {
+                      delete counter;
+                      cb();
+                    }
+                  }, key, 0, trace);
+              len += pskv.lens[i];
+            }
+            return;
+          }
+          if (size_aware_placement_ && pskv.keys.size() == 1) {
+            // time the round trip to the single server of a small key
+            const int server = PickServer(key, ps::Postoffice::Get()->GetServerKeyRanges().size());
+            const auto start = std::chrono::steady_clock::now();
+            CHECK_NOTNULL(ps_worker_)->ZPush(
+                pskv.keys, vals, pskv.lens,
+                cmd, [this, cb, server, start]() {
+                  placement_.Observe(server, std::chrono::duration<double, std::micro>(
+                      std::chrono::steady_clock::now() - start).count());
+                  cb();
+                }, key, 0, trace);
+            return;
+          }
           CHECK_NOTNULL(ps_worker_)->ZPush(
               pskv.keys, vals, pskv.lens,
-              cmd, [cb]() { cb(); }, key, 0);
+              cmd, cb, key, 0, trace);
         };
       Engine::Get()->PushAsync(
         push_to_servers,
@@ -732,14 +1077,32 @@ class KVStoreDist : public KVStoreLocal {
       CHECK_GT(num_servers, 0);
       // a simple heuristic for load balance
       if (num_arr_elems < bigarray_bound_) {
-        // send it to a single random picked server
-        int server = (key * 9973) % num_servers;
+        // send it to a single server, picked by size or hashed
+        int server = PickServer(key, num_servers);
         ps::Key ps_key = krs[server].begin() + key;
         CHECK_LT(ps_key, krs[server].end());
         pskv.keys.push_back(ps_key);
         const int total_bytes = num_arr_elems * num_bytes;
         pskv.lens.push_back(total_bytes);
         pskv.size = total_bytes;
+      } else if (CutThrough()) {
+        // chunks of bigarray_bound_ elements, servers see chunk c as key + (c << kChunkShift)
+        const size_t num_chunks = (num_arr_elems + bigarray_bound_ - 1) / bigarray_bound_;
+        CHECK_LT(key, 1 << kChunkShift) << "keys must be below 2^" << kChunkShift
+                                        << " with MXNET_KVSTORE_CUT_THROUGH";
+        CHECK_LE(num_chunks, 1 << (31 - kChunkShift)) << "key " << key << " has too many "
+            << "chunks, raise MXNET_KVSTORE_BIGARRAY_BOUND";
+        pskv.size = 0;
+        for (size_t c = 0; c < num_chunks; ++c) {
+          const size_t part_size = std::min(bigarray_bound_, num_arr_elems - c * bigarray_bound_);
+          const int server = (key + c) % num_servers;
+          ps::Key ps_key = krs[server].begin() + key + (static_cast<ps::Key>(c) << kChunkShift);
+          CHECK_LT(ps_key, krs[server].end());
+          pskv.keys.push_back(ps_key);
+          const int total_bytes = part_size * num_bytes;
+          pskv.lens.push_back(total_bytes);
+          pskv.size += total_bytes;
+        }
       } else {
         // parition it to all servers
         pskv.size = 0;
@@ -835,8 +1198,8 @@ class KVStoreDist : public KVStoreLocal {
 
       if (original_num_elem < bigarray_bound_) {
         // a simple heuristic for load balancing
-        // send it to a single random picked server
-        const int server = (key * 9973) % num_servers;
+        // send it to a single server, picked by size or hashed
+        const int server = PickServer(key, num_servers);
         ps::Key ps_key = krs[server].begin() + key;
         CHECK_LT(ps_key, krs[server].end());
         // meta info
@@ -968,6 +1331,67 @@ class KVStoreDist : public KVStoreLocal {
    * \brief threshold for partition
    */
   size_t bigarray_bound_;
+  /**
+   * \brief place keys below bigarray_bound_ by size instead of by hash
+   */
+  bool size_aware_placement_;
+  KeyPlacement placement_;
+  /**
+   * \brief push and pull big keys in chunks that servers aggregate and forward
+   * separately
+   */
+  bool cut_through_;
+  static const int kChunkShift = 24;
+  /**
+   * \brief allocate send buffers in shared memory for the shared-memory van
+   */
+  bool shm_van_;
+  /**
+   * \brief buffers of a fused bucket, and views of them for each of its keys
+   */
+  struct FusionBuf {
+    /**
+     * \brief the engine operations holding the weights for the deferred pulls
+     * of a round, and releasing them once the bucket is pulled aside. The
+     * second one to run copies the pulled bucket into the weights, then
+     * completes both
+     */
+    class Gate {
+     public:
+      void Arrive(NDArray weight, NDArray pulled, Engine::CallbackOnComplete on_complete) {
+        {
+          std::lock_guard<std::mutex> lock(mu_);
+          if (!arrived_) {
+            arrived_ = true;
+            first_ = on_complete;
+            return;
+          }
+        }
+        const TBlob& src = pulled.data();
+        memcpy(weight.data().dptr_, src.dptr_, src.Size() * mshadow::mshadow_sizeof(src.type_flag_));
+        first_();
+        on_complete();
+      }
+
+     private:
+      std::mutex mu_;
+      bool arrived_ = false;
+      Engine::CallbackOnComplete first_;
+    };
+    NDArray grad;
+    NDArray weight;
+    /** \brief the bucket pulled for the deferred pulls of a round */
+    NDArray pulled;
+    std::vector<NDArray> grads;
+    std::vector<NDArray> weights;
+    /** \brief the gate of the deferred pulls of this round, if any */
+    std::shared_ptr<Gate> gate;
+  };
+  KeyFusion fusion_;
+  std::unordered_map<int, FusionBuf> fusion_buf_;
+  std::unordered_map<int, TShape> fusion_shape_;
+  /** \brief initial values of the keys of open buckets, on rank 0 */
+  std::unordered_map<int, NDArray> fusion_init_;
   /**
    * \brief buffer for non-compressed data.
    * When gradient compression is active, this is used
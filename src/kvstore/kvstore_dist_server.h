@@ -28,6 +28,10 @@
 #include <mxnet/c_api.h>
 #include <mxnet/kvstore.h>
 #include <ps/ps.h>
+#include <ps/internal/metrics.h>
+#include <algorithm>
+#include <deque>
+#include <map>
 #include <queue>
 #include <string>
 #include <mutex>
@@ -35,9 +39,18 @@
 #include <memory>
 #include <functional>
 #include <future>
+#include <sstream>
 #include <vector>
 #include <iostream>
+#include "./adaptive_compression.h"
 #include "./comm.h"
+#include "./key_placement.h"
+#include "./powersgd.h"
+#include "./staleness.h"
+#include "./server_aggregator.h"
+#include "./server_optimizer.h"
+#include "./trace.h"
+#include "../engine/openmp.h"
 #include "../profiler/profiler.h"
 #include "../operator/tensor/elemwise_binary_op-inl.h"
 #include "../operator/tensor/init_op.h"
@@ -48,11 +61,13 @@ namespace kvstore {
 // maintain same order in frontend.
 enum class CommandType {
   kController, kSetMultiPrecision, kStopServer, kSyncMode, kSyncGlobalMode,
-  kSetGradientCompression, kSetProfilerParams
+  kSetGradientCompression, kSetProfilerParams, kSetServerOptimizer, kSetKeySizes,
+  kCheckPlacement, kSetKeyShapes
 };
 
 enum class RequestType {
-  kDefaultPushPull, kRowSparsePushPull, kCompressedPushPull, kBSCompressedPushPull
+  kDefaultPushPull, kRowSparsePushPull, kCompressedPushPull, kBSCompressedPushPull,
+  kAdaptivePushPull, kPowerSGDPushPull
 };
 
 struct DataHandleType {
@@ -186,11 +201,51 @@ class KVStoreDistServer {
     period_k1 = dmlc::GetEnv("MXNET_KVSTORE_HFA_K1", 1);
     period_k2 = dmlc::GetEnv("MXNET_KVSTORE_HFA_K2", 1);
     local_iters = 0;
+    use_native_optimizer_ = dmlc::GetEnv("MXNET_KVSTORE_USE_NATIVE_OPTIMIZER", false);
+    server_optimizer_ = std::make_shared<ServerOptimizer>();
+    int aggregation_threads = dmlc::GetEnv("MXNET_KVSTORE_AGGREGATION_THREADS", 0);
+    if (aggregation_threads > 0) {
+      aggregator_ = std::make_shared<ServerAggregator>(aggregation_threads);
+    }
+    use_adaptive_compression_ = dmlc::GetEnv("MXNET_KVSTORE_ADAPTIVE_COMPRESSION", false);
+    bsc_dense_density_ = dmlc::GetEnv("MXNET_KVSTORE_BSC_DENSE_DENSITY", 0.5f);
+    std::stringstream ranks(dmlc::GetEnv("MXNET_KVSTORE_POWERSGD_RANKS", std::string()));
+    std::string rank;
+    while (std::getline(ranks, rank, ',')) {
+      const size_t colon = rank.find(':');
+      CHECK_NE(colon, std::string::npos)
+        << "MXNET_KVSTORE_POWERSGD_RANKS expects key:rank pairs, got " << rank;
+      powersgd_ranks_[std::stoi(rank.substr(0, colon))] = std::stoi(rank.substr(colon + 1));
+    }
+    if (ps::IsGlobalServer()) {
+      staleness_.Init(dmlc::GetEnv("MXNET_KVSTORE_STALENESS", -1), ps::NumGlobalWorkers());
+      if (staleness_.enabled()) ExportStaleness();
+    }
     // explicitly set to false, avoid wrong dtype of store_ when net is float16
     multi_precision_ = false;
+    key_metrics_.reset(new ps::MetricTable<KeyMetrics>([](int key) {
+      auto* metrics = ps::Metrics::Get();
+      const std::string labels = ps::Metrics::Labels({{"key", std::to_string(key)}});
+      KeyMetrics m;
+      m.pushes = metrics->GetCounter("kvstore_push_requests_total", "pushes of a key", labels);
+      m.pulls = metrics->GetCounter("kvstore_pull_requests_total", "pulls of a key", labels);
+      m.bytes = metrics->GetCounter("kvstore_request_bytes_total",
+                                    "bytes of the requests of a key", labels);
+      m.handle_us = metrics->GetHistogram("kvstore_handle_us",
+                                          "microseconds handling a request of a key", labels);
+      return m;
+    }, 4096));
+    compression_metrics_.reset(new ps::MetricTable<ps::CompressionMetrics>([](int type) {
+      switch (static_cast<RequestType>(type)) {
+        case RequestType::kCompressedPushPull: return ps::CompressionMetrics::Get("2bit");
+        case RequestType::kBSCompressedPushPull: return ps::CompressionMetrics::Get("bsc");
+        default: return ps::CompressionMetrics::Get("powersgd");
+      }
+    }, 8));
   }
 
   ~KVStoreDistServer() {
+    for (const auto& s : samplers_) ps::Metrics::Get()->RemoveSampler(s.first, s.second);
     profiler::Profiler::Get()->SetState(profiler::Profiler::ProfilerState(0));
     delete ps_server_;
   }
@@ -213,15 +268,67 @@ class KVStoreDistServer {
   }
 
  private:
+  /*!
+   * \brief requests buffered until their round is merged or pulled from
+   * global servers, counted in the kvstore_pending_requests gauge
+   */
+  class PendingRequests {
+   public:
+    typedef std::vector<ps::KVMeta>::const_iterator const_iterator;
+
+    PendingRequests() {}
+    PendingRequests(const PendingRequests& other) : reqs_(other.reqs_) {
+      Pending()->Add(reqs_.size());
+    }
+    PendingRequests& operator=(const PendingRequests& other) {
+      Pending()->Add(static_cast<int64_t>(other.size()) - static_cast<int64_t>(size()));
+      reqs_ = other.reqs_;
+      return *this;
+    }
+    ~PendingRequests() { Pending()->Add(-static_cast<int64_t>(size())); }
+
+    void push_back(const ps::KVMeta& req) {
+      reqs_.push_back(req);
+      Pending()->Add(1);
+    }
+    void clear() {
+      Pending()->Add(-static_cast<int64_t>(size()));
+      reqs_.clear();
+    }
+
+    size_t size() const { return reqs_.size(); }
+    bool empty() const { return reqs_.empty(); }
+    const ps::KVMeta& operator[](size_t i) const { return reqs_[i]; }
+    const_iterator begin() const { return reqs_.begin(); }
+    const_iterator end() const { return reqs_.end(); }
+
+   private:
+    static ps::Gauge* Pending() {
+      static ps::Gauge* pending = ps::Metrics::Get()->GetGauge(
+        "kvstore_pending_requests", "push requests waiting for the rest of their round");
+      return pending;
+    }
+
+    std::vector<ps::KVMeta> reqs_;
+  };
+
   struct UpdateBuf {
-    std::vector<ps::KVMeta> request;
+    PendingRequests request;
     NDArray merged;
     // temp_array is used to cast received values as float32 for computation if required
     NDArray temp_array;
   };
+  /*! \brief requests, bytes and handling time of a key */
+  struct KeyMetrics {
+    ps::Counter* pushes = nullptr;
+    ps::Counter* pulls = nullptr;
+    ps::Counter* bytes = nullptr;
+    ps::Histogram* handle_us = nullptr;
+  };
   std::unordered_map<int, ps::KVPairs<char>> req_data_buf;
   std::unordered_map<int, ps::KVMeta> req_meta_buf;
-  std::queue<int> send_q;
+  /** \brief keys whose own data is buffered, in the order it came */
+  std::deque<int> send_q;
   std::unordered_map<int, UpdateBuf> update_buf_global;
   std::mutex send_mu;
 
@@ -230,7 +337,17 @@ class KVStoreDistServer {
                     ps::KVServer<char>* server) {
     // Send my data to other servers.
     if (req_meta.num_merge == -1) {
-      int key = send_q.front();
+      // the TSEngine overlay names the key it releases, the scheduler the oldest
+      std::unique_lock<std::mutex> send_lk(send_mu);
+      auto it = send_q.begin();
+      if (req_meta.key != ps::Meta::kEmpty) {
+        it = std::find_if(send_q.begin(), send_q.end(),
+                          [&](int k) { return req_meta_buf[k].key == req_meta.key; });
+      }
+      CHECK(it != send_q.end()) << "no buffered data to send for key " << req_meta.key;
+      int key = *it;
+      send_q.erase(it);
+      send_lk.unlock();
 
       // Copy my data to the sender buffer.
       req_data_buf[key].vals.CopyFrom(
@@ -250,10 +367,6 @@ class KVStoreDistServer {
         req_meta_buf[key].app_id,
         req_meta_buf[key].customer_id,
         req_meta_buf[key].num_merge);
-
-      std::unique_lock <std::mutex> send_lk(send_mu);
-      send_q.pop();
-      send_lk.unlock();
     } else {
       // Receive data from other servers and merge them.
       CHECK_EQ(req_data.keys.size(), (size_t) 1);
@@ -268,7 +381,7 @@ class KVStoreDistServer {
 
       std::unique_lock <std::mutex> send_lk(send_mu);
       if (req_meta.sender == my_id) {
-        send_q.push(key);
+        send_q.push_back(key);
         req_meta_buf[key].cmd = req_meta.cmd;
         req_meta_buf[key].push = req_meta.push;
         req_meta_buf[key].sender = req_meta.sender;
@@ -314,7 +427,17 @@ class KVStoreDistServer {
     switch (recved_type) {
       case CommandType::kStopServer:
         if (ps::IsGlobalServer()) {
+          // pulls held for a party that stopped pushing would never be answered
+          if (staleness_.enabled()) {
+            for (auto& response : staleness_.Finish(ps::Postoffice::IDtoRank(recved.sender))) {
+              response();
+            }
+          }
           if (++num_stop_executor_ == ps::NumGlobalWorkers()) {
+            if (staleness_.enabled()) {
+              LOG(INFO) << "Global server " << ps::MyRank(true) << " staleness: "
+                        << staleness_.Summary();
+            }
             LOG(INFO) << "Stop executor";
             exec_.Stop();
           }
@@ -322,6 +445,9 @@ class KVStoreDistServer {
           CHECK_NOTNULL(ps_server_);
           int cmd_id = static_cast<int>(CommandType::kStopServer);
           ps_server_->Request(cmd_id, "", ps::kServerGroupGlobal, true);
+          if (placement_.initialized()) {
+            LOG(INFO) << "Server " << ps::MyRank() << " key placement: " << placement_.Summary();
+          }
           LOG(INFO) << "Stop executor";
           exec_.Stop();
         }
@@ -347,6 +473,38 @@ class KVStoreDistServer {
         ProcessServerProfilerCommands(static_cast<KVStoreServerProfilerCommand>
           (recved.body.back() - '0'), recved.body);
         break;
+      case CommandType::kSetServerOptimizer:
+        // only global servers apply updates, the python updater stays as fallback
+        if (ps::IsGlobalServer() && use_native_optimizer_) {
+          server_optimizer_->DecodeParams(recved.body);
+          LOG(INFO) << "Use native server optimizer: " << recved.body;
+        }
+        break;
+      case CommandType::kSetKeySizes:
+        // local servers replay the batches of workers to place keys on global servers
+        if (!placement_.initialized()) {
+          placement_.Init(ps::Postoffice::Get()->GetServerKeyRanges(true).size(),
+                          bigarray_bound_);
+        }
+        placement_.Register(DecodeKeySizes(recved.body));
+        break;
+      case CommandType::kCheckPlacement:
+        // nodes with other weights place keys on other servers, whose rounds never complete
+        CHECK_EQ(recved.body, PlacementWeightsFingerprint(PlacementWeightsFromEnv()))
+          << "MXNET_KVSTORE_PLACEMENT_WEIGHTS of node " << recved.sender
+          << " differs from that of server " << ps::MyRank(ps::IsGlobalServer())
+          << ", it must be the same on all nodes of all parties";
+        if (!ps::IsGlobalServer() && !placement_checked_) {
+          placement_checked_ = true;
+          ps_server_->Request(recved.head, recved.body, ps::kServerGroupGlobal, true);
+        }
+        break;
+      case CommandType::kSetKeyShapes:
+        // PowerSGD views the parts of a key as rows of its tensor
+        for (const auto& shape : powersgd::DecodeKeyShapes(recved.body)) {
+          powersgd_cols_[shape.first] = shape.second.second;
+        }
+        break;
       case CommandType::kSetMultiPrecision:
         // uses value 1 for message id from frontend
         if (!multi_precision_) {
@@ -459,6 +617,8 @@ class KVStoreDistServer {
                     const ps::KVPairs<char>& req_data,
                     ps::KVServer<char>* server) {
     DataHandleType type = DepairDataHandleType(req_meta.cmd);
+    const int64_t start = ps::Metrics::NowUs();
+    const KeyMetrics* metrics = RecordRequest(type, req_meta, req_data);
 
     switch (type.requestType) {
 
@@ -518,9 +678,66 @@ class KVStoreDistServer {
         }
         break;
 
+      case RequestType::kPowerSGDPushPull:
+        if (req_meta.sender % 2 == 1) {
+          if (req_meta.push) {
+            DataHandleSyncPowerSGD(type, req_meta, req_data, server);
+          } else {
+            DataHandlePullPowerSGD(type, req_meta, req_data, server);
+          }
+        } else if (req_meta.push) {
+          DataHandlePushResponsePowerSGD(type, req_meta, server);
+        } else {
+          DataHandlePullResponsePowerSGD(type, req_meta, req_data, server);
+        }
+        break;
+
+      case RequestType::kAdaptivePushPull:
+        CHECK(req_meta.push) << "keys pushed adaptively are pulled as default keys";
+        if (req_meta.sender % 2 == 1) {
+          DataHandleAdaptive(type, req_meta, req_data, server);
+        } else {
+          DataHandleAdaptiveAck(req_meta, req_data);
+          DataHandlePushResponseDefault(type, req_meta, server);
+        }
+        break;
+
       default :
         LOG(FATAL) << "Unsupported RequestType";
     }
+    if (metrics) metrics->handle_us->Record(ps::Metrics::NowUs() - start);
+  }
+
+  /*!
+   * \brief counts a request of a worker, or of a local server on global
+   * servers, in the metrics of its key and of its compression
+   * \return the metrics of the key, null for responses
+   */
+  const KeyMetrics* RecordRequest(const DataHandleType type, const ps::KVMeta& req_meta,
+                                  const ps::KVPairs<char>& req_data) {
+    if (req_meta.sender % 2 == 0 || req_data.keys.empty()) return nullptr;
+    // compressed pushes carry the original size in their first key
+    const bool sized = req_meta.push && req_data.keys.size() == 2 &&
+                       (type.requestType == RequestType::kCompressedPushPull ||
+                        type.requestType == RequestType::kBSCompressedPushPull);
+    const int key = DecodeKey(req_data.keys[sized ? 1 : 0], ps::IsGlobalServer());
+    const KeyMetrics& metrics = key_metrics_->Get(key);
+    (req_meta.push ? metrics.pushes : metrics.pulls)->Add();
+    metrics.bytes->Add(req_data.vals.size());
+    if (sized) {
+      const int64_t original_size = DecodeKey(req_data.keys[0], true);
+      compression_metrics_->Get(static_cast<int>(type.requestType)).Record(
+        original_size * mshadow::mshadow_sizeof(type.dtype), req_data.vals.size());
+    } else if (req_meta.push && type.requestType == RequestType::kPowerSGDPushPull &&
+               req_data.vals.size() >= sizeof(powersgd::Header)) {
+      // the gradient is sent as P then Q, count it once
+      const auto* header = reinterpret_cast<const powersgd::Header*>(req_data.vals.data());
+      const int64_t raw = header->phase == powersgd::kP
+          ? static_cast<int64_t>(header->rows) * header->cols * sizeof(float) : 0;
+      compression_metrics_->Get(static_cast<int>(type.requestType)).Record(
+        raw, req_data.vals.size());
+    }
+    return &metrics;
   }
 
   inline bool has_multi_precision_copy(const DataHandleType type) {
@@ -539,7 +756,11 @@ class KVStoreDistServer {
     // let the main thread to execute updater_, which is necessary for python
     auto& stored = has_multi_precision_copy(type) ? store_realt_[key] : store_[key];
     auto& update = sync_mode ? update_buf->merged : update_buf->temp_array;
-    if (updater_ && ps::IsGlobalServer()) {
+    const bool native = ps::IsGlobalServer() && server_optimizer_->Supports(update, stored);
+    if (native) {
+      // runs on engine threads, updates of different keys overlap
+      server_optimizer_->Update(key, update, &stored);
+    } else if (updater_ && ps::IsGlobalServer()) {
       CHECK(updater_);
       exec_.Exec([this, key, &update, &stored]() {
         updater_(key, update, &stored);
@@ -551,7 +772,9 @@ class KVStoreDistServer {
     if (has_multi_precision_copy(type)) {
       CopyFromTo(stored, store_[key]);
     }
-    stored.WaitToRead();
+    // readers of a natively updated key wait on its var themselves, but the
+    // update of an async push from a server reads the pushed data in place
+    if (!native || enable_ts || !sync_mode) stored.WaitToRead();
     if (enable_ts) {
       // Send the aggregated data to other servers.
       DefaultAutoPull(type, key, store_v_[key], req_meta, req_data, server, true);
@@ -600,7 +823,8 @@ class KVStoreDistServer {
       return;
     }
     const NDArray& stored = store_[master_key];
-    if (has_multi_precision_copy(type)) stored.WaitToRead();
+    // native optimizer updates may still be in flight
+    stored.WaitToRead();
     CHECK(!stored.is_none()) << "Init " << master_key << " first";
     auto shape = stored.shape();
     auto unit_len = shape.ProdShape(1, shape.ndim());
@@ -758,13 +982,15 @@ class KVStoreDistServer {
   int DataPushToGlobalServersDefault(const DataHandleType type, const int key,
                                      ps::KVServer<char>* server) {
     CHECK(!ps::IsGlobalServer()) << "Invalid push operation on global servers";
-    CHECK(gradient_compression_->get_type() == CompressionType::kNone);
+    CHECK(gradient_compression_->get_type() == CompressionType::kNone ||
+          gradient_compression_->get_type() == CompressionType::kPowerSGD);
 
     const auto& stored = has_multi_precision_copy(type) ? store_realt_[key] : store_[key];
     CHECK(!stored.is_none()) << "Init " << key << " first";
 
-    // as server returns when store_realt is ready in this case
-    if (has_multi_precision_copy(type)) stored.WaitToRead();
+    // as server returns when store_realt is ready in this case,
+    // and every reader of the store waits on its var
+    stored.WaitToRead();
 
     const int dtype = type.dtype;
     const int num_bytes = mshadow::mshadow_sizeof(dtype);
@@ -780,6 +1006,69 @@ class KVStoreDistServer {
     params.keys = pskv.keys;
     params.lens = pskv.lens;
     params.vals = vals;
+    params.trace_id = KVStoreTrace::Get()->Current(key);
+    KVStoreTrace::Get()->Begin("forward", params.trace_id);
+    return server->Push(params, cmd, nullptr, key);
+  }
+
+  /**
+   * Pushes a fp32 key in the mode the compression controller picks for this
+   * round, each part of it encoded with a header naming its mode.
+   */
+  int DataPushToGlobalServersAdaptive(const DataHandleType type, const int key,
+                                      ps::KVServer<char>* server) {
+    CHECK(!ps::IsGlobalServer()) << "Invalid push operation on global servers";
+    CHECK(gradient_compression_->get_type() == CompressionType::kNone);
+    CHECK_EQ(type.dtype, mshadow::kFloat32);
+
+    const auto& stored = store_[key];
+    CHECK(!stored.is_none()) << "Init " << key << " first";
+    const int num_bytes = mshadow::mshadow_sizeof(type.dtype);
+    const int cmd = GetCommandType(RequestType::kAdaptivePushPull, type.dtype);
+    PSKV& pskv = EncodeDefaultKey(key, stored.shape().Size(), num_bytes);
+
+    if (!adaptive_.enabled()) {
+      adaptive_.Init(ps::NumGlobalServers(),
+                     dmlc::GetEnv("MXNET_KVSTORE_TARGET_SYNC_MS", 100.0),
+                     dmlc::GetEnv("MXNET_KVSTORE_ADAPTIVE_TWO_BIT_THRESHOLD", 0.5f),
+                     dmlc::GetEnv("MXNET_KVSTORE_ADAPTIVE_BSC_RATIO", 0.01f));
+    }
+    auto krs = ps::Postoffice::Get()->GetServerKeyRanges(true);
+    std::vector<std::pair<int, int64_t>> parts;
+    for (size_t i = 0; i < pskv.keys.size(); ++i) {
+      int link = 0;
+      while (pskv.keys[i] >= krs[link].end()) ++link;
+      parts.emplace_back(link, pskv.lens[i] / num_bytes);
+    }
+    const adaptive::Mode mode = adaptive_.Choose(key, parts);
+    const float param = adaptive_.param(mode);
+
+    auto& residual = adaptive_residual_[key];
+    if (residual.empty()) residual.assign(stored.shape().Size(), 0);
+    size_t size = 0;
+    for (const auto& part : parts) size += adaptive::EncodedBytes(mode, part.second, param);
+
+    ps::KVPairs<char> params;
+    params.keys = pskv.keys;
+    params.vals.resize(size);
+    const int nthreads = engine::OpenMP::Get()->GetRecommendedOMPThreadCount();
+    const float* data = stored.data().dptr<float>();
+    size_t offset = 0;
+    int64_t begin = 0;
+    for (const auto& part : parts) {
+      const size_t bytes = adaptive::EncodedBytes(mode, part.second, param);
+      adaptive::Encode(mode, data + begin, residual.data() + begin, part.second, param,
+                       params.vals.data() + offset, nthreads);
+      params.lens.push_back(bytes);
+      offset += bytes;
+      begin += part.second;
+    }
+
+    auto* van = ps::Postoffice::Get()->van();
+    for (const auto& part : parts) {
+      const int id = ps::Postoffice::ServerRankToID(part.first, true);
+      adaptive_.OnPush(part.first, van->GetSendBytes(id, true));
+    }
     return server->Push(params, cmd, nullptr, key);
   }
 
@@ -832,8 +1121,9 @@ class KVStoreDistServer {
     const auto &stored = has_multi_precision_copy(type) ? store_realt_[key] : store_[key];
     CHECK(!stored.is_none()) << "Init " << key << " first";
 
-    // as server returns when store_realt is ready in this case.
-    if (has_multi_precision_copy(type)) stored.WaitToRead();
+    // as server returns when store_realt is ready in this case,
+    // and every reader of the store waits on its var
+    stored.WaitToRead();
 
     const unsigned int original_size = stored.shape().Size();
 
@@ -931,7 +1221,9 @@ class KVStoreDistServer {
 
     // pull latest params from global servers.
     if (!ps_server_->enable_inter_ts || !initialized_[key]) {
-      server->Pull(pskv.keys, cmd, key);
+      const uint64_t trace = KVStoreTrace::Get()->Current(key);
+      KVStoreTrace::Get()->Begin("global pull", trace);
+      server->Pull(pskv.keys, cmd, key, trace);
     }
   }
 
@@ -951,11 +1243,179 @@ class KVStoreDistServer {
     int key = ts_key_map_[ts];
     ts_key_map_.erase(ts);
     mu_.unlock();
+    KVStoreTrace::Get()->End("forward", KVStoreTrace::Get()->Current(key));
 
     // Pull latest data from the global servers.
     DataPullFromGlobalServersDefault(type, key, server);
   }
 
+  int PowerSGDRank(const int key) {
+    auto it = powersgd_ranks_.find(key);
+    return it != powersgd_ranks_.end() ? it->second : gradient_compression_->get_rank();
+  }
+
+  /**
+   * Pushes P = M Q of each part of a key, M being the aggregated gradients plus
+   * the error of previous rounds. Keys too small for their factors to pay off
+   * are pushed as is.
+   */
+  int DataPushToGlobalServersPowerSGD(const DataHandleType type, const int key,
+                                      ps::KVServer<char>* server) {
+    CHECK(!ps::IsGlobalServer()) << "Invalid push operation on global servers";
+    CHECK(gradient_compression_->get_type() == CompressionType::kPowerSGD);
+    CHECK_EQ(type.dtype, mshadow::kFloat32) << "Gradient compression is only supported for "
+                                            << "float32 type of parameters";
+
+    const auto& stored = store_[key];
+    CHECK(!stored.is_none()) << "Init " << key << " first";
+    const int num_bytes = mshadow::mshadow_sizeof(type.dtype);
+    const size_t size = stored.shape().Size();
+    PSKV& pskv = EncodeDefaultKey(key, size, num_bytes);
+
+    auto& state = powersgd_[key];
+    if (state.parts.empty()) {
+      // every part is a matrix of its own, aggregated by its global server
+      const int rank = PowerSGDRank(key);
+      state.compress = size >= size_lower_bound;
+      for (size_t i = 0; i < pskv.keys.size(); ++i) {
+        PowerSGDPart part;
+        const int64_t n = pskv.lens[i] / num_bytes;
+        auto cols = powersgd_cols_.find(key);
+        part.cols = powersgd::Cols(n, cols != powersgd_cols_.end() ? cols->second : 0);
+        part.rows = n / part.cols;
+        part.rank = rank;
+        state.compress = state.compress && powersgd::Worthwhile(part.rows, part.cols, rank);
+        part.m.assign(n, 0);
+        part.q.resize(part.cols * rank);
+        // seeded by the ps key, so that all parties start from the same Q
+        powersgd::InitQ(part.q.data(), part.cols, rank, pskv.keys[i]);
+        part.factor.resize(std::max(part.rows, part.cols) * rank);
+        state.parts.push_back(std::move(part));
+      }
+    }
+    if (!state.compress) return DataPushToGlobalServersDefault(type, key, server);
+
+    stored.WaitToRead();
+    const float* grad = stored.data().dptr<float>();
+    const int nthreads = engine::OpenMP::Get()->GetRecommendedOMPThreadCount();
+    int64_t offset = 0;
+    for (auto& part : state.parts) {
+      float* m = part.m.data();
+      const int64_t n = part.rows * part.cols;
+      #pragma omp parallel for num_threads(nthreads) schedule(static)
+      for (int64_t i = 0; i < n; ++i) m[i] += grad[offset + i];
+      powersgd::MulQ(m, part.rows, part.cols, part.q.data(), part.rank, part.factor.data(),
+                     nthreads);
+      offset += n;
+    }
+    state.phase = powersgd::kP;
+    state.num_pulled = 0;
+    return PushPowerSGDFactors(key, pskv, server);
+  }
+
+  /**
+   * Pushes the factor of the current phase of each part of a key.
+   */
+  int PushPowerSGDFactors(const int key, const PSKV& pskv, ps::KVServer<char>* server) {
+    const auto& state = powersgd_[key];
+    ps::KVPairs<char> params;
+    params.keys = pskv.keys;
+    size_t size = 0;
+    for (const auto& part : state.parts) {
+      const int64_t dim = state.phase == powersgd::kP ? part.rows : part.cols;
+      params.lens.push_back(sizeof(powersgd::Header) + dim * part.rank * sizeof(float));
+      size += params.lens.back();
+    }
+    params.vals.resize(size);
+    char* data = params.vals.data();
+    for (size_t i = 0; i < state.parts.size(); ++i) {
+      const auto& part = state.parts[i];
+      powersgd::Header header;
+      header.phase = state.phase;
+      header.rows = part.rows;
+      header.cols = part.cols;
+      header.rank = part.rank;
+      memcpy(data, &header, sizeof(header));
+      memcpy(data + sizeof(header), part.factor.data(), params.lens[i] - sizeof(header));
+      data += params.lens[i];
+    }
+    const int cmd = GetCommandType(RequestType::kPowerSGDPushPull, mshadow::kFloat32);
+    return server->Push(params, cmd, nullptr, key);
+  }
+
+  /**
+   * Pulls P^ after P was pushed, or the summed Q and the weights after Q was.
+   */
+  void DataHandlePushResponsePowerSGD(const DataHandleType type, const ps::KVMeta& req_meta,
+                                      ps::KVServer<char>* server) {
+    CHECK(!ps::IsGlobalServer()) << "Invalid push response on global servers";
+    const int ts = req_meta.timestamp;
+    if (server->NumResponse(ts) != ps::NumGlobalServers() - 1) return;
+
+    mu_.lock();
+    int key = ts_key_map_[ts];
+    ts_key_map_.erase(ts);
+    mu_.unlock();
+
+    const auto& stored = store_[key];
+    PSKV& pskv = EncodeDefaultKey(key, stored.shape().Size(), mshadow::mshadow_sizeof(type.dtype));
+    mu_.lock();
+    for (auto& ps_key : pskv.keys)
+      key_map_[ps_key] = key;
+    mu_.unlock();
+    server->Pull(pskv.keys, req_meta.cmd, key);
+  }
+
+  void DataHandlePullResponsePowerSGD(const DataHandleType type, const ps::KVMeta& req_meta,
+                                      const ps::KVPairs<char>& req_data,
+                                      ps::KVServer<char>* server) {
+    CHECK(!ps::IsGlobalServer()) << "Invalid pull operation on global servers";
+    CHECK_EQ(req_data.keys.size(), (size_t)1);
+    CHECK_GE(req_data.vals.size(), sizeof(powersgd::Header));
+
+    mu_.lock();
+    int key = key_map_[req_data.keys[0]];
+    mu_.unlock();
+
+    auto& state = powersgd_[key];
+    const auto& stored = store_[key];
+    PSKV& pskv = EncodeDefaultKey(key, stored.shape().Size(), mshadow::mshadow_sizeof(type.dtype));
+    const size_t index = std::find(pskv.keys.begin(), pskv.keys.end(), req_data.keys[0])
+                       - pskv.keys.begin();
+    CHECK_LT(index, state.parts.size());
+    auto& part = state.parts[index];
+    const auto* header = reinterpret_cast<const powersgd::Header*>(req_data.vals.data());
+    const float* body = reinterpret_cast<const float*>(req_data.vals.data() + sizeof(*header));
+    CHECK_EQ(header->phase, state.phase) << "PowerSGD rounds of key " << key << " are out of order";
+    const int nthreads = engine::OpenMP::Get()->GetRecommendedOMPThreadCount();
+
+    if (state.phase == powersgd::kP) {
+      // Q = M^T P^, and M keeps what P^ Q^T misses
+      powersgd::MulTransposedP(part.m.data(), part.rows, part.cols, body, part.rank,
+                               part.factor.data(), nthreads);
+      powersgd::AddProduct(body, part.factor.data(), part.rows, part.cols, part.rank, 1, -1,
+                           part.m.data(), nthreads);
+      if (++state.num_pulled < state.parts.size()) return;
+      state.phase = powersgd::kQ;
+      int ts = PushPowerSGDFactors(key, pskv, server);
+      mu_.lock();
+      ts_key_map_[ts] = key;
+      mu_.unlock();
+    } else {
+      // the summed Q warm-starts the next round, the weights follow it
+      std::copy(body, body + part.cols * part.rank, part.q.begin());
+      const size_t offset = sizeof(*header) + part.cols * part.rank * sizeof(float);
+      ps::KVPairs<char> weights;
+      weights.keys = req_data.keys;
+      weights.lens.push_back(req_data.vals.size() - offset);
+      weights.vals = req_data.vals.segment(offset, req_data.vals.size());
+      DataHandleType weights_type;
+      weights_type.requestType = RequestType::kDefaultPushPull;
+      weights_type.dtype = mshadow::kFloat32;
+      DataHandlePullResponseDefault(weights_type, req_meta, weights, server);
+    }
+  }
+
   void HandleHFAAccumulate(const DataHandleType& type, NDArray& stored,
                            NDArray& stored_milestone, const NDArray& recved) {
     CHECK(use_hfa) << "Invalid operation, hfa is not enabled";
@@ -996,11 +1456,12 @@ class KVStoreDistServer {
     const size_t num_arr_elems = stored.shape().Size();
     const int num_bytes = mshadow::mshadow_sizeof(type.dtype);
 
-    if (num_arr_elems >= bigarray_bound_
+    // bi-sparse keys are on a single global server whatever their size
+    if (num_arr_elems >= bigarray_bound_ && !is_bscompressed
       && num_parts != ps::NumGlobalServers()) return;
 
     // Handle small data tensor.
-    if (num_arr_elems < bigarray_bound_) {
+    if (num_arr_elems < bigarray_bound_ || is_bscompressed) {
       size_t ds[] = {(size_t) req_data.lens[0] / num_bytes};
       TShape dshape(ds, ds + 1);
       TBlob recv_blob;
@@ -1018,8 +1479,7 @@ class KVStoreDistServer {
         const int original_size = stored.shape().Size();
         NDArray temp_array = NDArray(
           mxnet::TShape{static_cast<int64_t>(original_size)}, stored.ctx(), false, type.dtype);
-        temp_array = 0;  // Initialize with all zeros.
-        gradient_compression_->BSCDecompress(recved, temp_array, 0);
+        gradient_compression_->BSCPullDecompress(recved, temp_array, 0);
         temp_array.WaitToRead();
         if (use_hfa) {
           HandleHFAAccumulate(type, stored, stored_milestone, temp_array);
@@ -1030,13 +1490,13 @@ class KVStoreDistServer {
       stored.WaitToRead();
       if (!is_compressed && has_multi_precision_copy(type)) {
         auto& stored_dtype = store_[key];
-        stored_dtype = NDArray(dshape, Context(), false, type.dtype);
+        stored_dtype = NDArray(stored.shape(), Context(), false, type.dtype);
         CopyFromTo(stored, stored_dtype);
         stored_dtype.WaitToRead();
       }
     } else {
       // Handle large data tensor.
-      PSKV& pskv = (is_compressed || is_bscompressed) ?
+      PSKV& pskv = is_compressed ?
           EncodeCompressedKey(key, num_arr_elems, false, num_bytes) :
           EncodeDefaultKey(key, num_arr_elems, num_bytes);
       auto& keys = pskv.keys;
@@ -1070,9 +1530,7 @@ class KVStoreDistServer {
       if (vals->empty()) {
         vals->resize(total_val);
       } else {
-        if (!is_bscompressed) {
-          CHECK_EQ(vals->size(), total_val);
-        }
+        CHECK_EQ(vals->size(), total_val);
       }
       char* p_vals = vals->data();
       int* p_lens = nullptr;
@@ -1092,24 +1550,10 @@ class KVStoreDistServer {
           p_lens += s.lens.size();
         }
       }
-      if (is_default || is_compressed) {
-        if (use_hfa) {
-          HandleHFAAccumulate(type, stored, stored_milestone, recv_buf);
-        } else {
-          CopyFromTo(recv_buf, &stored, 0);
-        }
-      } else if (is_bscompressed) {
-        const int original_size = stored.shape().Size();
-        NDArray temp_array = NDArray(
-          mxnet::TShape{static_cast<int64_t>(original_size)}, stored.ctx(), false, type.dtype);
-        temp_array = 0;
-        gradient_compression_->BSCDecompress(recv_buf, temp_array, 0);
-        temp_array.WaitToRead();
-        if (use_hfa) {
-          HandleHFAAccumulate(type, stored, stored_milestone, temp_array);
-        } else {
-          CopyFromTo(temp_array, &stored);
-        }
+      if (use_hfa) {
+        HandleHFAAccumulate(type, stored, stored_milestone, recv_buf);
+      } else {
+        CopyFromTo(recv_buf, &stored, 0);
       }
       stored.WaitToRead();
       if (!is_compressed && has_multi_precision_copy(type)) {
@@ -1122,6 +1566,8 @@ class KVStoreDistServer {
     mu_.lock();
     recv_kvs_.erase(key);
     mu_.unlock();
+    const uint64_t trace = KVStoreTrace::Get()->Current(key);
+    KVStoreTrace::Get()->End("global pull", trace);
 
     mu_.lock();
     auto& init = initialized_[key];
@@ -1146,6 +1592,7 @@ class KVStoreDistServer {
         mu_.lock();
         auto& updates_tmp = update_buf_tmp_[key];
         mu_.unlock();
+        KVStoreTrace::Get()->Begin("fan-out", trace);
         if (!ps_server_->enable_p3) {
           for (const auto& req : updates_tmp.request) {
             server->Response(req, false);
@@ -1164,6 +1611,7 @@ class KVStoreDistServer {
           }
         }
         updates_tmp.request.clear();
+        KVStoreTrace::Get()->End("fan-out", trace);
       }
     }
   }
@@ -1171,12 +1619,14 @@ class KVStoreDistServer {
   void DefaultStorageResponse(const DataHandleType type, const int key,
                               const ps::KVMeta& req_meta, const ps::KVPairs<char>& req_data,
                               ps::KVServer<char>* server) {
+    KVStoreTrace::Get()->Begin("serve pull", req_meta.trace_id);
     store_mu_.lock();
     const NDArray& stored = store_[key];
     CHECK(!stored.is_none()) << "init " << key << " first";
 
-    // as server returns when store_realt is ready in this case
-    if (has_multi_precision_copy(type)) stored.WaitToRead();
+    // as server returns when store_realt is ready in this case,
+    // and native optimizer updates may still be in flight
+    stored.WaitToRead();
 
     bool is_global = req_meta.sender < ps::kOffset;
     if (type.requestType == RequestType::kDefaultPushPull || 
@@ -1188,26 +1638,19 @@ class KVStoreDistServer {
       response.vals.CopyFrom(static_cast<const char*>(stored.data().dptr_), len);
       server->Response(req_meta, response, is_global);
     } else if (type.requestType == RequestType::kBSCompressedPushPull) {
-      float threshold = gradient_compression_->get_threshold();
-      const int original_size = stored.shape().Size();
-      const int numWorkers = ps::NumGlobalWorkers();
-      const int zipped_size = float(original_size) * threshold * numWorkers * 2;
-      auto len = zipped_size * mshadow::mshadow_sizeof(type.dtype);
-      NDArray small_buf = NDArray(mxnet::TShape{static_cast<int64_t>(zipped_size)}, stored.ctx(), false, type.dtype);
-      NDArray stored_copy = NDArray(mxnet::TShape{static_cast<int64_t>(original_size)}, stored.ctx(), false, type.dtype);
-      small_buf = 0;
-      CopyFromTo(stored, stored_copy);
-      gradient_compression_->BSCPullCompress(stored_copy, small_buf, numWorkers, 0);
-      small_buf.WaitToRead();
+      // sized to the nonzeros of the aggregated gradients, not to the worst case
+      std::vector<char> compressed;
+      gradient_compression_->BSCPullCompress(stored, bsc_dense_density_, &compressed);
       ps::KVPairs<char> response;
       response.keys = req_data.keys;
-      response.lens = {len};
-      response.vals.CopyFrom(static_cast<const char*>(small_buf.data().dptr_), len);
+      response.lens = {static_cast<int>(compressed.size())};
+      response.vals.CopyFrom(compressed.data(), compressed.size());
       server->Response(req_meta, response, is_global);
     } else {
       LOG(FATAL) << "Unsupported RequestType";
     }
     store_mu_.unlock();
+    KVStoreTrace::Get()->End("serve pull", req_meta.trace_id);
   }
 
   void DataHandleSyncDefault(const DataHandleType type, const ps::KVMeta& req_meta,
@@ -1275,6 +1718,11 @@ class KVStoreDistServer {
         && !ps::EnableCentralWorkers()) return;
 
       auto &updates = update_buf_[key];
+      if (updates.request.empty()) {
+        // the first push of a round names it for the hops that follow
+        KVStoreTrace::Get()->Adopt(key, req_meta.trace_id);
+        KVStoreTrace::Get()->Begin(ps::IsGlobalServer() ? "update" : "merge", req_meta.trace_id);
+      }
       if (updates.merged.is_none()) {
         updates.merged = NDArray(dshape, Context(), false,
                                  has_multi_precision_copy(type) ? mshadow::kFloat32 : type.dtype);
@@ -1282,19 +1730,25 @@ class KVStoreDistServer {
       if (has_multi_precision_copy(type) && updates.temp_array.is_none()) {
         updates.temp_array = NDArray(dshape, Context(), false, mshadow::kFloat32);
       }
-      if (updates.request.empty()) {
-        CopyFromTo(recved, updates.merged);
+      if (aggregator_) {
+        // an engine op writing merged, the update of the round is ordered after it
+        aggregator_->Merge(key, updates.merged, req_data.vals, type.dtype,
+                           updates.request.empty());
       } else {
-        if (has_multi_precision_copy(type)) {
-          CopyFromTo(recved, updates.temp_array);
-          updates.temp_array.WaitToRead();
-          updates.merged += updates.temp_array;
+        if (updates.request.empty()) {
+          CopyFromTo(recved, updates.merged);
         } else {
-          updates.merged += recved;
+          if (has_multi_precision_copy(type)) {
+            CopyFromTo(recved, updates.temp_array);
+            updates.temp_array.WaitToRead();
+            updates.merged += updates.temp_array;
+          } else {
+            updates.merged += recved;
+          }
         }
+        updates.merged.WaitToRead();
       }
-      updates.merged.WaitToRead();
-      
+
       for (int i = 0; i < req_meta.num_merge; i++) {
         updates.request.push_back(req_meta);
       }
@@ -1310,17 +1764,17 @@ class KVStoreDistServer {
             ApplyUpdates(type, key, &updates, server);
           }
           // notify all workers to call pull
-          for (const auto& req : updates.request) {
-            server->Response(req, req.sender < ps::kOffset);
-          }
+          for (const auto& req : updates.request) ResponseGlobalPush(req, server);
           updates.request.clear();
-        } else {
+          KVStoreTrace::Get()->End("update", KVStoreTrace::Get()->Current(key));
+        } else if (!aggregator_) {
           updates.merged.WaitToRead();
         }
       } else {
         if (updates.request.size() == (size_t) ps::NumWorkers()) {
           // only aggregate gradients
           ApplyUpdates(type, key, &updates, server);
+          KVStoreTrace::Get()->End("merge", KVStoreTrace::Get()->Current(key));
           if (key == 0) local_iters += 1;
           if ((local_iters % period_k2 != 0) && use_hfa) {
             for (const auto &req : updates.request) {
@@ -1345,7 +1799,12 @@ class KVStoreDistServer {
             int ts;
             switch (gradient_compression_->get_type()) {
               case CompressionType::kNone:
-                ts = DataPushToGlobalServersDefault(type, key, server);
+                if (use_adaptive_compression_ && type.dtype == mshadow::kFloat32 &&
+                    !ps_server_->enable_p3 && !ps_server_->enable_intra_ts) {
+                  ts = DataPushToGlobalServersAdaptive(type, key, server);
+                } else {
+                  ts = DataPushToGlobalServersDefault(type, key, server);
+                }
                 break;
               case CompressionType::kTwoBit:
                 ts = DataPushToGlobalServersCompressed(type, key, server);
@@ -1353,12 +1812,15 @@ class KVStoreDistServer {
               case CompressionType::kBiSparseCompression:
                 ts = DataPushToGlobalServersBSCompressed(type, key, server);
                 break;
+              case CompressionType::kPowerSGD:
+                ts = DataPushToGlobalServersPowerSGD(type, key, server);
+                break;
             }
             mu_.lock();
             ts_key_map_[ts] = key;
             mu_.unlock();
           }
-        } else {
+        } else if (!aggregator_) {
           updates.merged.WaitToRead();
         }
       }
@@ -1373,8 +1835,9 @@ class KVStoreDistServer {
       const NDArray& stored = store_[key];
       CHECK(!stored.is_none()) << "Init " << key << " first";
 
-      // as server returns when store_realt is ready in this case
-      if (has_multi_precision_copy(type)) stored.WaitToRead();
+      // as server returns when store_realt is ready in this case,
+      // and native optimizer updates may still be in flight
+      stored.WaitToRead();
 
       auto len = stored.shape().Size() * mshadow::mshadow_sizeof(stored.dtype());
       response.keys = req_data.keys;
@@ -1383,6 +1846,182 @@ class KVStoreDistServer {
       server->AutoPullUpdate(version, req_meta, response, inter_domain);
   }
 
+  /**
+   * Decodes a push of a local server in the mode it picked, then merges it as
+   * a default push of fp32 values.
+   */
+  void DataHandleAdaptive(const DataHandleType type, const ps::KVMeta& req_meta,
+                          const ps::KVPairs<char>& req_data, ps::KVServer<char>* server) {
+    CHECK(ps::IsGlobalServer());
+    CHECK_EQ(req_data.keys.size(), (size_t)1);
+    CHECK_EQ(req_data.lens.size(), (size_t)1);
+    CHECK_EQ(req_data.vals.size(), (size_t)req_data.lens[0]);
+    CHECK_GE(req_data.vals.size(), sizeof(adaptive::Header));
+    CHECK_EQ(type.dtype, mshadow::kFloat32);
+
+    if (sync_global_mode_) {
+      std::lock_guard<std::mutex> lk(adaptive_mu_);
+      adaptive_arrival_[std::make_pair(req_meta.sender, req_meta.timestamp)] =
+          ps::Metrics::NowUs();
+    }
+    const auto* header = reinterpret_cast<const adaptive::Header*>(req_data.vals.data());
+    const int64_t size = header->size;
+    ps::KVPairs<char> decoded;
+    decoded.keys = req_data.keys;
+    decoded.lens.push_back(size * sizeof(float));
+    decoded.vals.resize(size * sizeof(float));
+    adaptive::Decode(req_data.vals.data(), req_data.vals.size(),
+                     reinterpret_cast<float*>(decoded.vals.data()), size,
+                     engine::OpenMP::Get()->GetRecommendedOMPThreadCount());
+
+    DataHandleType decoded_type;
+    decoded_type.requestType = RequestType::kDefaultPushPull;
+    decoded_type.dtype = mshadow::kFloat32;
+    if (sync_global_mode_) {
+      DataHandleSyncDefault(decoded_type, req_meta, decoded, server);
+    } else {
+      DataHandleAsyncDefault(decoded_type, req_meta, decoded, server);
+    }
+  }
+
+  /**
+   * \brief acknowledges a push of a round on global servers. Adaptive pushes
+   * carry how long they were held, so that local servers leave the wait for the
+   * other parties out of the goodput of their links
+   */
+  void ResponseGlobalPush(const ps::KVMeta& req, ps::KVServer<char>* server) {
+    const bool is_global = req.sender < ps::kOffset;
+    if (DepairDataHandleType(req.cmd).requestType != RequestType::kAdaptivePushPull) {
+      server->Response(req, is_global);
+      return;
+    }
+    int64_t held_us = 0;
+    {
+      std::lock_guard<std::mutex> lk(adaptive_mu_);
+      auto it = adaptive_arrival_.find(std::make_pair(req.sender, req.timestamp));
+      if (it != adaptive_arrival_.end()) {
+        held_us = ps::Metrics::NowUs() - it->second;
+        adaptive_arrival_.erase(it);
+      }
+    }
+    ps::KVPairs<char> res;
+    res.keys.push_back(req.key);
+    res.vals.resize(sizeof(held_us));
+    memcpy(res.vals.data(), &held_us, sizeof(held_us));
+    res.lens.push_back(sizeof(held_us));
+    server->Response(req, res, is_global);
+  }
+
+  /**
+   * \brief feeds the acknowledgement of an adaptive push to the goodput of its
+   * link, minus the time the global server held the push
+   */
+  void DataHandleAdaptiveAck(const ps::KVMeta& req_meta, const ps::KVPairs<char>& res) {
+    int64_t held_us = 0;
+    if (res.vals.size() == sizeof(held_us)) memcpy(&held_us, res.vals.data(), sizeof(held_us));
+    const int id = req_meta.sender;
+    adaptive_.OnAck(ps::Postoffice::IDtoRank(id),
+                    ps::Postoffice::Get()->van()->GetSendBytes(id, true), held_us);
+  }
+
+  /**
+   * Sums the factors local servers push for a part. Once all parties pushed,
+   * the summed P is orthogonalized, or the summed Q is applied as P^ Q^T.
+   */
+  void DataHandleSyncPowerSGD(const DataHandleType type, const ps::KVMeta& req_meta,
+                              const ps::KVPairs<char>& req_data, ps::KVServer<char>* server) {
+    CHECK(ps::IsGlobalServer());
+    CHECK(sync_global_mode_) << "PowerSGD compression requires dist_sync";
+    CHECK(!ps::EnableCentralWorkers()) << "PowerSGD compression does not support central workers";
+    CHECK_EQ(req_data.keys.size(), (size_t)1);
+    CHECK_EQ(req_data.lens.size(), (size_t)1);
+    CHECK_EQ(req_data.vals.size(), (size_t)req_data.lens[0]);
+    CHECK_GE(req_data.vals.size(), sizeof(powersgd::Header));
+
+    const int key = DecodeKey(req_data.keys[0], true);
+    const auto* header = reinterpret_cast<const powersgd::Header*>(req_data.vals.data());
+    const float* body = reinterpret_cast<const float*>(req_data.vals.data() + sizeof(*header));
+    const int64_t rows = header->rows, cols = header->cols;
+    const int rank = header->rank;
+    const bool is_p = header->phase == powersgd::kP;
+    const int64_t n = (is_p ? rows : cols) * rank;
+    CHECK_EQ(req_data.vals.size(), sizeof(*header) + n * sizeof(float));
+
+    auto& sum = powersgd_sum_[key];
+    auto& factor = is_p ? sum.p : sum.q;
+    if (sum.request.empty()) {
+      sum.header = *header;
+      factor.assign(body, body + n);
+    } else {
+      CHECK_EQ(sum.header.phase, header->phase) << "PowerSGD rounds of key " << key
+                                                << " are out of order";
+      CHECK_EQ(sum.header.rank, header->rank) << "ranks of key " << key << " differ";
+      for (int64_t i = 0; i < n; ++i) factor[i] += body[i];
+    }
+    sum.request.push_back(req_meta);
+    if (sum.request.size() < (size_t)ps::NumGlobalWorkers()) return;
+
+    if (is_p) {
+      powersgd::Orthogonalize(sum.p.data(), rows, rank);
+    } else {
+      auto& stored = store_[key];
+      CHECK(!stored.is_none()) << "init " << key << " first";
+      CHECK_EQ(stored.shape().Size(), static_cast<size_t>(rows * cols));
+      auto& updates = update_buf_[key];
+      if (updates.merged.is_none()) {
+        updates.merged = NDArray(stored.shape(), Context(), false, mshadow::kFloat32);
+      }
+      updates.merged.WaitToWrite();
+      powersgd::AddProduct(sum.p.data(), sum.q.data(), rows, cols, rank, 0, 1,
+                           updates.merged.data().dptr<float>(),
+                           engine::OpenMP::Get()->GetRecommendedOMPThreadCount());
+      DataHandleType merged_type;
+      merged_type.requestType = RequestType::kDefaultPushPull;
+      merged_type.dtype = mshadow::kFloat32;
+      ApplyUpdates(merged_type, key, &updates, server);
+    }
+    sum.ready = header->phase;
+    // notify all local servers to pull
+    for (const auto& req : sum.request) {
+      server->Response(req, true);
+    }
+    sum.request.clear();
+  }
+
+  /**
+   * Answers P^ after the P phase, the summed Q and the weights after the Q phase.
+   */
+  void DataHandlePullPowerSGD(const DataHandleType type, const ps::KVMeta& req_meta,
+                              const ps::KVPairs<char>& req_data, ps::KVServer<char>* server) {
+    CHECK(ps::IsGlobalServer());
+    CHECK_EQ(req_data.keys.size(), (size_t)1);
+    const int key = DecodeKey(req_data.keys[0], true);
+    auto& sum = powersgd_sum_[key];
+    CHECK_NE(sum.ready, 0u) << "key " << key << " is pulled before its first PowerSGD round";
+
+    powersgd::Header header = sum.header;
+    header.phase = sum.ready;
+    const size_t factor_bytes = (sum.ready == powersgd::kP ? header.rows : header.cols)
+                              * header.rank * sizeof(float);
+    const float* factor = sum.ready == powersgd::kP ? sum.p.data() : sum.q.data();
+    size_t weights_bytes = 0;
+    if (sum.ready == powersgd::kQ) {
+      store_[key].WaitToRead();
+      weights_bytes = store_[key].shape().Size() * sizeof(float);
+    }
+    ps::KVPairs<char> response;
+    response.keys = req_data.keys;
+    response.vals.resize(sizeof(header) + factor_bytes + weights_bytes);
+    char* data = response.vals.data();
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), factor, factor_bytes);
+    if (weights_bytes) {
+      memcpy(data + sizeof(header) + factor_bytes, store_[key].data().dptr_, weights_bytes);
+    }
+    response.lens = {static_cast<int>(response.vals.size())};
+    server->Response(req_meta, response, true);
+  }
+
   void DataHandleSyncCompressed(const DataHandleType type, const ps::KVMeta& req_meta,
                                 const ps::KVPairs<char>& req_data, ps::KVServer<char>* server) {
     // do some check
@@ -1566,7 +2205,11 @@ class KVStoreDistServer {
         updates.temp_array = NDArray(dshape, Context(), false, mshadow::kFloat32);
       }
 
-      if (req_meta.sender > ps::kOffset) {
+      if (req_meta.sender > ps::kOffset && aggregator_) {
+        // push from central workers, aggregate on the shard of key
+        aggregator_->Merge(key, updates.merged, req_data.vals, type.dtype,
+                           updates.request.empty());
+      } else if (req_meta.sender > ps::kOffset) {
         // push from central workers, aggregate
         if (updates.request.empty()) {
           CopyFromTo(recved, updates.merged);
@@ -1599,13 +2242,14 @@ class KVStoreDistServer {
             server->Response(req, false);
           }
           updates.request.clear();
-        } else {
+        } else if (!aggregator_) {
           updates.merged.WaitToRead();
         }
       } else {
         // push from server
         ApplyUpdates(type, key, false, &updates, server);
         server->Response(req_meta, true);
+        ReleasePulls(key, req_meta.sender);
       }
     }
   }
@@ -1693,6 +2337,7 @@ class KVStoreDistServer {
         });
         server->Response(req_meta, true);
         stored.WaitToRead();
+        ReleasePulls(key, req_meta.sender);
       }
     }
   }
@@ -1753,6 +2398,7 @@ class KVStoreDistServer {
           while (!init.load()) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
           }
+          if (!AdmitPull(type, key, req_meta, req_data, server)) return;
           DefaultStorageResponse(type, key, req_meta, req_data, server);
         } else {
           // receive and handle pull data
@@ -1762,11 +2408,72 @@ class KVStoreDistServer {
     }
   }
 
+  /**
+   * \brief whether a pull of a local server may be answered now under
+   * MXNET_KVSTORE_STALENESS, otherwise it is answered once the slowest local
+   * servers pushed enough
+   */
+  bool AdmitPull(const DataHandleType type, const int key, const ps::KVMeta& req_meta,
+                 const ps::KVPairs<char>& req_data, ps::KVServer<char>* server) {
+    if (!ps::IsGlobalServer() || sync_global_mode_ || !staleness_.enabled()) return true;
+    return staleness_.Pull(key, ps::Postoffice::IDtoRank(req_meta.sender),
+                           [this, type, key, req_meta, req_data, server]() {
+                             DefaultStorageResponse(type, key, req_meta, req_data, server);
+                           });
+  }
+
+  /** \brief advances the clock of the local server that pushed key */
+  void ReleasePulls(const int key, const int sender) {
+    if (!staleness_.enabled()) return;
+    for (auto& response : staleness_.Push(key, ps::Postoffice::IDtoRank(sender))) {
+      response();
+    }
+  }
+
+  /** \brief samples the staleness stats of each local server on metrics export */
+  void ExportStaleness() {
+    auto add = [this](const std::string& name, const std::string& help, int party,
+                      double (*field)(const StalenessBound::Stats&)) {
+      const std::string labels = ps::Metrics::Labels({{"party", std::to_string(party)}});
+      ps::Metrics::Get()->AddSampler(name, help, labels, [this, party, field] {
+        return field(staleness_.stats(party));
+      });
+      samplers_.emplace_back(name, labels);
+    };
+    typedef StalenessBound::Stats Stats;
+    for (int party = 0; party < ps::NumGlobalWorkers(); ++party) {
+      add("kvstore_staleness_pulls", "pulls of a party under the staleness bound", party,
+          [](const Stats& s) { return static_cast<double>(s.num_pulls); });
+      add("kvstore_staleness_mean", "mean rounds a party was ahead of the slowest one in pulls",
+          party, [](const Stats& s) { return s.mean_staleness(); });
+      add("kvstore_staleness_max", "most rounds a party was ahead of the slowest one in pulls",
+          party, [](const Stats& s) { return static_cast<double>(s.max_staleness); });
+      add("kvstore_staleness_waits", "pulls of a party held by the staleness bound", party,
+          [](const Stats& s) { return static_cast<double>(s.num_waits); });
+      add("kvstore_staleness_wait_ms_mean", "mean milliseconds held pulls of a party waited",
+          party, [](const Stats& s) { return s.mean_wait_ms(); });
+      add("kvstore_staleness_wait_ms_max", "most milliseconds a held pull of a party waited",
+          party, [](const Stats& s) { return s.max_wait_ms; });
+    }
+  }
+
   int DecodeKey(ps::Key key, bool is_global=false) {
     auto kr = ps::Postoffice::Get()->GetServerKeyRanges(is_global)[ps::MyRank(is_global)];
     return key - kr.begin();
   }
 
+  /**
+   * \brief the global server of a key below bigarray_bound_, hashed unless
+   * workers sent the key sizes
+   */
+  int PickGlobalServer(const int key, const int num_global_servers) {
+    if (placement_.initialized()) {
+      const int server = placement_.Server(key);
+      if (server >= 0) return server;
+    }
+    return static_cast<uint64_t>(key) * 9973 % num_global_servers;
+  }
+
   PSKV& EncodeDefaultKey(const int key, const size_t num_arr_elems, const int num_bytes) {
     mu_.lock();
     PSKV& pskv = ps_kv_[key];
@@ -1781,8 +2488,8 @@ class KVStoreDistServer {
       CHECK_GT(num_global_servers, 0);
       // a simple heuristic for load balance
       if (num_arr_elems < bigarray_bound_) {
-        // send it to a single random picked global server
-        int global_server = (key * 9973) % num_global_servers;
+        // send it to a single global server, picked by size or hashed
+        int global_server = PickGlobalServer(key, num_global_servers);
         ps::Key ps_key = krs[global_server].begin() + key;
         CHECK_LT(ps_key, krs[global_server].end());
         pskv.keys.push_back(ps_key);
@@ -1847,8 +2554,8 @@ class KVStoreDistServer {
       mu_.unlock();
 
       if (is_bsc_compr || original_num_elem < bigarray_bound_) {
-        // send it to a single random picked server
-        int global_server = (key * 9973) % num_global_servers;
+        // send it to a single global server, picked by size or hashed
+        int global_server = PickGlobalServer(key, num_global_servers);
         ps::Key ps_key = krs[global_server].begin() + key;
         CHECK_LT(ps_key, krs[global_server].end());
         // meta info
@@ -1946,6 +2653,8 @@ class KVStoreDistServer {
    * Used when gradient compression is active and action is push
    */
   std::unordered_map<int, NDArray> compr_buf_;
+  /** \brief share of nonzeros from which BSC pull responses are dense */
+  float bsc_dense_density_;
   std::unordered_map<int, NDArray> velocity_;
   std::unordered_map<int, NDArray> accumulated_velocity_;
 
@@ -1988,6 +2697,86 @@ class KVStoreDistServer {
    * currently there is no support for unsetting gradient compression
    */
   std::shared_ptr<kvstore::GradientCompression> gradient_compression_;
+
+  /**
+   * \brief native optimizer of global servers.
+   * starts with none, used after workers send kSetServerOptimizer and
+   * MXNET_KVSTORE_USE_NATIVE_OPTIMIZER is set, otherwise updater_ is used
+   */
+  std::shared_ptr<kvstore::ServerOptimizer> server_optimizer_;
+  bool use_native_optimizer_;
+
+  /**
+   * \brief size-aware placement of keys on global servers,
+   * set up by the first kSetKeySizes of workers
+   */
+  KeyPlacement placement_;
+  /**
+   * \brief whether the weights of workers were checked and sent on to global servers
+   */
+  bool placement_checked_ = false;
+
+  /**
+   * \brief key-sharded aggregation threads of dense pushes,
+   * enabled by MXNET_KVSTORE_AGGREGATION_THREADS
+   */
+  std::shared_ptr<kvstore::ServerAggregator> aggregator_;
+
+  /**
+   * \brief picks the compression of each push of local servers to global
+   * servers, with MXNET_KVSTORE_ADAPTIVE_COMPRESSION
+   */
+  bool use_adaptive_compression_;
+  /** \brief stale synchronous parallel of dist_async, MXNET_KVSTORE_STALENESS */
+  StalenessBound staleness_;
+  adaptive::CompressionController adaptive_;
+  /** \brief what the encodings of each key lost so far */
+  std::unordered_map<int, std::vector<float>> adaptive_residual_;
+  /** \brief when global servers received each adaptive push they hold, in us */
+  std::map<std::pair<int, int>, int64_t> adaptive_arrival_;
+  std::mutex adaptive_mu_;
+
+  /** \brief a part of a key compressed by PowerSGD on local servers */
+  struct PowerSGDPart {
+    int64_t rows;
+    int64_t cols;
+    int rank;
+    /** \brief the gradients plus what previous rounds missed */
+    std::vector<float> m;
+    /** \brief the Q all parties share, warm-started by the last round */
+    std::vector<float> q;
+    /** \brief P, then Q of this party */
+    std::vector<float> factor;
+  };
+  struct PowerSGDKey {
+    /** \brief false if the key is pushed as is */
+    bool compress = false;
+    std::vector<PowerSGDPart> parts;
+    uint32_t phase = 0;
+    size_t num_pulled = 0;
+  };
+  std::unordered_map<int, PowerSGDKey> powersgd_;
+  /** \brief ranks of keys set by MXNET_KVSTORE_POWERSGD_RANKS */
+  std::unordered_map<int, int> powersgd_ranks_;
+  /** \brief elements of a row of the tensor of each key, set by kSetKeyShapes */
+  std::unordered_map<int, int64_t> powersgd_cols_;
+  /** \brief factors of a part summed over parties on global servers */
+  struct PowerSGDSum {
+    powersgd::Header header;
+    /** \brief the phase of the last complete round, 0 before the first */
+    uint32_t ready = 0;
+    std::vector<float> p;
+    std::vector<float> q;
+    PendingRequests request;
+  };
+  std::unordered_map<int, PowerSGDSum> powersgd_sum_;
+
+  /*! \brief metrics of the keys workers or local servers request, found without locks */
+  std::unique_ptr<ps::MetricTable<KeyMetrics>> key_metrics_;
+  /*! \brief bytes of compressed pushes before and after compression, by RequestType */
+  std::unique_ptr<ps::MetricTable<ps::CompressionMetrics>> compression_metrics_;
+  /*! \brief names and labels of the samplers reading this server, removed on destruction */
+  std::vector<std::pair<std::string, std::string>> samplers_;
 };
 }  // namespace kvstore
 }  // namespace mxnet
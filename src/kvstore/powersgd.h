@@ -0,0 +1,205 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file powersgd.h
+ * \brief kernels of PowerSGD low-rank compression on raw cpu buffers
+ *
+ * A part of n elements is viewed as a rows x cols row-major matrix M, the rows
+ * of the tensor of its key flattened after their first dimension. With a
+ * rank-r factor Q (cols x r) shared by all parties, a round exchanges
+ *
+ *     P = M Q            summed over parties, then orthogonalized to P^
+ *     Q = M^T P^         summed over parties
+ *
+ * and applies P^ Q^T, the projection of the summed M on the span of P^. What
+ * the projection loses stays in M as error feedback for the next round, and
+ * the summed Q warm-starts it.
+ */
+#ifndef MXNET_KVSTORE_POWERSGD_H_
+#define MXNET_KVSTORE_POWERSGD_H_
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace mxnet {
+namespace kvstore {
+namespace powersgd {
+
+enum Phase : uint32_t {
+  /*! \brief P = M Q is pushed, P^ is pulled */
+  kP = 1,
+  /*! \brief Q = M^T P^ is pushed, the summed Q and the weights are pulled */
+  kQ = 2
+};
+
+/*! \brief leads each part of PowerSGD pushes and pulls */
+struct Header {
+  uint32_t phase;
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t rank;
+};
+
+/*!
+ * \brief columns of the matrix view of a part of size elements, whose key has
+ * rows of key_cols elements. Parts holding whole rows are viewed as those
+ * rows, so vectors are not compressed. Other parts, and parts of keys whose
+ * shape is unknown (key_cols 0), use the largest divisor not above the square
+ * root, so that the view is as square as possible
+ */
+inline int64_t Cols(int64_t size, int64_t key_cols = 0) {
+  if (key_cols > 0 && size % key_cols == 0) return key_cols;
+  int64_t cols = static_cast<int64_t>(std::sqrt(static_cast<double>(size)));
+  while (cols > 1 && size % cols != 0) --cols;
+  return std::max<int64_t>(cols, 1);
+}
+
+/*! \brief "key:dim0:rest,..." of the shapes of keys collapsed to 2 dimensions */
+inline std::string EncodeKeyShapes(const std::vector<std::pair<int, std::pair<int64_t, int64_t>>>& keys) {
+  std::ostringstream os;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    os << (i ? "," : "") << keys[i].first << ":" << keys[i].second.first
+       << ":" << keys[i].second.second;
+  }
+  return os.str();
+}
+
+inline std::vector<std::pair<int, std::pair<int64_t, int64_t>>> DecodeKeyShapes(const std::string& s) {
+  std::vector<std::pair<int, std::pair<int64_t, int64_t>>> keys;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    int key;
+    int64_t rows, cols;
+    char c1, c2;
+    std::stringstream is(item);
+    is >> key >> c1 >> rows >> c2 >> cols;
+    CHECK(!is.fail() && c1 == ':' && c2 == ':') << "invalid key shapes " << item;
+    keys.emplace_back(key, std::make_pair(rows, cols));
+  }
+  return keys;
+}
+
+/*! \brief whether the factors are at most half of the matrix */
+inline bool Worthwhile(int64_t rows, int64_t cols, int rank) {
+  return rank > 0 && 2 * (rows + cols) * rank <= rows * cols;
+}
+
+/*! \brief fills q with standard normal values, seeded so that parties agree */
+inline void InitQ(float* q, int64_t cols, int rank, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::normal_distribution<float> normal(0, 1);
+  for (int64_t i = 0; i < cols * rank; ++i) q[i] = normal(rng);
+}
+
+/*! \brief p = m q, m is rows x cols and q is cols x rank */
+inline void MulQ(const float* m, int64_t rows, int64_t cols, const float* q, int rank,
+                 float* p, int nthreads) {
+  #pragma omp parallel for num_threads(nthreads) schedule(static)
+  for (int64_t i = 0; i < rows; ++i) {
+    float* pi = p + i * rank;
+    std::fill(pi, pi + rank, 0.0f);
+    const float* mi = m + i * cols;
+    for (int64_t j = 0; j < cols; ++j) {
+      const float* qj = q + j * rank;
+      for (int k = 0; k < rank; ++k) pi[k] += mi[j] * qj[k];
+    }
+  }
+}
+
+/*! \brief q = m^T p, m is rows x cols and p is rows x rank */
+inline void MulTransposedP(const float* m, int64_t rows, int64_t cols, const float* p, int rank,
+                           float* q, int nthreads) {
+  std::fill(q, q + cols * rank, 0.0f);
+  // each thread owns a range of columns, rows are walked in order for locality
+  #pragma omp parallel num_threads(nthreads)
+  {
+#ifdef _OPENMP
+    const int t = omp_get_thread_num(), nt = omp_get_num_threads();
+#else
+    const int t = 0, nt = 1;
+#endif
+    const int64_t chunk = (cols + nt - 1) / nt;
+    const int64_t begin = std::min(cols, t * chunk), end = std::min(cols, begin + chunk);
+    for (int64_t i = 0; i < rows; ++i) {
+      const float* mi = m + i * cols;
+      const float* pi = p + i * rank;
+      for (int64_t j = begin; j < end; ++j) {
+        float* qj = q + j * rank;
+        for (int k = 0; k < rank; ++k) qj[k] += mi[j] * pi[k];
+      }
+    }
+  }
+}
+
+/*!
+ * \brief orthonormalizes the columns of p (rows x rank) by modified
+ * Gram-Schmidt, columns that vanish are zeroed
+ */
+inline void Orthogonalize(float* p, int64_t rows, int rank) {
+  for (int k = 0; k < rank; ++k) {
+    double before = 0;
+    for (int64_t i = 0; i < rows; ++i) before += p[i * rank + k] * p[i * rank + k];
+    for (int l = 0; l < k; ++l) {
+      double dot = 0;
+      for (int64_t i = 0; i < rows; ++i) dot += p[i * rank + k] * p[i * rank + l];
+      for (int64_t i = 0; i < rows; ++i) p[i * rank + k] -= dot * p[i * rank + l];
+    }
+    double norm = 0;
+    for (int64_t i = 0; i < rows; ++i) norm += p[i * rank + k] * p[i * rank + k];
+    // what is left of a column in the span of the previous ones is rounding noise
+    const float scale = norm > 1e-8 * before && norm > 1e-30 ? 1.0 / std::sqrt(norm) : 0;
+    for (int64_t i = 0; i < rows; ++i) p[i * rank + k] *= scale;
+  }
+}
+
+/*!
+ * \brief m = alpha * m + beta * p q^T, p is rows x rank and q is cols x rank
+ */
+inline void AddProduct(const float* p, const float* q, int64_t rows, int64_t cols, int rank,
+                       float alpha, float beta, float* m, int nthreads) {
+  #pragma omp parallel for num_threads(nthreads) schedule(static)
+  for (int64_t i = 0; i < rows; ++i) {
+    const float* pi = p + i * rank;
+    float* mi = m + i * cols;
+    for (int64_t j = 0; j < cols; ++j) {
+      const float* qj = q + j * rank;
+      float dot = 0;
+      for (int k = 0; k < rank; ++k) dot += pi[k] * qj[k];
+      // alpha = 0 overwrites m, which may hold garbage
+      mi[j] = alpha == 0 ? beta * dot : alpha * mi[j] + beta * dot;
+    }
+  }
+}
+
+}  // namespace powersgd
+}  // namespace kvstore
+}  // namespace mxnet
+#endif  // MXNET_KVSTORE_POWERSGD_H_
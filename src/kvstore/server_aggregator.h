@@ -0,0 +1,190 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file server_aggregator.h
+ * \brief key-sharded gradient aggregation threads of servers
+ */
+#ifndef MXNET_KVSTORE_SERVER_AGGREGATOR_H_
+#define MXNET_KVSTORE_SERVER_AGGREGATOR_H_
+#include <dmlc/blockingconcurrentqueue.h>
+#include <mxnet/engine.h>
+#include <mxnet/ndarray.h>
+#include <ps/ps.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mxnet {
+namespace kvstore {
+
+/**
+ * \brief merges pushed gradients of a key on the thread owning its shard.
+ *
+ * Each merge is an engine operation writing the aggregation buffer, so it is
+ * ordered with every other operation on the buffer, and readers wait on its
+ * var as for any other write. The operation only hands the merge to the
+ * shard of its key, whose thread applies it and completes the operation, so
+ * the engine threads are not held and keys of different shards merge in
+ * parallel. The received SArray is kept alive by the task, so no WaitToRead
+ * is needed per message.
+ */
+class ServerAggregator {
+ public:
+  explicit ServerAggregator(int num_threads) {
+    CHECK_GT(num_threads, 0);
+    for (int i = 0; i < num_threads; ++i) {
+      shards_.emplace_back(new Shard());
+    }
+    for (auto& shard : shards_) {
+      Shard* s = shard.get();
+      s->thread = std::thread([this, s]() { Run(s); });
+    }
+  }
+
+  ~ServerAggregator() {
+    {
+      // merges pushed to the engine still reach the inboxes
+      std::unique_lock<std::mutex> lk(mu_);
+      idle_.wait(lk, [this]() { return in_flight_ == 0; });
+    }
+    for (auto& shard : shards_) {
+      Task task;
+      task.stop = true;
+      shard->inbox.enqueue(std::move(task));
+    }
+    for (auto& shard : shards_) {
+      shard->thread.join();
+    }
+  }
+
+  /**
+   * \brief merges vals into merged asynchronously, as an engine operation
+   * writing merged, should be called from the customer thread only
+   * \param key key of the gradient, decides the shard
+   * \param merged the aggregation buffer of key
+   * \param vals received data with dtype elements
+   * \param dtype type of the received data
+   * \param overwrite copy instead of add, for the first push of a round
+   */
+  void Merge(const int key, const NDArray& merged, const ps::SArray<char>& vals,
+             const int dtype, const bool overwrite) {
+    CHECK_EQ(vals.size(), merged.shape().Size() * mshadow::mshadow_sizeof(dtype));
+    Shard* shard = shards_[key % shards_.size()].get();
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      ++in_flight_;
+    }
+    Engine::Get()->PushAsync(
+      [shard, merged, vals, dtype, overwrite](RunContext ctx,
+                                              Engine::CallbackOnComplete on_complete) {
+        Task task;
+        task.merged = merged;
+        task.vals = vals;
+        task.dtype = dtype;
+        task.overwrite = overwrite;
+        task.on_complete = on_complete;
+        shard->inbox.enqueue(std::move(task));
+      }, merged.ctx(), {}, {merged.var()}, FnProperty::kNormal, 0, "ServerAggregatorMerge");
+  }
+
+  /** \brief dst[i] += src[i] */
+  static void Add(float* dst, const float* src, size_t size) {
+    size_t i = 0;
+#if defined(__AVX__)
+    for (; i + 8 <= size; i += 8) {
+      _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i),
+                                              _mm256_loadu_ps(src + i)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= size; i += 4) {
+      _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+    }
+#endif
+    for (; i < size; ++i) dst[i] += src[i];
+  }
+
+ private:
+  struct Task {
+    NDArray merged;
+    ps::SArray<char> vals;
+    int dtype = 0;
+    bool overwrite = false;
+    bool stop = false;
+    Engine::CallbackOnComplete on_complete;
+  };
+
+  struct Shard {
+    dmlc::moodycamel::BlockingConcurrentQueue<Task> inbox;
+    std::thread thread;
+  };
+
+  void Run(Shard* shard) {
+    while (true) {
+      Task task;
+      shard->inbox.wait_dequeue(task);
+      if (task.stop) break;
+      Apply(task);
+      task.on_complete();
+      std::lock_guard<std::mutex> lk(mu_);
+      if (--in_flight_ == 0) idle_.notify_all();
+    }
+  }
+
+  static void Apply(const Task& task) {
+    const size_t size = task.merged.shape().Size();
+    MSHADOW_REAL_TYPE_SWITCH(task.merged.dtype(), DType, {
+      MSHADOW_REAL_TYPE_SWITCH(task.dtype, SType, {
+        DType* dst = task.merged.data().dptr<DType>();
+        const SType* src = reinterpret_cast<const SType*>(task.vals.data());
+        if (task.overwrite) {
+          if (std::is_same<DType, SType>::value) {
+            std::memcpy(dst, src, size * sizeof(DType));
+          } else {
+            for (size_t i = 0; i < size; ++i) dst[i] = static_cast<DType>(src[i]);
+          }
+        } else if (std::is_same<DType, float>::value && std::is_same<SType, float>::value) {
+          Add(reinterpret_cast<float*>(dst), reinterpret_cast<const float*>(src), size);
+        } else {
+          for (size_t i = 0; i < size; ++i) dst[i] += static_cast<DType>(src[i]);
+        }
+      });
+    });
+  }
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  /** \brief merges pushed to the engine and not applied yet */
+  int in_flight_ = 0;
+  std::mutex mu_;
+  std::condition_variable idle_;
+};
+}  // namespace kvstore
+}  // namespace mxnet
+#endif  // MXNET_KVSTORE_SERVER_AGGREGATOR_H_
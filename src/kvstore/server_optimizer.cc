@@ -0,0 +1,235 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file server_optimizer.cc
+ * \brief native optimizers applied by global servers without the python updater
+ */
+
+#include <cmath>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+#include "kvstore_local.h"
+#include "server_optimizer.h"
+#include "../operator/optimizer_op-inl.h"
+
+namespace mxnet {
+namespace kvstore {
+
+DMLC_REGISTER_PARAMETER(ServerOptimizerParam);
+
+/*! \brief delay compensated sgd, matches DCASGD in python/mxnet/optimizer */
+struct DCASGDKernel {
+  template<typename DType>
+  MSHADOW_XINLINE static void Map(int i, DType* weight_data, DType* mom_data,
+    DType* prev_weight_data, const DType* grad_data, const DType param_clip_gradient,
+    const DType param_momentum, const DType param_lamda, const DType param_lr,
+    const DType param_wd, const DType param_rescale_grad) {
+    DType grad = param_rescale_grad * grad_data[i];
+    if (param_clip_gradient >= 0.0f) {
+      grad = op::mshadow_op::clip::Map(grad, param_clip_gradient);
+    }
+    const DType weight = weight_data[i];
+    mom_data[i] = param_momentum * mom_data[i]
+                - param_lr * (grad + param_wd * weight
+                              + param_lamda * grad * grad * (weight - prev_weight_data[i]));
+    prev_weight_data[i] = weight;
+    weight_data[i] = weight + mom_data[i];
+  }
+};
+
+ServerOptimizer::ServerOptimizer() {
+  type_ = ServerOptimizerType::kNone;
+}
+
+void ServerOptimizer::SetParams(const std::vector<std::pair<std::string, std::string> >
+                                & kwargs) {
+  param_.InitAllowUnknown(kwargs);
+  CHECK_GE(param_.momentum, 0.0f) << "momentum must not be negative";
+  if (param_.optimizer == "sgd") {
+    type_ = ServerOptimizerType::kSGD;
+  } else if (param_.optimizer == "adam") {
+    type_ = ServerOptimizerType::kAdam;
+  } else if (param_.optimizer == "dcasgd") {
+    type_ = ServerOptimizerType::kDCASGD;
+  } else {
+    LOG(FATAL) << "Unknown type for server optimizer " << param_.optimizer;
+  }
+  std::lock_guard<std::mutex> lk(mu_);
+  states_.clear();
+}
+
+void ServerOptimizer::DecodeParams(const std::string &s) {
+  std::vector<std::string> elems;
+  mxnet::kvstore::split(s, ',', std::back_inserter(elems));
+  std::vector<std::pair<std::string, std::string> > kwargs;
+  for (const auto& elem : elems) {
+    std::vector<std::string> parts;
+    mxnet::kvstore::split(elem, ':', std::back_inserter(parts));
+    CHECK_EQ(parts.size(), 2) << "Improper server optimizer param " << elem;
+    kwargs.emplace_back(parts[0], parts[1]);
+  }
+  SetParams(kwargs);
+}
+
+ServerOptimizerType ServerOptimizer::get_type() const {
+  return type_;
+}
+
+bool ServerOptimizer::Supports(const NDArray& grad, const NDArray& weight) const {
+  return type_ != ServerOptimizerType::kNone &&
+         grad.storage_type() == kDefaultStorage &&
+         weight.storage_type() == kDefaultStorage &&
+         weight.ctx().dev_mask() == cpu::kDevMask &&
+         grad.dtype() == weight.dtype();
+}
+
+ServerOptimizer::State* ServerOptimizer::GetState(const int key, const NDArray& weight) {
+  std::lock_guard<std::mutex> lk(mu_);
+  State* state = &states_[key];
+  if (state->num_update == 0) {
+    switch (type_) {
+      case ServerOptimizerType::kSGD:
+        if (param_.momentum > 0.0f) {
+          state->mom = NDArray(weight.shape(), weight.ctx(), false, weight.dtype());
+          state->mom = 0;
+        }
+        break;
+      case ServerOptimizerType::kAdam:
+        state->mean = NDArray(weight.shape(), weight.ctx(), false, weight.dtype());
+        state->var = NDArray(weight.shape(), weight.ctx(), false, weight.dtype());
+        state->mean = 0;
+        state->var = 0;
+        break;
+      case ServerOptimizerType::kDCASGD:
+        state->mom = NDArray(weight.shape(), weight.ctx(), false, weight.dtype());
+        state->mom = 0;
+        state->prev_weight = NDArray(weight.shape(), weight.ctx(), false, weight.dtype());
+        CopyFromTo(weight, &state->prev_weight);
+        break;
+      default:
+        LOG(FATAL) << "Server optimizer is not set";
+    }
+  }
+  state->num_update += 1;
+  return state;
+}
+
+void ServerOptimizer::Update(const int key, const NDArray& grad, NDArray* weight,
+                             const int priority) {
+  CHECK(Supports(grad, *weight)) << "Unsupported update for key " << key;
+  CHECK_EQ(grad.shape().Size(), weight->shape().Size());
+  State* state = GetState(key, *weight);
+  const NDArray w = *weight;
+  const ServerOptimizerParam p = param_;
+  switch (type_) {
+    case ServerOptimizerType::kSGD:
+      if (p.momentum > 0.0f) {
+        op::SGDMomParam param;
+        param.lr = p.learning_rate;
+        param.momentum = p.momentum;
+        param.wd = p.wd;
+        param.rescale_grad = p.rescale_grad;
+        param.clip_gradient = p.clip_gradient;
+        param.lazy_update = false;
+        const NDArray mom = state->mom;
+        Engine::Get()->PushSync([w, grad, mom, param](RunContext rctx) {
+          nnvm::NodeAttrs attrs;
+          attrs.parsed = param;
+          OpContext ctx;
+          ctx.run_ctx = rctx;
+          op::SGDMomUpdate<cpu>(attrs, ctx, {w.data(), grad.data(), mom.data()},
+                                {kWriteInplace}, {w.data()});
+        }, w.ctx(), {grad.var()}, {w.var(), mom.var()},
+        FnProperty::kNormal, priority, "ServerSGDMomUpdate");
+      } else {
+        op::SGDParam param;
+        param.lr = p.learning_rate;
+        param.wd = p.wd;
+        param.rescale_grad = p.rescale_grad;
+        param.clip_gradient = p.clip_gradient;
+        param.lazy_update = false;
+        Engine::Get()->PushSync([w, grad, param](RunContext rctx) {
+          nnvm::NodeAttrs attrs;
+          attrs.parsed = param;
+          OpContext ctx;
+          ctx.run_ctx = rctx;
+          op::SGDUpdate<cpu>(attrs, ctx, {w.data(), grad.data()},
+                             {kWriteInplace}, {w.data()});
+        }, w.ctx(), {grad.var()}, {w.var()},
+        FnProperty::kNormal, priority, "ServerSGDUpdate");
+      }
+      break;
+    case ServerOptimizerType::kAdam: {
+      // bias correction folded into the learning rate as in python Adam
+      const double t = static_cast<double>(state->num_update);
+      const double coef1 = 1.0 - std::pow(p.beta1, t);
+      const double coef2 = 1.0 - std::pow(p.beta2, t);
+      op::AdamParam param;
+      param.lr = static_cast<float>(p.learning_rate * std::sqrt(coef2) / coef1);
+      param.beta1 = p.beta1;
+      param.beta2 = p.beta2;
+      param.epsilon = p.epsilon;
+      param.wd = p.wd;
+      param.rescale_grad = p.rescale_grad;
+      param.clip_gradient = p.clip_gradient;
+      param.lazy_update = false;
+      const NDArray mean = state->mean;
+      const NDArray var = state->var;
+      // AdamUpdate rescales grad inplace, so it runs on a private copy
+      NDArray grad_copy = NDArray(grad.shape(), grad.ctx(), false, grad.dtype());
+      CopyFromTo(grad, &grad_copy, priority);
+      Engine::Get()->PushSync([w, grad_copy, mean, var, param](RunContext rctx) {
+        nnvm::NodeAttrs attrs;
+        attrs.parsed = param;
+        OpContext ctx;
+        ctx.run_ctx = rctx;
+        op::AdamUpdate<cpu>(attrs, ctx, {w.data(), grad_copy.data(), mean.data(), var.data()},
+                            {kWriteInplace}, {w.data()});
+      }, w.ctx(), {}, {w.var(), grad_copy.var(), mean.var(), var.var()},
+      FnProperty::kNormal, priority, "ServerAdamUpdate");
+      break;
+    }
+    case ServerOptimizerType::kDCASGD: {
+      const NDArray mom = state->mom;
+      const NDArray prev_weight = state->prev_weight;
+      Engine::Get()->PushSync([w, grad, mom, prev_weight, p](RunContext rctx) {
+        MSHADOW_REAL_TYPE_SWITCH(w.dtype(), DType, {
+          op::mxnet_op::Kernel<DCASGDKernel, cpu>::Launch(
+            rctx.get_stream<cpu>(), w.shape().Size(), w.data().dptr<DType>(),
+            mom.data().dptr<DType>(), prev_weight.data().dptr<DType>(),
+            grad.data().dptr<DType>(), static_cast<DType>(p.clip_gradient),
+            static_cast<DType>(p.momentum), static_cast<DType>(p.lamda),
+            static_cast<DType>(p.learning_rate), static_cast<DType>(p.wd),
+            static_cast<DType>(p.rescale_grad));
+        });
+      }, w.ctx(), {grad.var()}, {w.var(), mom.var(), prev_weight.var()},
+      FnProperty::kNormal, priority, "ServerDCASGDUpdate");
+      break;
+    }
+    default:
+      LOG(FATAL) << "Server optimizer is not set";
+  }
+}
+
+}  // namespace kvstore
+}  // namespace mxnet
@@ -0,0 +1,142 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file server_optimizer.h
+ * \brief native optimizers applied by global servers without the python updater
+ */
+
+#ifndef MXNET_KVSTORE_SERVER_OPTIMIZER_H_
+#define MXNET_KVSTORE_SERVER_OPTIMIZER_H_
+#include <dmlc/parameter.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "mxnet/ndarray.h"
+
+namespace mxnet {
+namespace kvstore {
+
+enum class ServerOptimizerType {
+  kNone, kSGD, kAdam, kDCASGD
+};
+
+struct ServerOptimizerParam : public dmlc::Parameter<ServerOptimizerParam> {
+  std::string optimizer;
+  float learning_rate;
+  float wd;
+  float rescale_grad;
+  float clip_gradient;
+  float momentum;
+  float beta1;
+  float beta2;
+  float epsilon;
+  float lamda;
+  DMLC_DECLARE_PARAMETER(ServerOptimizerParam) {
+    DMLC_DECLARE_FIELD(optimizer)
+      .describe("Name of the optimizer, one of `sgd`, `adam`, `dcasgd`");
+    DMLC_DECLARE_FIELD(learning_rate).set_default(0.01f)
+      .describe("Learning rate");
+    DMLC_DECLARE_FIELD(wd).set_default(0.0f)
+      .describe("Weight decay");
+    DMLC_DECLARE_FIELD(rescale_grad).set_default(1.0f)
+      .describe("Rescale gradient to grad = rescale_grad*grad");
+    DMLC_DECLARE_FIELD(clip_gradient).set_default(-1.0f)
+      .describe("Clip gradient to [-clip_gradient, clip_gradient], turned off if negative");
+    DMLC_DECLARE_FIELD(momentum).set_default(0.0f)
+      .describe("Momentum of sgd and dcasgd");
+    DMLC_DECLARE_FIELD(beta1).set_default(0.9f)
+      .describe("Decay rate for the 1st moment estimates of adam");
+    DMLC_DECLARE_FIELD(beta2).set_default(0.999f)
+      .describe("Decay rate for the 2nd moment estimates of adam");
+    DMLC_DECLARE_FIELD(epsilon).set_default(1e-8f)
+      .describe("Small constant for numerical stability of adam");
+    DMLC_DECLARE_FIELD(lamda).set_default(0.04f)
+      .describe("Scale of the delay compensation term of dcasgd");
+  }
+};
+
+/*!
+ * \brief optimizer run natively by global servers.
+ *
+ * Updates are pushed to the engine with the weight and the optimizer states
+ * as mutable vars, so updates of different keys run concurrently on the
+ * engine's cpu workers and readers of a weight wait on its var only.
+ */
+class ServerOptimizer {
+ public:
+  ServerOptimizer();
+
+  /*!
+   * \brief sets parameters of the optimizer
+   * \param kwargs a vector of pair of strings, parsed by ServerOptimizerParam
+   */
+  void SetParams(const std::vector<std::pair<std::string, std::string> >& kwargs);
+
+  /*!
+   * \brief decodes parameters sent by workers in the form of
+   * `name:value,name:value,...`
+   */
+  void DecodeParams(const std::string& s);
+
+  /*!
+   * \brief returns type of the optimizer, kNone if not configured
+   */
+  ServerOptimizerType get_type() const;
+
+  /*!
+   * \brief whether the update of this weight can be handled natively,
+   * otherwise the caller should fall back to the python updater
+   */
+  bool Supports(const NDArray& grad, const NDArray& weight) const;
+
+  /*!
+   * \brief issues the update of one key, returns without waiting for it
+   * \param key key of the weight, used to look up optimizer states
+   * \param grad aggregated gradient
+   * \param weight weight to be updated inplace
+   * \param priority priority of the engine operation
+   */
+  void Update(const int key, const NDArray& grad, NDArray* weight, const int priority = 0);
+
+ private:
+  struct State {
+    NDArray mom;
+    NDArray mean;
+    NDArray var;
+    NDArray prev_weight;
+    int64_t num_update = 0;
+  };
+
+  /*!
+   * \brief returns states of a key, creates them on the first update
+   */
+  State* GetState(const int key, const NDArray& weight);
+
+  ServerOptimizerType type_;
+  ServerOptimizerParam param_;
+  std::unordered_map<int, State> states_;
+  std::mutex mu_;
+};
+}  // namespace kvstore
+}  // namespace mxnet
+#endif  // MXNET_KVSTORE_SERVER_OPTIMIZER_H_
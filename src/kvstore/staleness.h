@@ -0,0 +1,218 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file staleness.h
+ * \brief bounded staleness of asynchronous global synchronization
+ */
+#ifndef MXNET_KVSTORE_STALENESS_H_
+#define MXNET_KVSTORE_STALENESS_H_
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mxnet {
+namespace kvstore {
+
+/**
+ * \brief stale synchronous parallel on global servers.
+ *
+ * The clock of a party on a key counts its pushes of the key. A pull of a
+ * party more than bound rounds ahead of the slowest party waits, until enough
+ * pushes of the others brought the slowest party within bound. Pushes are
+ * never delayed, so a bound of 0 keeps parties in lockstep while updates are
+ * still applied as they come, and parties within bound never wait. Parties
+ * that finished no longer count as the slowest one.
+ *
+ * Per party, the staleness of pulls, i.e. how far the party was ahead of the
+ * slowest one, and the time pulls waited are kept for Summary and stats.
+ */
+class StalenessBound {
+ public:
+  typedef std::function<void()> Response;
+
+  struct Stats {
+    uint64_t num_pulls = 0;
+    uint64_t sum_staleness = 0;
+    int64_t max_staleness = 0;
+    uint64_t num_waits = 0;
+    double sum_wait_ms = 0;
+    double max_wait_ms = 0;
+
+    double mean_staleness() const {
+      return num_pulls ? static_cast<double>(sum_staleness) / num_pulls : 0;
+    }
+    double mean_wait_ms() const { return num_waits ? sum_wait_ms / num_waits : 0; }
+  };
+
+  /**
+   * \param bound rounds a party may be ahead, negative disables the bound
+   * \param num_parties number of local servers pushing to global servers
+   */
+  void Init(int bound, int num_parties) {
+    bound_ = bound;
+    num_parties_ = num_parties;
+    stats_.assign(num_parties, Stats());
+  }
+
+  bool enabled() const { return bound_ >= 0; }
+
+  /**
+   * \brief records a push of a party
+   * \return the responses of the pulls back within bound, to be sent
+   */
+  std::vector<Response> Push(int key, int party) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto& state = Get(key);
+    ++state.clock[party];
+    std::vector<Response> ready;
+    Release(&state, &ready);
+    return ready;
+  }
+
+  /**
+   * \brief records that a party stopped, so that it no longer holds the pulls
+   * of the others
+   * \return the responses of the pulls back within bound, to be sent
+   */
+  std::vector<Response> Finish(int party) {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::vector<Response> ready;
+    if (finished_.empty()) finished_.assign(num_parties_, false);
+    finished_.at(party) = true;
+    for (auto& key : keys_) Release(&key.second, &ready);
+    return ready;
+  }
+
+  /**
+   * \brief admits a pull of a party
+   * \return true if the party is within bound and the caller responds now,
+   * otherwise response is kept until Push releases it
+   */
+  bool Pull(int key, int party, const Response& response) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto& state = Get(key);
+    const int64_t staleness = std::max<int64_t>(state.clock[party] - Slowest(state), 0);
+    if (staleness <= bound_) {
+      Record(party, staleness, -1);
+      return true;
+    }
+    state.waiting.push_back({party, Clock::now(), response});
+    return false;
+  }
+
+  Stats stats(int party) {
+    std::lock_guard<std::mutex> lk(mu_);
+    return stats_.at(party);
+  }
+
+  std::string Summary() {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(2);
+    for (int i = 0; i < num_parties_; ++i) {
+      const Stats& s = stats_[i];
+      os << (i ? ", " : "") << "party " << i << ": staleness mean " << s.mean_staleness()
+         << " max " << s.max_staleness << ", " << s.num_waits << "/" << s.num_pulls
+         << " pulls waited, mean " << s.mean_wait_ms() << " ms max " << s.max_wait_ms << " ms";
+    }
+    return os.str();
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Waiting {
+    int party;
+    Clock::time_point since;
+    Response response;
+  };
+
+  struct KeyState {
+    std::vector<int64_t> clock;
+    std::vector<Waiting> waiting;
+  };
+
+  KeyState& Get(int key) {
+    auto& state = keys_[key];
+    if (state.clock.empty()) state.clock.assign(num_parties_, 0);
+    return state;
+  }
+
+  /** \brief the clock of the slowest party that did not finish */
+  int64_t Slowest(const KeyState& state) const {
+    int64_t slowest = std::numeric_limits<int64_t>::max();
+    for (int i = 0; i < num_parties_; ++i) {
+      if (finished_.empty() || !finished_[i]) slowest = std::min(slowest, state.clock[i]);
+    }
+    return slowest;
+  }
+
+  /** \brief moves the responses of the pulls of a key back within bound to ready */
+  void Release(KeyState* state, std::vector<Response>* ready) {
+    const int64_t slowest = Slowest(*state);
+    auto it = state->waiting.begin();
+    while (it != state->waiting.end()) {
+      const int64_t staleness = std::max<int64_t>(state->clock[it->party] - slowest, 0);
+      if (staleness > bound_) {
+        ++it;
+        continue;
+      }
+      const double wait_ms = std::chrono::duration<double, std::milli>(
+          Clock::now() - it->since).count();
+      Record(it->party, staleness, wait_ms);
+      ready->push_back(std::move(it->response));
+      it = state->waiting.erase(it);
+    }
+  }
+
+  /** \brief wait_ms is negative for pulls answered at once */
+  void Record(int party, int64_t staleness, double wait_ms) {
+    Stats& s = stats_[party];
+    ++s.num_pulls;
+    s.sum_staleness += staleness;
+    s.max_staleness = std::max(s.max_staleness, staleness);
+    if (wait_ms >= 0) {
+      ++s.num_waits;
+      s.sum_wait_ms += wait_ms;
+      s.max_wait_ms = std::max(s.max_wait_ms, wait_ms);
+    }
+  }
+
+  std::mutex mu_;
+  int bound_ = -1;
+  int num_parties_ = 0;
+  std::unordered_map<int, KeyState> keys_;
+  std::vector<Stats> stats_;
+  /** \brief parties that stopped, empty until one does */
+  std::vector<bool> finished_;
+};
+
+}  // namespace kvstore
+}  // namespace mxnet
+#endif  // MXNET_KVSTORE_STALENESS_H_
@@ -0,0 +1,134 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file trace.h
+ * \brief spans of the communication of each key and round across nodes
+ */
+#ifndef MXNET_KVSTORE_TRACE_H_
+#define MXNET_KVSTORE_TRACE_H_
+#include <dmlc/parameter.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "../profiler/profiler.h"
+
+namespace mxnet {
+namespace kvstore {
+
+/**
+ * \brief end-to-end tracing of pushes and pulls, with PS_TRACE.
+ *
+ * A trace id holds a key in the high 32 bits and its round in the low ones.
+ * Workers number the rounds of their keys and send the id in the ps-lite
+ * header of the push and the pull of each round. Local servers adopt the id
+ * of the first push they merge, and forward it with their push and pull to
+ * global servers, which adopt it in turn.
+ *
+ * Every hop is a ProfileTask of the "kvstore" domain named after the hop, key
+ * and round, whose async id is the trace id, so that the hops of a round line
+ * up once tools/merge_traces.py put the profiler dumps of all nodes on one
+ * clock. Hops often end on another thread than they began, e.g. when a
+ * response arrives, so open ones are kept by hop and id. Nothing is recorded
+ * while the profiler is not running.
+ */
+class KVStoreTrace {
+ public:
+  static KVStoreTrace* Get() {
+    static KVStoreTrace inst;
+    return &inst;
+  }
+
+  bool enabled() const { return enabled_; }
+
+  static uint64_t Id(int key, uint32_t round) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(key)) << 32) | round;
+  }
+
+  /*! \brief starts the next round of key on a worker, returns its id or 0 */
+  uint64_t NextRound(int key) {
+    if (!enabled_) return 0;
+    std::lock_guard<std::mutex> lk(mu_);
+    uint64_t& id = ids_[key];
+    id = Id(key, static_cast<uint32_t>(id) + 1);
+    return id;
+  }
+
+  /*! \brief makes id, received from the previous hop, the current round of key */
+  void Adopt(int key, uint64_t id) {
+    if (!enabled_ || !id) return;
+    std::lock_guard<std::mutex> lk(mu_);
+    ids_[key] = id;
+  }
+
+  /*! \brief the id of the current round of key, 0 if none */
+  uint64_t Current(int key) {
+    if (!enabled_) return 0;
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = ids_.find(key);
+    return it == ids_.end() ? 0 : it->second;
+  }
+
+  /*! \brief opens hop of round id, unless it is open already */
+  void Begin(const char* hop, uint64_t id) {
+    if (!enabled_ || !id ||
+        profiler::Profiler::Get()->GetState() != profiler::Profiler::kRunning) {
+      return;
+    }
+    std::lock_guard<std::mutex> lk(mu_);
+    auto& task = open_[std::make_pair(std::string(hop), id)];
+    if (task) return;
+    const std::string name = std::string(hop) + " key " + std::to_string(id >> 32) +
+                             " round " + std::to_string(id & 0xffffffff);
+    task.reset(new profiler::ProfileTask(name.c_str(), &domain_));
+    task->set_id(id);
+    task->start();
+  }
+
+  /*! \brief closes hop of round id, if it was opened */
+  void End(const char* hop, uint64_t id) {
+    if (!enabled_ || !id) return;
+    std::unique_ptr<profiler::ProfileTask> task;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      auto it = open_.find(std::make_pair(std::string(hop), id));
+      if (it == open_.end()) return;
+      task = std::move(it->second);
+      open_.erase(it);
+    }
+    task->stop();
+  }
+
+ private:
+  KVStoreTrace() : enabled_(dmlc::GetEnv("PS_TRACE", 0) != 0), domain_("kvstore") {}
+
+  bool enabled_;
+  profiler::ProfileDomain domain_;
+  std::mutex mu_;
+  std::unordered_map<int, uint64_t> ids_;
+  std::map<std::pair<std::string, uint64_t>, std::unique_ptr<profiler::ProfileTask>> open_;
+};
+
+}  // namespace kvstore
+}  // namespace mxnet
+#endif  // MXNET_KVSTORE_TRACE_H_
@@ -791,21 +791,33 @@ struct ProfileTask : public ProfileDuration {
 
   ProfileObjectType type() const override { return kTask; }
 
+  /*!
+   * \brief Set the async event id, so that tasks of different threads or
+   * processes with the same id are shown as one track (default: thread id)
+   * \param id Nonzero id of the task
+   */
+  void set_id(uint64_t id) { id_ = id; }
+
  protected:
   /*!
    * \brief Task statistic object
    */
   struct ProfileTaskStat : public DurationStat {
-    explicit ProfileTaskStat(const char *name, uint64_t start_time, uint64_t stop_time)
-      : DurationStat(ProfileStat::kAsyncNestableStart, ProfileStat::kAsyncNestableEnd) {
+    explicit ProfileTaskStat(const char *name, uint64_t start_time, uint64_t stop_time,
+                             uint64_t id = 0)
+      : DurationStat(ProfileStat::kAsyncNestableStart, ProfileStat::kAsyncNestableEnd)
+        , id_(id) {
       name_.set(name);
       items_[0].timestamp_ = start_time;
       items_[1].timestamp_ = stop_time;
     }
     void EmitExtra(std::ostream *os, size_t idx) override {
       DurationStat::EmitExtra(os, idx);
-      *os << "        \"id\": " << std::hash<std::thread::id>{}(thread_id_) << ",\n";
+      *os << "        \"id\": " << (id_ ? id_ : std::hash<std::thread::id>{}(thread_id_))
+          << ",\n";
     }
+    /*! \brief Async event id, 0 for the thread id */
+    uint64_t id_;
   };
 
  private:
@@ -815,7 +827,7 @@ struct ProfileTask : public ProfileDuration {
   inline void SendStat() {
     Profiler::Get()->AddNewProfileStat<ProfileTaskStat>([this](ProfileTaskStat *stat) {
       stat->categories_.set(domain_->name());
-    }, name_.c_str(), start_time_, ProfileStat::NowInMicrosec());
+    }, name_.c_str(), start_time_, ProfileStat::NowInMicrosec(), id_);
   }
   /*! \brief Task name */
   const profile_stat_string  name_;
@@ -829,6 +841,8 @@ struct ProfileTask : public ProfileDuration {
  protected:
   /*! \brief Task's start tick */
   uint64_t start_time_;
+  /*! \brief Async event id, 0 for the thread id */
+  uint64_t id_ = 0;
 };
 
 /*!
@@ -32,13 +32,25 @@
 #include <mxnet/base.h>
 #include <mxnet/storage.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 #include <vector>
 #include <mutex>
 #include <new>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/sysinfo.h>
+#endif  // defined(__linux__)
 #include "./storage_manager.h"
+#include "./cpu_device_storage.h"
 #include "../common/cuda_utils.h"
 #include "../common/utils.h"
+#include "../profiler/profiler.h"
 
 
 namespace mxnet {
@@ -329,6 +341,359 @@ void GPUPooledRoundedStorageManager::ReleaseAll() {
 
 #endif  // MXNET_USE_CUDA
 
+/*!
+ * \brief numa node of each cpu, read once from sysfs, empty if unknown
+ */
+inline const std::vector<int>& CpuNumaNodes() {
+  static const std::vector<int> cpu_node = []() {
+    std::vector<int> nodes;
+#if defined(__linux__)
+    for (int node = 0; ; ++node) {
+      std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      if (!file) break;
+      // ranges of cpus, e.g. 0-15,32-47
+      std::string list, range;
+      std::getline(file, list);
+      std::stringstream ss(list);
+      while (std::getline(ss, range, ',')) {
+        if (range.empty()) continue;
+        const size_t dash = range.find('-');
+        const int lo = std::stoi(range.substr(0, dash));
+        const int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+        if (hi >= static_cast<int>(nodes.size())) nodes.resize(hi + 1, 0);
+        for (int cpu = lo; cpu <= hi; ++cpu) nodes[cpu] = node;
+      }
+    }
+#endif  // defined(__linux__)
+    return nodes;
+  }();
+  return cpu_node;
+}
+
+/*! \brief number of numa nodes, at least 1 */
+inline int NumNumaNodes() {
+  const auto& nodes = CpuNumaNodes();
+  return nodes.empty() ? 1 : *std::max_element(nodes.begin(), nodes.end()) + 1;
+}
+
+/*! \brief numa node of the cpu the calling thread runs on */
+inline int CurrentNumaNode() {
+#if defined(__linux__)
+  const auto& nodes = CpuNumaNodes();
+  const int cpu = sched_getcpu();
+  if (cpu >= 0 && cpu < static_cast<int>(nodes.size())) return nodes[cpu];
+#endif  // defined(__linux__)
+  return 0;
+}
+
+/*!
+ * \brief whether allocating size bytes would leave less than reserve percent
+ * of the physical memory free
+ */
+inline bool LowOnMemory(size_t size, int reserve) {
+#if defined(__linux__)
+  struct sysinfo info;
+  if (sysinfo(&info) != 0) return false;
+  const size_t total = static_cast<size_t>(info.totalram) * info.mem_unit;
+  const size_t free = static_cast<size_t>(info.freeram + info.bufferram) * info.mem_unit;
+  return free <= total * reserve / 100 || size > free - total * reserve / 100;
+#else
+  return false;
+#endif  // defined(__linux__)
+}
+
+/*!
+ * \brief Storage manager with a memory pool, with rounded size, on cpu.
+ *
+ * Sizes are rounded to buckets as in GPUPooledRoundedStorageManager. A freed
+ * chunk goes to a small cache of the freeing thread and, once that is full, to
+ * the free list of the NUMA node the thread runs on. Thread caches are
+ * registered with the manager, so that ReleaseAll drains them too. Allocations are served
+ * from the thread cache, then from the node of the calling thread, so reused
+ * memory stays close to the cores that last touched it, and fresh chunks are
+ * placed by first touch. Hits and misses are reported as profiler counters.
+ */
+class CPUPooledRoundedStorageManager final : public StorageManager {
+ public:
+  /*!
+   * \brief Default constructor.
+   */
+  CPUPooledRoundedStorageManager() : central_(std::make_shared<Central>()) {
+    reserve_ = dmlc::GetEnv("MXNET_CPU_MEM_POOL_RESERVE", 5);
+    page_size_ = dmlc::GetEnv("MXNET_CPU_MEM_POOL_PAGE_SIZE", 4096);
+    cut_off_ = dmlc::GetEnv("MXNET_CPU_MEM_POOL_ROUND_LINEAR_CUTOFF", 24);
+    if (page_size_ < 64) {
+      LOG(FATAL) << "MXNET_CPU_MEM_POOL_PAGE_SIZE cannot be set to a value smaller than 64. " \
+                 << "Got: " << page_size_ << ".";
+    }
+    if (page_size_ != 1ul << common::ilog2ul(page_size_ - 1)) {
+      LOG(FATAL) << "MXNET_CPU_MEM_POOL_PAGE_SIZE must be a power of 2. Got: " << page_size_ << ".";
+    }
+    page_size_ = common::ilog2ul(page_size_ - 1);
+    if (cut_off_ < 20 || cut_off_ > LOG2_MAX_MEM) {
+      LOG(FATAL) << "MXNET_CPU_MEM_POOL_ROUND_LINEAR_CUTOFF cannot be set to a value " \
+                 << "smaller than 20 or greater than " << LOG2_MAX_MEM << ". Got: " \
+                 << cut_off_ << ".";
+    }
+    if (cut_off_ < page_size_) {
+      LOG(FATAL) << "MXNET_CPU_MEM_POOL_ROUND_LINEAR_CUTOFF cannot be set to a value " \
+                 << "smaller than log2 of MXNET_CPU_MEM_POOL_PAGE_SIZE. Got: " \
+                 << cut_off_ << " vs " << page_size_ << ".";
+    }
+    num_buckets_ = (1ul << (LOG2_MAX_MEM - cut_off_)) + cut_off_;
+    central_->nodes.resize(NumNumaNodes());
+    for (auto& node : central_->nodes) {
+      node.reset(new Node());
+      node->pool.resize(num_buckets_);
+    }
+  }
+  /*!
+   * \brief Default destructor.
+   */
+  ~CPUPooledRoundedStorageManager() {
+    {
+      // threads exiting from now on free their caches themselves
+      std::lock_guard<std::mutex> lock(central_->caches_mu);
+      central_->alive = false;
+    }
+    ReleaseAll();
+  }
+
+  void Alloc(Storage::Handle* handle) override;
+  void Free(Storage::Handle handle) override;
+
+  void DirectFree(Storage::Handle handle) override {
+    CPUDeviceStorage::Free(handle.dptr);
+    central_->used_memory -= get_size(get_bucket(handle.size));
+  }
+
+  /*!
+   * \brief frees the cached chunks of the nodes and of every thread
+   */
+  void ReleaseAll();
+  /*! \brief bytes allocated from the system, cached ones included */
+  size_t UsedMemory() const { return central_->used_memory; }
+  /*! \brief bytes cached by the nodes and the threads */
+  size_t CachedMemory() const { return central_->cached_memory; }
+
+ private:
+  inline int div_pow2_round_up(size_t s, int divisor_log2) {
+    size_t result = s >> divisor_log2;
+    return static_cast<int>(result + (s > (result << divisor_log2) ? 1 : 0));
+  }
+  inline int get_bucket(size_t s) {
+    int log_size = common::ilog2ul(std::max<size_t>(s, 2) - 1);
+    if (log_size > static_cast<int>(cut_off_))
+      return div_pow2_round_up(s, cut_off_) - 1 + cut_off_;
+    else
+      return std::max(log_size, static_cast<int>(page_size_));
+  }
+  inline size_t get_size(int bucket) {
+    if (bucket <= static_cast<int>(cut_off_))
+      return 1ul << bucket;
+    else
+      return (bucket - cut_off_ + 1) * (1ul << cut_off_);
+  }
+
+  /*! \brief free lists of a NUMA node */
+  struct Node {
+    std::mutex mu;
+    std::vector<std::vector<void*>> pool;
+  };
+
+  struct ThreadCache;
+
+  /*! \brief state shared with the thread caches, which may outlive the manager */
+  struct Central {
+    std::vector<std::unique_ptr<Node>> nodes;
+    // caches of live threads, and whether the manager is still there
+    std::mutex caches_mu;
+    std::unordered_set<ThreadCache*> caches;
+    bool alive = true;
+    std::atomic<size_t> used_memory{0};
+    std::atomic<size_t> cached_memory{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+  };
+
+  /*!
+   * \brief per-thread cache of small chunks, bucket i holds chunks of 2^i
+   * bytes. Its lock is only contended by ReleaseAll.
+   */
+  struct ThreadCache {
+    std::mutex mu;
+    std::shared_ptr<Central> central;
+    std::vector<std::vector<void*>> pool;
+
+    /*! \brief frees the chunks, with caches_mu of central held */
+    void Release() {
+      std::lock_guard<std::mutex> lock(mu);
+      for (size_t i = 0; i < pool.size(); ++i) {
+        for (void* chunk : pool[i]) CPUDeviceStorage::Free(chunk);
+        central->used_memory -= pool[i].size() * (1ul << i);
+        central->cached_memory -= pool[i].size() * (1ul << i);
+        pool[i].clear();
+      }
+    }
+  };
+
+  /*!
+   * \brief caches of the calling thread. On thread exit they go back to the
+   * free lists of their managers, or are freed if the manager is gone.
+   */
+  struct ThreadCaches {
+    ~ThreadCaches() {
+      const int numa_node = CurrentNumaNode();
+      for (auto& cache : caches) {
+        Central* central = cache->central.get();
+        std::lock_guard<std::mutex> lock(central->caches_mu);
+        central->caches.erase(cache.get());
+        if (!central->alive) {
+          cache->Release();
+          continue;
+        }
+        auto& nodes = central->nodes;
+        Node* node = nodes[numa_node < static_cast<int>(nodes.size()) ? numa_node : 0].get();
+        std::lock_guard<std::mutex> node_lock(node->mu);
+        for (size_t i = 0; i < cache->pool.size(); ++i) {
+          node->pool[i].insert(node->pool[i].end(), cache->pool[i].begin(), cache->pool[i].end());
+        }
+      }
+    }
+    std::vector<std::unique_ptr<ThreadCache>> caches;
+  };
+
+  ThreadCache* GetThreadCache() {
+    static thread_local ThreadCaches tls;
+    for (auto& cache : tls.caches) {
+      if (cache->central == central_) return cache.get();
+    }
+    ThreadCache* cache = new ThreadCache();
+    tls.caches.emplace_back(cache);
+    cache->central = central_;
+    cache->pool.resize(kMaxCachedBucket + 1);
+    std::lock_guard<std::mutex> lock(central_->caches_mu);
+    central_->caches.insert(cache);
+    return cache;
+  }
+
+  Node* GetNode() {
+    const int numa_node = CurrentNumaNode();
+    return central_->nodes[numa_node < static_cast<int>(central_->nodes.size()) ?
+                           numa_node : 0].get();
+  }
+
+  void Publish();
+  // log2 of the largest chunk kept in thread caches, 1MB
+  static const int kMaxCachedBucket = 20;
+  // number of chunks of a bucket kept in a thread cache
+  static const size_t kThreadCacheDepth = 8;
+  // log2 of maximum page size. 16GB
+  const size_t LOG2_MAX_MEM = 34;
+  // page size
+  size_t page_size_;
+  // log2 of memory size before switching to exponential mode to linear mode
+  size_t cut_off_;
+  // number of buckets
+  size_t num_buckets_;
+  // percentage of reserved memory
+  int reserve_;
+  // memory pool
+  std::shared_ptr<Central> central_;
+  // profiler counters, created on first use
+  std::once_flag counters_once_;
+  std::unique_ptr<profiler::ProfileDomain> domain_;
+  std::unique_ptr<profiler::ProfileCounter> hit_counter_, miss_counter_, cached_counter_;
+  DISALLOW_COPY_AND_ASSIGN(CPUPooledRoundedStorageManager);
+};  // class CPUPooledRoundedStorageManager
+
+void CPUPooledRoundedStorageManager::Alloc(Storage::Handle* handle) {
+  int bucket = get_bucket(handle->size);
+  size_t size = get_size(bucket);
+  void* ret = nullptr;
+  if (bucket <= kMaxCachedBucket) {
+    ThreadCache* cache = GetThreadCache();
+    std::lock_guard<std::mutex> lock(cache->mu);
+    auto&& reuse_pool = cache->pool[bucket];
+    if (!reuse_pool.empty()) {
+      ret = reuse_pool.back();
+      reuse_pool.pop_back();
+      central_->cached_memory -= size;
+    }
+  }
+  if (ret == nullptr) {
+    Node* node = GetNode();
+    std::lock_guard<std::mutex> lock(node->mu);
+    auto&& reuse_pool = node->pool[bucket];
+    if (!reuse_pool.empty()) {
+      ret = reuse_pool.back();
+      reuse_pool.pop_back();
+      central_->cached_memory -= size;
+    }
+  }
+  if (ret != nullptr) {
+    central_->hits++;
+  } else {
+    if (central_->cached_memory > 0 && LowOnMemory(size, reserve_)) ReleaseAll();
+    ret = CPUDeviceStorage::Alloc(size);
+    central_->used_memory += size;
+    central_->misses++;
+  }
+  handle->dptr = ret;
+  if (((central_->hits + central_->misses) & 1023) == 0) Publish();
+}
+
+void CPUPooledRoundedStorageManager::Free(Storage::Handle handle) {
+  int bucket = get_bucket(handle.size);
+  if (bucket <= kMaxCachedBucket) {
+    ThreadCache* cache = GetThreadCache();
+    std::lock_guard<std::mutex> lock(cache->mu);
+    auto&& reuse_pool = cache->pool[bucket];
+    if (reuse_pool.size() < kThreadCacheDepth) {
+      reuse_pool.push_back(handle.dptr);
+      central_->cached_memory += get_size(bucket);
+      return;
+    }
+  }
+  Node* node = GetNode();
+  std::lock_guard<std::mutex> lock(node->mu);
+  node->pool[bucket].push_back(handle.dptr);
+  central_->cached_memory += get_size(bucket);
+}
+
+void CPUPooledRoundedStorageManager::ReleaseAll() {
+  {
+    std::lock_guard<std::mutex> lock(central_->caches_mu);
+    for (ThreadCache* cache : central_->caches) cache->Release();
+  }
+  for (auto& node : central_->nodes) {
+    std::lock_guard<std::mutex> lock(node->mu);
+    for (size_t i = 0; i < node->pool.size(); i++) {
+      size_t size = get_size(i);
+      for (auto& j : node->pool[i]) {
+        CPUDeviceStorage::Free(j);
+        central_->used_memory -= size;
+        central_->cached_memory -= size;
+      }
+      node->pool[i].clear();
+    }
+  }
+}
+
+void CPUPooledRoundedStorageManager::Publish() {
+  profiler::Profiler *prof = profiler::Profiler::Get();
+  if (!prof->IsProfiling(profiler::Profiler::kMemory)) return;
+  std::call_once(counters_once_, [this]() {
+    domain_.reset(new profiler::ProfileDomain("CPU Memory Pool"));
+    hit_counter_.reset(new profiler::ProfileCounter("Pool hits", domain_.get()));
+    miss_counter_.reset(new profiler::ProfileCounter("Pool misses", domain_.get()));
+    cached_counter_.reset(new profiler::ProfileCounter("Pool cached bytes", domain_.get()));
+  });
+  *hit_counter_ = central_->hits.load();
+  *miss_counter_ = central_->misses.load();
+  *cached_counter_ = central_->cached_memory.load();
+}
+
 }  // namespace storage
 }  // namespace mxnet
 
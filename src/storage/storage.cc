@@ -77,6 +77,19 @@ class StorageImpl : public Storage {
         LOG(FATAL) << "Unimplemented device";
     }
   }
+
+  static storage::StorageManager* CreateCPUStorageManager() {
+    const char *type = getenv("MXNET_CPU_MEM_POOL_TYPE");
+    std::string strategy = type == nullptr ? "Naive" : type;
+    if (strategy == "Round") {
+      LOG(INFO) << "Using CPUPooledRoundedStorageManager.";
+      return new storage::CPUPooledRoundedStorageManager();
+    }
+    if (strategy != "Naive") {
+      LOG(FATAL) << "Unknown memory pool strategy specified: " << strategy << ".";
+    }
+    return new storage::NaiveStorageManager<storage::CPUDeviceStorage>();
+  }
   // internal storage managers
   std::array<common::LazyAllocArray<storage::StorageManager>,
              kMaxNumberOfDevices> storage_managers_;
@@ -94,7 +107,7 @@ void StorageImpl::Alloc(Storage::Handle* handle) {
         storage::StorageManager *ptr = nullptr;
         switch (handle->ctx.dev_type) {
           case Context::kCPU: {
-            ptr = new storage::NaiveStorageManager<storage::CPUDeviceStorage>();
+            ptr = CreateCPUStorageManager();
             break;
           }
           case Context::kCPUShared: {
@@ -113,10 +126,10 @@ void StorageImpl::Alloc(Storage::Handle* handle) {
             if (num_gpu_device > 0) {
               ptr = new storage::NaiveStorageManager<storage::PinnedMemoryStorage>();
             } else {
-              ptr = new storage::NaiveStorageManager<storage::CPUDeviceStorage>();
+              ptr = CreateCPUStorageManager();
             }
 #else
-            ptr = new storage::NaiveStorageManager<storage::CPUDeviceStorage>();
+            ptr = CreateCPUStorageManager();
 #endif  // MXNET_USE_CUDA
             break;
           }
@@ -0,0 +1,117 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file adaptive_compression_test.cc
+ * \brief checks the adaptive compression: each mode decodes what it encoded
+ *  up to what the error feedback keeps, and the goodput of a link leaves out
+ *  the time global servers held its pushes
+ *
+ * Usage: adaptive_compression_test [size=100003] [nthreads=4]
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../src/kvstore/adaptive_compression.h"
+
+using namespace mxnet::kvstore;
+
+namespace {
+
+const char* kNames[] = {"raw", "fp16", "2-bit", "bsc"};
+
+/*!
+ * \brief encodes and decodes rounds of x with mode, and checks that each round
+ * decodes to x plus the residual before it, minus the residual after it
+ * \return the largest difference between the decoded and the input values
+ */
+float RoundTrip(adaptive::Mode mode, float param, const std::vector<float>& x, int nthreads) {
+  const int64_t size = x.size();
+  std::vector<float> residual(size, 0), before, decoded(size);
+  std::vector<char> encoded(adaptive::EncodedBytes(mode, size, param));
+  float max_error = 0;
+  for (int round = 0; round < 3; ++round) {
+    before = residual;
+    adaptive::Encode(mode, x.data(), residual.data(), size, param, encoded.data(), nthreads);
+    adaptive::Decode(encoded.data(), encoded.size(), decoded.data(), size, nthreads);
+    for (int64_t i = 0; i < size; ++i) {
+      const float lost = x[i] + before[i] - decoded[i];
+      CHECK_LE(std::fabs(lost - residual[i]), 1e-5f * (1 + std::fabs(x[i] + before[i])))
+          << kNames[mode] << " lost " << lost << " at " << i << " but kept " << residual[i];
+      max_error = std::max(max_error, std::fabs(decoded[i] - x[i]));
+    }
+  }
+  switch (mode) {
+    case adaptive::kRaw:
+      CHECK_EQ(max_error, 0) << "raw is not exact";
+      break;
+    case adaptive::kFP16:
+      CHECK_LE(max_error, 1e-2f);
+      break;
+    case adaptive::kTwoBit:
+      for (float d : decoded) CHECK(d == 0 || d == param || d == -param) << d;
+      break;
+    case adaptive::kBSC: {
+      int64_t nonzeros = 0;
+      for (float d : decoded) nonzeros += d != 0;
+      CHECK_LE(nonzeros, adaptive::NumPairs(size, param));
+      break;
+    }
+  }
+  return max_error;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int64_t size = argc > 1 ? atoll(argv[1]) : 100003;
+  const int nthreads = argc > 2 ? atoi(argv[2]) : 4;
+
+  std::mt19937 gen(0);
+  std::normal_distribution<float> normal(0, 1);
+  std::vector<float> x(size);
+  for (auto& v : x) v = normal(gen);
+  for (int m = adaptive::kRaw; m <= static_cast<int>(adaptive::kBSC); ++m) {
+    const auto mode = static_cast<adaptive::Mode>(m);
+    const float param = mode == adaptive::kTwoBit ? 0.5f : mode == adaptive::kBSC ? 0.01f : 0;
+    const float error = RoundTrip(mode, param, x, nthreads);
+    printf("%-5s %8zu bytes for %lld values, largest error %g\n", kNames[mode],
+           adaptive::EncodedBytes(mode, size, param), static_cast<long long>(size), error);
+  }
+
+  // a link busy for 200ms whose pushes were held 150ms on the global server
+  adaptive::CompressionController controller;
+  controller.Init(1, 100, 0.5f, 0.01f);
+  const size_t bytes = 1 << 20;
+  controller.OnPush(0, 0);
+  controller.OnPush(0, bytes / 2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  controller.OnAck(0, bytes, 160000);
+  controller.OnAck(0, bytes, 150000);
+  const double elapsed = bytes / controller.goodput(0);
+  CHECK_LE(elapsed, 100) << "the goodput counts " << elapsed << "ms for 50ms of transfer";
+  CHECK_GE(elapsed, 45);
+  printf("goodput over %.1fms of transfer, without the time servers held the pushes\n", elapsed);
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file bsc_bench.cc
+ * \brief microbenchmark of the bi-sparse compression codec against the
+ *  previous scalar implementation (shuffled index vector, priority_queue
+ *  top-k and float indices), and checks that pull responses decode to the
+ *  weights they encode, in the sparse and the dense format
+ *
+ * Usage: bsc_bench [size=25000000] [threshold=0.01] [repeat=5] [nthreads=4]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <vector>
+#include "../src/kvstore/bsc_codec.h"
+
+using namespace mxnet::kvstore;
+
+namespace {
+
+void LegacyCompress(const float* grad, float* u, float* v, float* out,
+                    int original_size, float threshold) {
+  const int zipped_size = float(original_size) * threshold;
+  float momentum = 0.9;
+  const int sample_size = original_size * 0.005 * threshold >= 10
+                            ? original_size * 0.005 : 10 / threshold;
+  const unsigned int top_k = sample_size * threshold;
+  for (int i = 0; i < original_size; i++) {
+    u[i] = u[i] * momentum + grad[i];
+    v[i] = v[i] + u[i];
+  }
+  std::vector<int> indices(original_size);
+  std::iota(indices.begin(), indices.end(), 0);
+  std::shuffle(indices.begin(), indices.end(), std::default_random_engine(42));
+  std::priority_queue<float, std::vector<float>, std::greater<float> > q;
+  for (int i = 0; i < sample_size; i++) {
+    float abs_val = fabs(v[indices[i]]);
+    if (q.size() < top_k || abs_val > q.top()) {
+      if (q.size() == top_k) q.pop();
+      q.push(abs_val);
+    }
+  }
+  float boundary = q.top();
+  int send_grad_index = 0;
+  for (int i = 0; i < original_size; i++) {
+    if (fabs(v[i]) >= boundary && send_grad_index < zipped_size) {
+      out[send_grad_index] = v[i];
+      out[send_grad_index + zipped_size] = i;
+      v[i] = 0;
+      u[i] = 0;
+      send_grad_index += 1;
+    }
+  }
+  for (; send_grad_index < zipped_size; send_grad_index++) {
+    out[send_grad_index] = -65530;
+    out[send_grad_index + zipped_size] = -1;
+  }
+}
+
+void LegacyDecompress(const float* zip, int zipped_size, float* out, int original_size) {
+  std::memset(out, 0, original_size * sizeof(float));
+  for (int i = 0; i < zipped_size; i++) {
+    int grad_index = zip[i + zipped_size];
+    if (grad_index >= 0) out[grad_index] = zip[i];
+  }
+}
+
+void Compress(const float* grad, float* u, float* v, float* out,
+              int64_t original_size, float threshold, int nthreads) {
+  const int64_t zipped_size = float(original_size) * threshold;
+  const int64_t sample_size = original_size * 0.005 * threshold >= 10
+                            ? original_size * 0.005 : 10 / threshold;
+  bsc::MomentumCorrection(grad, u, v, original_size, 0.9, nthreads);
+  std::vector<float> sample;
+  bsc::SampleAbs(v, original_size, sample_size, 42, &sample);
+  const float boundary = bsc::TopKBoundary(&sample, sample_size * threshold);
+  bsc::Gather(v, original_size, bsc::AbsGreaterEqual(boundary), out, zipped_size,
+              nthreads, [u, v](int64_t i) {
+    v[i] = 0;
+    u[i] = 0;
+  });
+}
+
+/*!
+ * \brief encodes a pull response of weights with the given share of nonzeros,
+ * decodes it, and returns the number of elements that differ
+ */
+int64_t PullRoundTrip(int64_t size, float density, int nthreads) {
+  std::vector<float> x(size, 0);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  std::normal_distribution<float> normal(0, 1);
+  for (auto& w : x) {
+    if (uniform(rng) < density) w = normal(rng) + 2;
+  }
+  const int64_t nnz = bsc::CountNonZero(x.data(), size, nthreads);
+  int64_t mismatch = 0;
+  for (bool dense : {false, true}) {
+    std::vector<char> response(bsc::PullBytes(size, nnz, dense));
+    bsc::PullCompress(x.data(), size, nnz, dense, response.data(), nthreads);
+    std::vector<float> out(size, -1);
+    bsc::PullDecompress(response.data(), response.size(), out.data(), size, nthreads);
+    int64_t differ = 0;
+    for (int64_t i = 0; i < size; ++i) differ += out[i] != x[i];
+    printf("pull density %-6g %-6s %10zu bytes, mismatch %lld\n", density,
+           dense ? "dense" : "sparse", response.size(), static_cast<long long>(differ));
+    mismatch += differ;
+  }
+  return mismatch;
+}
+
+double Seconds(std::function<void()> f) {
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int64_t size = argc > 1 ? atoll(argv[1]) : 25000000;
+  const float threshold = argc > 2 ? atof(argv[2]) : 0.01;
+  const int repeat = argc > 3 ? atoi(argv[3]) : 5;
+  const int nthreads = argc > 4 ? atoi(argv[4]) : 4;
+  const int64_t zipped_size = float(size) * threshold;
+
+  std::vector<float> grad(size);
+  std::mt19937 rng(0);
+  std::normal_distribution<float> normal(0, 1);
+  for (auto& g : grad) g = normal(rng);
+
+  std::vector<float> u0(size, 0), v0(size, 0), u1(size, 0), v1(size, 0);
+  std::vector<float> zip0(2 * zipped_size), zip1(2 * zipped_size);
+  std::vector<float> dense0(size), dense1(size);
+
+  double legacy_c = 0, legacy_d = 0, codec_c = 0, codec_d = 0;
+  for (int r = 0; r < repeat; ++r) {
+    legacy_c += Seconds([&]() {
+      LegacyCompress(grad.data(), u0.data(), v0.data(), zip0.data(), size, threshold);
+    });
+    legacy_d += Seconds([&]() {
+      LegacyDecompress(zip0.data(), zipped_size, dense0.data(), size);
+    });
+    codec_c += Seconds([&]() {
+      Compress(grad.data(), u1.data(), v1.data(), zip1.data(), size, threshold, nthreads);
+    });
+    codec_d += Seconds([&]() {
+      bsc::Decompress(zip1.data(), zipped_size, dense1.data(), size, nthreads);
+    });
+  }
+
+  // every sent value must land at its own index
+  int64_t sent = 0, mismatch = 0;
+  const uint32_t* index = bsc::IndexSection(zip1.data(), zipped_size);
+  for (int64_t i = 0; i < zipped_size; ++i) {
+    if (index[i] == bsc::kBSCEmptyIndex) continue;
+    ++sent;
+    if (dense1[index[i]] != zip1[i]) ++mismatch;
+  }
+
+  const double gb = static_cast<double>(size) * sizeof(float) * repeat / 1e9;
+  printf("size %lld threshold %g threads %d, sent %lld of %lld slots, mismatch %lld\n",
+         static_cast<long long>(size), threshold, nthreads, static_cast<long long>(sent),
+         static_cast<long long>(zipped_size), static_cast<long long>(mismatch));
+  printf("compress    legacy %8.3f GB/s  codec %8.3f GB/s  speedup %.2fx\n",
+         gb / legacy_c, gb / codec_c, legacy_c / codec_c);
+  printf("decompress  legacy %8.3f GB/s  codec %8.3f GB/s  speedup %.2fx\n",
+         gb / legacy_d, gb / codec_d, legacy_d / codec_d);
+
+  for (float density : {0.0f, 0.001f, threshold, 0.3f, 1.0f}) {
+    mismatch += PullRoundTrip(std::min<int64_t>(size, 1 << 20), density, nthreads);
+  }
+  return mismatch == 0 ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file key_fusion_test.cc
+ * \brief checks the rounds of KeyFusion buckets: keys not pushed every round
+ *  neither stall the pulls of the others nor abort the next round, a round
+ *  never holds the pushes of two iterations, and pulls are never served from
+ *  a bucket older than the last push
+ *
+ * Usage: key_fusion_test [keys=8] [iterations=10000]
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "../src/kvstore/key_fusion.h"
+
+using namespace mxnet::kvstore;
+
+namespace {
+
+/*! \brief a bucket as driven by KVStoreDist, and the versions it serves */
+class Worker {
+ public:
+  explicit Worker(int num_keys) {
+    fusion_.Init(1024, 1 << 20);
+    std::vector<int> sealed;
+    for (int k = 1; k <= num_keys; ++k) CHECK(fusion_.Add(k, 4, 0, 4, &sealed));
+    sealed = fusion_.SealAll();
+    CHECK_EQ(sealed.size(), 1U);
+    bucket_ = &fusion_.bucket(sealed[0]);
+    iteration_.assign(num_keys, 0);
+  }
+
+  /*! \brief PushFused of the index-th key in an iteration */
+  void Push(int index, int iteration) {
+    if (KeyFusion::Flush(bucket_, index)) PushBucket();
+    iteration_[index] = iteration;
+    if (KeyFusion::Push(bucket_, index, 0)) PushBucket();
+  }
+
+  /*! \brief PullFused of the index-th key */
+  void Pull(int index) {
+    switch (KeyFusion::Pull(bucket_, index)) {
+      case KeyFusion::kDefer:
+        waiting_.push_back(index);
+        return;
+      case KeyFusion::kPullAndCopy:
+        pulled_ = server_;
+        break;
+      case KeyFusion::kCopy:
+        break;
+    }
+    CHECK_EQ(pulled_, server_) << "key " << index << " served from an outdated bucket";
+  }
+
+  int num_waiting() const { return waiting_.size(); }
+
+ private:
+  /*! \brief PushBucket, keys not pushed in the round send zero gradients */
+  void PushBucket() {
+    // the pulls of an iteration may wait for this push, which would then wait
+    // for the next iteration to read their values if it held its gradients
+    int iteration = -1;
+    for (size_t i = 0; i < iteration_.size(); ++i) {
+      if (!bucket_->pushed[i]) continue;
+      if (iteration < 0) iteration = iteration_[i];
+      CHECK_EQ(iteration_[i], iteration) << "a round holds the pushes of two iterations";
+    }
+    ++server_;
+    if (!KeyFusion::Pushed(bucket_)) {
+      CHECK(waiting_.empty());
+      return;
+    }
+    CHECK(!waiting_.empty());
+    pulled_ = server_;
+    waiting_.clear();
+  }
+
+  KeyFusion fusion_;
+  KeyFusion::Bucket* bucket_;
+  /*! \brief the iteration of the last push of each key */
+  std::vector<int> iteration_;
+  /*! \brief version of the bucket on servers, and in the last pull */
+  int server_ = 0;
+  int pulled_ = -1;
+  std::vector<int> waiting_;
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int num_keys = argc > 1 ? atoi(argv[1]) : 8;
+  const int rounds = argc > 2 ? atoi(argv[2]) : 10000;
+
+  // the last key is frozen: the first round ends when the next one starts,
+  // later rounds complete without it
+  {
+    Worker w(3);
+    w.Pull(0);
+    w.Pull(2);
+    w.Push(0, 1);
+    w.Pull(0);
+    w.Push(1, 1);
+    w.Pull(1);
+    CHECK_EQ(w.num_waiting(), 2);
+    w.Push(0, 2);
+    CHECK_EQ(w.num_waiting(), 0) << "pulls wait for a key that is not pushed";
+    w.Pull(0);
+    w.Push(1, 2);
+    CHECK_EQ(w.num_waiting(), 0) << "a round waits for a skipped key";
+    w.Pull(1);
+    // pulls without pushes fetch the bucket again
+    w.Pull(0);
+    w.Pull(1);
+    w.Pull(0);
+    // the frozen key is pushed again, after the others
+    w.Push(0, 3);
+    w.Push(1, 3);
+    w.Push(2, 3);
+    w.Pull(2);
+    w.Push(0, 4);
+    w.Push(1, 4);
+    w.Pull(1);
+    CHECK_EQ(w.num_waiting(), 1);
+    w.Push(2, 4);
+    CHECK_EQ(w.num_waiting(), 0);
+    printf("a frozen key ends the first round early, and is skipped until pushed again\n");
+  }
+
+  // each iteration pushes a subset of the keys in their order, the subset
+  // changes now and then, and pulls come with the pushes or after them
+  std::mt19937 gen(0);
+  Worker w(num_keys);
+  std::vector<int> active;
+  int late = 0;
+  for (int r = 0; r < rounds; ++r) {
+    if (r % 50 == 0) {
+      active.clear();
+      for (int k = 0; k < num_keys; ++k) {
+        if (std::bernoulli_distribution(0.7)(gen)) active.push_back(k);
+      }
+      if (active.empty()) active.push_back(0);
+    }
+    const bool interleaved = std::bernoulli_distribution(0.5)(gen);
+    for (int k : active) {
+      w.Push(k, r);
+      if (interleaved) w.Pull(k);
+    }
+    if (!interleaved) {
+      for (int k : active) w.Pull(k);
+    }
+    // only the first iterations after the keys changed may wait for the next
+    // one, until the keys no longer pushed are skipped
+    if (w.num_waiting()) {
+      CHECK_LT(r % 50, 2) << "iteration " << r << " waits for keys that stopped being pushed";
+      ++late;
+    }
+    if (std::bernoulli_distribution(0.05)(gen)) {
+      // pulls of an iteration without pushes
+      for (int k = 0; k < num_keys; ++k) w.Pull(k);
+    }
+  }
+  printf("%d iterations of %d keys, %d ended by the next one\n", rounds, num_keys, late);
+  printf("all checks passed\n");
+  return 0;
+}
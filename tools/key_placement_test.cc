@@ -0,0 +1,96 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file key_placement_test.cc
+ * \brief checks KeyPlacement: nodes registering the same batches with the same
+ *  weights agree on the plan, and weights that change the plan change the
+ *  fingerprint servers check at startup
+ *
+ * Usage: key_placement_test [num_servers=4] [keys=200]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../src/kvstore/key_placement.h"
+
+using namespace mxnet::kvstore;
+
+namespace {
+
+typedef std::vector<std::pair<int, std::pair<size_t, int>>> Batch;
+
+/*! \brief the server of each key, as placed by a node with weights */
+std::vector<int> Plan(const std::string& weights, int num_servers, const std::vector<Batch>& batches,
+                      int num_keys) {
+  setenv("MXNET_KVSTORE_PLACEMENT_WEIGHTS", weights.c_str(), 1);
+  KeyPlacement placement;
+  placement.Init(num_servers, 1 << 20);
+  // servers replay the batches as decoded from kSetKeySizes
+  for (const auto& batch : batches) placement.Register(DecodeKeySizes(EncodeKeySizes(batch)));
+  std::vector<int> plan;
+  for (int k = 0; k < num_keys; ++k) plan.push_back(placement.Server(k));
+  return plan;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int num_servers = argc > 1 ? atoi(argv[1]) : 4;
+  const int num_keys = argc > 2 ? atoi(argv[2]) : 200;
+
+  std::mt19937 gen(0);
+  std::vector<Batch> batches(5);
+  for (int k = 0; k < num_keys; ++k) {
+    const size_t elems = std::uniform_int_distribution<size_t>(1, 1 << 21)(gen);
+    batches[k % batches.size()].emplace_back(k, std::make_pair(elems, k % 3 ? 4 : 2));
+  }
+
+  // weights that place keys the same way have the same fingerprint
+  const std::string base = PlacementWeightsFingerprint("");
+  CHECK_EQ(base.size(), 16U);
+  for (const char* same : {"1", "1,1", "1.0,1,1e0"}) {
+    CHECK_EQ(PlacementWeightsFingerprint(same), base) << same;
+    CHECK(Plan(same, num_servers, batches, num_keys) == Plan("", num_servers, batches, num_keys))
+        << same;
+  }
+  CHECK_EQ(PlacementWeightsFingerprint("1,1,0.5"), PlacementWeightsFingerprint("1, 1, 0.50"));
+
+  // weights that change the plan change the fingerprint
+  const std::vector<std::string> weights = {"", "1,1,0.5", "1,0.5,1", "2,1,1", "1,1,0.25"};
+  for (size_t i = 0; i < weights.size(); ++i) {
+    const std::vector<int> plan = Plan(weights[i], num_servers, batches, num_keys);
+    CHECK(plan == Plan(weights[i], num_servers, batches, num_keys))
+        << "two nodes with weights " << weights[i] << " disagree";
+    for (size_t j = 0; j < i; ++j) {
+      CHECK_NE(PlacementWeightsFingerprint(weights[i]), PlacementWeightsFingerprint(weights[j]))
+          << weights[i] << " and " << weights[j];
+      if (plan != Plan(weights[j], num_servers, batches, num_keys)) continue;
+      LOG(INFO) << weights[i] << " and " << weights[j] << " happen to place keys the same way";
+    }
+    printf("weights \"%s\": fingerprint %s\n", weights[i].c_str(),
+           PlacementWeightsFingerprint(weights[i]).c_str());
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+"""Merges the profiler dumps of the nodes of a PS_TRACE=1 run into one
+chrome://tracing file on the clock of a reference node.
+
+Every node writes clock_<node>.json on exit, holding the smallest one-way
+delay it saw from each peer. Half the difference of the two directions of a
+link is the offset of the clocks at its ends. Offsets are chained from the
+reference along the links of smallest round trip, so that nodes which never
+talk directly, e.g. workers of different parties, are still aligned.
+
+Example:
+    python3 tools/merge_traces.py -o merged.json \\
+        gs/profile.json,gs/clock_global_server0.json \\
+        s0/profile.json,s0/clock_server0@10.0.0.1:9092.json \\
+        w0/profile.json,w0/clock_worker0@10.0.0.1:9092.json
+"""
+
+from __future__ import print_function
+import argparse
+import heapq
+import json
+import sys
+
+
+def load_clock(path):
+    with open(path) as f:
+        clock = json.load(f)
+    clock['delays'] = {int(peer): d[0] for peer, d in clock['delays'].items()}
+    return clock
+
+
+def one_way(clocks, a, b):
+    """Smallest delay node a saw from node b, None if a never heard of b."""
+    ids, seen = clocks[b]['ids'], clocks[a]['delays']
+    # a and b talk in the domains they share
+    delays = [seen[ids[domain]] for domain in clocks[a]['ids']
+              if domain in ids and ids[domain] in seen]
+    return min(delays) if delays else None
+
+
+def solve_offsets(clocks, reference):
+    """Offsets of the clock of each node to the reference, in microseconds.
+
+    Grows a tree from the reference over the links seen both ways, taking
+    the link of the smallest round trip first, as it bounds the error of its
+    offset best.
+    """
+    offsets = {reference: 0}
+    frontier = []
+
+    def expand(a):
+        for b in clocks:
+            if b in offsets:
+                continue
+            b_from_a, a_from_b = one_way(clocks, b, a), one_way(clocks, a, b)
+            if b_from_a is None or a_from_b is None:
+                continue
+            heapq.heappush(frontier, (b_from_a + a_from_b, b, offsets[a] + (b_from_a - a_from_b) / 2.0))
+
+    expand(reference)
+    while frontier:
+        rtt, b, offset = heapq.heappop(frontier)
+        if b in offsets:
+            continue
+        offsets[b] = offset
+        print('%s: offset %+.0f us, round trip %d us' % (b, offset, rtt))
+        expand(b)
+    for node in clocks:
+        if node not in offsets:
+            print('warning: %s exchanged no traced messages with the others, '
+                  'its clock is left as is' % node, file=sys.stderr)
+            offsets[node] = 0
+    return offsets
+
+
+def merge(pairs, reference):
+    clocks = {}
+    profiles = []
+    for pair in pairs:
+        profile, clock_path = pair.split(',', 1)
+        clock = load_clock(clock_path)
+        clocks[clock['node']] = clock
+        profiles.append((clock['node'], profile))
+    if reference is None:
+        names = sorted(clocks)
+        globals_ = [n for n in names if n.startswith('global_server')]
+        reference = globals_[0] if globals_ else names[0]
+    if reference not in clocks:
+        sys.exit('unknown reference node %s' % reference)
+    offsets = solve_offsets(clocks, reference)
+
+    events = []
+    for index, (node, profile) in enumerate(profiles):
+        with open(profile) as f:
+            trace = json.load(f)
+        # pids of categories collide across nodes
+        pids = {}
+        for event in trace['traceEvents']:
+            if 'pid' in event:
+                event['pid'] = pids.setdefault(event['pid'], (index + 1) * 1000 + len(pids))
+            if 'ts' in event:
+                event['ts'] -= offsets[node]
+            if event.get('ph') == 'M' and event.get('name') == 'process_name':
+                event['args']['name'] = '%s %s' % (node, event['args']['name'])
+            events.append(event)
+    return events
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        formatter_class=argparse.ArgumentDefaultsHelpFormatter,
+        description='Merge the profiler dumps of PS_TRACE=1 nodes on one clock')
+    parser.add_argument('pairs', nargs='+', metavar='PROFILE,CLOCK',
+                        help='profiler dump of a node and the clock_<node>.json it wrote')
+    parser.add_argument('-o', '--output', default='merged.json', help='merged dump')
+    parser.add_argument('--reference', default=None,
+                        help='node whose clock the others are put on, '
+                             'the first global server if not given')
+    return parser.parse_args()
+
+
+if __name__ == '__main__':
+    args = parse_args()
+    events = merge(args.pairs, args.reference)
+    with open(args.output, 'w') as f:
+        json.dump({'traceEvents': events, 'displayTimeUnit': 'ms'}, f)
+    print('wrote %d events to %s' % (len(events), args.output))
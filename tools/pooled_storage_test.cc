@@ -0,0 +1,144 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file pooled_storage_test.cc
+ * \brief checks CPUPooledRoundedStorageManager: chunks cached by threads are
+ *  counted and freed by ReleaseAll while the threads run, and threads that
+ *  outlive the manager exit without touching it
+ *
+ * Usage: pooled_storage_test [threads=8] [chunks=64]
+ */
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../src/storage/pooled_storage_manager.h"
+
+using namespace mxnet;
+using namespace mxnet::storage;
+
+namespace {
+
+/*! \brief lets the main thread step the workers through phases */
+class Phases {
+ public:
+  explicit Phases(int num_threads) : num_threads_(num_threads) { }
+  /*! \brief called by a worker once done with phase, waits for the next one */
+  void Done(int phase) {
+    std::unique_lock<std::mutex> lock(mu_);
+    if (++done_ == num_threads_) cv_.notify_all();
+    cv_.wait(lock, [&]() { return phase_ > phase; });
+  }
+  /*! \brief waits for every worker to be done with the current phase, starts the next */
+  void Next() {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait(lock, [&]() { return done_ == num_threads_; });
+    done_ = 0;
+    ++phase_;
+    cv_.notify_all();
+  }
+  void WaitDone() {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait(lock, [&]() { return done_ == num_threads_; });
+  }
+
+ private:
+  std::mutex mu_;
+  std::condition_variable cv_;
+  int num_threads_, done_ = 0, phase_ = 0;
+};
+
+/*! \brief allocates chunks of 1KB to 1MB and frees them, so they stay cached */
+void Churn(StorageManager* manager, int chunks) {
+  std::vector<Storage::Handle> handles(chunks);
+  for (int i = 0; i < chunks; ++i) {
+    handles[i].size = 1024 << (i % 11);
+    handles[i].ctx = Context::CPU();
+    manager->Alloc(&handles[i]);
+    memset(handles[i].dptr, i, handles[i].size);
+  }
+  for (auto& h : handles) manager->Free(h);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int num_threads = argc > 1 ? atoi(argv[1]) : 8;
+  const int chunks = argc > 2 ? atoi(argv[2]) : 64;
+
+  {
+    CPUPooledRoundedStorageManager manager;
+    Phases phases(num_threads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&]() {
+        Churn(&manager, chunks);
+        phases.Done(0);
+        Churn(&manager, chunks);
+        phases.Done(1);
+      });
+    }
+    // the chunks sit in the caches of live threads, and are counted
+    phases.WaitDone();
+    CHECK_GT(manager.CachedMemory(), 0U);
+    CHECK_EQ(manager.CachedMemory(), manager.UsedMemory()) << "a cached chunk is not counted";
+    printf("%d threads cache %zu bytes\n", num_threads, manager.CachedMemory());
+    manager.ReleaseAll();
+    CHECK_EQ(manager.UsedMemory(), 0U) << "ReleaseAll left chunks in thread caches";
+    CHECK_EQ(manager.CachedMemory(), 0U);
+    // caches drained under their threads are refilled as usual
+    phases.Next();
+    phases.WaitDone();
+    CHECK_GT(manager.CachedMemory(), 0U);
+    CHECK_EQ(manager.CachedMemory(), manager.UsedMemory());
+    phases.Next();
+    for (auto& t : threads) t.join();
+    // exited threads hand their caches to the nodes
+    CHECK_EQ(manager.CachedMemory(), manager.UsedMemory());
+    manager.ReleaseAll();
+    CHECK_EQ(manager.UsedMemory(), 0U);
+    printf("ReleaseAll drained the caches of live and exited threads\n");
+  }
+
+  // threads that outlive their manager
+  {
+    std::vector<std::thread> threads;
+    Phases phases(num_threads);
+    {
+      CPUPooledRoundedStorageManager manager;
+      for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&]() {
+          Churn(&manager, chunks);
+          phases.Done(0);
+        });
+      }
+      phases.WaitDone();
+    }
+    phases.Next();
+    for (auto& t : threads) t.join();
+    printf("threads exited after their manager\n");
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file powersgd_test.cc
+ * \brief checks the PowerSGD kernels: a matrix of rank r is rebuilt exactly
+ *  by a round of rank r, the error of a round shrinks as the rank grows, and
+ *  the error feedback plus the applied product is the input. Parts are viewed
+ *  as the rows of their tensors, which keeps the rank of the gradient
+ *
+ * Usage: powersgd_test [rows=300] [cols=200] [nthreads=4]
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <utility>
+#include <vector>
+#include "../src/kvstore/powersgd.h"
+
+using namespace mxnet::kvstore;
+
+namespace {
+
+/*! \brief the matrix of singular values decay^k, k < rank, on random subspaces */
+std::vector<float> LowRank(int64_t rows, int64_t cols, int rank, float decay, uint64_t seed) {
+  std::vector<float> u(rows * rank), v(cols * rank), m(rows * cols);
+  powersgd::InitQ(u.data(), rows, rank, seed);
+  powersgd::InitQ(v.data(), cols, rank, seed + 1);
+  powersgd::Orthogonalize(u.data(), rows, rank);
+  powersgd::Orthogonalize(v.data(), cols, rank);
+  for (int k = 0; k < rank; ++k) {
+    for (int64_t i = 0; i < rows; ++i) u[i * rank + k] *= std::pow(decay, k);
+  }
+  powersgd::AddProduct(u.data(), v.data(), rows, cols, rank, 0, 1, m.data(), 1);
+  return m;
+}
+
+double Norm(const std::vector<float>& m) {
+  double sum = 0;
+  for (float x : m) sum += static_cast<double>(x) * x;
+  return std::sqrt(sum);
+}
+
+/*!
+ * \brief one round of a single party on m, leaves the error feedback in m
+ * and the applied product in out
+ */
+void Round(std::vector<float>* m, int64_t rows, int64_t cols, int rank, int nthreads,
+           std::vector<float>* out) {
+  std::vector<float> p(rows * rank), q(cols * rank);
+  powersgd::InitQ(q.data(), cols, rank, 42);
+  powersgd::MulQ(m->data(), rows, cols, q.data(), rank, p.data(), nthreads);
+  powersgd::Orthogonalize(p.data(), rows, rank);
+  powersgd::MulTransposedP(m->data(), rows, cols, p.data(), rank, q.data(), nthreads);
+  out->resize(rows * cols);
+  powersgd::AddProduct(p.data(), q.data(), rows, cols, rank, 0, 1, out->data(), nthreads);
+  powersgd::AddProduct(p.data(), q.data(), rows, cols, rank, 1, -1, m->data(), nthreads);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int64_t rows = argc > 1 ? atoll(argv[1]) : 300;
+  const int64_t cols = argc > 2 ? atoll(argv[2]) : 200;
+  const int nthreads = argc > 3 ? atoi(argv[3]) : 4;
+  // Gram-Schmidt in float loses digits when the random Q is ill-conditioned
+  const float eps = 1e-3;
+
+  // a matrix of rank r is rebuilt exactly, extra columns of P^ vanish
+  for (int r : {1, 4, 8}) {
+    const std::vector<float> m = LowRank(rows, cols, r, 1, r);
+    for (int rank : {r, r + 2}) {
+      std::vector<float> e(m), out;
+      Round(&e, rows, cols, rank, nthreads, &out);
+      const double err = Norm(e) / Norm(m);
+      printf("rank %d matrix, rank %d round: relative error %.2e\n", r, rank, err);
+      CHECK_LT(err, eps) << "a rank " << r << " matrix is not rebuilt by rank " << rank;
+    }
+  }
+
+  // the error of a full rank matrix shrinks with the rank
+  const int full = static_cast<int>(std::min(rows, cols));
+  const std::vector<float> m = LowRank(rows, cols, full, 0.5, 7);
+  double last = 1;
+  for (int rank : {1, 2, 4, 8, 16}) {
+    std::vector<float> e(m), out;
+    Round(&e, rows, cols, rank, nthreads, &out);
+    const double err = Norm(e) / Norm(m);
+    printf("full rank matrix, rank %d round: relative error %.2e\n", rank, err);
+    CHECK_LT(err, last) << "rank " << rank << " does worse than a lower rank";
+    last = err;
+  }
+
+  // the error feedback and the applied product add up to the input
+  std::mt19937 gen(0);
+  std::normal_distribution<float> normal(0, 1);
+  std::vector<float> input(rows * cols);
+  for (auto& x : input) x = normal(gen);
+  std::vector<float> e(input), out;
+  Round(&e, rows, cols, 4, nthreads, &out);
+  double diff = 0;
+  for (int64_t i = 0; i < rows * cols; ++i) {
+    const double d = e[i] + out[i] - input[i];
+    diff += d * d;
+  }
+  printf("error feedback + product - input: relative norm %.2e\n", std::sqrt(diff) / Norm(input));
+  CHECK_LT(std::sqrt(diff) / Norm(input), eps) << "the error feedback loses part of the input";
+
+  // parts are viewed as rows of their tensor, only parts of unknown shape or
+  // split within rows are viewed as square as possible
+  CHECK_EQ(powersgd::Cols(rows * cols, cols), cols);
+  CHECK_EQ(powersgd::Cols(rows * cols + 1, cols), powersgd::Cols(rows * cols + 1));
+  CHECK_EQ(powersgd::Cols(1000, 1), 1);
+  CHECK(!powersgd::Worthwhile(1000, powersgd::Cols(1000, 1), 4)) << "vectors are compressed";
+  const auto shapes = powersgd::DecodeKeyShapes(
+      powersgd::EncodeKeyShapes({{3, {rows, cols}}, {11, {1000, 1}}}));
+  CHECK(shapes == decltype(shapes)({{3, {rows, cols}}, {11, {1000, 1}}}));
+  // the square view of a low rank gradient is not low rank
+  const int64_t square = powersgd::Cols(rows * cols);
+  if (square != cols) {
+    const std::vector<float> low = LowRank(rows, cols, 4, 1, 5);
+    std::vector<float> by_shape(low), by_size(low), out;
+    Round(&by_shape, rows, cols, 4, nthreads, &out);
+    Round(&by_size, rows * cols / square, square, 4, nthreads, &out);
+    printf("rank 4 gradient, rank 4 round: relative error %.2e by shape, %.2e as %lldx%lld\n",
+           Norm(by_shape) / Norm(low), Norm(by_size) / Norm(low),
+           static_cast<long long>(rows * cols / square), static_cast<long long>(square));
+    CHECK_LT(Norm(by_shape) / Norm(low), eps);
+    CHECK_GT(Norm(by_size) / Norm(low), Norm(by_shape) / Norm(low));
+  }
+
+  // threads split the products without changing them
+  std::vector<float> p1(rows * 4), p2(rows * 4), q1(cols * 4), q2(cols * 4);
+  powersgd::InitQ(q1.data(), cols, 4, 1);
+  powersgd::MulQ(input.data(), rows, cols, q1.data(), 4, p1.data(), 1);
+  powersgd::MulQ(input.data(), rows, cols, q1.data(), 4, p2.data(), nthreads);
+  powersgd::MulTransposedP(input.data(), rows, cols, p1.data(), 4, q1.data(), 1);
+  powersgd::MulTransposedP(input.data(), rows, cols, p1.data(), 4, q2.data(), nthreads);
+  CHECK(p1 == p2 && q1 == q2) << "products differ across thread counts";
+  printf("all checks passed\n");
+  return 0;
+}
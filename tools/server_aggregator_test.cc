@@ -0,0 +1,111 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file server_aggregator_test.cc
+ * \brief checks ServerAggregator: rounds of pushes of many keys are merged
+ *  on the shards, a copy of each round pushed to the engine right after its
+ *  last merge sees the whole round and none of the next one, and fp16 pushes
+ *  merge into fp32 buffers
+ *
+ * Usage: server_aggregator_test [size=1001] [keys=16] [threads=4] [rounds=20]
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../src/kvstore/server_aggregator.h"
+
+using namespace mxnet;
+using namespace mxnet::kvstore;
+
+int main(int argc, char *argv[]) {
+  const int64_t size = argc > 1 ? atoll(argv[1]) : 1001;
+  const int num_keys = argc > 2 ? atoi(argv[2]) : 16;
+  const int num_threads = argc > 3 ? atoi(argv[3]) : 4;
+  const int rounds = argc > 4 ? atoi(argv[4]) : 20;
+  const int pushes = 3;
+
+  // the vectorized sum matches the scalar one, tails included
+  std::vector<float> a(size), b(size), c(size);
+  for (int64_t i = 0; i < size; ++i) {
+    a[i] = c[i] = 0.5f * i;
+    b[i] = 1.0f - i;
+    c[i] += b[i];
+  }
+  ServerAggregator::Add(a.data(), b.data(), size);
+  CHECK(a == c) << "vectorized sum differs";
+
+  const TShape shape{size};
+  {
+    ServerAggregator aggregator(num_threads);
+    std::vector<NDArray> merged;
+    for (int k = 0; k < num_keys; ++k) {
+      merged.emplace_back(shape, Context::CPU(), false, mshadow::kFloat32);
+    }
+    // push p of round r of key k is k + r + p everywhere
+    std::vector<std::vector<NDArray>> snapshots(rounds);
+    for (int r = 0; r < rounds; ++r) {
+      for (int p = 0; p < pushes; ++p) {
+        for (int k = 0; k < num_keys; ++k) {
+          ps::SArray<char> vals(size * sizeof(float));
+          float* v = reinterpret_cast<float*>(vals.data());
+          for (int64_t i = 0; i < size; ++i) v[i] = k + r + p;
+          aggregator.Merge(k, merged[k], vals, mshadow::kFloat32, p == 0);
+        }
+      }
+      // the next round overwrites merged, the copy must come in between
+      for (int k = 0; k < num_keys; ++k) {
+        snapshots[r].emplace_back(shape, Context::CPU(), false, mshadow::kFloat32);
+        CopyFromTo(merged[k], &snapshots[r][k]);
+      }
+    }
+    for (int r = 0; r < rounds; ++r) {
+      for (int k = 0; k < num_keys; ++k) {
+        snapshots[r][k].WaitToRead();
+        const float* s = static_cast<const float*>(snapshots[r][k].data().dptr_);
+        const float expected = pushes * (k + r) + pushes * (pushes - 1) / 2;
+        for (int64_t i = 0; i < size; ++i) {
+          CHECK_EQ(s[i], expected) << "round " << r << " of key " << k << " at " << i;
+        }
+      }
+    }
+    printf("%d keys on %d threads, %d rounds of %d pushes: all rounds complete\n", num_keys,
+           num_threads, rounds, pushes);
+
+    // fp16 pushes into an fp32 buffer
+    NDArray merged32(shape, Context::CPU(), false, mshadow::kFloat32);
+    for (int p = 0; p < pushes; ++p) {
+      ps::SArray<char> vals(size * sizeof(mshadow::half::half_t));
+      auto* v = reinterpret_cast<mshadow::half::half_t*>(vals.data());
+      for (int64_t i = 0; i < size; ++i) v[i] = mshadow::half::half_t(0.25f * (i % 8));
+      aggregator.Merge(num_keys, merged32, vals, mshadow::kFloat16, p == 0);
+    }
+    merged32.WaitToRead();
+    const float* m = static_cast<const float*>(merged32.data().dptr_);
+    for (int64_t i = 0; i < size; ++i) {
+      CHECK_EQ(m[i], pushes * 0.25f * (i % 8)) << "fp16 merge at " << i;
+    }
+    printf("fp16 pushes merged into fp32\n");
+  }
+  Engine::Get()->WaitForAll();
+  printf("all checks passed\n");
+  return 0;
+}
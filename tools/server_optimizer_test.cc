@@ -0,0 +1,152 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file server_optimizer_test.cc
+ * \brief checks the native optimizer of global servers: updates of several
+ *  keys are issued without waiting, as ApplyUpdates does, and a reader that
+ *  waits on the weight's var then sees every update applied, as the python
+ *  optimizers would apply them
+ *
+ * Usage: server_optimizer_test [size=10000] [keys=8] [steps=20]
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/kvstore/server_optimizer.h"
+
+using namespace mxnet;
+using namespace mxnet::kvstore;
+
+namespace {
+
+/*! \brief scalar reference of one optimizer on one key */
+struct Reference {
+  std::string optimizer;
+  float lr, wd, momentum;
+  float beta1 = 0.9f, beta2 = 0.999f, epsilon = 1e-8f, lamda = 0.04f;
+  std::vector<float> w, mom, mean, var, prev;
+  int t = 0;
+
+  void Update(const std::vector<float>& g) {
+    const size_t n = w.size();
+    if (mom.empty()) {
+      mom.assign(n, 0);
+      mean.assign(n, 0);
+      var.assign(n, 0);
+      prev = w;
+    }
+    ++t;
+    const float lr_t = optimizer == "adam"
+        ? lr * std::sqrt(1 - std::pow(beta2, t)) / (1 - std::pow(beta1, t)) : lr;
+    for (size_t i = 0; i < n; ++i) {
+      if (optimizer == "sgd" && momentum == 0) {
+        w[i] -= lr * (g[i] + wd * w[i]);
+      } else if (optimizer == "sgd") {
+        mom[i] = momentum * mom[i] - lr * (g[i] + wd * w[i]);
+        w[i] += mom[i];
+      } else if (optimizer == "adam") {
+        const float grad = g[i] + wd * w[i];
+        mean[i] = beta1 * mean[i] + (1 - beta1) * grad;
+        var[i] = beta2 * var[i] + (1 - beta2) * grad * grad;
+        w[i] -= lr_t * mean[i] / (std::sqrt(var[i]) + epsilon);
+      } else {
+        const float weight = w[i];
+        mom[i] = momentum * mom[i]
+               - lr * (g[i] + wd * weight + lamda * g[i] * g[i] * (weight - prev[i]));
+        prev[i] = weight;
+        w[i] = weight + mom[i];
+      }
+    }
+  }
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const int64_t size = argc > 1 ? atoll(argv[1]) : 10000;
+  const int num_keys = argc > 2 ? atoi(argv[2]) : 8;
+  const int steps = argc > 3 ? atoi(argv[3]) : 20;
+  const float eps = 1e-4;
+
+  std::mt19937 gen(0);
+  std::normal_distribution<float> normal(0, 1);
+  const TShape shape{size};
+  struct Case {
+    std::string params, optimizer;
+    float lr, momentum;
+  };
+  const float wd = 0.01f;
+  for (const Case& c : {Case{"optimizer:sgd,learning_rate:0.1,wd:0.01", "sgd", 0.1f, 0},
+                        Case{"optimizer:sgd,learning_rate:0.1,wd:0.01,momentum:0.9",
+                             "sgd", 0.1f, 0.9f},
+                        Case{"optimizer:adam,learning_rate:0.01,wd:0.01", "adam", 0.01f, 0},
+                        Case{"optimizer:dcasgd,learning_rate:0.1,wd:0.01,momentum:0.9",
+                             "dcasgd", 0.1f, 0.9f}}) {
+    ServerOptimizer opt;
+    opt.DecodeParams(c.params);
+    std::vector<Reference> refs(num_keys);
+    std::vector<NDArray> weights;
+    for (int k = 0; k < num_keys; ++k) {
+      Reference& ref = refs[k];
+      ref.optimizer = c.optimizer;
+      ref.lr = c.lr;
+      ref.wd = wd;
+      ref.momentum = c.momentum;
+      ref.w.resize(size);
+      for (auto& x : ref.w) x = normal(gen);
+      weights.emplace_back(shape, Context::CPU(), false, mshadow::kFloat32);
+      weights.back().SyncCopyFromCPU(ref.w.data(), size);
+    }
+    // every update gets a gradient of its own, so that none waits for a reader
+    std::vector<NDArray> grads;
+    for (int s = 0; s < steps; ++s) {
+      for (int k = 0; k < num_keys; ++k) {
+        std::vector<float> g(size);
+        for (auto& x : g) x = normal(gen);
+        grads.emplace_back(shape, Context::CPU(), false, mshadow::kFloat32);
+        grads.back().SyncCopyFromCPU(g.data(), size);
+        CHECK(opt.Supports(grads.back(), weights[k]));
+        opt.Update(k, grads.back(), &weights[k]);
+        refs[k].Update(g);
+      }
+    }
+    // read as the pull responses of global servers do, raw after the wait
+    double max_err = 0;
+    for (int k = 0; k < num_keys; ++k) {
+      weights[k].WaitToRead();
+      const float* w = static_cast<const float*>(weights[k].data().dptr_);
+      for (int64_t i = 0; i < size; ++i) {
+        const double err = std::abs(w[i] - refs[k].w[i]) / (1 + std::abs(refs[k].w[i]));
+        max_err = std::max(max_err, err);
+      }
+    }
+    printf("%s: %d keys, %d steps, max relative error %.2e\n", c.params.c_str(), num_keys,
+           steps, max_err);
+    CHECK_LT(max_err, eps) << "a reader saw a weight that differs from " << c.params;
+  }
+  Engine::Get()->WaitForAll();
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * Copyright (c) 2021 by Contributors at INET-RC
+ * \file staleness_test.cc
+ * \brief checks StalenessBound: pulls within the bound are admitted, pulls
+ *  beyond it are held until the slowest party catches up, keys are bounded
+ *  apart, parties that stop release the pulls they held, and parties racing
+ *  through rounds never pull beyond the bound
+ *
+ * Usage: staleness_test [num_parties=4] [rounds=2000] [bound=2]
+ */
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../src/kvstore/staleness.h"
+
+using namespace mxnet::kvstore;
+
+int main(int argc, char *argv[]) {
+  const int num_parties = argc > 1 ? atoi(argv[1]) : 4;
+  const int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+  const int bound = argc > 3 ? atoi(argv[3]) : 2;
+
+  StalenessBound off;
+  off.Init(-1, 3);
+  CHECK(!off.enabled());
+
+  // party 0 runs two rounds ahead of a bound of 1
+  StalenessBound sb;
+  sb.Init(1, 3);
+  CHECK(sb.enabled());
+  int answered = 0;
+  auto respond = [&answered] { ++answered; };
+  CHECK(sb.Push(0, 0).empty());
+  CHECK(sb.Pull(0, 0, respond)) << "a party one round ahead is within bound";
+  CHECK(sb.Push(0, 0).empty());
+  CHECK(!sb.Pull(0, 0, respond)) << "a party two rounds ahead is held";
+  CHECK(sb.Pull(0, 1, respond)) << "the slowest party is never held";
+  CHECK(sb.Pull(1, 0, respond)) << "other keys have clocks of their own";
+  CHECK(sb.Push(0, 1).empty()) << "party 2 is still two rounds behind";
+  auto released = sb.Push(0, 2);
+  CHECK_EQ(released.size(), 1U) << "the held pull is back within bound";
+  for (auto& r : released) r();
+  CHECK_EQ(answered, 1);
+  CHECK(sb.Push(0, 2).empty()) << "released pulls are answered once";
+
+  StalenessBound::Stats s = sb.stats(0);
+  CHECK_EQ(s.num_pulls, 3U);
+  CHECK_EQ(s.num_waits, 1U);
+  CHECK_EQ(s.max_staleness, 1);
+  CHECK_EQ(sb.stats(1).num_waits, 0U);
+  CHECK_EQ(sb.stats(2).num_pulls, 0U);
+  printf("%s\n", sb.Summary().c_str());
+
+  // a bound of 0 keeps the parties in lockstep
+  StalenessBound lockstep;
+  lockstep.Init(0, 2);
+  lockstep.Push(0, 0);
+  CHECK(!lockstep.Pull(0, 0, respond));
+  CHECK_EQ(lockstep.Push(0, 1).size(), 1U);
+
+  // a party that stops releases the pulls it held, on every key
+  StalenessBound stop;
+  stop.Init(0, 3);
+  answered = 0;
+  stop.Push(0, 0);
+  stop.Push(1, 0);
+  stop.Push(0, 1);
+  CHECK(!stop.Pull(0, 0, respond));
+  CHECK(!stop.Pull(1, 0, respond));
+  CHECK(!stop.Pull(0, 1, respond));
+  auto finished = stop.Finish(2);
+  CHECK_EQ(finished.size(), 2U) << "party 1 still holds key 1";
+  for (auto& r : finished) r();
+  CHECK_EQ(answered, 2);
+  CHECK(stop.Pull(0, 1, respond)) << "a party that stopped still holds pulls";
+  CHECK_EQ(stop.Push(1, 1).size(), 1U);
+  CHECK_EQ(stop.Finish(0).size(), 0U);
+  stop.Push(0, 1);
+  CHECK(stop.Pull(0, 1, respond)) << "the last party is never held";
+  CHECK_EQ(stop.stats(1).max_staleness, 0);
+
+  // parties racing through rounds of push then pull, each pull blocks until
+  // it is answered, either at once or by the push that releases it
+  StalenessBound race;
+  race.Init(bound, num_parties);
+  std::atomic<int> clocks[64];
+  CHECK_LE(num_parties, 64);
+  for (int p = 0; p < num_parties; ++p) clocks[p] = 0;
+  std::atomic<int> max_ahead{0};
+  std::vector<std::thread> threads;
+  for (int p = 0; p < num_parties; ++p) {
+    threads.emplace_back([&, p] {
+      std::mutex mu;
+      std::condition_variable cv;
+      for (int round = 1; round <= rounds; ++round) {
+        clocks[p] = round;
+        for (auto& r : race.Push(0, p)) r();
+        bool done = false;
+        auto answer = [&] {
+          // how far this party is ahead of the slowest one when answered
+          int slowest = round;
+          for (int q = 0; q < num_parties; ++q) slowest = std::min<int>(slowest, clocks[q]);
+          int ahead = max_ahead;
+          while (round - slowest > ahead && !max_ahead.compare_exchange_weak(ahead, round - slowest)) {}
+          std::lock_guard<std::mutex> lk(mu);
+          done = true;
+          cv.notify_one();
+        };
+        if (race.Pull(0, p, answer)) answer();
+        std::unique_lock<std::mutex> lk(mu);
+        cv.wait(lk, [&] { return done; });
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  uint64_t waits = 0;
+  for (int p = 0; p < num_parties; ++p) {
+    const StalenessBound::Stats stats = race.stats(p);
+    CHECK_EQ(stats.num_pulls, static_cast<uint64_t>(rounds)) << "party " << p;
+    CHECK_LE(stats.max_staleness, bound) << "party " << p;
+    waits += stats.num_waits;
+  }
+  CHECK_LE(max_ahead.load(), bound) << "a pull was answered beyond the bound";
+  printf("%d parties, %d rounds, bound %d: %llu of %d pulls waited\n", num_parties, rounds,
+         bound, static_cast<unsigned long long>(waits), num_parties * rounds);
+  printf("all checks passed\n");
+  return 0;
+}